@@ -3,6 +3,7 @@
 //shader input
 layout (location = 0) in vec3 inColor;
 layout (location = 1) in vec2 texCoord;
+layout (location = 2) flat in float textureLayer;
 //output write
 layout (location = 0) out vec4 outFragColor;
 
@@ -14,10 +15,10 @@ layout(set = 0, binding = 1) uniform  SceneData{
 	vec4 sunlightColor;
 } sceneData;
 
-layout(set = 2, binding = 0) uniform sampler2D tex1;
+layout(set = 2, binding = 0) uniform sampler2DArray tex1;
 
 void main()
 {
-	vec3 color = texture(tex1,texCoord).xyz;
+	vec3 color = texture(tex1,vec3(texCoord,textureLayer)).xyz;
 	outFragColor = vec4(color,1.0f);
 }
\ No newline at end of file
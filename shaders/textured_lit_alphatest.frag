@@ -0,0 +1,31 @@
+#version 450
+
+//shader input
+layout (location = 0) in vec3 inColor;
+layout (location = 1) in vec2 texCoord;
+layout (location = 2) flat in float textureLayer;
+//output write
+layout (location = 0) out vec4 outFragColor;
+
+layout(set = 0, binding = 1) uniform  SceneData{
+	vec4 fogColor; // w is for exponent
+	vec4 fogDistances; //x for min, y for max, zw unused.
+	vec4 ambientColor;
+	vec4 sunlightDirection; //w for sun power
+	vec4 sunlightColor;
+} sceneData;
+
+layout(set = 2, binding = 0) uniform sampler2DArray tex1;
+
+void main()
+{
+	vec4 color = texture(tex1,vec3(texCoord,textureLayer));
+
+	// Cut out leaves, torches and the like where the texture is transparent
+	if (color.a < 0.5f)
+	{
+		discard;
+	}
+
+	outFragColor = vec4(color.xyz,1.0f);
+}
@@ -7,6 +7,8 @@ layout (location = 3) in vec2 vTexCoord;
 
 layout (location = 0) out vec3 outColor;
 layout (location = 1) out vec2 texCoord;
+//layer of the texture array the material samples
+layout (location = 2) flat out float textureLayer;
 
 layout(set = 0, binding = 0) uniform  CameraBuffer{   
     mat4 view;
@@ -16,6 +18,7 @@ layout(set = 0, binding = 0) uniform  CameraBuffer{
 
 struct ObjectData{
 	mat4 model;
+	vec4 sphereBounds;
 }; 
 
 //all object matrices
@@ -33,9 +36,11 @@ layout( push_constant ) uniform constants
 
 void main() 
 {	
-	mat4 modelMatrix = objectBuffer.objects[gl_BaseInstance].model;
+	//gl_InstanceIndex already counts from the draw's firstInstance, where its instances' objects start
+	mat4 modelMatrix = objectBuffer.objects[gl_InstanceIndex].model;
 	mat4 transformMatrix = (cameraData.viewproj * modelMatrix);
 	gl_Position = transformMatrix * vec4(vPosition, 1.0f);
 	outColor = vColor;
 	texCoord = vTexCoord;
+	textureLayer = PushConstants.data.x;
 }
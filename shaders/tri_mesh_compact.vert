@@ -0,0 +1,60 @@
+#version 460
+
+// CompactVertex layout, the input assembler already converted the unorm/snorm values to floats
+layout (location = 0) in vec4 vPosition;
+layout (location = 1) in vec2 vNormal;
+layout (location = 3) in vec2 vTexCoord;
+
+layout (location = 0) out vec3 outColor;
+layout (location = 1) out vec2 texCoord;
+//layer of the texture array the material samples
+layout (location = 2) flat out float textureLayer;
+
+layout(set = 0, binding = 0) uniform  CameraBuffer{   
+    mat4 view;
+    mat4 proj;
+	mat4 viewproj; 
+} cameraData;
+
+struct ObjectData{
+	mat4 model;
+	vec4 sphereBounds;
+}; 
+
+//all object matrices
+layout(std140,set = 1, binding = 0) readonly buffer ObjectBuffer{   
+
+	ObjectData objects[];
+} objectBuffer;
+
+//push constants block
+layout( push_constant ) uniform constants
+{
+ vec4 data;
+ mat4 render_matrix;
+ vec4 positionOffset;
+ vec4 positionScale;
+} PushConstants;
+
+//inverse of the octahedral mapping in Mesh::compact_vertices
+vec3 decode_octahedral(vec2 encoded)
+{
+	vec3 normal = vec3(encoded, 1.0f - abs(encoded.x) - abs(encoded.y));
+	float t = max(-normal.z, 0.0f);
+	normal.x += normal.x >= 0.0f ? -t : t;
+	normal.y += normal.y >= 0.0f ? -t : t;
+	return normalize(normal);
+}
+
+void main() 
+{	
+	vec3 position = PushConstants.positionOffset.xyz + vPosition.xyz * PushConstants.positionScale.xyz;
+
+	//gl_InstanceIndex already counts from the draw's firstInstance, where its instances' objects start
+	mat4 modelMatrix = objectBuffer.objects[gl_InstanceIndex].model;
+	mat4 transformMatrix = (cameraData.viewproj * modelMatrix);
+	gl_Position = transformMatrix * vec4(position, 1.0f);
+	outColor = decode_octahedral(vNormal);
+	texCoord = vTexCoord;
+	textureLayer = PushConstants.data.x;
+}
@@ -1,7 +1,15 @@
 #include <vk_engine.h>
+#include <vk_benchmarks.h>
 
 int main(int argc, char* argv[])
 {
+	// Benchmarks run instead of the main loop, only the texture upload and culling ones start the engine
+	int exitCode = 0;
+	if (vkbench::run_from_args(argc, argv, exitCode))
+	{
+		return exitCode;
+	}
+
 	VulkanEngine engine;
 
 	engine.init();	
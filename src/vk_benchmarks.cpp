@@ -0,0 +1,1307 @@
+#include "vk_benchmarks.h"
+
+#include "vk_initializers.h"
+#include "vk_ktx2.h"
+#include "vk_mesh.h"
+#include "vk_obj_loader.h"
+#include "vk_textures.h"
+
+#include <tiny_obj_loader.h>
+
+#include <glm/gtx/transform.hpp>
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstring>
+#include <functional>
+#include <iostream>
+#include <random>
+#include <string>
+#include <thread>
+#include <vector>
+
+namespace {
+
+	// Assets every mesh benchmark runs over
+	const char* OBJ_ASSETS[] = {
+		"../../assets/monkey_smooth.obj",
+		"../../assets/monkey_flat.obj",
+		"../../assets/lost_empire.obj",
+	};
+
+	// Number of timed runs per measurement. The fastest one is reported
+	constexpr int BENCH_RUNS = 5;
+
+	double time_best_ms(const std::function<void()>& function)
+	{
+		double best = 0.0;
+		for (int run = 0; run < BENCH_RUNS; run++)
+		{
+			auto start = std::chrono::high_resolution_clock::now();
+			function();
+			auto end = std::chrono::high_resolution_clock::now();
+
+			double ms = std::chrono::duration<double, std::milli>(end - start).count();
+			if (run == 0 || ms < best)
+			{
+				best = ms;
+			}
+		}
+		return best;
+	}
+
+	// The loader Mesh::load_from_obj used before vkobj. Kept as the reference the new loader is checked against
+	bool load_obj_tinyobj(const char* filename, std::vector<Vertex>& outVertices)
+	{
+		tinyobj::attrib_t attrib;
+		std::vector<tinyobj::shape_t> shapes;
+		std::vector<tinyobj::material_t> materials;
+
+		std::string warn;
+		std::string err;
+
+		tinyobj::LoadObj(&attrib, &shapes, &materials, &warn, &err, filename, nullptr);
+
+		if (!err.empty())
+		{
+			std::cerr << err << std::endl;
+			return false;
+		}
+
+		for (size_t s = 0; s < shapes.size(); s++)
+		{
+			size_t index_offset = 0;
+			for (size_t f = 0; f < shapes[s].mesh.num_face_vertices.size(); f++)
+			{
+				int fv = 3;
+
+				for (size_t v = 0; v < fv; v++)
+				{
+					tinyobj::index_t idx = shapes[s].mesh.indices[index_offset + v];
+
+					Vertex new_vert;
+					new_vert.position.x = attrib.vertices[3 * idx.vertex_index + 0];
+					new_vert.position.y = attrib.vertices[3 * idx.vertex_index + 1];
+					new_vert.position.z = attrib.vertices[3 * idx.vertex_index + 2];
+
+					new_vert.normal.x = attrib.normals[3 * idx.normal_index + 0];
+					new_vert.normal.y = attrib.normals[3 * idx.normal_index + 1];
+					new_vert.normal.z = attrib.normals[3 * idx.normal_index + 2];
+
+					new_vert.uv.x = attrib.texcoords[2 * idx.texcoord_index + 0];
+					new_vert.uv.y = 1 - attrib.texcoords[2 * idx.texcoord_index + 1];
+
+					new_vert.color = new_vert.normal;
+
+					outVertices.push_back(new_vert);
+				}
+				index_offset += fv;
+			}
+		}
+
+		return true;
+	}
+
+	// Vertices per batch when the OBJ comparison streams an asset, small enough that lost_empire takes many
+	constexpr size_t COMPARE_STREAM_BATCH_VERTICES = 4096;
+
+	// Stream an OBJ the way the engine streams large imports, but into memory. outTriangleMaterials gets the material
+	// of every triangle from the runs, so it lines up with what load_obj returns
+	bool stream_obj_to_memory(const char* filename, std::vector<Vertex>& outVertices, std::vector<uint32_t>& outTriangleMaterials,
+		std::vector<ObjMaterial>& outMaterials, size_t& outBatchCount)
+	{
+		std::vector<Vertex> batch(COMPARE_STREAM_BATCH_VERTICES);
+		outBatchCount = 0;
+
+		ObjStreamTarget target;
+		target.batchVertexCount = COMPARE_STREAM_BATCH_VERTICES;
+		target.begin = [&](size_t maxVertexCount) {
+			outVertices.reserve(maxVertexCount);
+			return true;
+		};
+		target.acquire_batch = [&]() {
+			return batch.data();
+		};
+		target.submit_batch = [&](size_t count) {
+			outVertices.insert(outVertices.end(), batch.begin(), batch.begin() + count);
+			outBatchCount++;
+			return true;
+		};
+		target.finish = [&](std::vector<ObjMaterial>& materials, const std::vector<ObjTriangleRun>& runs) {
+			outMaterials = materials;
+			for (const ObjTriangleRun& run : runs)
+			{
+				outTriangleMaterials.insert(outTriangleMaterials.end(), run.triangleCount, run.material);
+			}
+			return true;
+		};
+
+		AABB bounds;
+		return vkobj::stream_obj(filename, target, bounds);
+	}
+
+	bool same_materials(const std::vector<ObjMaterial>& a, const std::vector<ObjMaterial>& b)
+	{
+		if (a.size() != b.size())
+		{
+			return false;
+		}
+
+		for (size_t i = 0; i < a.size(); i++)
+		{
+			if (a[i].name != b[i].name || a[i].diffuse != b[i].diffuse || a[i].dissolve != b[i].dissolve
+				|| a[i].diffuseTexture != b[i].diffuseTexture || a[i].alphaTexture != b[i].alphaTexture)
+			{
+				return false;
+			}
+		}
+		return true;
+	}
+
+	// Textures the block compression report covers
+	const char* TEXTURE_ASSETS[] = {
+		"../../assets/lost_empire-RGBA.png",
+		"../../assets/lost_empire-RGB.png",
+		"../../assets/lost_empire-Alpha.png",
+	};
+
+	// Texture sampled by the mip bandwidth comparison
+	const char* MIP_TEXTURE_ASSET = "../../assets/lost_empire-RGBA.png";
+
+	// Every upload in the texture upload benchmark stays alive until the engine shuts down, so it only sends a tile of
+	// each texture
+	constexpr uint32_t UPLOAD_TILE_SIZE = 1024;
+
+	// Screen and camera of the simulated frame: a textured ground plane seen from eye height, receding to the horizon
+	constexpr uint32_t MIP_SCREEN_WIDTH = 1700;
+	constexpr uint32_t MIP_SCREEN_HEIGHT = 900;
+	constexpr float MIP_CAMERA_HEIGHT = 2.0f;
+	constexpr float MIP_CAMERA_PITCH = 0.25f;			// Radians below the horizon
+	constexpr float MIP_VERTICAL_FOV = 1.22f;			// 70 degrees
+	constexpr float MIP_TEXTURE_WORLD_SIZE = 64.0f;		// World units one repeat of the texture covers
+
+	// Texture cache model: lines of 4x4 RGBA8 texels, 64 bytes each, 256 of them in a direct mapped 16 KB cache
+	constexpr uint32_t CACHE_TILE_TEXELS = 4;
+	constexpr uint32_t CACHE_LINE_BYTES = CACHE_TILE_TEXELS * CACHE_TILE_TEXELS * 4;
+	constexpr uint32_t CACHE_LINES = 256;
+
+	// Pixels are shaded in screen tiles of this size, the way rasterizers walk triangles
+	constexpr uint32_t SCREEN_TILE_SIZE = 8;
+
+	struct TextureCacheModel {
+		std::vector<uint64_t> tags = std::vector<uint64_t>(CACHE_LINES, UINT64_MAX);
+		uint64_t misses{ 0 };
+
+		void fetch(uint64_t line)
+		{
+			// Spread neighbouring tiles of a row over the sets
+			const size_t set = static_cast<size_t>((line * 0x9E3779B97F4A7C15ull) >> 56) % CACHE_LINES;
+			if (tags[set] != line)
+			{
+				tags[set] = line;
+				misses++;
+			}
+		}
+	};
+
+	// Bytes a frame reads from memory, with and without mip levels, for a texture of width x height texels
+	uint64_t simulate_texture_traffic(uint32_t width, uint32_t height, bool mipmapped)
+	{
+		const uint32_t levelCount = mipmapped ? vkutil::mip_level_count(width, height) : 1;
+
+		// First cache line of each level, levels stored one after another
+		std::vector<uint64_t> levelBase(levelCount);
+		uint64_t lines = 0;
+		for (uint32_t level = 0; level < levelCount; level++)
+		{
+			levelBase[level] = lines;
+			const uint32_t levelWidth = std::max(1u, width >> level);
+			const uint32_t levelHeight = std::max(1u, height >> level);
+			lines += static_cast<uint64_t>((levelWidth + CACHE_TILE_TEXELS - 1) / CACHE_TILE_TEXELS) * ((levelHeight + CACHE_TILE_TEXELS - 1) / CACHE_TILE_TEXELS);
+		}
+
+		const float tanHalfFov = std::tan(MIP_VERTICAL_FOV * 0.5f);
+		const float aspect = static_cast<float>(MIP_SCREEN_WIDTH) / MIP_SCREEN_HEIGHT;
+		const float cosPitch = std::cos(MIP_CAMERA_PITCH);
+		const float sinPitch = std::sin(MIP_CAMERA_PITCH);
+
+		// Texture coordinate where the ray through a screen position hits the ground, false for the sky
+		auto ground_uv = [&](float x, float y, float& u, float& v) {
+			const float viewX = (2.0f * x / MIP_SCREEN_WIDTH - 1.0f) * tanHalfFov * aspect;
+			const float viewY = (1.0f - 2.0f * y / MIP_SCREEN_HEIGHT) * tanHalfFov;
+
+			// Pitch the view ray down around the x axis
+			const float dirY = viewY * cosPitch - sinPitch;
+			const float dirZ = viewY * sinPitch + cosPitch;
+			if (dirY >= -1e-4f)
+			{
+				return false;
+			}
+
+			const float t = MIP_CAMERA_HEIGHT / -dirY;
+			u = viewX * t / MIP_TEXTURE_WORLD_SIZE;
+			v = dirZ * t / MIP_TEXTURE_WORLD_SIZE;
+			return true;
+		};
+
+		TextureCacheModel cache;
+
+		// Four texels around a repeating texture coordinate at one level
+		auto fetch_bilinear = [&](uint32_t level, float u, float v) {
+			const uint32_t levelWidth = std::max(1u, width >> level);
+			const uint32_t levelHeight = std::max(1u, height >> level);
+			const uint32_t tilesPerRow = (levelWidth + CACHE_TILE_TEXELS - 1) / CACHE_TILE_TEXELS;
+
+			const float texelX = (u - std::floor(u)) * levelWidth - 0.5f;
+			const float texelY = (v - std::floor(v)) * levelHeight - 0.5f;
+			const int64_t x0 = static_cast<int64_t>(std::floor(texelX));
+			const int64_t y0 = static_cast<int64_t>(std::floor(texelY));
+
+			for (int64_t y = y0; y <= y0 + 1; y++)
+			{
+				for (int64_t x = x0; x <= x0 + 1; x++)
+				{
+					const uint32_t wrappedX = static_cast<uint32_t>((x % levelWidth + levelWidth) % levelWidth);
+					const uint32_t wrappedY = static_cast<uint32_t>((y % levelHeight + levelHeight) % levelHeight);
+					cache.fetch(levelBase[level] + static_cast<uint64_t>(wrappedY / CACHE_TILE_TEXELS) * tilesPerRow + wrappedX / CACHE_TILE_TEXELS);
+				}
+			}
+		};
+
+		for (uint32_t tileY = 0; tileY < MIP_SCREEN_HEIGHT; tileY += SCREEN_TILE_SIZE)
+		{
+			for (uint32_t tileX = 0; tileX < MIP_SCREEN_WIDTH; tileX += SCREEN_TILE_SIZE)
+			{
+				for (uint32_t y = tileY; y < std::min(tileY + SCREEN_TILE_SIZE, MIP_SCREEN_HEIGHT); y++)
+				{
+					for (uint32_t x = tileX; x < std::min(tileX + SCREEN_TILE_SIZE, MIP_SCREEN_WIDTH); x++)
+					{
+						float u, v, uRight, vRight, uDown, vDown;
+						if (!ground_uv(x + 0.5f, y + 0.5f, u, v) ||
+							!ground_uv(x + 1.5f, y + 0.5f, uRight, vRight) ||
+							!ground_uv(x + 0.5f, y + 1.5f, uDown, vDown))
+						{
+							continue;
+						}
+
+						if (!mipmapped)
+						{
+							fetch_bilinear(0, u, v);
+							continue;
+						}
+
+						// Level of detail from the pixel's footprint in texels, the same rule the sampler uses
+						const float dx = std::hypot((uRight - u) * width, (vRight - v) * height);
+						const float dy = std::hypot((uDown - u) * width, (vDown - v) * height);
+						const float lod = std::clamp(std::log2(std::max(std::max(dx, dy), 1e-8f)), 0.0f, static_cast<float>(levelCount - 1));
+
+						// Trilinear filtering reads the two levels around the lod
+						const uint32_t level = static_cast<uint32_t>(lod);
+						fetch_bilinear(level, u, v);
+						if (lod > level && level + 1 < levelCount)
+						{
+							fetch_bilinear(level + 1, u, v);
+						}
+					}
+				}
+			}
+		}
+
+		return cache.misses * CACHE_LINE_BYTES;
+	}
+
+	// Scenes the culling benchmark scales through
+	const size_t CULLING_OBJECT_COUNTS[] = { 1000, 10000, 100000, 1000000 };
+
+	// Every this many objects of a culling scene is a monkey, the rest are triangles
+	constexpr size_t CULLING_MONKEY_INTERVAL = 10;
+
+	// Objects of the synthetic scene the CPU culling comparison runs next to the triangle grid
+	constexpr size_t CPU_CULLING_OBJECT_COUNT = 100000;
+
+	// Times each cull of the CPU culling comparison runs for one measurement, the grid takes microseconds
+	constexpr int CPU_CULLING_REPEATS = 100;
+
+	// Positions scattered through a box around the engine's camera, deeper than its far plane and wider than its view,
+	// so some objects are culled by every plane. The same seed gives the same positions every run
+	void scatter_culling_positions(size_t count, std::vector<glm::vec3>& outPositions)
+	{
+		std::mt19937 random(1234);
+		std::uniform_real_distribution<float> x(-150.0f, 150.0f);
+		std::uniform_real_distribution<float> y(-40.0f, 50.0f);
+		std::uniform_real_distribution<float> z(-250.0f, 30.0f);
+
+		outPositions.resize(count);
+		for (glm::vec3& position : outPositions)
+		{
+			position = glm::vec3(x(random), y(random), z(random));
+		}
+	}
+
+	// Monkeys and triangles at the scattered positions
+	void build_culling_scene(VulkanEngine& engine, size_t count, std::vector<RenderObject>& outObjects)
+	{
+		std::vector<glm::vec3> positions;
+		scatter_culling_positions(count, positions);
+
+		// The triangle is built in, the monkey is only there if its file loaded
+		Mesh* monkey = engine.get_mesh("monkey");
+		Mesh* triangle = engine.get_mesh("triangle");
+
+		outObjects.resize(count);
+		for (size_t i = 0; i < count; i++)
+		{
+			RenderObject& object = outObjects[i];
+			object.mesh = i % CULLING_MONKEY_INTERVAL == 0 && monkey ? monkey : triangle;
+			object.material = engine.get_material("defaultmesh");
+			object.alphaTestedMaterial = nullptr;
+			object.transformMatrix = glm::translate(positions[i]);
+		}
+	}
+
+	// Objects and distinct meshes of the world bounds check
+	constexpr size_t WORLD_BOUNDS_OBJECT_COUNT = 100000;
+	constexpr size_t WORLD_BOUNDS_MESH_COUNT = 16;
+
+	// Meshes the compaction check uploads, every other one is freed again
+	constexpr int COMPACTION_MESH_COUNT = 64;
+
+	// Capacity, rounds and largest alignment of the random part of the offset allocator check
+	constexpr VkDeviceSize ALLOCATOR_CHECK_CAPACITY = 1 << 20;
+	constexpr int ALLOCATOR_CHECK_ROUNDS = 20000;
+	constexpr VkDeviceSize ALLOCATOR_CHECK_MAX_ALIGNMENT = 48;
+
+	// A live allocation of the offset allocator check
+	struct CheckedRange {
+		VkDeviceSize offset;
+		VkDeviceSize size;
+	};
+
+	// Live ranges are aligned, inside the capacity and don't overlap, and the allocator's free space is what they leave
+	bool ranges_consistent(const OffsetAllocator& allocator, std::vector<CheckedRange> ranges)
+	{
+		std::sort(ranges.begin(), ranges.end(), [](const CheckedRange& a, const CheckedRange& b) { return a.offset < b.offset; });
+
+		VkDeviceSize used = 0;
+		for (size_t i = 0; i < ranges.size(); i++)
+		{
+			if (ranges[i].offset + ranges[i].size > allocator.capacity() || (i > 0 && ranges[i - 1].offset + ranges[i - 1].size > ranges[i].offset))
+			{
+				return false;
+			}
+			used += ranges[i].size;
+		}
+		return allocator.free_space() == allocator.capacity() - used;
+	}
+
+	// Small indexed mesh whose vertices and indices tell it apart from every other one
+	void build_compaction_mesh(int id, Mesh& outMesh)
+	{
+		const size_t vertexCount = 300 + 97 * static_cast<size_t>(id);
+
+		outMesh._vertices.resize(vertexCount);
+		for (size_t v = 0; v < vertexCount; v++)
+		{
+			Vertex& vertex = outMesh._vertices[v];
+			vertex.position = glm::vec3(static_cast<float>(id), static_cast<float>(v), 1.0f);
+			vertex.normal = glm::vec3(0.0f, 0.0f, 1.0f);
+			vertex.color = glm::vec3(0.0f, 0.0f, 1.0f);
+			vertex.uv = glm::vec2(0.0f);
+		}
+
+		outMesh._indices.resize(vertexCount * 3);
+		for (size_t i = 0; i < outMesh._indices.size(); i++)
+		{
+			outMesh._indices[i] = static_cast<uint32_t>((i * 7 + id) % vertexCount);
+		}
+
+		outMesh.compute_bounds();
+	}
+
+	// Copy a geometry range back to the CPU and compare it with what was uploaded
+	// Copy size bytes of a device local buffer into out
+	void read_back(VulkanEngine& engine, VkBuffer source, VkDeviceSize offset, VkDeviceSize size, void* out)
+	{
+		AllocatedBuffer readback = engine.create_buffer(size, VK_BUFFER_USAGE_TRANSFER_DST_BIT, VMA_MEMORY_USAGE_GPU_TO_CPU);
+
+		const VkBufferCopy copy = { offset, 0, size };
+		engine._uploads.wait(engine._uploads.submit([=](VkCommandBuffer cmd) {
+			vkCmdCopyBuffer(cmd, source, readback._buffer, 1, &copy);
+		}));
+
+		void* data;
+		vmaMapMemory(engine._allocator, readback._allocation, &data);
+		vmaInvalidateAllocation(engine._allocator, readback._allocation, 0, VK_WHOLE_SIZE);
+		memcpy(out, data, size);
+		vmaUnmapMemory(engine._allocator, readback._allocation);
+		vmaDestroyBuffer(engine._allocator, readback._buffer, readback._allocation);
+	}
+
+	bool range_matches(VulkanEngine& engine, GeometryArena::Pool pool, const GeometryRange& range, const void* expected)
+	{
+		std::vector<char> data(range.size);
+		read_back(engine, engine._geometry.buffer(pool, range.block), range.offset, range.size, data.data());
+		return memcmp(data.data(), expected, range.size) == 0;
+	}
+
+	// Every batch of the cull pass draws from where its mesh is in the geometry arena now
+	bool culling_matches_meshes(VulkanEngine& engine)
+	{
+		const std::vector<IndirectBatch>& batches = engine._culling.batches();
+		if (batches.empty())
+		{
+			return true;
+		}
+
+		std::vector<GPUDrawBatch> gpuBatches(batches.size());
+		read_back(engine, engine._culling.batch_buffer(), 0, sizeof(GPUDrawBatch) * gpuBatches.size(), gpuBatches.data());
+
+		bool match = true;
+		for (size_t b = 0; b < batches.size(); b++)
+		{
+			const Mesh& mesh = *batches[b].mesh;
+			const GPUDrawBatch& batch = gpuBatches[b];
+			const uint32_t firstVertex = mesh._vertexRange.first_element();
+
+			match &= batch.vertexOffset == static_cast<int32_t>(firstVertex);
+			if (batch.indexed)
+			{
+				const uint32_t firstIndex = mesh._indexRange.first_element();
+				match &= batch.first >= firstIndex && batch.first + batch.count <= firstIndex + mesh._indexCount;
+			}
+			else
+			{
+				match &= batch.first == firstVertex && batch.count <= mesh._vertexCount;
+			}
+		}
+		return match;
+	}
+
+	// Largest difference between two boxes, relative to their size
+	float box_difference(const AABB& a, const AABB& b)
+	{
+		const float size = std::max(glm::length(a.max - a.min), 1.0f);
+		const glm::vec3 difference = glm::max(glm::abs(a.min - b.min), glm::abs(a.max - b.max));
+		return std::max(difference.x, std::max(difference.y, difference.z)) / size;
+	}
+
+	// Spheres of the default scene's triangle grid, placed the way init_scene places the triangles
+	void build_grid_spheres(SphereBoundsTable& outTable)
+	{
+		const glm::vec3 triangle[] = { { 1.0f, 1.0f, 0.5f }, { -1.0f, 1.0f, 0.5f }, { 0.0f, -1.0f, 0.5f } };
+		const glm::vec4 sphere = vkbounds::compute_sphere(triangle, 3, sizeof(glm::vec3), vkbounds::compute_aabb(triangle, 3, sizeof(glm::vec3)));
+
+		outTable.resize(41 * 41);
+
+		size_t i = 0;
+		for (int x = -20; x <= 20; x++)
+		{
+			for (int y = -20; y <= 20; y++)
+			{
+				const glm::mat4 transform = glm::translate(glm::vec3(x, 0, y)) * glm::scale(glm::vec3(0.2f));
+				outTable.set(i++, vkbounds::transform_sphere(sphere, transform));
+			}
+		}
+	}
+
+	// Spheres of unit radius at the scattered positions
+	void build_synthetic_spheres(size_t count, SphereBoundsTable& outTable)
+	{
+		std::vector<glm::vec3> positions;
+		scatter_culling_positions(count, positions);
+
+		outTable.resize(count);
+		for (size_t i = 0; i < count; i++)
+		{
+			outTable.set(i, glm::vec4(positions[i], 1.0f));
+		}
+	}
+}
+
+bool vkbench::run_from_args(int argc, char* argv[], int& outExitCode)
+{
+	for (int i = 1; i < argc; i++)
+	{
+		if (strcmp(argv[i], "--compare-obj") == 0)
+		{
+			outExitCode = compare_obj_loaders() ? 0 : 1;
+			return true;
+		}
+
+		if (strcmp(argv[i], "--mip-bandwidth") == 0)
+		{
+			outExitCode = compare_mip_bandwidth() ? 0 : 1;
+			return true;
+		}
+
+		if (strcmp(argv[i], "--texture-upload") == 0)
+		{
+			outExitCode = compare_texture_uploads() ? 0 : 1;
+			return true;
+		}
+
+		if (strcmp(argv[i], "--gpu-culling") == 0)
+		{
+			outExitCode = scale_gpu_culling() ? 0 : 1;
+			return true;
+		}
+
+		if (strcmp(argv[i], "--cpu-culling") == 0)
+		{
+			outExitCode = compare_cpu_culling() ? 0 : 1;
+			return true;
+		}
+
+		if (strcmp(argv[i], "--offset-allocator") == 0)
+		{
+			outExitCode = check_offset_allocator() ? 0 : 1;
+			return true;
+		}
+
+		if (strcmp(argv[i], "--compact-geometry") == 0)
+		{
+			outExitCode = check_geometry_compaction() ? 0 : 1;
+			return true;
+		}
+
+		if (strcmp(argv[i], "--world-bounds") == 0)
+		{
+			outExitCode = check_world_bounds() ? 0 : 1;
+			return true;
+		}
+
+		if (strcmp(argv[i], "--encode-textures") == 0)
+		{
+			// The format to write can follow, BC7 by default
+			vkbc::BlockFormat format = vkbc::BlockFormat::BC7;
+			if (i + 1 < argc && strcmp(argv[i + 1], "bc1") == 0)
+			{
+				format = vkbc::BlockFormat::BC1;
+			}
+			else if (i + 1 < argc && strcmp(argv[i + 1], "bc3") == 0)
+			{
+				format = vkbc::BlockFormat::BC3;
+			}
+
+			outExitCode = encode_textures(format) ? 0 : 1;
+			return true;
+		}
+	}
+
+	return false;
+}
+
+bool vkbench::compare_obj_loaders()
+{
+	bool allMatch = true;
+
+	// vkobj splits every file across the cores, the timings only mean something next to how many there are
+	std::cout << "vkobj parses on up to " << std::max(1u, std::thread::hardware_concurrency()) << " threads" << std::endl;
+
+	for (const char* asset : OBJ_ASSETS)
+	{
+		std::vector<Vertex> reference;
+		std::vector<Vertex> vertices;
+
+		if (!load_obj_tinyobj(asset, reference) || !vkobj::load_obj(asset, vertices))
+		{
+			std::cout << "Failed to load " << asset << std::endl;
+			allMatch = false;
+			continue;
+		}
+
+		const bool match = reference.size() == vertices.size() &&
+			memcmp(reference.data(), vertices.data(), vertices.size() * sizeof(Vertex)) == 0;
+		allMatch &= match;
+
+		double tinyobjMs = time_best_ms([&]() {
+			std::vector<Vertex> out;
+			load_obj_tinyobj(asset, out);
+		});
+
+		double vkobjMs = time_best_ms([&]() {
+			std::vector<Vertex> out;
+			vkobj::load_obj(asset, out);
+		});
+
+		std::cout << asset << ": " << vertices.size() << " vertices, "
+			<< "tinyobj " << tinyobjMs << " ms, vkobj " << vkobjMs << " ms ("
+			<< tinyobjMs / vkobjMs << "x), output " << (match ? "identical" : "DIFFERENT") << std::endl;
+
+		// A streamed import has to come out as the whole file load does: same vertices in the same order, and the same
+		// material for every triangle
+		std::vector<uint32_t> triangleMaterials;
+		std::vector<ObjMaterial> materials;
+		std::vector<Vertex> streamed;
+		std::vector<uint32_t> streamedTriangleMaterials;
+		std::vector<ObjMaterial> streamedMaterials;
+		size_t batchCount = 0;
+
+		vertices.clear();
+		if (!vkobj::load_obj(asset, vertices, &triangleMaterials, &materials)
+			|| !stream_obj_to_memory(asset, streamed, streamedTriangleMaterials, streamedMaterials, batchCount))
+		{
+			std::cout << "Failed to stream " << asset << std::endl;
+			allMatch = false;
+			continue;
+		}
+
+		const bool streamMatch = streamed.size() == vertices.size()
+			&& memcmp(streamed.data(), vertices.data(), vertices.size() * sizeof(Vertex)) == 0
+			&& streamedTriangleMaterials == triangleMaterials
+			&& same_materials(streamedMaterials, materials);
+		allMatch &= streamMatch;
+
+		std::cout << asset << ": streamed in " << batchCount << " batches of " << COMPARE_STREAM_BATCH_VERTICES << " vertices, "
+			<< materials.size() << " materials, output " << (streamMatch ? "identical to vkobj::load_obj" : "DIFFERENT from vkobj::load_obj") << std::endl;
+	}
+
+	return allMatch;
+}
+
+bool vkbench::compare_mip_bandwidth()
+{
+	DecodedImage image;
+	if (!vkutil::decode_image_from_file(MIP_TEXTURE_ASSET, image))
+	{
+		return false;
+	}
+
+	auto start = std::chrono::high_resolution_clock::now();
+	vkutil::generate_mipmaps(image);
+	auto end = std::chrono::high_resolution_clock::now();
+
+	const double levelZeroMB = static_cast<double>(image.width) * image.height * 4 / (1024.0 * 1024.0);
+	const double mipsMB = image.mips.size() / (1024.0 * 1024.0);
+
+	std::cout << MIP_TEXTURE_ASSET << ": " << image.width << "x" << image.height << ", " << image.mipLevels << " levels filtered in "
+		<< std::chrono::duration<double, std::milli>(end - start).count() << " ms on the CPU, "
+		<< levelZeroMB << " MB + " << mipsMB << " MB of mips" << std::endl;
+
+	const double withoutMB = simulate_texture_traffic(image.width, image.height, false) / (1024.0 * 1024.0);
+	const double withMB = simulate_texture_traffic(image.width, image.height, true) / (1024.0 * 1024.0);
+
+	std::cout << "Texture traffic of a " << MIP_SCREEN_WIDTH << "x" << MIP_SCREEN_HEIGHT << " ground plane frame: "
+		<< withoutMB << " MB without mips, " << withMB << " MB with trilinear mips ("
+		<< withoutMB / std::max(withMB, 1e-9) << "x less)" << std::endl;
+
+	return true;
+}
+
+bool vkbench::encode_textures(vkbc::BlockFormat writeFormat)
+{
+	const vkbc::BlockFormat formats[] = { vkbc::BlockFormat::BC1, vkbc::BlockFormat::BC3, vkbc::BlockFormat::BC7 };
+
+	bool allWritten = true;
+
+	for (const char* asset : TEXTURE_ASSETS)
+	{
+		DecodedImage image;
+		if (!vkutil::decode_image_from_file(asset, image))
+		{
+			allWritten = false;
+			continue;
+		}
+		vkutil::generate_mipmaps(image);
+
+		const size_t texelCount = static_cast<size_t>(image.width) * image.height;
+		const double rgbaMB = (texelCount * 4 + image.mips.size()) / (1024.0 * 1024.0);
+
+		std::cout << asset << ": " << image.width << "x" << image.height << ", " << image.mipLevels << " levels, "
+			<< rgbaMB << " MB as RGBA8" << std::endl;
+
+		for (vkbc::BlockFormat format : formats)
+		{
+			vkktx::Texture texture;
+			texture.format = vkbc::vk_format(format);
+			texture.width = image.width;
+			texture.height = image.height;
+			vkutil::fingerprint_file(asset, texture.sourceSize, texture.sourceHash);
+
+			size_t totalSize = 0;
+			for (uint32_t level = 0, width = image.width, height = image.height; level < image.mipLevels; level++)
+			{
+				texture.levelOffsets.push_back(totalSize);
+				texture.levelSizes.push_back(vkbc::level_size(format, width, height));
+				totalSize += texture.levelSizes.back();
+				width = std::max(1u, width / 2);
+				height = std::max(1u, height / 2);
+			}
+			texture.data.resize(totalSize);
+
+			auto start = std::chrono::high_resolution_clock::now();
+
+			const unsigned char* rgba = image.pixels.get();
+			for (uint32_t level = 0, width = image.width, height = image.height; level < image.mipLevels; level++)
+			{
+				vkbc::encode(format, rgba, width, height, texture.data.data() + texture.levelOffsets[level]);
+
+				rgba = (level == 0 ? image.mips.data() : rgba + static_cast<size_t>(width) * height * 4);
+				width = std::max(1u, width / 2);
+				height = std::max(1u, height / 2);
+			}
+
+			auto end = std::chrono::high_resolution_clock::now();
+
+			// Quality of the level everything up close samples
+			std::vector<unsigned char> decoded(texelCount * 4);
+			vkbc::decode(format, texture.data.data(), image.width, image.height, decoded.data());
+
+			const double colorPsnr = vkbc::psnr(image.pixels.get(), decoded.data(), texelCount, vkbc::Channels::Color);
+			const double alphaPsnr = vkbc::psnr(image.pixels.get(), decoded.data(), texelCount, vkbc::Channels::Alpha);
+			const double compressedMB = totalSize / (1024.0 * 1024.0);
+
+			std::cout << "  " << vkbc::format_name(format) << ": " << compressedMB << " MB (" << rgbaMB / compressedMB << "x smaller), "
+				<< "PSNR color " << colorPsnr << " dB, alpha " << alphaPsnr << " dB, encoded in "
+				<< std::chrono::duration<double, std::milli>(end - start).count() << " ms" << std::endl;
+
+			if (format == writeFormat)
+			{
+				const std::string path = vkutil::ktx2_path(asset);
+				allWritten &= vkktx::write(path.c_str(), texture);
+			}
+		}
+	}
+
+	return allWritten;
+}
+
+bool vkbench::compare_texture_uploads()
+{
+	VulkanEngine engine;
+	engine.init();
+
+	const bool hostCopyAvailable = engine._hostImageCopy.available();
+	if (!hostCopyAvailable)
+	{
+		std::cout << "The GPU has no VK_EXT_host_image_copy, only the staging path is timed" << std::endl;
+	}
+
+	bool allUploaded = true;
+
+	for (const char* asset : TEXTURE_ASSETS)
+	{
+		DecodedImage image;
+		if (!vkutil::decode_image_from_file(asset, image))
+		{
+			allUploaded = false;
+			continue;
+		}
+
+		// The top left tile, with its chain filtered up front so both paths copy the same bytes
+		DecodedImage tile;
+		tile.width = std::min(image.width, UPLOAD_TILE_SIZE);
+		tile.height = std::min(image.height, UPLOAD_TILE_SIZE);
+		tile.file = asset;
+		tile.pixels = std::unique_ptr<unsigned char, void(*)(void*)>(static_cast<unsigned char*>(malloc(static_cast<size_t>(tile.width) * tile.height * 4)), free);
+		for (uint32_t y = 0; y < tile.height; y++)
+		{
+			memcpy(tile.pixels.get() + static_cast<size_t>(y) * tile.width * 4, image.pixels.get() + static_cast<size_t>(y) * image.width * 4, tile.width * 4);
+		}
+		vkutil::generate_mipmaps(tile);
+
+		auto time_upload = [&](bool hostCopy) {
+			engine._hostImageCopy.set_enabled(hostCopy);
+			return time_best_ms([&]() {
+				UploadBatch batch(engine._uploads);
+				AllocatedImage uploaded;
+				allUploaded &= vkutil::upload_image(engine, tile, uploaded, batch);
+				engine._uploads.wait(batch.submit());
+			});
+		};
+
+		const double stagingMs = time_upload(false);
+		std::cout << asset << ": " << tile.width << "x" << tile.height << " tile, " << tile.mipLevels << " levels, staging " << stagingMs << " ms";
+
+		if (hostCopyAvailable)
+		{
+			const double hostMs = time_upload(true);
+			std::cout << ", host image copy " << hostMs << " ms (" << stagingMs / hostMs << "x)";
+		}
+		std::cout << std::endl;
+	}
+
+	engine._hostImageCopy.set_enabled(true);
+	engine.cleanup();
+
+	return allUploaded;
+}
+
+bool vkbench::scale_gpu_culling()
+{
+	VulkanEngine engine;
+	engine.init();
+
+	if (!engine._culling.available())
+	{
+		std::cout << "The GPU has no indirect count draws, there is no cull pass to time" << std::endl;
+		engine.cleanup();
+		return false;
+	}
+
+	// Nothing is presented, the passes are submitted on their own and timed with timestamps around them
+	VkCommandPool commandPool;
+	VkCommandPoolCreateInfo poolInfo = vkinit::command_pool_create_info(engine._graphicsQueueFamily, VK_COMMAND_POOL_CREATE_RESET_COMMAND_BUFFER_BIT);
+	VK_CHECK(vkCreateCommandPool(engine._device, &poolInfo, nullptr, &commandPool));
+
+	VkCommandBuffer cmd;
+	VkCommandBufferAllocateInfo allocInfo = vkinit::command_buffer_allocate_info(commandPool, 1);
+	VK_CHECK(vkAllocateCommandBuffers(engine._device, &allocInfo, &cmd));
+
+	VkFence fence;
+	VkFenceCreateInfo fenceInfo = vkinit::fence_create_info();
+	VK_CHECK(vkCreateFence(engine._device, &fenceInfo, nullptr, &fence));
+
+	VkQueryPoolCreateInfo queryInfo = {};
+	queryInfo.sType = VK_STRUCTURE_TYPE_QUERY_POOL_CREATE_INFO;
+	queryInfo.queryType = VK_QUERY_TYPE_TIMESTAMP;
+	queryInfo.queryCount = 2;
+
+	VkQueryPool queryPool;
+	VK_CHECK(vkCreateQueryPool(engine._device, &queryInfo, nullptr, &queryPool));
+
+	// Culled from the engine's own camera
+	const FrameCamera camera = engine.frame_camera();
+
+	glm::vec4 frustum[6];
+	vkbounds::extract_frustum_planes(camera.projection * camera.view, frustum);
+
+	GPUCullData cullData = {};
+	std::copy(frustum, frustum + 6, cullData.frustum);
+	cullData.cameraPosition = glm::vec4(camera.position, camera.pixelsPerUnitAtOne);
+	cullData.maxPixelError = LOD_MAX_PIXEL_ERROR;
+
+	bool allBuilt = true;
+	std::vector<RenderObject> objects;
+
+	for (size_t count : CULLING_OBJECT_COUNTS)
+	{
+		build_culling_scene(engine, count, objects);
+
+		// The previous scene's pass has finished, its buffers can go
+		if (!engine._culling.build(objects.data(), objects.size(), engine._uploads))
+		{
+			allBuilt = false;
+			continue;
+		}
+		engine._uploads.wait(engine._culling.upload_token());
+
+		const size_t batchCount = engine._culling.batches().size();
+		AllocatedBuffer readback = engine.create_buffer(sizeof(uint32_t) * batchCount, VK_BUFFER_USAGE_TRANSFER_DST_BIT, VMA_MEMORY_USAGE_GPU_TO_CPU);
+
+		double gpuMs = 0.0;
+		double recordMs = 0.0;
+		for (int run = 0; run < BENCH_RUNS; run++)
+		{
+			VK_CHECK(vkResetCommandBuffer(cmd, 0));
+			VkCommandBufferBeginInfo beginInfo = vkinit::command_buffer_begin_info(VK_COMMAND_BUFFER_USAGE_ONE_TIME_SUBMIT_BIT);
+			VK_CHECK(vkBeginCommandBuffer(cmd, &beginInfo));
+
+			// Only the first run has the scene's buffers to take over from the upload queue
+			engine._uploads.record_acquires(cmd, engine._culling.upload_token());
+
+			vkCmdResetQueryPool(cmd, queryPool, 0, 2);
+			vkCmdWriteTimestamp(cmd, VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT, queryPool, 0);
+
+			auto recordStart = std::chrono::high_resolution_clock::now();
+			engine._culling.record_cull(cmd, cullData);
+			auto recordEnd = std::chrono::high_resolution_clock::now();
+
+			vkCmdWriteTimestamp(cmd, VK_PIPELINE_STAGE_BOTTOM_OF_PIPE_BIT, queryPool, 1);
+
+			// Read back how many commands each batch got
+			VkMemoryBarrier countBarrier = {};
+			countBarrier.sType = VK_STRUCTURE_TYPE_MEMORY_BARRIER;
+			countBarrier.srcAccessMask = VK_ACCESS_SHADER_WRITE_BIT;
+			countBarrier.dstAccessMask = VK_ACCESS_TRANSFER_READ_BIT;
+			vkCmdPipelineBarrier(cmd, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, VK_PIPELINE_STAGE_TRANSFER_BIT, 0, 1, &countBarrier, 0, nullptr, 0, nullptr);
+
+			VkBufferCopy copy = { 0, 0, sizeof(uint32_t) * batchCount };
+			vkCmdCopyBuffer(cmd, engine._culling.count_buffer(), readback._buffer, 1, &copy);
+
+			VkMemoryBarrier hostBarrier = {};
+			hostBarrier.sType = VK_STRUCTURE_TYPE_MEMORY_BARRIER;
+			hostBarrier.srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
+			hostBarrier.dstAccessMask = VK_ACCESS_HOST_READ_BIT;
+			vkCmdPipelineBarrier(cmd, VK_PIPELINE_STAGE_TRANSFER_BIT, VK_PIPELINE_STAGE_HOST_BIT, 0, 1, &hostBarrier, 0, nullptr, 0, nullptr);
+
+			VK_CHECK(vkEndCommandBuffer(cmd));
+
+			VkSubmitInfo submit = vkinit::submit_info(&cmd);
+			VK_CHECK(vkQueueSubmit(engine._graphicsQueue, 1, &submit, fence));
+			VK_CHECK(vkWaitForFences(engine._device, 1, &fence, true, UINT64_MAX));
+			VK_CHECK(vkResetFences(engine._device, 1, &fence));
+
+			uint64_t timestamps[2];
+			VK_CHECK(vkGetQueryPoolResults(engine._device, queryPool, 0, 2, sizeof(timestamps), timestamps, sizeof(uint64_t),
+				VK_QUERY_RESULT_64_BIT | VK_QUERY_RESULT_WAIT_BIT));
+
+			const double runGpuMs = (timestamps[1] - timestamps[0]) * engine._gpuProperties.limits.timestampPeriod / 1000000.0;
+			const double runRecordMs = std::chrono::duration<double, std::milli>(recordEnd - recordStart).count();
+			gpuMs = run == 0 ? runGpuMs : std::min(gpuMs, runGpuMs);
+			recordMs = run == 0 ? runRecordMs : std::min(recordMs, runRecordMs);
+		}
+
+		uint32_t visible = 0;
+		void* counts;
+		vmaMapMemory(engine._allocator, readback._allocation, &counts);
+		vmaInvalidateAllocation(engine._allocator, readback._allocation, 0, VK_WHOLE_SIZE);
+		for (size_t b = 0; b < batchCount; b++)
+		{
+			visible += static_cast<const uint32_t*>(counts)[b];
+		}
+		vmaUnmapMemory(engine._allocator, readback._allocation);
+		vmaDestroyBuffer(engine._allocator, readback._buffer, readback._allocation);
+
+		// The same sphere test, one object at a time on the CPU, for scale
+		size_t cpuVisible = 0;
+		const double cpuMs = time_best_ms([&]() {
+			cpuVisible = 0;
+			for (const RenderObject& object : objects)
+			{
+				const glm::vec4 sphere = vkbounds::transform_sphere(object.mesh->_boundingSphere, object.transformMatrix);
+				cpuVisible += vkbounds::sphere_in_frustum(sphere, frustum) ? 1 : 0;
+			}
+		});
+
+		std::cout << count << " objects: " << visible << " of " << engine._culling.record_count() << " submeshes visible, cull pass "
+			<< gpuMs << " ms on the GPU, recorded in " << recordMs * 1000.0 << " us for " << batchCount << " indirect draws. "
+			<< "The same test on one CPU core takes " << cpuMs << " ms (" << cpuVisible << " visible)" << std::endl;
+	}
+
+	vkDestroyQueryPool(engine._device, queryPool, nullptr);
+	vkDestroyFence(engine._device, fence, nullptr);
+	vkDestroyCommandPool(engine._device, commandPool, nullptr);
+
+	engine.cleanup();
+
+	return allBuilt;
+}
+
+bool vkbench::compare_cpu_culling()
+{
+	// Only the camera is needed, the engine isn't started
+	VulkanEngine engine;
+	const FrameCamera camera = engine.frame_camera();
+
+	glm::vec4 planes[6];
+	vkbounds::extract_frustum_planes(camera.projection * camera.view, planes);
+
+	SphereBoundsTable grid;
+	build_grid_spheres(grid);
+
+	SphereBoundsTable synthetic;
+	build_synthetic_spheres(CPU_CULLING_OBJECT_COUNT, synthetic);
+
+	bool allMatch = true;
+
+	auto compare = [&](const char* name, const SphereBoundsTable& table) {
+		std::vector<uint32_t> simdVisible(table.padded_count());
+		std::vector<uint32_t> scalarVisible(table.padded_count());
+		size_t simdCount = 0;
+		size_t scalarCount = 0;
+
+		const double scalarMs = time_best_ms([&]() {
+			for (int r = 0; r < CPU_CULLING_REPEATS; r++)
+			{
+				scalarCount = vkbounds::cull_spheres_scalar(table, planes, scalarVisible.data());
+			}
+		}) / CPU_CULLING_REPEATS;
+
+		const double simdMs = time_best_ms([&]() {
+			for (int r = 0; r < CPU_CULLING_REPEATS; r++)
+			{
+				simdCount = vkbounds::cull_spheres(table, planes, simdVisible.data());
+			}
+		}) / CPU_CULLING_REPEATS;
+
+		const bool match = simdCount == scalarCount && std::equal(simdVisible.begin(), simdVisible.begin() + simdCount, scalarVisible.begin());
+		allMatch &= match;
+
+		std::cout << name << ": " << simdCount << " of " << table.count << " objects visible, scalar " << table.count / scalarMs
+			<< " objects/ms, SIMD " << table.count / simdMs << " objects/ms (" << scalarMs / simdMs << "x)"
+			<< (match ? "" : ", VISIBLE LISTS DIFFER") << std::endl;
+	};
+
+	compare("41x41 triangle grid", grid);
+	compare("Synthetic scene", synthetic);
+
+	return allMatch;
+}
+
+bool vkbench::check_world_bounds()
+{
+	std::mt19937 random(4321);
+	std::uniform_real_distribution<float> unit(-1.0f, 1.0f);
+	std::uniform_real_distribution<float> scale(0.1f, 10.0f);
+
+	// Meshes only need their local boxes
+	std::vector<Mesh> meshes(WORLD_BOUNDS_MESH_COUNT);
+	for (Mesh& mesh : meshes)
+	{
+		const glm::vec3 center(unit(random) * 10.0f, unit(random) * 10.0f, unit(random) * 10.0f);
+		const glm::vec3 extent(scale(random), scale(random), scale(random));
+		mesh._bounds.min = center - extent;
+		mesh._bounds.max = center + extent;
+	}
+
+	// Rotated, unevenly scaled and moved, so every column of the matrices has negative and positive terms
+	std::vector<RenderObject> objects(WORLD_BOUNDS_OBJECT_COUNT);
+	for (size_t i = 0; i < objects.size(); i++)
+	{
+		const glm::vec3 axis = glm::normalize(glm::vec3(unit(random), unit(random), unit(random)) + glm::vec3(0.0f, 0.0f, 1e-3f));
+
+		RenderObject& object = objects[i];
+		object.mesh = &meshes[i % meshes.size()];
+		object.material = nullptr;
+		object.transformMatrix = glm::translate(glm::vec3(unit(random), unit(random), unit(random)) * 100.0f)
+			* glm::rotate(unit(random) * glm::pi<float>(), axis)
+			* glm::scale(glm::vec3(scale(random), scale(random), scale(random)));
+	}
+
+	// Only the batch helper is used, the engine isn't started
+	VulkanEngine engine;
+	std::vector<AABB> bounds;
+	const double batchMs = time_best_ms([&]() {
+		engine.compute_world_bounds(objects.data(), static_cast<int>(objects.size()), bounds);
+	});
+
+	std::vector<AABB> scalarBounds(objects.size());
+	const double scalarMs = time_best_ms([&]() {
+		for (size_t i = 0; i < objects.size(); i++)
+		{
+			scalarBounds[i] = vkbounds::transform_aabb_scalar(objects[i].mesh->_bounds, objects[i].transformMatrix);
+		}
+	});
+
+	float maxDifference = 0.0f;
+	for (size_t i = 0; i < objects.size(); i++)
+	{
+		maxDifference = std::max(maxDifference, box_difference(bounds[i], scalarBounds[i]));
+	}
+
+	const bool match = bounds.size() == objects.size() && maxDifference < 1e-5f;
+
+	std::cout << objects.size() << " world boxes: compute_world_bounds " << batchMs << " ms, scalar transform_aabb " << scalarMs
+		<< " ms, largest relative difference " << maxDifference << (match ? "" : ", BOXES DIFFER") << std::endl;
+
+	return match;
+}
+
+bool vkbench::check_offset_allocator()
+{
+	bool allPassed = true;
+	auto check = [&](const char* name, bool passed) {
+		std::cout << "OffsetAllocator " << name << ": " << (passed ? "ok" : "FAILED") << std::endl;
+		allPassed &= passed;
+	};
+
+	// Best fit: of a 300 and a 200 byte hole, 150 bytes go into the 200 byte one even though the larger comes first
+	{
+		OffsetAllocator allocator;
+		allocator.init(1000);
+
+		VkDeviceSize a, b, c, d, e;
+		allocator.allocate(100, 1, a);
+		allocator.allocate(300, 1, b);
+		allocator.allocate(100, 1, c);
+		allocator.allocate(200, 1, d);
+		allocator.allocate(300, 1, e);
+		allocator.free(b, 300);
+		allocator.free(d, 200);
+
+		VkDeviceSize offset;
+		check("best fit", allocator.allocate(150, 1, offset) && offset == d && allocator.largest_free_block() == 300);
+	}
+
+	// Freeing the range between two free blocks merges all three back into one
+	{
+		OffsetAllocator allocator;
+		allocator.init(300);
+
+		VkDeviceSize a, b, c;
+		allocator.allocate(100, 1, a);
+		allocator.allocate(100, 1, b);
+		allocator.allocate(100, 1, c);
+		allocator.free(a, 100);
+		allocator.free(c, 100);
+		const bool split = allocator.largest_free_block() == 100;
+		allocator.free(b, 100);
+
+		VkDeviceSize whole;
+		check("merge with both neighbours", split && allocator.largest_free_block() == 300 && allocator.free_space() == 300
+			&& allocator.allocate(300, 1, whole) && whole == 0);
+	}
+
+	// A 12 byte stride isn't a power of two. The padding in front of an aligned range stays free and is used again
+	{
+		OffsetAllocator allocator;
+		allocator.init(120);
+
+		VkDeviceSize a, b, padding;
+		const bool aligned = allocator.allocate(7, 1, a) && a == 0 && allocator.allocate(24, 12, b) && b == 12;
+		check("non power of two alignment", aligned && allocator.allocate(5, 1, padding) && padding == 7
+			&& allocator.free_space() == 120 - 7 - 24 - 5);
+	}
+
+	// A range that doesn't fit once its start is aligned is skipped for a larger block further on
+	{
+		OffsetAllocator allocator;
+		allocator.init(200);
+
+		VkDeviceSize a, b, c, offset;
+		allocator.allocate(1, 1, a);
+		allocator.allocate(30, 1, b);
+		allocator.allocate(1, 1, c);
+		allocator.free(b, 30);
+		check("alignment padding skips a block", allocator.allocate(30, 7, offset) && offset % 7 == 0 && offset > c);
+	}
+
+	// Shrinking gives the end of a range back, which merges with the free space behind it
+	{
+		OffsetAllocator allocator;
+		allocator.init(1000);
+
+		VkDeviceSize offset;
+		allocator.allocate(400, 1, offset);
+		allocator.free(offset + 100, 300);
+		check("shrink", allocator.free_space() == 900 && allocator.largest_free_block() == 900);
+	}
+
+	// Random allocations and frees with odd sizes and alignments, checked after every step, then everything freed
+	{
+		OffsetAllocator allocator;
+		allocator.init(ALLOCATOR_CHECK_CAPACITY);
+
+		std::mt19937 random(7);
+		std::uniform_int_distribution<VkDeviceSize> size(1, 4096);
+		std::uniform_int_distribution<VkDeviceSize> alignment(1, ALLOCATOR_CHECK_MAX_ALIGNMENT);
+
+		std::vector<CheckedRange> ranges;
+		bool consistent = true;
+		for (int round = 0; round < ALLOCATOR_CHECK_ROUNDS && consistent; round++)
+		{
+			if (ranges.empty() || random() % 3 != 0)
+			{
+				const VkDeviceSize rangeSize = size(random);
+				const VkDeviceSize rangeAlignment = alignment(random);
+
+				VkDeviceSize offset;
+				if (allocator.allocate(rangeSize, rangeAlignment, offset))
+				{
+					consistent &= offset % rangeAlignment == 0;
+					ranges.push_back({ offset, rangeSize });
+				}
+			}
+			else
+			{
+				const size_t index = random() % ranges.size();
+				allocator.free(ranges[index].offset, ranges[index].size);
+				ranges[index] = ranges.back();
+				ranges.pop_back();
+			}
+
+			consistent &= ranges_consistent(allocator, ranges);
+		}
+
+		for (const CheckedRange& range : ranges)
+		{
+			allocator.free(range.offset, range.size);
+		}
+
+		check("random allocations and frees", consistent && allocator.free_space() == ALLOCATOR_CHECK_CAPACITY
+			&& allocator.largest_free_block() == ALLOCATOR_CHECK_CAPACITY);
+	}
+
+	return allPassed;
+}
+
+bool vkbench::check_geometry_compaction()
+{
+	VulkanEngine engine;
+	engine.init();
+
+	// Test meshes go into the engine's own table, so compact_geometry moves them along with the scene's
+	std::vector<std::string> names;
+	UploadBatch batch(engine._uploads);
+	for (int id = 0; id < COMPACTION_MESH_COUNT; id++)
+	{
+		names.push_back("compaction_test_" + std::to_string(id));
+		Mesh& mesh = engine._meshes[names.back()];
+		build_compaction_mesh(id, mesh);
+		engine.upload_meshes(mesh, batch);
+	}
+	engine._uploads.wait(batch.submit());
+
+	// The meshes that stay are drawn too, so the cull pass has batches that compaction moves
+	for (int id = 1; id < COMPACTION_MESH_COUNT; id += 2)
+	{
+		RenderObject object;
+		object.mesh = &engine._meshes[names[id]];
+		object.material = engine.get_material("defaultmesh");
+		object.transformMatrix = glm::translate(glm::vec3(id, 0, 0));
+		engine._renderables.push_back(object);
+	}
+	engine.update_renderable_bounds();
+	engine.rebuild_culling();
+
+	// Every other mesh goes, leaving a hole behind each one that stays
+	for (int id = 0; id < COMPACTION_MESH_COUNT; id += 2)
+	{
+		engine.free_mesh(engine._meshes[names[id]]);
+		engine._meshes.erase(names[id]);
+	}
+
+	engine.compact_geometry();
+	engine._uploads.wait(engine._uploads.last_token());
+
+	bool allMatch = true;
+
+	// Every live range is now in block 0 of its pool, and no two overlap
+	for (GeometryArena::Pool pool : { GeometryArena::Pool::Vertex, GeometryArena::Pool::Index })
+	{
+		std::vector<GeometryRange> ranges;
+		for (auto& entry : engine._meshes)
+		{
+			const GeometryRange& range = pool == GeometryArena::Pool::Vertex ? entry.second._vertexRange : entry.second._indexRange;
+			if (range.valid() && range.size > 0)
+			{
+				allMatch &= range.block == 0;
+				ranges.push_back(range);
+			}
+		}
+
+		std::sort(ranges.begin(), ranges.end(), [](const GeometryRange& a, const GeometryRange& b) { return a.offset < b.offset; });
+		for (size_t i = 1; i < ranges.size(); i++)
+		{
+			allMatch &= ranges[i - 1].offset + ranges[i - 1].size <= ranges[i].offset;
+		}
+	}
+
+	// The meshes that stayed still read their own vertices and indices
+	size_t checked = 0;
+	for (int id = 1; id < COMPACTION_MESH_COUNT; id += 2)
+	{
+		const Mesh& mesh = engine._meshes[names[id]];
+
+		std::vector<char> indices(mesh.index_data_count() * mesh.index_size());
+		mesh.write_index_data(indices.data());
+
+		allMatch &= range_matches(engine, GeometryArena::Pool::Vertex, mesh._vertexRange, mesh.vertex_data());
+		allMatch &= range_matches(engine, GeometryArena::Pool::Index, mesh._indexRange, indices.data());
+		checked++;
+	}
+
+	const bool cullingMatches = culling_matches_meshes(engine);
+	allMatch &= cullingMatches;
+
+	std::cout << "Freed " << COMPACTION_MESH_COUNT / 2 << " of " << COMPACTION_MESH_COUNT << " test meshes and compacted the geometry arena: "
+		<< (allMatch ? "every live range is packed into one block and the " : "RANGES DIFFER, checked ") << checked
+		<< " remaining test meshes read back what they uploaded" << std::endl;
+	std::cout << engine._culling.batches().size() << " cull pass batches " << (cullingMatches ? "draw from the compacted ranges" : "STILL DRAW FROM THE OLD RANGES") << std::endl;
+
+	engine.cleanup();
+
+	return allMatch;
+}
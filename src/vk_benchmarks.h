@@ -0,0 +1,47 @@
+#pragma once
+
+#include "vk_block_compression.h"
+
+// Offline measurements that run instead of the engine, selected from the command line
+namespace vkbench {
+
+	// Run the benchmark named by the command line arguments. Returns false if no benchmark was requested
+	bool run_from_args(int argc, char* argv[], int& outExitCode);
+
+	// Load the OBJ assets through tinyobj and through vkobj::load_obj, check that the vertices match and print the timings.
+	// Then stream each through vkobj::stream_obj and check its vertices and materials match load_obj byte for byte
+	bool compare_obj_loaders();
+
+	// Filter the mip chain of the level texture on the CPU, then estimate the memory traffic of sampling it across a
+	// ground plane through a simple texture cache model, with only level 0 and with trilinear mips
+	bool compare_mip_bandwidth();
+
+	// Encode the level textures with full mip chains into every BC format, report the PSNR of level 0 and the memory
+	// against RGBA8, and write the chosen format as a KTX2 file next to each texture for the engine to load
+	bool encode_textures(vkbc::BlockFormat writeFormat);
+
+	// Upload a tile of each level texture with its mip chain through a staging buffer and through host image copy,
+	// timing each until the GPU can sample it. Starts the engine for a device
+	bool compare_texture_uploads();
+
+	// Cull scenes of a thousand up to a million objects with the GPU cull pass, timing the pass on the GPU and its
+	// recording on the CPU, next to the same test run over the objects on the CPU. Starts the engine for a device
+	bool scale_gpu_culling();
+
+	// Frustum cull the default scene's triangle grid and a synthetic scene of 100k objects from the engine's camera,
+	// one sphere at a time and with vkbounds::cull_spheres, and report both in objects/ms
+	bool compare_cpu_culling();
+
+	// Transform random boxes by random rotations, scales and translations with VulkanEngine::compute_world_bounds and
+	// with the scalar vkbounds::transform_aabb_scalar, and check that they agree
+	bool check_world_bounds();
+
+	// Check OffsetAllocator on its own, without a device: best fit, merging with both neighbours on free, alignments
+	// that aren't powers of two, shrinking, and random allocations and frees that must never overlap
+	bool check_offset_allocator();
+
+	// Upload test meshes into the geometry arena, free every other one, compact the arena and check that every live
+	// range is packed into one block and still holds its mesh's vertices and indices. Starts the engine for a device
+	bool check_geometry_compaction();
+
+}
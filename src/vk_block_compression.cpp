@@ -0,0 +1,855 @@
+#include "vk_block_compression.h"
+
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+#include <functional>
+#include <limits>
+#include <thread>
+#include <vector>
+
+namespace {
+
+	// Rows of blocks each encoding thread takes at least, small levels stay on one thread
+	constexpr uint32_t BLOCK_ROWS_PER_THREAD = 16;
+
+	// Interpolation weights of BC7's 4 bit indices, out of 64
+	constexpr int BC7_WEIGHTS4[16] = { 0, 4, 9, 13, 17, 21, 26, 30, 34, 38, 43, 47, 51, 55, 60, 64 };
+
+	// Alpha below this is transparent in BC1's 1 bit alpha, and hidden by the alpha tested materials
+	constexpr int BC1_ALPHA_THRESHOLD = 128;
+
+	using Block = unsigned char[16][4];
+
+	uint32_t blocks_across(uint32_t size)
+	{
+		return (size + 3) / 4;
+	}
+
+	// Split rows [0, rowCount) of blocks over the cores. The calling thread works too
+	void parallel_rows(uint32_t rowCount, const std::function<void(uint32_t firstRow, uint32_t endRow)>& function)
+	{
+		const uint32_t hardwareThreads = std::max(1u, std::thread::hardware_concurrency());
+		const uint32_t threadCount = std::min(hardwareThreads, std::max(1u, rowCount / BLOCK_ROWS_PER_THREAD));
+		const uint32_t rowsPerThread = (rowCount + threadCount - 1) / threadCount;
+
+		std::vector<std::thread> threads;
+		for (uint32_t thread = 1; thread < threadCount; thread++)
+		{
+			const uint32_t firstRow = std::min(rowCount, thread * rowsPerThread);
+			threads.emplace_back(function, firstRow, std::min(rowCount, firstRow + rowsPerThread));
+		}
+
+		function(0, std::min(rowCount, rowsPerThread));
+
+		for (std::thread& thread : threads)
+		{
+			thread.join();
+		}
+	}
+
+	void load_block(const unsigned char* rgba, uint32_t width, uint32_t height, uint32_t blockX, uint32_t blockY, Block& outBlock)
+	{
+		for (uint32_t y = 0; y < 4; y++)
+		{
+			const uint32_t sourceY = std::min(blockY * 4 + y, height - 1);
+			for (uint32_t x = 0; x < 4; x++)
+			{
+				const uint32_t sourceX = std::min(blockX * 4 + x, width - 1);
+				memcpy(outBlock[y * 4 + x], rgba + (static_cast<size_t>(sourceY) * width + sourceX) * 4, 4);
+			}
+		}
+	}
+
+	void store_block(const Block& block, uint32_t width, uint32_t height, uint32_t blockX, uint32_t blockY, unsigned char* rgba)
+	{
+		for (uint32_t y = 0; y < 4 && blockY * 4 + y < height; y++)
+		{
+			for (uint32_t x = 0; x < 4 && blockX * 4 + x < width; x++)
+			{
+				memcpy(rgba + (static_cast<size_t>(blockY * 4 + y) * width + blockX * 4 + x) * 4, block[y * 4 + x], 4);
+			}
+		}
+	}
+
+	// Line through a set of points that fits them best: their mean and the direction they vary along the most,
+	// from power iteration on the covariance. Points project onto [outMin, outMax] along the axis
+	void fit_line(const float points[16][4], int count, int channels, float outMean[4], float outAxis[4], float& outMin, float& outMax)
+	{
+		float mean[4] = {};
+		for (int i = 0; i < count; i++)
+		{
+			for (int c = 0; c < channels; c++)
+			{
+				mean[c] += points[i][c];
+			}
+		}
+		for (int c = 0; c < channels; c++)
+		{
+			mean[c] /= count;
+		}
+
+		float covariance[4][4] = {};
+		for (int i = 0; i < count; i++)
+		{
+			for (int a = 0; a < channels; a++)
+			{
+				for (int b = 0; b < channels; b++)
+				{
+					covariance[a][b] += (points[i][a] - mean[a]) * (points[i][b] - mean[b]);
+				}
+			}
+		}
+
+		float axis[4] = { 1.0f, 1.0f, 1.0f, 1.0f };
+		for (int iteration = 0; iteration < 8; iteration++)
+		{
+			float next[4] = {};
+			float length = 0.0f;
+			for (int a = 0; a < channels; a++)
+			{
+				for (int b = 0; b < channels; b++)
+				{
+					next[a] += covariance[a][b] * axis[b];
+				}
+				length += next[a] * next[a];
+			}
+
+			// Flat blocks have no direction, any axis does
+			if (length < 1e-12f)
+			{
+				break;
+			}
+
+			length = std::sqrt(length);
+			for (int c = 0; c < channels; c++)
+			{
+				axis[c] = next[c] / length;
+			}
+		}
+
+		float axisLength = 0.0f;
+		for (int c = 0; c < channels; c++)
+		{
+			axisLength += axis[c] * axis[c];
+		}
+		axisLength = std::sqrt(axisLength);
+
+		outMin = std::numeric_limits<float>::max();
+		outMax = -std::numeric_limits<float>::max();
+		for (int c = 0; c < channels; c++)
+		{
+			outMean[c] = mean[c];
+			outAxis[c] = axis[c] / axisLength;
+		}
+
+		for (int i = 0; i < count; i++)
+		{
+			float t = 0.0f;
+			for (int c = 0; c < channels; c++)
+			{
+				t += (points[i][c] - mean[c]) * outAxis[c];
+			}
+			outMin = std::min(outMin, t);
+			outMax = std::max(outMax, t);
+		}
+	}
+
+	// Endpoints that best reproduce points from their weights: point i is (1 - weights[i]) * e0 + weights[i] * e1.
+	// False when every weight is the same and the endpoints can't be told apart
+	bool solve_endpoints(const float points[16][4], const float weights[16], int count, int channels, float outE0[4], float outE1[4])
+	{
+		float aa = 0.0f, ab = 0.0f, bb = 0.0f;
+		float ax[4] = {}, bx[4] = {};
+		for (int i = 0; i < count; i++)
+		{
+			const float b = weights[i];
+			const float a = 1.0f - b;
+			aa += a * a;
+			ab += a * b;
+			bb += b * b;
+			for (int c = 0; c < channels; c++)
+			{
+				ax[c] += a * points[i][c];
+				bx[c] += b * points[i][c];
+			}
+		}
+
+		const float determinant = aa * bb - ab * ab;
+		if (std::fabs(determinant) < 1e-6f)
+		{
+			return false;
+		}
+
+		for (int c = 0; c < channels; c++)
+		{
+			outE0[c] = std::clamp((bb * ax[c] - ab * bx[c]) / determinant, 0.0f, 255.0f);
+			outE1[c] = std::clamp((aa * bx[c] - ab * ax[c]) / determinant, 0.0f, 255.0f);
+		}
+		return true;
+	}
+
+	uint16_t pack_565(const float color[3])
+	{
+		const int r = static_cast<int>(std::lround(std::clamp(color[0], 0.0f, 255.0f) * 31.0f / 255.0f));
+		const int g = static_cast<int>(std::lround(std::clamp(color[1], 0.0f, 255.0f) * 63.0f / 255.0f));
+		const int b = static_cast<int>(std::lround(std::clamp(color[2], 0.0f, 255.0f) * 31.0f / 255.0f));
+		return static_cast<uint16_t>((r << 11) | (g << 5) | b);
+	}
+
+	void unpack_565(uint16_t packed, int outColor[4])
+	{
+		const int r = (packed >> 11) & 31;
+		const int g = (packed >> 5) & 63;
+		const int b = packed & 31;
+		outColor[0] = (r << 3) | (r >> 2);
+		outColor[1] = (g << 2) | (g >> 4);
+		outColor[2] = (b << 3) | (b >> 2);
+		outColor[3] = 255;
+	}
+
+	// The four colors a BC1 block decodes to. Color blocks in BC3 always use four colors
+	bool color_palette(uint16_t c0, uint16_t c1, bool alwaysFourColors, int outPalette[4][4])
+	{
+		unpack_565(c0, outPalette[0]);
+		unpack_565(c1, outPalette[1]);
+
+		const bool fourColors = alwaysFourColors || c0 > c1;
+		for (int c = 0; c < 3; c++)
+		{
+			if (fourColors)
+			{
+				outPalette[2][c] = (2 * outPalette[0][c] + outPalette[1][c]) / 3;
+				outPalette[3][c] = (outPalette[0][c] + 2 * outPalette[1][c]) / 3;
+			}
+			else
+			{
+				outPalette[2][c] = (outPalette[0][c] + outPalette[1][c]) / 2;
+				outPalette[3][c] = 0;
+			}
+		}
+		outPalette[2][3] = 255;
+		outPalette[3][3] = fourColors ? 255 : 0;
+		return fourColors;
+	}
+
+	struct ColorCandidate {
+		uint16_t c0;
+		uint16_t c1;
+		uint32_t indices;
+		int error;
+		uint8_t selected[16];
+	};
+
+	// Quantize two endpoints, order them for the mode the block needs and pick each texel's closest palette entry
+	ColorCandidate evaluate_color(const Block& texels, const bool transparent[16], bool threeColors, bool alwaysFourColors,
+		const float e0[3], const float e1[3])
+	{
+		ColorCandidate candidate;
+		candidate.c0 = pack_565(e0);
+		candidate.c1 = pack_565(e1);
+
+		// c0 > c1 selects four colors in BC1, c0 <= c1 three colors and transparent black
+		if (!alwaysFourColors && (threeColors ? candidate.c0 > candidate.c1 : candidate.c0 < candidate.c1))
+		{
+			std::swap(candidate.c0, candidate.c1);
+		}
+
+		int palette[4][4];
+		const bool fourColors = color_palette(candidate.c0, candidate.c1, alwaysFourColors, palette);
+
+		candidate.indices = 0;
+		candidate.error = 0;
+		for (int i = 0; i < 16; i++)
+		{
+			int best = 0;
+			if (transparent[i])
+			{
+				best = 3;
+			}
+			else
+			{
+				int bestError = std::numeric_limits<int>::max();
+				for (int p = 0; p < (fourColors ? 4 : 3); p++)
+				{
+					int error = 0;
+					for (int c = 0; c < 3; c++)
+					{
+						const int d = palette[p][c] - texels[i][c];
+						error += d * d;
+					}
+					if (error < bestError)
+					{
+						bestError = error;
+						best = p;
+					}
+				}
+				candidate.error += bestError;
+			}
+
+			candidate.selected[i] = static_cast<uint8_t>(best);
+			candidate.indices |= static_cast<uint32_t>(best) << (i * 2);
+		}
+
+		return candidate;
+	}
+
+	void encode_color_block(const Block& texels, bool punchThrough, bool alwaysFourColors, unsigned char out[8])
+	{
+		bool transparent[16];
+		float points[16][4];
+		int count = 0;
+		for (int i = 0; i < 16; i++)
+		{
+			transparent[i] = punchThrough && texels[i][3] < BC1_ALPHA_THRESHOLD;
+			if (!transparent[i])
+			{
+				for (int c = 0; c < 3; c++)
+				{
+					points[count][c] = texels[i][c];
+				}
+				count++;
+			}
+		}
+
+		ColorCandidate best;
+		if (count == 0)
+		{
+			// Fully transparent, three color mode with every texel on the transparent entry
+			best.c0 = 0;
+			best.c1 = 0;
+			best.indices = 0xFFFFFFFF;
+		}
+		else
+		{
+			const bool threeColors = count < 16;
+
+			float mean[4], axis[4], tMin, tMax;
+			fit_line(points, count, 3, mean, axis, tMin, tMax);
+
+			float e0[3], e1[3];
+			for (int c = 0; c < 3; c++)
+			{
+				e0[c] = mean[c] + axis[c] * tMax;
+				e1[c] = mean[c] + axis[c] * tMin;
+			}
+			best = evaluate_color(texels, transparent, threeColors, alwaysFourColors, e0, e1);
+
+			// One least squares pass over the chosen indices usually moves the endpoints closer to the texels
+			float palettePosition[4];
+			int palette[4][4];
+			const bool fourColors = color_palette(best.c0, best.c1, alwaysFourColors, palette);
+			palettePosition[0] = 0.0f;
+			palettePosition[1] = 1.0f;
+			palettePosition[2] = fourColors ? 1.0f / 3.0f : 0.5f;
+			palettePosition[3] = 2.0f / 3.0f;
+
+			float weights[16];
+			int weighted = 0;
+			for (int i = 0; i < 16; i++)
+			{
+				if (!transparent[i])
+				{
+					weights[weighted++] = palettePosition[best.selected[i]];
+				}
+			}
+
+			float refined0[4], refined1[4];
+			if (best.error > 0 && solve_endpoints(points, weights, count, 3, refined0, refined1))
+			{
+				const ColorCandidate refined = evaluate_color(texels, transparent, threeColors, alwaysFourColors, refined0, refined1);
+				if (refined.error < best.error)
+				{
+					best = refined;
+				}
+			}
+		}
+
+		out[0] = static_cast<unsigned char>(best.c0 & 0xFF);
+		out[1] = static_cast<unsigned char>(best.c0 >> 8);
+		out[2] = static_cast<unsigned char>(best.c1 & 0xFF);
+		out[3] = static_cast<unsigned char>(best.c1 >> 8);
+		for (int i = 0; i < 4; i++)
+		{
+			out[4 + i] = static_cast<unsigned char>(best.indices >> (i * 8));
+		}
+	}
+
+	void decode_color_block(const unsigned char in[8], bool alwaysFourColors, Block& outTexels)
+	{
+		const uint16_t c0 = static_cast<uint16_t>(in[0] | (in[1] << 8));
+		const uint16_t c1 = static_cast<uint16_t>(in[2] | (in[3] << 8));
+		const uint32_t indices = in[4] | (in[5] << 8) | (in[6] << 16) | (static_cast<uint32_t>(in[7]) << 24);
+
+		int palette[4][4];
+		color_palette(c0, c1, alwaysFourColors, palette);
+
+		for (int i = 0; i < 16; i++)
+		{
+			const int index = (indices >> (i * 2)) & 3;
+			for (int c = 0; c < 4; c++)
+			{
+				outTexels[i][c] = static_cast<unsigned char>(palette[index][c]);
+			}
+		}
+	}
+
+	// The eight alphas a BC3 alpha block decodes to
+	void alpha_palette(int a0, int a1, int outPalette[8])
+	{
+		outPalette[0] = a0;
+		outPalette[1] = a1;
+		if (a0 > a1)
+		{
+			for (int i = 2; i < 8; i++)
+			{
+				outPalette[i] = ((8 - i) * a0 + (i - 1) * a1) / 7;
+			}
+		}
+		else
+		{
+			for (int i = 2; i < 6; i++)
+			{
+				outPalette[i] = ((6 - i) * a0 + (i - 1) * a1) / 5;
+			}
+			outPalette[6] = 0;
+			outPalette[7] = 255;
+		}
+	}
+
+	void encode_alpha_block(const Block& texels, unsigned char out[8])
+	{
+		int aMin = 255, aMax = 0;
+		for (int i = 0; i < 16; i++)
+		{
+			aMin = std::min<int>(aMin, texels[i][3]);
+			aMax = std::max<int>(aMax, texels[i][3]);
+		}
+
+		// Eight interpolated values between the extremes, a flat block is all index 0
+		int palette[8];
+		alpha_palette(aMax, aMin, palette);
+
+		uint64_t indices = 0;
+		for (int i = 0; i < 16 && aMax > aMin; i++)
+		{
+			int best = 0;
+			int bestError = std::numeric_limits<int>::max();
+			for (int p = 0; p < 8; p++)
+			{
+				const int error = std::abs(palette[p] - texels[i][3]);
+				if (error < bestError)
+				{
+					bestError = error;
+					best = p;
+				}
+			}
+			indices |= static_cast<uint64_t>(best) << (i * 3);
+		}
+
+		out[0] = static_cast<unsigned char>(aMax);
+		out[1] = static_cast<unsigned char>(aMin);
+		for (int i = 0; i < 6; i++)
+		{
+			out[2 + i] = static_cast<unsigned char>(indices >> (i * 8));
+		}
+	}
+
+	void decode_alpha_block(const unsigned char in[8], Block& outTexels)
+	{
+		int palette[8];
+		alpha_palette(in[0], in[1], palette);
+
+		uint64_t indices = 0;
+		for (int i = 0; i < 6; i++)
+		{
+			indices |= static_cast<uint64_t>(in[2 + i]) << (i * 8);
+		}
+
+		for (int i = 0; i < 16; i++)
+		{
+			outTexels[i][3] = static_cast<unsigned char>(palette[(indices >> (i * 3)) & 7]);
+		}
+	}
+
+	// Bits of a BC7 block, least significant bit of the first byte first
+	struct BitWriter {
+		unsigned char* bytes;
+		uint32_t position{ 0 };
+
+		void write(uint32_t value, uint32_t count)
+		{
+			for (uint32_t i = 0; i < count; i++, position++)
+			{
+				bytes[position >> 3] |= static_cast<unsigned char>(((value >> i) & 1) << (position & 7));
+			}
+		}
+	};
+
+	struct BitReader {
+		const unsigned char* bytes;
+		uint32_t position{ 0 };
+
+		uint32_t read(uint32_t count)
+		{
+			uint32_t value = 0;
+			for (uint32_t i = 0; i < count; i++, position++)
+			{
+				value |= static_cast<uint32_t>((bytes[position >> 3] >> (position & 7)) & 1) << i;
+			}
+			return value;
+		}
+	};
+
+	struct Bc7Candidate {
+		int endpoints[2][4];	// 7 bit values
+		int parity[2];
+		uint8_t indices[16];
+		int error;
+	};
+
+	int bc7_interpolate(int e0, int e1, int weight)
+	{
+		return ((64 - weight) * e0 + weight * e1 + 32) >> 6;
+	}
+
+	// Mode 6 with endpoints quantized for one pair of parity bits, texels projected onto the endpoint line and
+	// snapped to the closest of the neighbouring weights
+	Bc7Candidate evaluate_bc7(const Block& texels, const float e0[4], const float e1[4], int parity0, int parity1)
+	{
+		Bc7Candidate candidate;
+		candidate.parity[0] = parity0;
+		candidate.parity[1] = parity1;
+
+		int full[2][4];
+		for (int c = 0; c < 4; c++)
+		{
+			candidate.endpoints[0][c] = std::clamp(static_cast<int>(std::lround((e0[c] - parity0) * 0.5f)), 0, 127);
+			candidate.endpoints[1][c] = std::clamp(static_cast<int>(std::lround((e1[c] - parity1) * 0.5f)), 0, 127);
+			full[0][c] = candidate.endpoints[0][c] * 2 + parity0;
+			full[1][c] = candidate.endpoints[1][c] * 2 + parity1;
+		}
+
+		float direction[4];
+		float lengthSquared = 0.0f;
+		for (int c = 0; c < 4; c++)
+		{
+			direction[c] = static_cast<float>(full[1][c] - full[0][c]);
+			lengthSquared += direction[c] * direction[c];
+		}
+
+		candidate.error = 0;
+		for (int i = 0; i < 16; i++)
+		{
+			float t = 0.0f;
+			for (int c = 0; c < 4; c++)
+			{
+				t += (texels[i][c] - full[0][c]) * direction[c];
+			}
+			t = lengthSquared > 0.0f ? t / lengthSquared : 0.0f;
+
+			const int guess = std::clamp(static_cast<int>(std::lround(t * 15.0f)), 0, 15);
+
+			int best = guess;
+			int bestError = std::numeric_limits<int>::max();
+			for (int index = std::max(0, guess - 1); index <= std::min(15, guess + 1); index++)
+			{
+				int error = 0;
+				for (int c = 0; c < 4; c++)
+				{
+					const int d = bc7_interpolate(full[0][c], full[1][c], BC7_WEIGHTS4[index]) - texels[i][c];
+					error += d * d;
+				}
+				if (error < bestError)
+				{
+					bestError = error;
+					best = index;
+				}
+			}
+
+			candidate.indices[i] = static_cast<uint8_t>(best);
+			candidate.error += bestError;
+		}
+
+		return candidate;
+	}
+
+	Bc7Candidate best_bc7(const Block& texels, const float e0[4], const float e1[4])
+	{
+		Bc7Candidate best = evaluate_bc7(texels, e0, e1, 0, 0);
+		for (int parity = 1; parity < 4 && best.error > 0; parity++)
+		{
+			const Bc7Candidate candidate = evaluate_bc7(texels, e0, e1, parity & 1, parity >> 1);
+			if (candidate.error < best.error)
+			{
+				best = candidate;
+			}
+		}
+		return best;
+	}
+
+	void encode_bc7_block(const Block& texels, unsigned char out[16])
+	{
+		float points[16][4];
+		for (int i = 0; i < 16; i++)
+		{
+			for (int c = 0; c < 4; c++)
+			{
+				points[i][c] = texels[i][c];
+			}
+		}
+
+		float mean[4], axis[4], tMin, tMax;
+		fit_line(points, 16, 4, mean, axis, tMin, tMax);
+
+		float e0[4], e1[4];
+		for (int c = 0; c < 4; c++)
+		{
+			e0[c] = std::clamp(mean[c] + axis[c] * tMin, 0.0f, 255.0f);
+			e1[c] = std::clamp(mean[c] + axis[c] * tMax, 0.0f, 255.0f);
+		}
+
+		Bc7Candidate best = best_bc7(texels, e0, e1);
+
+		float weights[16];
+		for (int i = 0; i < 16; i++)
+		{
+			weights[i] = BC7_WEIGHTS4[best.indices[i]] / 64.0f;
+		}
+
+		float refined0[4], refined1[4];
+		if (best.error > 0 && solve_endpoints(points, weights, 16, 4, refined0, refined1))
+		{
+			const Bc7Candidate refined = best_bc7(texels, refined0, refined1);
+			if (refined.error < best.error)
+			{
+				best = refined;
+			}
+		}
+
+		// The first index is stored without its top bit, so it has to be below 8. The weights are symmetric,
+		// swapping the endpoints and mirroring the indices decodes the same
+		if (best.indices[0] >= 8)
+		{
+			std::swap(best.endpoints[0], best.endpoints[1]);
+			std::swap(best.parity[0], best.parity[1]);
+			for (int i = 0; i < 16; i++)
+			{
+				best.indices[i] = static_cast<uint8_t>(15 - best.indices[i]);
+			}
+		}
+
+		memset(out, 0, 16);
+		BitWriter writer{ out };
+		writer.write(1 << 6, 7);
+		for (int c = 0; c < 4; c++)
+		{
+			writer.write(best.endpoints[0][c], 7);
+			writer.write(best.endpoints[1][c], 7);
+		}
+		writer.write(best.parity[0], 1);
+		writer.write(best.parity[1], 1);
+		for (int i = 0; i < 16; i++)
+		{
+			writer.write(best.indices[i], i == 0 ? 3 : 4);
+		}
+	}
+
+	void decode_bc7_block(const unsigned char in[16], Block& outTexels)
+	{
+		// Mode 6 is the only one with bit 6 as its lowest set bit
+		if ((in[0] & 0x7F) != 0x40)
+		{
+			for (int i = 0; i < 16; i++)
+			{
+				outTexels[i][0] = 255;
+				outTexels[i][1] = 0;
+				outTexels[i][2] = 255;
+				outTexels[i][3] = 255;
+			}
+			return;
+		}
+
+		BitReader reader{ in };
+		reader.read(7);
+
+		int endpoints[2][4];
+		for (int c = 0; c < 4; c++)
+		{
+			endpoints[0][c] = static_cast<int>(reader.read(7));
+			endpoints[1][c] = static_cast<int>(reader.read(7));
+		}
+
+		const int parity0 = static_cast<int>(reader.read(1));
+		const int parity1 = static_cast<int>(reader.read(1));
+		for (int c = 0; c < 4; c++)
+		{
+			endpoints[0][c] = endpoints[0][c] * 2 + parity0;
+			endpoints[1][c] = endpoints[1][c] * 2 + parity1;
+		}
+
+		for (int i = 0; i < 16; i++)
+		{
+			const int index = static_cast<int>(reader.read(i == 0 ? 3 : 4));
+			for (int c = 0; c < 4; c++)
+			{
+				outTexels[i][c] = static_cast<unsigned char>(bc7_interpolate(endpoints[0][c], endpoints[1][c], BC7_WEIGHTS4[index]));
+			}
+		}
+	}
+
+	void encode_block(vkbc::BlockFormat format, const Block& texels, unsigned char* out)
+	{
+		switch (format)
+		{
+		case vkbc::BlockFormat::BC1:
+			encode_color_block(texels, true, false, out);
+			break;
+		case vkbc::BlockFormat::BC3:
+			encode_alpha_block(texels, out);
+			encode_color_block(texels, false, true, out + 8);
+			break;
+		case vkbc::BlockFormat::BC7:
+			encode_bc7_block(texels, out);
+			break;
+		}
+	}
+
+	void decode_block(vkbc::BlockFormat format, const unsigned char* in, Block& outTexels)
+	{
+		switch (format)
+		{
+		case vkbc::BlockFormat::BC1:
+			decode_color_block(in, false, outTexels);
+			break;
+		case vkbc::BlockFormat::BC3:
+			decode_color_block(in + 8, true, outTexels);
+			decode_alpha_block(in, outTexels);
+			break;
+		case vkbc::BlockFormat::BC7:
+			decode_bc7_block(in, outTexels);
+			break;
+		}
+	}
+
+}
+
+const char* vkbc::format_name(BlockFormat format)
+{
+	switch (format)
+	{
+	case BlockFormat::BC1: return "BC1";
+	case BlockFormat::BC3: return "BC3";
+	case BlockFormat::BC7: return "BC7";
+	}
+	return "unknown";
+}
+
+uint32_t vkbc::block_size(BlockFormat format)
+{
+	return format == BlockFormat::BC1 ? 8 : 16;
+}
+
+VkFormat vkbc::vk_format(BlockFormat format)
+{
+	switch (format)
+	{
+	case BlockFormat::BC1: return VK_FORMAT_BC1_RGBA_SRGB_BLOCK;
+	case BlockFormat::BC3: return VK_FORMAT_BC3_SRGB_BLOCK;
+	case BlockFormat::BC7: return VK_FORMAT_BC7_SRGB_BLOCK;
+	}
+	return VK_FORMAT_UNDEFINED;
+}
+
+bool vkbc::from_vk_format(VkFormat format, BlockFormat& outFormat)
+{
+	switch (format)
+	{
+	case VK_FORMAT_BC1_RGBA_SRGB_BLOCK:
+	case VK_FORMAT_BC1_RGBA_UNORM_BLOCK:
+		outFormat = BlockFormat::BC1;
+		return true;
+	case VK_FORMAT_BC3_SRGB_BLOCK:
+	case VK_FORMAT_BC3_UNORM_BLOCK:
+		outFormat = BlockFormat::BC3;
+		return true;
+	case VK_FORMAT_BC7_SRGB_BLOCK:
+	case VK_FORMAT_BC7_UNORM_BLOCK:
+		outFormat = BlockFormat::BC7;
+		return true;
+	default:
+		return false;
+	}
+}
+
+size_t vkbc::level_size(BlockFormat format, uint32_t width, uint32_t height)
+{
+	return static_cast<size_t>(blocks_across(width)) * blocks_across(height) * block_size(format);
+}
+
+void vkbc::encode(BlockFormat format, const unsigned char* rgba, uint32_t width, uint32_t height, unsigned char* outBlocks)
+{
+	const uint32_t blocksX = blocks_across(width);
+	const uint32_t blockBytes = block_size(format);
+
+	parallel_rows(blocks_across(height), [&](uint32_t firstRow, uint32_t endRow) {
+		Block texels;
+		for (uint32_t blockY = firstRow; blockY < endRow; blockY++)
+		{
+			for (uint32_t blockX = 0; blockX < blocksX; blockX++)
+			{
+				load_block(rgba, width, height, blockX, blockY, texels);
+				encode_block(format, texels, outBlocks + (static_cast<size_t>(blockY) * blocksX + blockX) * blockBytes);
+			}
+		}
+	});
+}
+
+void vkbc::decode(BlockFormat format, const unsigned char* blocks, uint32_t width, uint32_t height, unsigned char* outRgba)
+{
+	const uint32_t blocksX = blocks_across(width);
+	const uint32_t blockBytes = block_size(format);
+
+	parallel_rows(blocks_across(height), [&](uint32_t firstRow, uint32_t endRow) {
+		Block texels;
+		for (uint32_t blockY = firstRow; blockY < endRow; blockY++)
+		{
+			for (uint32_t blockX = 0; blockX < blocksX; blockX++)
+			{
+				decode_block(format, blocks + (static_cast<size_t>(blockY) * blocksX + blockX) * blockBytes, texels);
+				store_block(texels, width, height, blockX, blockY, outRgba);
+			}
+		}
+	});
+}
+
+double vkbc::psnr(const unsigned char* reference, const unsigned char* test, size_t texelCount, Channels channels)
+{
+	const int firstChannel = channels == Channels::Color ? 0 : 3;
+	const int endChannel = channels == Channels::Color ? 3 : 4;
+
+	uint64_t squaredError = 0;
+	uint64_t sampleCount = 0;
+	for (size_t i = 0; i < texelCount; i++)
+	{
+		if (channels == Channels::Color && reference[i * 4 + 3] < BC1_ALPHA_THRESHOLD)
+		{
+			continue;
+		}
+
+		for (int c = firstChannel; c < endChannel; c++)
+		{
+			const int d = reference[i * 4 + c] - test[i * 4 + c];
+			squaredError += static_cast<uint64_t>(d * d);
+		}
+		sampleCount += endChannel - firstChannel;
+	}
+
+	if (squaredError == 0)
+	{
+		return std::numeric_limits<double>::infinity();
+	}
+
+	const double meanSquaredError = static_cast<double>(squaredError) / sampleCount;
+	return 10.0 * std::log10(255.0 * 255.0 / meanSquaredError);
+}
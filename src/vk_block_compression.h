@@ -0,0 +1,46 @@
+#pragma once
+
+#include <vk_types.h>
+
+#include <cstddef>
+#include <cstdint>
+
+// Encoders and decoders for the BC block compressed formats, for building KTX2 files offline and for decoding them
+// on the CPU when a GPU can't sample them. Every format stores 4x4 texel blocks, one row of blocks after another
+namespace vkbc {
+
+	enum class BlockFormat : uint32_t {
+		BC1,	// 8 bytes per block, RGB with 1 bit alpha for alpha tested textures
+		BC3,	// 16 bytes per block, BC1 color with interpolated alpha
+		BC7,	// 16 bytes per block, RGBA. The encoder only writes mode 6
+	};
+
+	const char* format_name(BlockFormat format);
+
+	// Bytes per 4x4 block
+	uint32_t block_size(BlockFormat format);
+
+	// The sRGB Vulkan format of each block format
+	VkFormat vk_format(BlockFormat format);
+
+	// False for Vulkan formats that aren't one of the block formats here
+	bool from_vk_format(VkFormat format, BlockFormat& outFormat);
+
+	// Bytes of a width x height level, partial blocks at the edges count whole
+	size_t level_size(BlockFormat format, uint32_t width, uint32_t height);
+
+	// Compress an RGBA8 level into level_size() bytes of blocks, on all cores. Edge blocks repeat the last texels
+	void encode(BlockFormat format, const unsigned char* rgba, uint32_t width, uint32_t height, unsigned char* outBlocks);
+
+	// Decompress blocks back into a width x height RGBA8 level. BC7 blocks in modes other than 6 decode as magenta
+	void decode(BlockFormat format, const unsigned char* blocks, uint32_t width, uint32_t height, unsigned char* outRgba);
+
+	enum class Channels : uint32_t {
+		Color,	// RGB of the texels the reference shows, alpha testing hides the others
+		Alpha,
+	};
+
+	// Peak signal to noise ratio in dB between two RGBA8 images. Infinite for identical images
+	double psnr(const unsigned char* reference, const unsigned char* test, size_t texelCount, Channels channels);
+
+}
@@ -0,0 +1,389 @@
+#include "vk_bounds.h"
+
+#include <algorithm>
+#include <cfloat>
+#include <cmath>
+
+#include <glm/common.hpp>
+#include <glm/geometric.hpp>
+
+// SSE2 is part of every x86-64 target, so it needs no extra compile flags
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#define VKBOUNDS_SSE 1
+#include <emmintrin.h>
+#endif
+
+// AVX isn't, it is compiled for the one function that uses it and only called when the CPU reports it
+#if defined(VKBOUNDS_SSE) && (defined(__GNUC__) || defined(__clang__))
+#define VKBOUNDS_AVX 1
+#define VKBOUNDS_AVX_TARGET __attribute__((target("avx")))
+#include <immintrin.h>
+#elif defined(VKBOUNDS_SSE) && defined(_MSC_VER)
+#define VKBOUNDS_AVX 1
+#define VKBOUNDS_AVX_TARGET
+#include <immintrin.h>
+#include <intrin.h>
+#endif
+
+namespace {
+
+	inline const glm::vec3* position_at(const glm::vec3* positions, size_t index, size_t stride)
+	{
+		return reinterpret_cast<const glm::vec3*>(reinterpret_cast<const char*>(positions) + index * stride);
+	}
+
+#ifdef VKBOUNDS_SSE
+	// Load exactly 12 bytes, w is 0. A 16 byte load would read past the end of a tightly packed vec3 array
+	inline __m128 load_vec3(const glm::vec3* p)
+	{
+		const float* f = &p->x;
+		return _mm_movelh_ps(_mm_castpd_ps(_mm_load_sd(reinterpret_cast<const double*>(f))), _mm_load_ss(f + 2));
+	}
+
+	inline void store_vec3(glm::vec3& out, __m128 value)
+	{
+		float* f = &out.x;
+		_mm_storel_pi(reinterpret_cast<__m64*>(f), value);
+		_mm_store_ss(f + 2, _mm_movehl_ps(value, value));
+	}
+
+	inline __m128 load_column(const glm::mat4& m, int column)
+	{
+		return _mm_loadu_ps(&m[column][0]);
+	}
+
+	size_t cull_spheres_sse(const SphereBoundsTable& table, const glm::vec4 planes[6], uint32_t* outVisible)
+	{
+		size_t visible = 0;
+
+		for (size_t i = 0; i < table.padded_count(); i += 4)
+		{
+			const __m128 x = _mm_loadu_ps(&table.centerX[i]);
+			const __m128 y = _mm_loadu_ps(&table.centerY[i]);
+			const __m128 z = _mm_loadu_ps(&table.centerZ[i]);
+			const __m128 negativeRadius = _mm_sub_ps(_mm_setzero_ps(), _mm_loadu_ps(&table.radius[i]));
+
+			__m128 inside = _mm_castsi128_ps(_mm_set1_epi32(-1));
+			for (int p = 0; p < 6; p++)
+			{
+				__m128 distance = _mm_add_ps(_mm_mul_ps(x, _mm_set1_ps(planes[p].x)), _mm_set1_ps(planes[p].w));
+				distance = _mm_add_ps(distance, _mm_mul_ps(y, _mm_set1_ps(planes[p].y)));
+				distance = _mm_add_ps(distance, _mm_mul_ps(z, _mm_set1_ps(planes[p].z)));
+				inside = _mm_and_ps(inside, _mm_cmpge_ps(distance, negativeRadius));
+			}
+
+			// Every lane is written, only the visible ones move the end of the list forward
+			const int mask = _mm_movemask_ps(inside);
+			for (int lane = 0; lane < 4; lane++)
+			{
+				outVisible[visible] = static_cast<uint32_t>(i + lane);
+				visible += (mask >> lane) & 1;
+			}
+		}
+
+		return visible;
+	}
+#endif
+
+#ifdef VKBOUNDS_AVX
+	bool cpu_has_avx()
+	{
+#if defined(__GNUC__) || defined(__clang__)
+		return __builtin_cpu_supports("avx");
+#else
+		// The CPU has the instructions and the OS saves the YMM registers
+		int info[4];
+		__cpuid(info, 1);
+		const bool osxsave = (info[2] & (1 << 27)) != 0;
+		const bool avx = (info[2] & (1 << 28)) != 0;
+		return osxsave && avx && (_xgetbv(0) & 6) == 6;
+#endif
+	}
+
+	VKBOUNDS_AVX_TARGET size_t cull_spheres_avx(const SphereBoundsTable& table, const glm::vec4 planes[6], uint32_t* outVisible)
+	{
+		size_t visible = 0;
+
+		for (size_t i = 0; i < table.padded_count(); i += 8)
+		{
+			const __m256 x = _mm256_loadu_ps(&table.centerX[i]);
+			const __m256 y = _mm256_loadu_ps(&table.centerY[i]);
+			const __m256 z = _mm256_loadu_ps(&table.centerZ[i]);
+			const __m256 negativeRadius = _mm256_sub_ps(_mm256_setzero_ps(), _mm256_loadu_ps(&table.radius[i]));
+
+			__m256 inside = _mm256_castsi256_ps(_mm256_set1_epi32(-1));
+			for (int p = 0; p < 6; p++)
+			{
+				__m256 distance = _mm256_add_ps(_mm256_mul_ps(x, _mm256_set1_ps(planes[p].x)), _mm256_set1_ps(planes[p].w));
+				distance = _mm256_add_ps(distance, _mm256_mul_ps(y, _mm256_set1_ps(planes[p].y)));
+				distance = _mm256_add_ps(distance, _mm256_mul_ps(z, _mm256_set1_ps(planes[p].z)));
+				inside = _mm256_and_ps(inside, _mm256_cmp_ps(distance, negativeRadius, _CMP_GE_OQ));
+			}
+
+			const int mask = _mm256_movemask_ps(inside);
+			for (int lane = 0; lane < 8; lane++)
+			{
+				outVisible[visible] = static_cast<uint32_t>(i + lane);
+				visible += (mask >> lane) & 1;
+			}
+		}
+
+		return visible;
+	}
+#endif
+}
+
+void SphereBoundsTable::resize(size_t sphereCount)
+{
+	count = sphereCount;
+
+	// Padding spheres have a radius no plane distance can beat
+	const size_t padded = (sphereCount + 7) / 8 * 8;
+	centerX.assign(padded, 0.0f);
+	centerY.assign(padded, 0.0f);
+	centerZ.assign(padded, 0.0f);
+	radius.assign(padded, -FLT_MAX);
+}
+
+void SphereBoundsTable::set(size_t index, const glm::vec4& sphere)
+{
+	centerX[index] = sphere.x;
+	centerY[index] = sphere.y;
+	centerZ[index] = sphere.z;
+	radius[index] = sphere.w;
+}
+
+AABB vkbounds::compute_aabb(const glm::vec3* positions, size_t count, size_t stride)
+{
+	AABB box;
+	if (count == 0)
+	{
+		return box;
+	}
+
+#ifdef VKBOUNDS_SSE
+	// Two independent min/max chains so consecutive vertices don't wait on each other
+	__m128 min0 = load_vec3(positions);
+	__m128 max0 = min0;
+	__m128 min1 = min0;
+	__m128 max1 = min0;
+
+	size_t i = 1;
+	for (; i + 2 <= count; i += 2)
+	{
+		const __m128 p0 = load_vec3(position_at(positions, i, stride));
+		const __m128 p1 = load_vec3(position_at(positions, i + 1, stride));
+		min0 = _mm_min_ps(min0, p0);
+		max0 = _mm_max_ps(max0, p0);
+		min1 = _mm_min_ps(min1, p1);
+		max1 = _mm_max_ps(max1, p1);
+	}
+	if (i < count)
+	{
+		const __m128 p = load_vec3(position_at(positions, i, stride));
+		min0 = _mm_min_ps(min0, p);
+		max0 = _mm_max_ps(max0, p);
+	}
+
+	store_vec3(box.min, _mm_min_ps(min0, min1));
+	store_vec3(box.max, _mm_max_ps(max0, max1));
+#else
+	box.min = *positions;
+	box.max = *positions;
+	for (size_t i = 1; i < count; i++)
+	{
+		const glm::vec3& p = *position_at(positions, i, stride);
+		box.min = glm::min(box.min, p);
+		box.max = glm::max(box.max, p);
+	}
+#endif
+
+	return box;
+}
+
+glm::vec4 vkbounds::compute_sphere(const glm::vec3* positions, size_t count, size_t stride, const AABB& box)
+{
+	const glm::vec3 center = (box.min + box.max) * 0.5f;
+
+	float maxDistanceSquared = 0.0f;
+
+#ifdef VKBOUNDS_SSE
+	// Four positions at a time, transposed so each lane holds one position's squared distance
+	const __m128 centerX = _mm_set1_ps(center.x);
+	const __m128 centerY = _mm_set1_ps(center.y);
+	const __m128 centerZ = _mm_set1_ps(center.z);
+	__m128 maxDistances = _mm_setzero_ps();
+
+	size_t i = 0;
+	for (; i + 4 <= count; i += 4)
+	{
+		__m128 p0 = load_vec3(position_at(positions, i, stride));
+		__m128 p1 = load_vec3(position_at(positions, i + 1, stride));
+		__m128 p2 = load_vec3(position_at(positions, i + 2, stride));
+		__m128 p3 = load_vec3(position_at(positions, i + 3, stride));
+		_MM_TRANSPOSE4_PS(p0, p1, p2, p3);
+
+		const __m128 dx = _mm_sub_ps(p0, centerX);
+		const __m128 dy = _mm_sub_ps(p1, centerY);
+		const __m128 dz = _mm_sub_ps(p2, centerZ);
+		const __m128 distances = _mm_add_ps(_mm_add_ps(_mm_mul_ps(dx, dx), _mm_mul_ps(dy, dy)), _mm_mul_ps(dz, dz));
+		maxDistances = _mm_max_ps(maxDistances, distances);
+	}
+
+	alignas(16) float lanes[4];
+	_mm_store_ps(lanes, maxDistances);
+	maxDistanceSquared = std::max(std::max(lanes[0], lanes[1]), std::max(lanes[2], lanes[3]));
+#else
+	size_t i = 0;
+#endif
+
+	for (; i < count; i++)
+	{
+		const glm::vec3 d = *position_at(positions, i, stride) - center;
+		maxDistanceSquared = std::max(maxDistanceSquared, d.x * d.x + d.y * d.y + d.z * d.z);
+	}
+
+	return glm::vec4(center, std::sqrt(maxDistanceSquared));
+}
+
+AABB vkbounds::transform_aabb(const AABB& box, const glm::mat4& transform)
+{
+	AABB out;
+
+#ifdef VKBOUNDS_SSE
+	const __m128 half = _mm_set1_ps(0.5f);
+	const __m128 absMask = _mm_castsi128_ps(_mm_set1_epi32(0x7fffffff));
+
+	const __m128 boxMin = load_vec3(&box.min);
+	const __m128 boxMax = load_vec3(&box.max);
+	const __m128 center = _mm_mul_ps(_mm_add_ps(boxMin, boxMax), half);
+	const __m128 extent = _mm_mul_ps(_mm_sub_ps(boxMax, boxMin), half);
+
+	const __m128 c0 = load_column(transform, 0);
+	const __m128 c1 = load_column(transform, 1);
+	const __m128 c2 = load_column(transform, 2);
+	const __m128 c3 = load_column(transform, 3);
+
+	// worldCenter = M * (center, 1)
+	__m128 worldCenter = _mm_add_ps(c3, _mm_mul_ps(c0, _mm_shuffle_ps(center, center, _MM_SHUFFLE(0, 0, 0, 0))));
+	worldCenter = _mm_add_ps(worldCenter, _mm_mul_ps(c1, _mm_shuffle_ps(center, center, _MM_SHUFFLE(1, 1, 1, 1))));
+	worldCenter = _mm_add_ps(worldCenter, _mm_mul_ps(c2, _mm_shuffle_ps(center, center, _MM_SHUFFLE(2, 2, 2, 2))));
+
+	// worldExtent = |M| * extent
+	__m128 worldExtent = _mm_mul_ps(_mm_and_ps(c0, absMask), _mm_shuffle_ps(extent, extent, _MM_SHUFFLE(0, 0, 0, 0)));
+	worldExtent = _mm_add_ps(worldExtent, _mm_mul_ps(_mm_and_ps(c1, absMask), _mm_shuffle_ps(extent, extent, _MM_SHUFFLE(1, 1, 1, 1))));
+	worldExtent = _mm_add_ps(worldExtent, _mm_mul_ps(_mm_and_ps(c2, absMask), _mm_shuffle_ps(extent, extent, _MM_SHUFFLE(2, 2, 2, 2))));
+
+	store_vec3(out.min, _mm_sub_ps(worldCenter, worldExtent));
+	store_vec3(out.max, _mm_add_ps(worldCenter, worldExtent));
+#else
+	out = transform_aabb_scalar(box, transform);
+#endif
+
+	return out;
+}
+
+AABB vkbounds::transform_aabb_scalar(const AABB& box, const glm::mat4& transform)
+{
+	const glm::vec3 center = (box.min + box.max) * 0.5f;
+	const glm::vec3 extent = (box.max - box.min) * 0.5f;
+
+	const glm::vec3 worldCenter = glm::vec3(transform * glm::vec4(center, 1.0f));
+	const glm::vec3 worldExtent = glm::abs(glm::vec3(transform[0])) * extent.x
+		+ glm::abs(glm::vec3(transform[1])) * extent.y
+		+ glm::abs(glm::vec3(transform[2])) * extent.z;
+
+	AABB out;
+	out.min = worldCenter - worldExtent;
+	out.max = worldCenter + worldExtent;
+	return out;
+}
+
+void vkbounds::transform_aabbs(const AABB* boxes, size_t boxStride, const glm::mat4* transforms, size_t transformStride, size_t count, AABB* outBoxes)
+{
+	const char* box = reinterpret_cast<const char*>(boxes);
+	const char* transform = reinterpret_cast<const char*>(transforms);
+
+	for (size_t i = 0; i < count; i++)
+	{
+		outBoxes[i] = transform_aabb(*reinterpret_cast<const AABB*>(box), *reinterpret_cast<const glm::mat4*>(transform));
+		box += boxStride;
+		transform += transformStride;
+	}
+}
+
+glm::vec4 vkbounds::transform_sphere(const glm::vec4& sphere, const glm::mat4& transform)
+{
+	const glm::vec3 center = glm::vec3(transform * glm::vec4(glm::vec3(sphere), 1.0f));
+	const float scale = std::max(glm::length(glm::vec3(transform[0])),
+		std::max(glm::length(glm::vec3(transform[1])), glm::length(glm::vec3(transform[2]))));
+
+	return glm::vec4(center, sphere.w * scale);
+}
+
+void vkbounds::extract_frustum_planes(const glm::mat4& viewproj, glm::vec4 outPlanes[6])
+{
+	// Rows of the matrix, glm stores columns
+	const glm::vec4 row0 = glm::vec4(viewproj[0][0], viewproj[1][0], viewproj[2][0], viewproj[3][0]);
+	const glm::vec4 row1 = glm::vec4(viewproj[0][1], viewproj[1][1], viewproj[2][1], viewproj[3][1]);
+	const glm::vec4 row2 = glm::vec4(viewproj[0][2], viewproj[1][2], viewproj[2][2], viewproj[3][2]);
+	const glm::vec4 row3 = glm::vec4(viewproj[0][3], viewproj[1][3], viewproj[2][3], viewproj[3][3]);
+
+	// -w <= x, y <= w and, with glm's default clip space, -w <= z <= w
+	outPlanes[0] = row3 + row0;
+	outPlanes[1] = row3 - row0;
+	outPlanes[2] = row3 + row1;
+	outPlanes[3] = row3 - row1;
+	outPlanes[4] = row3 + row2;
+	outPlanes[5] = row3 - row2;
+
+	for (int i = 0; i < 6; i++)
+	{
+		outPlanes[i] /= glm::length(glm::vec3(outPlanes[i]));
+	}
+}
+
+bool vkbounds::sphere_in_frustum(const glm::vec4& sphere, const glm::vec4 planes[6])
+{
+	for (int i = 0; i < 6; i++)
+	{
+		if (glm::dot(glm::vec3(planes[i]), glm::vec3(sphere)) + planes[i].w < -sphere.w)
+		{
+			return false;
+		}
+	}
+	return true;
+}
+
+size_t vkbounds::cull_spheres(const SphereBoundsTable& table, const glm::vec4 planes[6], uint32_t* outVisible)
+{
+#ifdef VKBOUNDS_AVX
+	static const bool hasAvx = cpu_has_avx();
+	if (hasAvx)
+	{
+		return cull_spheres_avx(table, planes, outVisible);
+	}
+#endif
+
+#ifdef VKBOUNDS_SSE
+	return cull_spheres_sse(table, planes, outVisible);
+#else
+	return cull_spheres_scalar(table, planes, outVisible);
+#endif
+}
+
+size_t vkbounds::cull_spheres_scalar(const SphereBoundsTable& table, const glm::vec4 planes[6], uint32_t* outVisible)
+{
+	size_t visible = 0;
+
+	for (size_t i = 0; i < table.count; i++)
+	{
+		const glm::vec4 sphere = glm::vec4(table.centerX[i], table.centerY[i], table.centerZ[i], table.radius[i]);
+		if (sphere_in_frustum(sphere, planes))
+		{
+			outVisible[visible++] = static_cast<uint32_t>(i);
+		}
+	}
+
+	return visible;
+}
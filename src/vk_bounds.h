@@ -0,0 +1,74 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+#include <glm/vec3.hpp>
+#include <glm/vec4.hpp>
+#include <glm/mat4x4.hpp>
+
+// Axis aligned bounding box
+struct AABB
+{
+	glm::vec3 min{ 0.0f };
+	glm::vec3 max{ 0.0f };
+};
+
+// World space bounding spheres as a structure of arrays, so culling loads 4 or 8 of each component at once. The arrays
+// are padded to a multiple of 8 with spheres that are never visible, the SIMD loops need no scalar tail
+struct SphereBoundsTable
+{
+	std::vector<float> centerX;
+	std::vector<float> centerY;
+	std::vector<float> centerZ;
+	std::vector<float> radius;
+	size_t count{ 0 };
+
+	void resize(size_t sphereCount);
+
+	// xyz center and w radius
+	void set(size_t index, const glm::vec4& sphere);
+
+	// Length of the arrays, count rounded up to a multiple of 8
+	size_t padded_count() const { return radius.size(); }
+};
+
+namespace vkbounds {
+
+	// Bounds of count positions that are stride bytes apart, so positions can be read straight out of a vertex array.
+	// An empty range gives a zero box
+	AABB compute_aabb(const glm::vec3* positions, size_t count, size_t stride);
+
+	// Sphere around the center of box that contains every position, xyz center and w radius
+	glm::vec4 compute_sphere(const glm::vec3* positions, size_t count, size_t stride, const AABB& box);
+
+	// Box around a local box under an affine transform. Transforms the center and sums the absolute
+	// axes for the extent, so the result is exact for the box rather than growing with every rotation
+	AABB transform_aabb(const AABB& box, const glm::mat4& transform);
+
+	// transform_aabb without SSE, the reference the SSE path is checked against
+	AABB transform_aabb_scalar(const AABB& box, const glm::mat4& transform);
+
+	// transform_aabb over count boxes and transforms, each read stride bytes after the one before.
+	// Lets the boxes and matrices be read in place from arrays of larger structs
+	void transform_aabbs(const AABB* boxes, size_t boxStride, const glm::mat4* transforms, size_t transformStride, size_t count, AABB* outBoxes);
+
+	// Sphere around a local sphere under an affine transform, the radius grows with the largest axis scale
+	glm::vec4 transform_sphere(const glm::vec4& sphere, const glm::mat4& transform);
+
+	// The six planes bounding what a view projection matrix sees, xyz pointing inwards and normalized. A sphere is
+	// outside when dot(xyz, center) + w < -radius for any of them
+	void extract_frustum_planes(const glm::mat4& viewproj, glm::vec4 outPlanes[6]);
+
+	// True when a sphere, xyz center and w radius, touches the inside of every plane
+	bool sphere_in_frustum(const glm::vec4& sphere, const glm::vec4 planes[6]);
+
+	// Write the indices of the spheres in the table that touch the inside of every plane to outVisible, in order, and
+	// return how many there are. outVisible needs room for padded_count() indices. Tests 8 spheres at a time on CPUs
+	// with AVX, 4 with SSE
+	size_t cull_spheres(const SphereBoundsTable& table, const glm::vec4 planes[6], uint32_t* outVisible);
+
+	// cull_spheres one sphere at a time, the reference the SIMD paths are measured against
+	size_t cull_spheres_scalar(const SphereBoundsTable& table, const glm::vec4 planes[6], uint32_t* outVisible);
+
+}
@@ -0,0 +1,102 @@
+#include "vk_draw_sort.h"
+
+#include <cstring>
+#include <utility>
+
+namespace {
+
+	uint64_t field(uint32_t value, int bits)
+	{
+		return static_cast<uint64_t>(value) & ((uint64_t(1) << bits) - 1);
+	}
+}
+
+uint64_t vkdraw::make_key(uint32_t pass, uint32_t pipeline, uint32_t textureSet, uint32_t geometryBlock, uint32_t mesh,
+	uint32_t material, uint32_t submesh, uint32_t lod, float depth)
+{
+	// Positive floats order the same as their bits. Below the sign bit, the top bits are the exponent
+	uint32_t depthBits = 0;
+	if (depth > 0.0f)
+	{
+		memcpy(&depthBits, &depth, sizeof(depthBits));
+	}
+
+	uint64_t key = field(pass, PASS_BITS);
+	key = (key << PIPELINE_BITS) | field(pipeline, PIPELINE_BITS);
+	key = (key << TEXTURE_SET_BITS) | field(textureSet, TEXTURE_SET_BITS);
+	key = (key << GEOMETRY_BLOCK_BITS) | field(geometryBlock, GEOMETRY_BLOCK_BITS);
+	key = (key << MESH_BITS) | field(mesh, MESH_BITS);
+	key = (key << MATERIAL_BITS) | field(material, MATERIAL_BITS);
+	key = (key << SUBMESH_BITS) | field(submesh, SUBMESH_BITS);
+	key = (key << LOD_BITS) | field(lod, LOD_BITS);
+	key = (key << DEPTH_BITS) | (depthBits >> (31 - DEPTH_BITS));
+	return key;
+}
+
+void vkdraw::radix_sort(std::vector<DrawKey>& keys, std::vector<DrawKey>& scratch)
+{
+	const size_t count = keys.size();
+	scratch.resize(count);
+	if (count < 2)
+	{
+		return;
+	}
+
+	// Histograms of all eight digits in one read of the keys
+	uint32_t histograms[8][256] = {};
+	for (const DrawKey& draw : keys)
+	{
+		for (int digit = 0; digit < 8; digit++)
+		{
+			histograms[digit][(draw.key >> (digit * 8)) & 0xFF]++;
+		}
+	}
+
+	DrawKey* source = keys.data();
+	DrawKey* destination = scratch.data();
+
+	for (int digit = 0; digit < 8; digit++)
+	{
+		uint32_t* histogram = histograms[digit];
+
+		// Every key has the same digit, this pass wouldn't move anything
+		if (histogram[(source[0].key >> (digit * 8)) & 0xFF] == count)
+		{
+			continue;
+		}
+
+		uint32_t offset = 0;
+		for (int bucket = 0; bucket < 256; bucket++)
+		{
+			const uint32_t bucketCount = histogram[bucket];
+			histogram[bucket] = offset;
+			offset += bucketCount;
+		}
+
+		for (size_t i = 0; i < count; i++)
+		{
+			destination[histogram[(source[i].key >> (digit * 8)) & 0xFF]++] = source[i];
+		}
+
+		std::swap(source, destination);
+	}
+
+	// An odd number of passes left the result in scratch
+	if (source != keys.data())
+	{
+		keys.swap(scratch);
+	}
+}
+
+uint32_t DrawStateIds::get_id(uint64_t key)
+{
+	auto it = _ids.find(key);
+	if (it != _ids.end())
+	{
+		return it->second;
+	}
+
+	const uint32_t id = static_cast<uint32_t>(_ids.size());
+	_ids.emplace(key, id);
+	return id;
+}
@@ -0,0 +1,69 @@
+#pragma once
+
+#include <cstdint>
+#include <type_traits>
+#include <unordered_map>
+#include <vector>
+
+// One draw of the frame: a submesh of a visible object, recorded in the order of key. Consecutive draws whose keys
+// only differ in depth are drawn as instances of one draw
+struct DrawKey {
+	uint64_t key;
+	uint32_t object;	// Place of the object in the frame's visible list
+	uint16_t submesh;
+	uint16_t lod;
+};
+
+namespace vkdraw {
+
+	// Widths of the key's fields, from the most significant. Sorting by the key groups draws by what they bind, the
+	// costliest change first, then by what they draw so instances end up next to each other, and orders draws that
+	// draw the same thing front to back
+	constexpr int PASS_BITS = 1;
+	constexpr int PIPELINE_BITS = 8;
+	constexpr int TEXTURE_SET_BITS = 10;
+	constexpr int GEOMETRY_BLOCK_BITS = 4;
+	constexpr int MESH_BITS = 14;
+	constexpr int MATERIAL_BITS = 10;
+	constexpr int SUBMESH_BITS = 6;
+	constexpr int LOD_BITS = 3;
+	constexpr int DEPTH_BITS = 8;
+
+	// What a key is besides its depth. Draws sharing it can be instanced, as long as their ids didn't wrap
+	constexpr uint64_t instance_group(uint64_t key) { return key >> DEPTH_BITS; }
+
+	// Pass 0 draws opaque geometry, pass 1 alpha tested. Ids wider than their field wrap, which only costs extra binds.
+	// depth is the distance from the camera, anything below 0 counts as 0
+	uint64_t make_key(uint32_t pass, uint32_t pipeline, uint32_t textureSet, uint32_t geometryBlock, uint32_t mesh,
+		uint32_t material, uint32_t submesh, uint32_t lod, float depth);
+
+	// Stable LSD radix sort by key, one 8 bit digit per pass. Digits every key shares are skipped, so keys that only
+	// differ in a few fields take a few passes. scratch is resized to match keys
+	void radix_sort(std::vector<DrawKey>& keys, std::vector<DrawKey>& scratch);
+}
+
+// Small ids for the handles draws bind, so they fit the fields of a key. A handle gets the next id the first time it
+// is seen and keeps it
+class DrawStateIds {
+public:
+	// Pipelines, descriptor sets, meshes and materials. Non-dispatchable Vulkan handles are pointers on 64 bit targets
+	// and uint64_t on 32 bit ones, either way they are keyed on 64 bits
+	template<typename Handle>
+	uint32_t get(Handle handle)
+	{
+		if constexpr (std::is_pointer<Handle>::value)
+		{
+			return get_id(static_cast<uint64_t>(reinterpret_cast<uintptr_t>(handle)));
+		}
+		else
+		{
+			static_assert(std::is_same<Handle, uint64_t>::value, "draw state ids are for pointers and Vulkan handles");
+			return get_id(handle);
+		}
+	}
+
+private:
+	uint32_t get_id(uint64_t key);
+
+	std::unordered_map<uint64_t, uint32_t> _ids;
+};
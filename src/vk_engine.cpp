@@ -1,6 +1,9 @@
 ﻿
 #include "vk_engine.h"
+#include "vk_mesh_cache.h"
+#include "vk_obj_loader.h"
 #include "vk_pipeline.h"
+#include "vk_tasks.h"
 #include "vk_textures.h"
 
 #include <SDL.h>
@@ -14,26 +17,21 @@
 // Bootstrap library
 #include "VkBootstrap.h"
 
+#include <algorithm>
+#include <cassert>
+#include <cfloat>
+#include <chrono>
 #include <fstream>
 #include <iostream>
+#include <numeric>
 
 #define VMA_IMPLEMENTATION
 #include "vk_mem_alloc.h"
 
-// A macro function that will immediately abort when an error occurs
-#define VK_CHECK(x)														\
-	do																	\
-	{																	\
-		VkResult err = x;												\
-		if (err)														\
-		{																\
-			std::cout <<"Detected Vulkan error: " << err << std::endl;	\
-			abort();													\
-		}																\
-	} while (0)
-
 void VulkanEngine::init()
 {
+	auto initStart = std::chrono::high_resolution_clock::now();
+
 	// We initialize SDL and create a window with it. 
 	SDL_Init(SDL_INIT_VIDEO);
 
@@ -68,14 +66,75 @@ void VulkanEngine::init()
 	
 	init_descriptors();
 
-	// Initialize the object rendering pipelines
-	init_pipelines();
+	// Meshes only pick the compact vertex layout if this GPU can read it
+	MeshLoadOptions loadOptions;
+	loadOptions.allowCompact = supports_compact_vertices();
+
+	// Mip chains are filtered right after decoding when the upload queue can't blit them
+	const bool blitMipmaps = _uploads.can_blit() && vkutil::supports_linear_blit(_chosenGPU, VK_FORMAT_R8G8B8A8_SRGB);
+
+	std::vector<ImageAsset> images(1);
+	images[0].name = "empire_diffuse";
+	images[0].filename = "../../assets/lost_empire-RGBA.png";
+
+	std::vector<MeshAsset> meshes(2);
+	meshes[0].name = "monkey";
+	meshes[0].filename = "../../assets/monkey_smooth.obj";
+	meshes[1].name = "empire";
+	meshes[1].filename = "../../assets/lost_empire.obj";
+
+	// Pipeline compilation, image decoding and OBJ parsing only touch their own data and run side by side.
+	// Uploads are recorded by one task at a time, the upload service isn't thread safe
+	TaskGraph startup;
+
+	const TaskGraph::TaskId pipelinesTask = startup.add("init_pipelines", [this]() { init_pipelines(); });
+
+	std::vector<TaskGraph::TaskId> decodeTasks;
+	for (ImageAsset& image : images)
+	{
+		decodeTasks.push_back(startup.add("decode " + image.name, [this, &image, blitMipmaps]() {
+			// A block compressed copy written by vkbench --encode-textures replaces the original, as long as it was
+			// encoded from the original as it is now
+			const std::string compressed = vkutil::ktx2_path(image.filename);
+			const std::string& file = vkutil::ktx2_is_current(compressed, image.filename) ? compressed : image.filename;
+
+			image.decoded = vkutil::decode_image_from_file(file.c_str(), image.image);
+			if (image.decoded && !vkutil::supports_sampled_format(_chosenGPU, image.image.format))
+			{
+				image.decoded = vkutil::transcode_to_rgba8(image.image);
+			}
+			if (image.decoded && !blitMipmaps)
+			{
+				vkutil::generate_mipmaps(image.image);
+			}
+		}));
+	}
+
+	std::vector<TaskGraph::TaskId> parseTasks;
+	for (MeshAsset& mesh : meshes)
+	{
+		parseTasks.push_back(startup.add("parse " + mesh.name, [this, &mesh, &loadOptions]() {
+			parse_mesh_asset(mesh, loadOptions);
+		}));
+	}
+
+	// Each load waits for every asset of its kind. load_meshes also waits for load_images, only one task records uploads
+	const TaskGraph::TaskId imagesTask = startup.add("load_images", [this, &images]() { load_images(images); }, decodeTasks);
+
+	std::vector<TaskGraph::TaskId> meshDependencies = parseTasks;
+	meshDependencies.push_back(imagesTask);
+	const TaskGraph::TaskId meshesTask = startup.add("load_meshes", [this, &meshes]() { load_meshes(meshes); }, meshDependencies);
 
-	load_images();
+	startup.add("init_scene", [this]() { init_scene(); }, { pipelinesTask, meshesTask });
 
-	load_meshes();
+	startup.run();
+	startup.print_timeline("Startup timeline");
 
-	init_scene();
+	auto initEnd = std::chrono::high_resolution_clock::now();
+
+	// Tokens count the upload submits, every one of them used to be a blocking round trip
+	std::cout << "init() took " << std::chrono::duration<double, std::milli>(initEnd - initStart).count() << " ms with "
+		<< _uploads.last_token() << " upload submits" << std::endl;
 
 	//everything went fine
 	_isInitialized = true;
@@ -87,6 +146,9 @@ void VulkanEngine::cleanup()
 	{
 		// Make sure the gpu has stopped doing its things
 		vkWaitForFences(_device, 1, &get_current_frame()._renderFence, true, 1000000000);
+
+		// Uploads can still be running on the transfer queue
+		vkDeviceWaitIdle(_device);
 		
 		_mainDeletionQueue.flush();
 
@@ -103,10 +165,27 @@ void VulkanEngine::cleanup()
 
 void VulkanEngine::draw()
 {
+	// Free the staging memory of finished uploads
+	_uploads.collect();
+
 	// Wait until the GPU has finished rendering the last frame. Timeout of 1 second
 	// Fences must be reset in between each use
 	VK_CHECK(vkWaitForFences(_device, 1, &get_current_frame()._renderFence, true, 1000000000));
 	VK_CHECK(vkResetFences(_device, 1, &get_current_frame()._renderFence));
+
+	// Geometry freed FRAME_OVERLAP frames ago isn't drawn by any frame in flight anymore
+	_geometry.begin_frame(_frameNumber);
+
+	// Nor is the per-frame data this frame wrote last time
+	get_current_frame().arena.reset();
+
+	// Meshes were freed since the cull pass was built, it would still draw them
+	if (_cullingDirty)
+	{
+		rebuild_culling();
+	}
+
+	auto recordStart = std::chrono::high_resolution_clock::now();
 	
 	// Reset the command buffer to empty it and queue new commands
 	VK_CHECK(vkResetCommandBuffer(get_current_frame()._mainCommandBuffer, 0));
@@ -123,6 +202,49 @@ void VulkanEngine::draw()
 
 	VK_CHECK(vkBeginCommandBuffer(cmd, &cmdBeginInfo));
 
+	// The cull pass draws the scene it was built from, nothing it records walks the objects
+	const bool gpuCulling = _useGpuCulling && _culling.available() && _culling.record_count() > 0;
+
+	// The frame only waits for the uploads of what it draws
+	UploadToken requiredUploads = 0;
+	if (gpuCulling)
+	{
+		requiredUploads = _culling.upload_token();
+	}
+	else
+	{
+		requiredUploads = _sceneUploadToken;
+	}
+
+	// Take ownership of the uploaded buffers and images before the render pass uses them
+	_uploads.record_acquires(cmd, requiredUploads);
+
+	// Culling runs in a compute pass ahead of the render pass
+	uint32_t globalOffsets[2];
+	bool globalWritten = false;
+	if (gpuCulling)
+	{
+		const FrameCamera camera = frame_camera();
+
+		auto dataStart = std::chrono::high_resolution_clock::now();
+		globalWritten = write_global_data(camera, globalOffsets);
+		get_current_frame().arena.flush();
+		if (!globalWritten)
+		{
+			std::cout << "Camera and scene data don't fit the frame arena, the frame draws nothing" << std::endl;
+		}
+
+		GPUCullData cullData = {};
+		vkbounds::extract_frustum_planes(camera.projection * camera.view, cullData.frustum);
+		cullData.cameraPosition = glm::vec4(camera.position, camera.pixelsPerUnitAtOne);
+		cullData.maxPixelError = LOD_MAX_PIXEL_ERROR;
+
+		auto dataEnd = std::chrono::high_resolution_clock::now();
+		_frameDataMs += std::chrono::duration<double, std::milli>(dataEnd - dataStart).count();
+
+		_culling.record_cull(cmd, cullData);
+	}
+
 	// Make a clear color frame number. This will flash with a 120*pi frame period
 	VkClearValue clearValue;
 	float flash = abs(sin(_frameNumber / 120.0f));
@@ -148,7 +270,14 @@ void VulkanEngine::draw()
 	vkCmdBeginRenderPass(cmd, &rpInfo, VK_SUBPASS_CONTENTS_INLINE);
 
 	// Once rendering commands are added, they will go here
-	draw_objects(cmd, _renderables.data(), _renderables.size());
+	if (gpuCulling && globalWritten)
+	{
+		draw_objects_indirect(cmd, globalOffsets);
+	}
+	else if (!gpuCulling)
+	{
+		draw_objects(cmd, _renderables.data(), _renderables.size());
+	}
 
 	// Finalize the render pass
 	vkCmdEndRenderPass(cmd);
@@ -156,16 +285,64 @@ void VulkanEngine::draw()
 	// Finalize the command buffer (it can still be executed but no commands can be added)
 	VK_CHECK(vkEndCommandBuffer(cmd));
 
+	auto recordEnd = std::chrono::high_resolution_clock::now();
+	_frameRecordMs += std::chrono::duration<double, std::milli>(recordEnd - recordStart).count();
+
+	if ((_frameNumber + 1) % FRAME_STATS_INTERVAL == 0)
+	{
+		std::cout << "CPU per frame over " << FRAME_STATS_INTERVAL << " frames: recording " << _frameRecordMs / FRAME_STATS_INTERVAL
+			<< " ms, of that per-frame data " << _frameDataMs / FRAME_STATS_INTERVAL * 1000.0 << " us, "
+			<< get_current_frame().arena.used() / 1024 << " KB of the frame arena" << std::endl;
+
+		// Only draw_objects culls on the CPU
+		if (_frameCulledObjects > 0 && _frameCullMs > 0.0)
+		{
+			std::cout << "CPU culling: " << _frameCullMs / FRAME_STATS_INTERVAL * 1000.0 << " us per frame, "
+				<< _frameCulledObjects / _frameCullMs << " objects/ms" << std::endl;
+		}
+
+		// Binds per frame every draw would have taken, against the ones the sorted order took
+		if (_drawCounters.draws > 0)
+		{
+			const DrawCounters& counters = _drawCounters;
+			std::cout << "Draws: " << counters.draws / FRAME_STATS_INTERVAL << " per frame for " << counters.instances / FRAME_STATS_INTERVAL
+				<< " instances, sorted in "
+				<< _frameSortMs / FRAME_STATS_INTERVAL * 1000.0 << " us. Binds avoided: pipelines "
+				<< (counters.draws - counters.pipelineBinds) / FRAME_STATS_INTERVAL << " of " << counters.draws / FRAME_STATS_INTERVAL
+				<< ", descriptor sets " << (counters.descriptorSetsUsed - counters.descriptorSetBinds) / FRAME_STATS_INTERVAL
+				<< " of " << counters.descriptorSetsUsed / FRAME_STATS_INTERVAL << ", vertex and index buffers "
+				<< (counters.buffersUsed - counters.bufferBinds) / FRAME_STATS_INTERVAL << " of " << counters.buffersUsed / FRAME_STATS_INTERVAL << std::endl;
+		}
+
+		_frameRecordMs = 0.0;
+		_frameDataMs = 0.0;
+		_frameCullMs = 0.0;
+		_frameCulledObjects = 0;
+		_frameSortMs = 0.0;
+		_drawCounters = {};
+	}
+
 	// Prepare the submition to the queue
 	VkSubmitInfo submit = vkinit::submit_info(&cmd);
 
-	VkPipelineStageFlags waitStage = VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT;
+	VkPipelineStageFlags waitStages[] = { VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT, _uploads.acquire_stages() };
+	VkSemaphore waitSemaphores[] = { get_current_frame()._presentSemaphore, _uploads.timeline() };
 
-	submit.pWaitDstStageMask = &waitStage;
+	// The value for the binary _presentSemaphore is ignored
+	uint64_t waitValues[] = { 0, requiredUploads };
 
-	// Wait on the _presentSemaphore, as it signals when the swapchain is ready
-	submit.waitSemaphoreCount = 1;
-	submit.pWaitSemaphores = &get_current_frame()._presentSemaphore;
+	VkTimelineSemaphoreSubmitInfo timelineInfo = {};
+	timelineInfo.sType = VK_STRUCTURE_TYPE_TIMELINE_SEMAPHORE_SUBMIT_INFO;
+	timelineInfo.pNext = nullptr;
+	timelineInfo.waitSemaphoreValueCount = 2;
+	timelineInfo.pWaitSemaphoreValues = waitValues;
+
+	submit.pNext = &timelineInfo;
+	submit.pWaitDstStageMask = waitStages;
+
+	// Wait on the _presentSemaphore, as it signals when the swapchain is ready, and on the uploads the frame draws
+	submit.waitSemaphoreCount = 2;
+	submit.pWaitSemaphores = waitSemaphores;
 
 	// Signal the _renderSemaphore to signal that rendering is completed
 	submit.signalSemaphoreCount = 1;
@@ -225,6 +402,13 @@ void VulkanEngine::run()
 						_selectedShader = 0;
 					}
 				}
+
+				// Switch between culling on the GPU and drawing every object from the CPU
+				if (e.key.keysym.sym == SDLK_c)
+				{
+					_useGpuCulling = !_useGpuCulling;
+					std::cout << "Drawing " << (_useGpuCulling && _culling.available() ? "through the GPU cull pass" : "from the CPU") << std::endl;
+				}
 			}
 		}
 
@@ -240,7 +424,7 @@ void VulkanEngine::init_vulkan()
 	// Make the Vulkan instance with basic debug features
 	auto inst_ret = builder.set_app_name("Example Vulkan Application")
 		.request_validation_layers(true)
-		.require_api_version(1, 1, 0)
+		.require_api_version(1, 2, 0)
 		.use_default_debug_messenger()
 		.build();
 
@@ -255,15 +439,35 @@ void VulkanEngine::init_vulkan()
 	SDL_Vulkan_CreateSurface(_window, _instance, &_surface);
 
 	// Use VKBootstrap to select a GPU
-	// We want a GPU that can write to the SDL surface and supports Vulkan 1.1
+	// We want a GPU that can write to the SDL surface and supports Vulkan 1.2, for timeline semaphores
 	vkb::PhysicalDeviceSelector selector{ vkb_inst };
-	vkb::PhysicalDevice physicalDevice = selector.set_minimum_version(1, 1)
+	// Host image copy and host memory import let textures and cooked meshes skip the staging buffer, when the GPU has them
+	vkb::PhysicalDevice physicalDevice = selector.set_minimum_version(1, 2)
 		.set_surface(_surface)
+		.add_desired_extensions(HostImageCopy::extensions())
+		.add_desired_extensions(HostMemoryImport::extensions())
 		.select()
 		.value();
 
+	// Uploads signal a timeline semaphore that frames wait on. The cull pass needs indirect count draws, where the GPU has them
+	VkPhysicalDeviceVulkan12Features vulkan12Features = {};
+	vulkan12Features.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_VULKAN_1_2_FEATURES;
+	vulkan12Features.pNext = nullptr;
+	vulkan12Features.timelineSemaphore = VK_TRUE;
+	vulkan12Features.drawIndirectCount = _culling.query(physicalDevice.physical_device, physicalDevice.features) ? VK_TRUE : VK_FALSE;
+
 	// Create the final Vulkan device
 	vkb::DeviceBuilder deviceBuilder{ physicalDevice };
+	deviceBuilder.add_pNext(&vulkan12Features);
+
+	_hostMemoryImport.query(physicalDevice.physical_device);
+
+	VkBaseOutStructure* hostImageCopyFeatures = _hostImageCopy.query(physicalDevice.physical_device);
+	if (hostImageCopyFeatures)
+	{
+		deviceBuilder.add_pNext(hostImageCopyFeatures);
+	}
+
 	vkb::Device vkbDevice = deviceBuilder.build().value();
 
 	// Get the VkDevice handle used in the rest of a Vulkan application
@@ -274,6 +478,19 @@ void VulkanEngine::init_vulkan()
 	_graphicsQueue = vkbDevice.get_queue(vkb::QueueType::graphics).value();
 	_graphicsQueueFamily = vkbDevice.get_queue_index(vkb::QueueType::graphics).value();
 
+	// Uploads go to a transfer queue that isn't the graphics family when the GPU has one, so copies run next to rendering
+	auto transferQueue = vkbDevice.get_queue(vkb::QueueType::transfer);
+	if (transferQueue)
+	{
+		_transferQueue = transferQueue.value();
+		_transferQueueFamily = vkbDevice.get_queue_index(vkb::QueueType::transfer).value();
+	}
+	else
+	{
+		_transferQueue = _graphicsQueue;
+		_transferQueueFamily = _graphicsQueueFamily;
+	}
+
 	// Initialize the memory allocator
 	VmaAllocatorCreateInfo allocatorInfo = {};
 	allocatorInfo.physicalDevice = _chosenGPU;
@@ -285,6 +502,27 @@ void VulkanEngine::init_vulkan()
 		vmaDestroyAllocator(_allocator);
 	});
 
+	// Cleaned up before the allocator, it owns the staging ring
+	_uploads.init(_device, _allocator, _transferQueue, _transferQueueFamily, _graphicsQueueFamily, UPLOAD_STAGING_SIZE);
+
+	_mainDeletionQueue.push_function([&]() {
+		_uploads.cleanup();
+	});
+
+	_geometry.init(_device, _allocator, _uploads, _graphicsQueueFamily, _transferQueueFamily,
+		GEOMETRY_VERTEX_BLOCK_SIZE, GEOMETRY_INDEX_BLOCK_SIZE, FRAME_OVERLAP);
+
+	_mainDeletionQueue.push_function([&]() {
+		_geometry.cleanup();
+	});
+
+	_hostImageCopy.init(_device);
+	_hostMemoryImport.init(_device);
+
+	std::cout << "Uploads run on " << (_uploads.has_transfer_queue() ? "a dedicated transfer queue" : "the graphics queue") << std::endl;
+	std::cout << "Textures upload " << (_hostImageCopy.available() ? "through host image copy" : "through staging") << std::endl;
+	std::cout << "Cooked meshes upload " << (_hostMemoryImport.available() ? "straight from their file mappings" : "through staging") << std::endl;
+
 	_gpuProperties = vkbDevice.physical_device.properties;
 	std::cout << "The GPU has a minimum buffer alignment of " << _gpuProperties.limits.minUniformBufferOffsetAlignment << std::endl;
 
@@ -487,19 +725,6 @@ void VulkanEngine::init_commands()
 			vkDestroyCommandPool(_device, _frames[i]._commandPool, nullptr);
 		});
 	}
-
-	VkCommandPoolCreateInfo uploadCommandPoolInfo = vkinit::command_pool_create_info(_graphicsQueueFamily);
-
-	// Create a command pool for upload context
-	VK_CHECK(vkCreateCommandPool(_device, &uploadCommandPoolInfo, nullptr, &_uploadContext._commandPool));
-
-	_mainDeletionQueue.push_function([=]() {
-		vkDestroyCommandPool(_device, _uploadContext._commandPool, nullptr);
-	});
-
-	// Allocate the default command buffer that we will use for the instant commands
-	VkCommandBufferAllocateInfo cmdAllocInfo = vkinit::command_buffer_allocate_info(_uploadContext._commandPool, 1);
-	VK_CHECK(vkAllocateCommandBuffers(_device, &cmdAllocInfo, &_uploadContext._commandBuffer));
 }
 
 void VulkanEngine::init_sync_structures()
@@ -532,13 +757,6 @@ void VulkanEngine::init_sync_structures()
 			vkDestroySemaphore(_device, _frames[i]._renderSemaphore, nullptr);
 		});
 	}
-
-	VkFenceCreateInfo uploadFenceCreateInfo = vkinit::fence_create_info();
-
-	VK_CHECK(vkCreateFence(_device, &uploadFenceCreateInfo, nullptr, &_uploadContext._uploadFence));
-	_mainDeletionQueue.push_function([=]() {
-		vkDestroyFence(_device, _uploadContext._uploadFence, nullptr);
-	});
 }
 
 void VulkanEngine::init_pipelines()
@@ -556,12 +774,24 @@ void VulkanEngine::init_pipelines()
 		std::cout << "Error when building the textured mesh shader" << std::endl;
 	}
 
+	VkShaderModule alphaTestedMeshShader;
+	if (!load_shader_module("../../shaders/textured_lit_alphatest.frag.spv", &alphaTestedMeshShader))
+	{
+		std::cout << "Error when building the alpha tested mesh shader" << std::endl;
+	}
+
 	VkShaderModule meshVertShader;
 	if (!load_shader_module("../../shaders/tri_mesh.vert.spv", &meshVertShader))
 	{
 		std::cout << "Error when building the mesh vertex shader module" << std::endl;
 	}
 
+	VkShaderModule compactMeshVertShader;
+	if (!load_shader_module("../../shaders/tri_mesh_compact.vert.spv", &compactMeshVertShader))
+	{
+		std::cout << "Error when building the compact mesh vertex shader module" << std::endl;
+	}
+
 	// Build the stage-create-info for both the vertex and fragment stages
 	PipelineBuilder pipelineBuilder;
 
@@ -664,15 +894,75 @@ void VulkanEngine::init_pipelines()
 
 	pipelineBuilder._pipelineLayout = texturedPipeLayout;
 	VkPipeline texPipeline = pipelineBuilder.build_pipeline(_device, _renderPass);
-	create_material(texPipeline, texturedPipeLayout, "texturedmesh");
+	Material* texturedMaterial = create_material(texPipeline, texturedPipeLayout, "texturedmesh");
+
+	// Same as the textured pipeline, but discards transparent texels. Kept separate so opaque draws keep early depth testing
+	pipelineBuilder._shaderStages[1] = vkinit::pipeline_shader_stage_create_info(VK_SHADER_STAGE_FRAGMENT_BIT, alphaTestedMeshShader);
+
+	VkPipeline alphaTestedPipeline = pipelineBuilder.build_pipeline(_device, _renderPass);
+	Material* alphaTestedMaterial = create_material(alphaTestedPipeline, texturedPipeLayout, "texturedmesh_alphatest");
+
+	// Build the same pipelines again for meshes in the compact vertex layout
+	VertexInputDescription compactVertexDescription = CompactVertex::get_vertex_description();
+
+	pipelineBuilder._vertexInputInfo.pVertexAttributeDescriptions = compactVertexDescription.attributes.data();
+	pipelineBuilder._vertexInputInfo.vertexAttributeDescriptionCount = compactVertexDescription.attributes.size();
+
+	pipelineBuilder._vertexInputInfo.pVertexBindingDescriptions = compactVertexDescription.bindings.data();
+	pipelineBuilder._vertexInputInfo.vertexBindingDescriptionCount = compactVertexDescription.bindings.size();
+
+	pipelineBuilder._shaderStages.clear();
+	pipelineBuilder._shaderStages.push_back(
+		vkinit::pipeline_shader_stage_create_info(VK_SHADER_STAGE_VERTEX_BIT, compactMeshVertShader));
+
+	pipelineBuilder._shaderStages.push_back(
+		vkinit::pipeline_shader_stage_create_info(VK_SHADER_STAGE_FRAGMENT_BIT, colorMeshShader));
+
+	pipelineBuilder._pipelineLayout = meshPipLayout;
+	VkPipeline compactMeshPipeline = pipelineBuilder.build_pipeline(_device, _renderPass);
+	get_material("defaultmesh")->compactPipeline = compactMeshPipeline;
+
+	pipelineBuilder._shaderStages[1] = vkinit::pipeline_shader_stage_create_info(VK_SHADER_STAGE_FRAGMENT_BIT, texturedMeshShader);
+
+	pipelineBuilder._pipelineLayout = texturedPipeLayout;
+	VkPipeline compactTexPipeline = pipelineBuilder.build_pipeline(_device, _renderPass);
+	texturedMaterial->compactPipeline = compactTexPipeline;
+
+	pipelineBuilder._shaderStages[1] = vkinit::pipeline_shader_stage_create_info(VK_SHADER_STAGE_FRAGMENT_BIT, alphaTestedMeshShader);
+
+	VkPipeline compactAlphaTestedPipeline = pipelineBuilder.build_pipeline(_device, _renderPass);
+	alphaTestedMaterial->compactPipeline = compactAlphaTestedPipeline;
+
+	// The cull pass, only built where the GPU can draw what it writes
+	VkShaderModule cullShader = VK_NULL_HANDLE;
+	if (_culling.supported() && !load_shader_module("../../shaders/cull.comp.spv", &cullShader))
+	{
+		std::cout << "Error when building the cull compute shader" << std::endl;
+	}
+	if (cullShader != VK_NULL_HANDLE)
+	{
+		_culling.init(_device, _allocator, _objectSetLayout, cullShader);
+		vkDestroyShaderModule(_device, cullShader, nullptr);
+
+		_mainDeletionQueue.push_function([&]() {
+			_culling.cleanup();
+		});
+	}
 
 	vkDestroyShaderModule(_device, meshVertShader, nullptr);
+	vkDestroyShaderModule(_device, compactMeshVertShader, nullptr);
 	vkDestroyShaderModule(_device, colorMeshShader, nullptr);
 	vkDestroyShaderModule(_device, texturedMeshShader, nullptr);
+	vkDestroyShaderModule(_device, alphaTestedMeshShader, nullptr);
 
-	_mainDeletionQueue.push_function([&]() {
+	// Capture the handles by value, the locals are gone by the time the queue is flushed
+	_mainDeletionQueue.push_function([=]() {
 		vkDestroyPipeline(_device, meshPipeline, nullptr);
 		vkDestroyPipeline(_device, texPipeline, nullptr);
+		vkDestroyPipeline(_device, compactMeshPipeline, nullptr);
+		vkDestroyPipeline(_device, compactTexPipeline, nullptr);
+		vkDestroyPipeline(_device, alphaTestedPipeline, nullptr);
+		vkDestroyPipeline(_device, compactAlphaTestedPipeline, nullptr);
 
 		vkDestroyPipelineLayout(_device, meshPipLayout, nullptr);
 		vkDestroyPipelineLayout(_device, texturedPipeLayout, nullptr);
@@ -681,19 +971,34 @@ void VulkanEngine::init_pipelines()
 
 void VulkanEngine::init_scene()
 {
+	// Meshes that failed to load are left out of the scene
 	RenderObject monkey;
 	monkey.mesh = get_mesh("monkey");
 	monkey.material = get_material("defaultmesh");
 	monkey.transformMatrix = glm::mat4{ 1.0f };
 
-	_renderables.push_back(monkey);
+	if (monkey.mesh)
+	{
+		_renderables.push_back(monkey);
+
+		// A line of monkeys going into the distance, each one drawn at a coarser level of detail as it shrinks on screen
+		for (int i = 1; i <= 10; i++)
+		{
+			monkey.transformMatrix = glm::translate(glm::vec3{ -6.0f, 0.0f, -8.0f * i });
+			_renderables.push_back(monkey);
+		}
+	}
 
 	RenderObject map;
 	map.mesh = get_mesh("empire");
 	map.material = get_material("texturedmesh");
+	map.alphaTestedMaterial = get_material("texturedmesh_alphatest");
 	map.transformMatrix = glm::translate(glm::vec3{ 5,-10,0 });
 
-	_renderables.push_back(map);
+	if (map.mesh)
+	{
+		_renderables.push_back(map);
+	}
 
 	for (int x = -20; x <= 20; x++)
 	{
@@ -710,37 +1015,47 @@ void VulkanEngine::init_scene()
 		}
 	}
 
-	Material* texturedMat = get_material("texturedmesh");
-
-	// Allocate the descriptor set for single-texture to use on the material
-	VkDescriptorSetAllocateInfo allocInfo = {};
-	allocInfo.pNext = nullptr;
-	allocInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_ALLOCATE_INFO;
-	allocInfo.descriptorPool = _descriptorPool;
-	allocInfo.descriptorSetCount = 1;
-	allocInfo.pSetLayouts = &_singleTextureSetLayout;
-
-	vkAllocateDescriptorSets(_device, &allocInfo, &texturedMat->textureSet);
-
-	// Create a sampler for the texture
+	// Create a sampler for the textures. Magnified blocks stay sharp, minified ones blend between mip levels
 	VkSamplerCreateInfo samplerInfo = vkinit::sampler_create_info(VK_FILTER_NEAREST);
+	samplerInfo.minFilter = VK_FILTER_LINEAR;
+	samplerInfo.mipmapMode = VK_SAMPLER_MIPMAP_MODE_LINEAR;
+	samplerInfo.minLod = 0.0f;
+	samplerInfo.maxLod = VK_LOD_CLAMP_NONE;
 
-	VkSampler blockySampler;
-	vkCreateSampler(_device, &samplerInfo, nullptr, &blockySampler);
+	vkCreateSampler(_device, &samplerInfo, nullptr, &_textureSampler);
 
 	_mainDeletionQueue.push_function([=]() {
-		vkDestroySampler(_device, blockySampler, nullptr);
+		vkDestroySampler(_device, _textureSampler, nullptr);
 	});
 
-	// Write to the descriptor set so that it points to our empire_diffuse texture
-	VkDescriptorImageInfo imageBufferInfo;
-	imageBufferInfo.sampler = blockySampler;
-	imageBufferInfo.imageView = _loadedTextures["empire_diffuse"].imageView;
-	imageBufferInfo.imageLayout = VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL;
+	// The alpha tested blocks sample the same atlas
+	set_material_texture(get_material("texturedmesh"), "empire_diffuse");
+	set_material_texture(get_material("texturedmesh_alphatest"), "empire_diffuse");
 
-	VkWriteDescriptorSet texture1 = vkinit::write_descriptor_image(VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER, texturedMat->textureSet, &imageBufferInfo, 0);
+	// The frames drawing the objects wait for everything they read, once for the whole scene
+	for (const RenderObject& object : _renderables)
+	{
+		_sceneUploadToken = std::max(_sceneUploadToken, object.mesh->_uploadToken);
+		_sceneUploadToken = std::max(_sceneUploadToken, object.material->uploadToken);
+		if (object.alphaTestedMaterial)
+		{
+			_sceneUploadToken = std::max(_sceneUploadToken, object.alphaTestedMaterial->uploadToken);
+		}
+	}
+
+	// draw_objects culls against these, the objects don't move
+	update_renderable_bounds();
 
-	vkUpdateDescriptorSets(_device, 1, &texture1, 0, nullptr);
+	// The cull pass keeps its own copy of the objects on the GPU, uploaded once here
+	if (_culling.build(_renderables.data(), _renderables.size(), _uploads))
+	{
+		std::cout << "Objects are culled on the GPU: " << _culling.record_count() << " submeshes in "
+			<< _culling.batches().size() << " indirect draws" << std::endl;
+	}
+	else
+	{
+		std::cout << "Objects are drawn from the CPU, the GPU has no indirect count draws" << std::endl;
+	}
 }
 
 bool VulkanEngine::load_shader_module(const char* filepath, VkShaderModule* outShaderModule)
@@ -787,7 +1102,7 @@ bool VulkanEngine::load_shader_module(const char* filepath, VkShaderModule* outS
 	return true;
 }
 
-void VulkanEngine::load_meshes()
+void VulkanEngine::load_meshes(std::vector<MeshAsset>& assets)
 {
 	// Make the array the length of 3 vertices
 	triangleMesh._vertices.resize(3);
@@ -804,88 +1119,366 @@ void VulkanEngine::load_meshes()
 
 	// Ignore vertex normals for now
 
-	// Load the monkey obj
-	Mesh monkeyMesh{};
-	monkeyMesh.load_from_obj("../../assets/monkey_smooth.obj");
+	triangleMesh.compute_bounds();
 
-	Mesh lostEmpire{};
-	lostEmpire.load_from_obj("../../assets/lost_empire.obj");
+	// Streamed imports submit batch after batch and recycle the staging ring as they go, which an open UploadBatch
+	// would hold on to until it submits. They go first, before the batch opens
+	for (MeshAsset& asset : assets)
+	{
+		if (!asset.parsed && is_streamed_import(asset.filename.c_str()))
+		{
+			asset.loaded = stream_mesh_from_obj(asset.mesh, asset.filename.c_str());
+			if (!asset.loaded)
+			{
+				std::cout << "Failed to stream " << asset.filename << ", " << asset.name << " isn't loaded" << std::endl;
+			}
+		}
+	}
+
+	// Every other mesh goes to the GPU in one submit
+	UploadBatch batch(_uploads);
+
+	for (MeshAsset& asset : assets)
+	{
+		if (asset.parsed)
+		{
+			upload_meshes(asset.mesh, batch);
+			asset.loaded = true;
+		}
+	}
 
 	// Send the meshes to the GPU
-	upload_meshes(triangleMesh);
-	upload_meshes(monkeyMesh);
-	upload_meshes(lostEmpire);
+	upload_meshes(triangleMesh, batch);
+
+	// Streamed meshes keep the token of their own uploads if nothing else was batched
+	const UploadToken uploadToken = batch.submit();
+	triangleMesh._uploadToken = std::max(triangleMesh._uploadToken, uploadToken);
+	for (MeshAsset& asset : assets)
+	{
+		asset.mesh._uploadToken = std::max(asset.mesh._uploadToken, uploadToken);
+		_sceneUploadToken = std::max(_sceneUploadToken, asset.mesh._uploadToken);
+	}
+	_sceneUploadToken = std::max(_sceneUploadToken, uploadToken);
+
+	_geometry.print_stats();
 
 	//note that we are copying them. Eventually we will delete the hardcoded _monkey and _triangle meshes, so it's no problem now.
-	_meshes["monkey"] = monkeyMesh;
+	// Meshes that failed to load are left out, get_mesh returns null for them
+	for (MeshAsset& asset : assets)
+	{
+		if (asset.loaded)
+		{
+			_meshes[asset.name] = asset.mesh;
+		}
+	}
 	_meshes["triangle"] = triangleMesh;
-	_meshes["empire"] = lostEmpire;
 }
 
-void VulkanEngine::upload_meshes(Mesh& mesh)
+void VulkanEngine::parse_mesh_asset(MeshAsset& asset, const MeshLoadOptions& options)
 {
-	const size_t bufferSize = mesh._vertices.size() * sizeof(Vertex);
-	// Allocate staging buffer
-	VkBufferCreateInfo stagingBufferInfo = {};
-	stagingBufferInfo.sType = VK_STRUCTURE_TYPE_BUFFER_CREATE_INFO;
-	stagingBufferInfo.pNext = nullptr;
+	if (is_streamed_import(asset.filename.c_str()))
+	{
+		return;
+	}
 
-	stagingBufferInfo.size = bufferSize;
-	stagingBufferInfo.usage = VK_BUFFER_USAGE_TRANSFER_SRC_BIT;
+	asset.parsed = asset.mesh.load_from_obj(asset.filename.c_str(), options);
+}
 
-	// Let the VMA library know that this data should be on CPU RAM
-	VmaAllocationCreateInfo vmaallocInfo = {};
-	vmaallocInfo.usage = VMA_MEMORY_USAGE_CPU_ONLY;
+bool VulkanEngine::is_streamed_import(const char* filename)
+{
+	// Open the file with the cursor at the end, the position is the file size
+	std::ifstream file(filename, std::ios::ate | std::ios::binary);
+	const size_t fileSize = file.is_open() ? static_cast<size_t>(file.tellg()) : 0;
 
-	AllocatedBuffer stagingBuffer;
+	return fileSize >= STREAMING_IMPORT_MIN_SIZE;
+}
 
-	// Allocate the buffer
-	VK_CHECK(vmaCreateBuffer(_allocator, &stagingBufferInfo, &vmaallocInfo,
-		&stagingBuffer._buffer,
-		&stagingBuffer._allocation,
-		nullptr));
+bool VulkanEngine::stream_mesh_from_obj(Mesh& mesh, const char* filename)
+{
+	// Batches only free their part of the ring when nothing holds it, and one batch always fits it
+	assert(!_uploads.staging_held());
+
+	const size_t batchSize = STREAMING_IMPORT_BATCH_VERTICES * sizeof(Vertex);
+	static_assert(STREAMING_IMPORT_BATCH_VERTICES * sizeof(Vertex) <= UPLOAD_STAGING_SIZE, "a streamed batch has to fit the staging ring");
+	const size_t oversizedBefore = _uploads.oversized_staging_count();
+
+	size_t streamedVertices = 0;
+	size_t batchCount = 0;
+
+	// Each batch takes its own part of the staging ring, so batches parse while earlier ones still copy.
+	// The ring only blocks once it is full of batches the GPU hasn't copied yet
+	StagingRegion staging;
+	UploadToken lastBatch = 0;
+
+	auto submit_copy = [&](GeometryArena::Pool pool, const GeometryRange& range, VkDeviceSize offset, VkDeviceSize size) {
+		const StagingRegion source = staging;
+		const VkBuffer destination = _geometry.buffer(pool, range.block);
+		const VkDeviceSize destinationOffset = range.offset + offset;
+
+		lastBatch = _uploads.submit([=](VkCommandBuffer cmd) {
+			VkBufferCopy copy;
+			copy.srcOffset = source.offset;
+			copy.dstOffset = destinationOffset;
+			copy.size = size;
+			vkCmdCopyBuffer(cmd, source.buffer, destination, 1, &copy);
+		});
+		batchCount++;
+	};
 
-	// Copy vertex data
-	void* data;
-	vmaMapMemory(_allocator, stagingBuffer._allocation, &data);
+	ObjStreamTarget target;
+	target.batchVertexCount = STREAMING_IMPORT_BATCH_VERTICES;
 
-	memcpy(data, mesh._vertices.data(), mesh._vertices.size() * sizeof(Vertex));
+	// The vertex range is sized from the face corners before anything is parsed, and shrunk to fit afterwards
+	target.begin = [&](size_t maxVertexCount) {
+		if (maxVertexCount == 0)
+		{
+			return false;
+		}
 
-	vmaUnmapMemory(_allocator, stagingBuffer._allocation);
+		mesh._vertexRange = _geometry.allocate(GeometryArena::Pool::Vertex, maxVertexCount, sizeof(Vertex));
+		return true;
+	};
 
-	// Allocate vertex buffer
-	VkBufferCreateInfo vertexBufferInfo = {};
-	vertexBufferInfo.sType = VK_STRUCTURE_TYPE_BUFFER_CREATE_INFO;
-	vertexBufferInfo.pNext = nullptr;
-	// The total size, in bytes, of the buffer we are allocating
-	vertexBufferInfo.size = bufferSize;
-	// This buffer is going to be used as a Vertex Buffer
-	vertexBufferInfo.usage = VK_BUFFER_USAGE_VERTEX_BUFFER_BIT | VK_BUFFER_USAGE_TRANSFER_DST_BIT;
+	target.acquire_batch = [&]() {
+		staging = _uploads.allocate_staging(batchSize, alignof(Vertex));
+		return static_cast<Vertex*>(staging.data);
+	};
 
-	// Let the VMA library know that this data should be GPU native
-	vmaallocInfo.usage = VMA_MEMORY_USAGE_GPU_ONLY;
+	target.submit_batch = [&](size_t count) {
+		submit_copy(GeometryArena::Pool::Vertex, mesh._vertexRange, streamedVertices * sizeof(Vertex), count * sizeof(Vertex));
+		streamedVertices += count;
+		return true;
+	};
 
-	// Allocate the buffer
-	VK_CHECK(vmaCreateBuffer(_allocator, &vertexBufferInfo, &vmaallocInfo,
-		&mesh._vertexBuffer._buffer,
-		&mesh._vertexBuffer._allocation,
-		nullptr));
-	
-	immediate_submit([=](VkCommandBuffer cmd) {
-		VkBufferCopy copy;
-		copy.dstOffset = 0;
-		copy.srcOffset = 0;
-		copy.size = bufferSize;
-		vkCmdCopyBuffer(cmd, stagingBuffer._buffer, mesh._vertexBuffer._buffer, 1, &copy);
-	});
+	// The vertices can't be sorted by material once they are on the GPU. An index buffer lists each material's
+	// triangles one after the other instead, written a batch at a time like the vertices
+	target.finish = [&](std::vector<ObjMaterial>& materials, const std::vector<ObjTriangleRun>& runs) {
+		std::vector<ObjTriangleRun> indexOrder;
+		mesh.group_by_material_runs(materials, runs, indexOrder);
 
-	// Add the destruction of mesh buffer to the deletion queue
-	_mainDeletionQueue.push_function([=]() {
-		vmaDestroyBuffer(_allocator, mesh._vertexBuffer._buffer, mesh._vertexBuffer._allocation);
-	});
+		mesh._indexRange = _geometry.allocate(GeometryArena::Pool::Index, streamedVertices, sizeof(uint32_t));
+
+		const size_t batchIndexCount = batchSize / sizeof(uint32_t);
+		size_t writtenIndices = 0;
+		size_t count = 0;
+		uint32_t* indices = nullptr;
+
+		for (const ObjTriangleRun& run : indexOrder)
+		{
+			const size_t runEnd = (run.firstTriangle + run.triangleCount) * 3;
+			for (size_t vertex = run.firstTriangle * 3; vertex < runEnd; vertex++)
+			{
+				if (indices == nullptr)
+				{
+					staging = _uploads.allocate_staging(batchSize, alignof(uint32_t));
+					indices = static_cast<uint32_t*>(staging.data);
+				}
+
+				indices[count++] = static_cast<uint32_t>(vertex);
+
+				if (count == batchIndexCount)
+				{
+					submit_copy(GeometryArena::Pool::Index, mesh._indexRange, writtenIndices * sizeof(uint32_t), count * sizeof(uint32_t));
+					writtenIndices += count;
+					count = 0;
+					indices = nullptr;
+				}
+			}
+		}
+
+		if (count > 0)
+		{
+			submit_copy(GeometryArena::Pool::Index, mesh._indexRange, writtenIndices * sizeof(uint32_t), count * sizeof(uint32_t));
+			writtenIndices += count;
+		}
+
+		return writtenIndices == streamedVertices;
+	};
+
+	AABB bounds;
+	const bool loaded = vkobj::stream_obj(filename, target, bounds);
+
+	if (!loaded)
+	{
+		// Nothing draws the ranges yet, they only have to wait for the copies into them
+		_uploads.wait(lastBatch);
+		if (mesh._vertexRange.valid())
+		{
+			_geometry.shrink(GeometryArena::Pool::Vertex, mesh._vertexRange, 0);
+			mesh._vertexRange = GeometryRange{};
+		}
+		if (mesh._indexRange.valid())
+		{
+			_geometry.shrink(GeometryArena::Pool::Index, mesh._indexRange, 0);
+			mesh._indexRange = GeometryRange{};
+		}
+		return false;
+	}
+
+	// The arena is shared by both queue families, so the last batch's token is all a frame has to wait for
+	mesh._uploadToken = lastBatch;
+
+	// Triangles with more than 3 corners made the upper bound larger than what was written
+	_geometry.shrink(GeometryArena::Pool::Vertex, mesh._vertexRange, streamedVertices * sizeof(Vertex));
+
+	mesh._vertexFormat = VertexFormat::Full;
+	mesh._vertexCount = static_cast<uint32_t>(streamedVertices);
+	mesh._indexCount = static_cast<uint32_t>(streamedVertices);
+	mesh._indexType = VK_INDEX_TYPE_UINT32;
+	mesh._meshletCount = 0;
+
+	// Bounds of the file's positions. Without the vertices the sphere can only be the one around the box
+	mesh._bounds = bounds;
+	mesh._boundingSphere = glm::vec4((bounds.min + bounds.max) * 0.5f, glm::length(bounds.max - bounds.min) * 0.5f);
+
+	std::cout << "Streamed " << filename << ": " << streamedVertices << " vertices in " << mesh._submeshes.size() << " submeshes, "
+		<< batchCount << " batches of " << batchSize / 1024 << " KB of staging memory" << std::endl;
+
+	// Every batch should have come out of the ring. Any that didn't got a buffer of its own, which costs an allocation
+	// per batch and host memory that grows with the file
+	const size_t oversizedBatches = _uploads.oversized_staging_count() - oversizedBefore;
+	if (oversizedBatches > 0)
+	{
+		std::cout << "Streaming " << filename << " allocated " << oversizedBatches << " staging buffers outside the ring" << std::endl;
+	}
+	assert(oversizedBatches == 0);
+
+	return true;
+}
+
+void VulkanEngine::upload_meshes(Mesh& mesh, UploadBatch& batch)
+{
+	const size_t vertexBufferSize = mesh.vertex_data_count() * mesh.vertex_stride();
+	const size_t indexBufferSize = mesh.index_data_count() * mesh.index_size();
+
+	mesh._vertexCount = static_cast<uint32_t>(mesh.vertex_data_count());
+	mesh._indexCount = static_cast<uint32_t>(mesh.index_data_count());
+	mesh._meshletCount = static_cast<uint32_t>(mesh.meshlet_data_count());
+	mesh._indexType = mesh.index_size() == sizeof(uint16_t) ? VK_INDEX_TYPE_UINT16 : VK_INDEX_TYPE_UINT32;
+
+	// Cooked meshes are GPU ready already. Where the GPU can import the file mapping, the copies read it in place.
+	// The import covers whole alignment units, which have to stay inside the mapped pages
+	ImportedHostBuffer imported;
+	bool importedCache = false;
+	if (mesh._cache && _hostMemoryImport.available())
+	{
+		const MappedFile& file = mesh._cache->file();
+		const VkDeviceSize alignment = _hostMemoryImport.alignment();
+		const VkDeviceSize importSize = (file.size() + alignment - 1) / alignment * alignment;
+		importedCache = importSize <= file.mapped_size() && _hostMemoryImport.import(file.data(), importSize, imported);
+	}
+
+	StagingRegion source;
+	VkDeviceSize vertexSourceOffset = 0;
+	VkDeviceSize indexSourceOffset = 0;
+
+	if (importedCache)
+	{
+		const MeshCacheHeader& header = mesh._cache->header();
+		source = { imported.buffer, 0, nullptr };
+		vertexSourceOffset = header.vertexOffset;
+		indexSourceOffset = header.indexOffset;
+
+		// The mapping and the buffer over it live until the copies out of them have finished
+		std::shared_ptr<MeshCache> cache = mesh._cache;
+		batch.on_complete([this, imported, cache]() {
+			_hostMemoryImport.destroy(imported);
+		});
+	}
+	else
+	{
+		// Vertices and indices share one region of the staging ring, packed one after the other
+		indexSourceOffset = vertexBufferSize;
+
+		source = batch.allocate_staging(vertexBufferSize + indexBufferSize);
+
+		// Copy vertex and index data. Cooked meshes the GPU couldn't import are copied out of the file mapping
+		char* data = static_cast<char*>(source.data);
+
+		memcpy(data, mesh.vertex_data(), vertexBufferSize);
+		mesh.write_index_data(data + indexSourceOffset);
+	}
+
+	// The mesh doesn't need the cooked file anymore, the copies hold on to it if they read it in place
+	mesh._cache.reset();
+
+	// Vertices and indices are suballocated from the geometry arena. Ranges start on a whole vertex or index,
+	// so draws can address them with base vertex and first index
+	mesh._vertexRange = _geometry.allocate(GeometryArena::Pool::Vertex, mesh._vertexCount, mesh.vertex_stride());
+
+	// Nothing waits for the copies here. Frames that draw the mesh wait for the batch's token on the GPU.
+	// The arena is shared by both queue families, so its ranges need no ownership transfer
+	batch.copy_buffer(source, vertexSourceOffset, _geometry.buffer(GeometryArena::Pool::Vertex, mesh._vertexRange.block), mesh._vertexRange.offset, vertexBufferSize);
+
+	if (indexBufferSize > 0)
+	{
+		mesh._indexRange = _geometry.allocate(GeometryArena::Pool::Index, mesh._indexCount, mesh.index_size());
+		batch.copy_buffer(source, indexSourceOffset, _geometry.buffer(GeometryArena::Pool::Index, mesh._indexRange.block), mesh._indexRange.offset, indexBufferSize);
+	}
+}
+
+void VulkanEngine::free_mesh(Mesh& mesh)
+{
+	_geometry.free(GeometryArena::Pool::Vertex, mesh._vertexRange);
+	_geometry.free(GeometryArena::Pool::Index, mesh._indexRange);
+	mesh._vertexCount = 0;
+	mesh._indexCount = 0;
 
-	vmaDestroyBuffer(_allocator, stagingBuffer._buffer, stagingBuffer._allocation);
+	// The cull batches still point at the freed ranges
+	_cullingDirty = true;
+}
+
+void VulkanEngine::compact_geometry()
+{
+	std::vector<GeometryRange*> vertexRanges;
+	std::vector<GeometryRange*> indexRanges;
+	for (auto& entry : _meshes)
+	{
+		vertexRanges.push_back(&entry.second._vertexRange);
+		indexRanges.push_back(&entry.second._indexRange);
+	}
+
+	// Every mesh now reads from the new blocks, which the copy fills
+	const UploadToken token = _geometry.compact(vertexRanges, indexRanges);
+	for (auto& entry : _meshes)
+	{
+		entry.second._uploadToken = std::max(entry.second._uploadToken, token);
+	}
+	_sceneUploadToken = std::max(_sceneUploadToken, token);
 
+	// The cull batches baked the old offsets of every mesh
+	rebuild_culling();
+}
+
+void VulkanEngine::rebuild_culling()
+{
+	_cullingDirty = false;
+	if (!_culling.available())
+	{
+		return;
+	}
+
+	// build replaces buffers the frames in flight read
+	VK_CHECK(vkDeviceWaitIdle(_device));
+	_culling.build(_renderables.data(), _renderables.size(), _uploads);
+}
+
+bool VulkanEngine::supports_compact_vertices()
+{
+	const VkFormat formats[] = { VK_FORMAT_R16G16B16A16_UNORM, VK_FORMAT_R16G16_SNORM, VK_FORMAT_R16G16_UNORM };
+
+	for (VkFormat format : formats)
+	{
+		VkFormatProperties properties;
+		vkGetPhysicalDeviceFormatProperties(_chosenGPU, format, &properties);
+
+		if ((properties.bufferFeatures & VK_FORMAT_FEATURE_VERTEX_BUFFER_BIT) == 0)
+		{
+			return false;
+		}
+	}
+
+	return true;
 }
 
 Material* VulkanEngine::create_material(VkPipeline pipeline, VkPipelineLayout layout, const std::string& name)
@@ -922,109 +1515,486 @@ Mesh* VulkanEngine::get_mesh(const std::string& name)
 }
 
 
-void VulkanEngine::draw_objects(VkCommandBuffer cmd, RenderObject* first, int count)
+void VulkanEngine::set_material_texture(Material* material, const std::string& textureName)
+{
+	auto it = _loadedTextures.find(textureName);
+	if (it == _loadedTextures.end())
+	{
+		std::cout << "No texture " << textureName << " to give a material" << std::endl;
+		return;
+	}
+	const Texture& texture = it->second;
+
+	// Write the array's descriptor set the first time one of its layers is used
+	VkDescriptorSet& textureSet = _textureSets[texture.imageView];
+	if (textureSet == VK_NULL_HANDLE)
+	{
+		VkDescriptorSetAllocateInfo allocInfo = {};
+		allocInfo.pNext = nullptr;
+		allocInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_ALLOCATE_INFO;
+		allocInfo.descriptorPool = _descriptorPool;
+		allocInfo.descriptorSetCount = 1;
+		allocInfo.pSetLayouts = &_singleTextureSetLayout;
+
+		vkAllocateDescriptorSets(_device, &allocInfo, &textureSet);
+
+		VkDescriptorImageInfo imageBufferInfo;
+		imageBufferInfo.sampler = _textureSampler;
+		imageBufferInfo.imageView = texture.imageView;
+		imageBufferInfo.imageLayout = VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL;
+
+		VkWriteDescriptorSet texture1 = vkinit::write_descriptor_image(VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER, textureSet, &imageBufferInfo, 0);
+
+		vkUpdateDescriptorSets(_device, 1, &texture1, 0, nullptr);
+	}
+
+	material->textureSet = textureSet;
+	material->textureLayer = texture.layer;
+	material->uploadToken = texture.uploadToken;
+
+	// Objects may already draw with the material
+	_sceneUploadToken = std::max(_sceneUploadToken, texture.uploadToken);
+}
+
+FrameCamera VulkanEngine::frame_camera() const
 {
+	FrameCamera camera;
+
 	// Make a model view matrix for rendering the object
 	// Camera view
 	glm::vec3 camPos = { 0.0f,-6.0f,-10.0f };
 
-	glm::mat4 view = glm::translate(glm::mat4(1.0f), camPos);
+	camera.view = glm::translate(glm::mat4(1.0f), camPos);
 	// Camera projection
-	glm::mat4 projection = glm::perspective(glm::radians(70.0f), 1700.0f / 900.0f, 0.1f, 200.0f);
-	projection[1][1] *= -1;
+	const float fovY = glm::radians(70.0f);
+	camera.projection = glm::perspective(fovY, 1700.0f / 900.0f, 0.1f, 200.0f);
+	camera.projection[1][1] *= -1;
 
-	GPUCameraData camData;
-	camData.proj = projection;
-	camData.view = view;
-	camData.viewproj = projection * view;
+	// The view only translates, so the camera sits at -camPos. One unit at distance 1 covers this many pixels
+	camera.position = -camPos;
+	camera.pixelsPerUnitAtOne = _windowExtent.height / (2.0f * tanf(fovY * 0.5f));
 
-	void* data;
-	vmaMapMemory(_allocator, get_current_frame().cameraBuffer._allocation, &data);
+	return camera;
+}
 
-	memcpy(data, &camData, sizeof(GPUCameraData));
+bool VulkanEngine::write_global_data(const FrameCamera& camera, uint32_t outOffsets[2])
+{
+	// Per-frame data is written straight into the frame's mapped arena, the descriptors pick it up by dynamic offset
+	FrameArena& arena = get_current_frame().arena;
+	const FrameSlice cameraSlice = arena.allocate(sizeof(GPUCameraData));
+	const FrameSlice sceneSlice = arena.allocate(sizeof(GPUSceneData));
+	if (!cameraSlice.valid() || !sceneSlice.valid())
+	{
+		return false;
+	}
 
-	vmaUnmapMemory(_allocator, get_current_frame().cameraBuffer._allocation);
+	GPUCameraData* camData = static_cast<GPUCameraData*>(cameraSlice.data);
+	camData->proj = camera.projection;
+	camData->view = camera.view;
+	camData->viewproj = camera.projection * camera.view;
 
 	float framed = (_frameNumber / 120.f);
 
 	_sceneParameters.ambientColor = { sin(framed),0,cos(framed),1 };
 
-	char* sceneData;
-	vmaMapMemory(_allocator, _sceneParameterBuffer._allocation, (void**)&sceneData);
+	memcpy(sceneSlice.data, &_sceneParameters, sizeof(GPUSceneData));
 
-	int frameIndex = _frameNumber % FRAME_OVERLAP;
+	outOffsets[0] = static_cast<uint32_t>(cameraSlice.offset);
+	outOffsets[1] = static_cast<uint32_t>(sceneSlice.offset);
+	return true;
+}
 
-	sceneData += pad_uniform_buffer_size(sizeof(GPUSceneData)) * frameIndex;
+void VulkanEngine::draw_objects(VkCommandBuffer cmd, RenderObject* first, int count)
+{
+	const FrameCamera camera = frame_camera();
 
-	memcpy(sceneData, &_sceneParameters, sizeof(GPUSceneData));
+	// Cull first, only the objects in view get object data and draws
+	int visibleCount = count;
+	if (first == _renderables.data() && _renderableBounds.count == static_cast<size_t>(count))
+	{
+		auto cullStart = std::chrono::high_resolution_clock::now();
 
-	vmaUnmapMemory(_allocator, _sceneParameterBuffer._allocation);
+		glm::vec4 planes[6];
+		vkbounds::extract_frustum_planes(camera.projection * camera.view, planes);
 
+		_visibleObjects.resize(_renderableBounds.padded_count());
+		visibleCount = static_cast<int>(vkbounds::cull_spheres(_renderableBounds, planes, _visibleObjects.data()));
+
+		// Only objects that were tested count towards the culling rate
+		auto cullEnd = std::chrono::high_resolution_clock::now();
+		_frameCullMs += std::chrono::duration<double, std::milli>(cullEnd - cullStart).count();
+		_frameCulledObjects += count;
+	}
+	else
+	{
+		_visibleObjects.resize(count);
+		std::iota(_visibleObjects.begin(), _visibleObjects.end(), 0);
+	}
 
-	void* objectData;
-	vmaMapMemory(_allocator, get_current_frame().objectBuffer._allocation, &objectData);
+	const glm::vec3 cameraPosition = camera.position;
+	const float pixelsPerUnitAtOne = camera.pixelsPerUnitAtOne;
 
-	GPUObjectData* objectSSBO = (GPUObjectData*)objectData;
+	// One key per draw, so the recorded order only depends on what the draws bind and not on the order of the objects
+	auto sortStart = std::chrono::high_resolution_clock::now();
 
-	for (int i = 0; i < count; i++)
+	_drawKeys.clear();
+	for (int i = 0; i < visibleCount; i++)
 	{
-		RenderObject& object = first[i];
+		const RenderObject& object = first[_visibleObjects[i]];
+		Mesh* mesh = object.mesh;
+
+		// Meshes that failed to load have nothing in the arena
+		if (!mesh->_vertexRange.valid())
+		{
+			continue;
+		}
+
+		const float depth = glm::length(glm::vec3(object.transformMatrix[3]) - cameraPosition);
+		const float pixelsPerUnit = mesh->_submeshes.empty() ? 0.0f : pixels_per_unit(object, cameraPosition, pixelsPerUnitAtOne);
+
+		// One draw per submesh. Meshes without submeshes, like the triangle, are drawn whole
+		const size_t drawCount = std::max<size_t>(mesh->_submeshes.size(), 1);
+		for (size_t d = 0; d < drawCount; d++)
+		{
+			const Submesh* submesh = mesh->_submeshes.empty() ? nullptr : &mesh->_submeshes[d];
+			Material* material = draw_material(object, submesh);
+			VkPipeline pipeline = mesh->_vertexFormat == VertexFormat::Compact ? material->compactPipeline : material->pipeline;
+
+			// Alpha tested submeshes go after everything opaque
+			const uint32_t pass = material != object.material ? 1 : 0;
+			const uint32_t lod = submesh ? submesh->select_lod(pixelsPerUnit, LOD_MAX_PIXEL_ERROR) : 0;
+
+			DrawKey draw;
+			draw.key = vkdraw::make_key(pass, _pipelineIds.get(pipeline), _textureSetIds.get(material->textureSet),
+				mesh->_vertexRange.block, _meshIds.get(mesh), _materialIds.get(material), static_cast<uint32_t>(d), lod, depth);
+			draw.object = static_cast<uint32_t>(i);
+			draw.submesh = static_cast<uint16_t>(d);
+			draw.lod = static_cast<uint16_t>(lod);
+			_drawKeys.push_back(draw);
+		}
+	}
+
+	vkdraw::radix_sort(_drawKeys, _drawKeyScratch);
+
+	auto sortEnd = std::chrono::high_resolution_clock::now();
+	_frameSortMs += std::chrono::duration<double, std::milli>(sortEnd - sortStart).count();
+
+	auto dataStart = std::chrono::high_resolution_clock::now();
+
+	uint32_t globalOffsets[2];
+	const bool globalWritten = write_global_data(camera, globalOffsets);
+
+	FrameArena& arena = get_current_frame().arena;
+	const FrameSlice objectSlice = arena.allocate(sizeof(GPUObjectData) * MAX_OBJECTS);
+	if (_drawKeys.size() > MAX_OBJECTS)
+	{
+		std::cout << _drawKeys.size() << " draws are more than the " << MAX_OBJECTS << " the object buffer holds" << std::endl;
+		return;
+	}
+	if (!globalWritten || !objectSlice.valid())
+	{
+		std::cout << "Per-frame data of " << _drawKeys.size() << " draws doesn't fit the frame arena" << std::endl;
+		return;
+	}
+
+	// Object data is packed in draw order, one entry per draw, so the instances of a draw read consecutive entries
+	// starting at its firstInstance
+	GPUObjectData* objectSSBO = static_cast<GPUObjectData*>(objectSlice.data);
+
+	for (size_t i = 0; i < _drawKeys.size(); i++)
+	{
+		const RenderObject& object = first[_visibleObjects[_drawKeys[i].object]];
 		objectSSBO[i].modelMatrix = object.transformMatrix;
+		objectSSBO[i].sphereBounds = object.mesh->_boundingSphere;
 	}
 
-	vmaUnmapMemory(_allocator, get_current_frame().objectBuffer._allocation);
+	arena.flush();
 
-	Mesh* lastMesh = nullptr;
-	Material* lastMaterial = nullptr;
+	const uint32_t objectOffset = static_cast<uint32_t>(objectSlice.offset);
 
-	for (int i = 0; i < count; i++)
+	auto dataEnd = std::chrono::high_resolution_clock::now();
+	_frameDataMs += std::chrono::duration<double, std::milli>(dataEnd - dataStart).count();
+
+	Material* lastMaterial = nullptr;
+	Mesh* lastMesh = nullptr;
+	VkPipeline lastPipeline = VK_NULL_HANDLE;
+	VkPipelineLayout lastLayout = VK_NULL_HANDLE;
+	VkDescriptorSet lastTextureSet = VK_NULL_HANDLE;
+
+	// Every mesh lives in the geometry arena, usually all in its first blocks, so these rarely bind more than once
+	uint32_t boundVertexBlock = UINT32_MAX;
+	uint32_t boundIndexBlock = UINT32_MAX;
+	VkIndexType boundIndexType = VK_INDEX_TYPE_MAX_ENUM;
+
+	const size_t keyCount = _drawKeys.size();
+	size_t groupEnd = 0;
+	for (size_t groupStart = 0; groupStart < keyCount; groupStart = groupEnd)
 	{
-		RenderObject& object = first[i];
+		const DrawKey& draw = _drawKeys[groupStart];
+		const RenderObject& object = first[_visibleObjects[draw.object]];
+		Mesh* mesh = object.mesh;
+		const Submesh* submesh = mesh->_submeshes.empty() ? nullptr : &mesh->_submeshes[draw.submesh];
+		Material* material = draw_material(object, submesh);
+
+		// The following draws of the same mesh, submesh, material and level become instances of this one. Ids that
+		// wrapped can give different draws the same key, so what they draw is checked too
+		groupEnd = groupStart + 1;
+		while (groupEnd < keyCount && vkdraw::instance_group(_drawKeys[groupEnd].key) == vkdraw::instance_group(draw.key))
+		{
+			const DrawKey& next = _drawKeys[groupEnd];
+			const RenderObject& nextObject = first[_visibleObjects[next.object]];
+			if (nextObject.mesh != mesh || next.submesh != draw.submesh || next.lod != draw.lod
+				|| draw_material(nextObject, submesh) != material)
+			{
+				break;
+			}
+			groupEnd++;
+		}
+
+		const uint32_t firstInstance = static_cast<uint32_t>(groupStart);
+		const uint32_t instanceCount = static_cast<uint32_t>(groupEnd - groupStart);
+
+		_drawCounters.draws++;
+		_drawCounters.instances += instanceCount;
+
+		// Arena blocks are bound at offset 0, the ranges are selected per draw
+		_drawCounters.buffersUsed++;
+		if (mesh->_vertexRange.block != boundVertexBlock)
+		{
+			VkBuffer vertexBuffer = _geometry.buffer(GeometryArena::Pool::Vertex, mesh->_vertexRange.block);
+			VkDeviceSize offset = 0;
+			vkCmdBindVertexBuffers(cmd, 0, 1, &vertexBuffer, &offset);
+			boundVertexBlock = mesh->_vertexRange.block;
+			_drawCounters.bufferBinds++;
+		}
+
+		// 16 and 32 bit indices share the index blocks, a change of index type rebinds too
+		if (mesh->_indexCount > 0)
+		{
+			_drawCounters.buffersUsed++;
+			if (mesh->_indexRange.block != boundIndexBlock || mesh->_indexType != boundIndexType)
+			{
+				vkCmdBindIndexBuffer(cmd, _geometry.buffer(GeometryArena::Pool::Index, mesh->_indexRange.block), 0, mesh->_indexType);
+				boundIndexBlock = mesh->_indexRange.block;
+				boundIndexType = mesh->_indexType;
+				_drawCounters.bufferBinds++;
+			}
+		}
+
+		const uint32_t firstIndex = mesh->_indexRange.first_element();
+		const int32_t vertexOffset = static_cast<int32_t>(mesh->_vertexRange.first_element());
+
+		// The material has a pipeline for each vertex layout
+		VkPipeline pipeline = mesh->_vertexFormat == VertexFormat::Compact ? material->compactPipeline : material->pipeline;
 
 		// Only bind the pipeline if it doesn't match with the already bound one
-		if (object.material != lastMaterial)
+		if (pipeline != lastPipeline)
 		{
+			vkCmdBindPipeline(cmd, VK_PIPELINE_BIND_POINT_GRAPHICS, pipeline);
+			lastPipeline = pipeline;
+			_drawCounters.pipelineBinds++;
+		}
 
-			vkCmdBindPipeline(cmd, VK_PIPELINE_BIND_POINT_GRAPHICS, object.material->pipeline);
-			lastMaterial = object.material;
+		// Both pipelines of a material share its layout, so the global and object sets only need rebinding when the layout changes
+		_drawCounters.descriptorSetsUsed += material->textureSet != VK_NULL_HANDLE ? 3 : 2;
+		const bool layoutChanged = material->pipelineLayout != lastLayout;
+		if (layoutChanged)
+		{
+			lastLayout = material->pipelineLayout;
 
-			uint32_t uniform_offset = pad_uniform_buffer_size(sizeof(GPUSceneData)) * frameIndex;
-			vkCmdBindDescriptorSets(cmd, VK_PIPELINE_BIND_POINT_GRAPHICS, object.material->pipelineLayout, 0, 1, &get_current_frame().globalDescriptor, 1, &uniform_offset);
+			vkCmdBindDescriptorSets(cmd, VK_PIPELINE_BIND_POINT_GRAPHICS, material->pipelineLayout, 0, 1, &get_current_frame().globalDescriptor, 2, globalOffsets);
 
 			// Object data descriptor
-			vkCmdBindDescriptorSets(cmd, VK_PIPELINE_BIND_POINT_GRAPHICS, object.material->pipelineLayout, 1, 1, &get_current_frame().objectDescriptor, 0, nullptr);
-			
-			if (object.material->textureSet != VK_NULL_HANDLE)
-			{
-				// Texture descriptor
-				vkCmdBindDescriptorSets(cmd, VK_PIPELINE_BIND_POINT_GRAPHICS, object.material->pipelineLayout, 2, 1, &object.material->textureSet, 0, nullptr);
+			vkCmdBindDescriptorSets(cmd, VK_PIPELINE_BIND_POINT_GRAPHICS, material->pipelineLayout, 1, 1, &get_current_frame().objectDescriptor, 1, &objectOffset);
+			_drawCounters.descriptorSetBinds += 2;
+		}
 
-			}
+		// Materials whose textures were packed into the same array share one set, they only differ in the layer they push
+		if (material->textureSet != VK_NULL_HANDLE && (layoutChanged || material->textureSet != lastTextureSet))
+		{
+			// Texture descriptor
+			vkCmdBindDescriptorSets(cmd, VK_PIPELINE_BIND_POINT_GRAPHICS, material->pipelineLayout, 2, 1, &material->textureSet, 0, nullptr);
+			lastTextureSet = material->textureSet;
+			_drawCounters.descriptorSetBinds++;
+		}
+
+		// Push constants only carry the texture layer and the mesh's dequantization, the shaders read every instance's
+		// model matrix from the object buffer
+		if (material != lastMaterial || mesh != lastMesh)
+		{
+			lastMaterial = material;
+			lastMesh = mesh;
+
+			MeshPushConstants constants;
+			constants.data = glm::vec4(static_cast<float>(material->textureLayer), 0.0f, 0.0f, 0.0f);
+			constants.render_matrix = object.transformMatrix;
+			constants.positionOffset = glm::vec4(mesh->_positionOffset, 0.0f);
+			constants.positionScale = glm::vec4(mesh->_positionScale, 0.0f);
+
+			// Upload the mesh to the GPU via push constants
+			vkCmdPushConstants(cmd, material->pipelineLayout, VK_SHADER_STAGE_VERTEX_BIT, 0, sizeof(MeshPushConstants), &constants);
+		}
+
+		// We can now draw
+		if (submesh)
+		{
+			const MeshLod& lod = submesh->lods[draw.lod];
+			vkCmdDrawIndexed(cmd, lod.indexCount, instanceCount, firstIndex + lod.firstIndex, vertexOffset, firstInstance);
+		}
+		else if (mesh->_indexCount > 0)
+		{
+			vkCmdDrawIndexed(cmd, mesh->_indexCount, instanceCount, firstIndex, vertexOffset, firstInstance);
+		}
+		else
+		{
+			vkCmdDraw(cmd, mesh->_vertexCount, instanceCount, static_cast<uint32_t>(vertexOffset), firstInstance);
 		}
+	}
+}
 
-		glm::mat4 model = object.transformMatrix;
-		// Final render matrix, that we are calculating on the cpu
-		glm::mat4 mesh_matrix = model;
+void VulkanEngine::draw_objects_indirect(VkCommandBuffer cmd, const uint32_t globalOffsets[2])
+{
+	const std::vector<IndirectBatch>& batches = _culling.batches();
 
-		MeshPushConstants constants;
-		constants.render_matrix = mesh_matrix;
+	// The culled scene's objects live in a buffer of their own, uploaded once when it was built
+	const VkDescriptorSet objectSet = _culling.object_set();
+	const uint32_t objectOffset = 0;
 
-		// Upload the mesh to the GPU via push constants
-		vkCmdPushConstants(cmd, object.material->pipelineLayout, VK_SHADER_STAGE_VERTEX_BIT, 0, sizeof(MeshPushConstants), &constants);
+	Material* lastMaterial = nullptr;
+	Mesh* lastMesh = nullptr;
+	VkPipeline lastPipeline = VK_NULL_HANDLE;
+	VkPipelineLayout lastLayout = VK_NULL_HANDLE;
+	VkDescriptorSet lastTextureSet = VK_NULL_HANDLE;
 
-		// Only bind the mesh if it's a different one from last bind
-		if (object.mesh != lastMesh)
+	uint32_t boundVertexBlock = UINT32_MAX;
+	uint32_t boundIndexBlock = UINT32_MAX;
+	VkIndexType boundIndexType = VK_INDEX_TYPE_MAX_ENUM;
+
+	// One draw per batch however many objects it has, the cull pass wrote its commands and how many there are
+	for (uint32_t b : _culling.draw_order())
+	{
+		const IndirectBatch& batch = batches[b];
+		Mesh* mesh = batch.mesh;
+		Material* material = batch.material;
+
+		if (mesh->_vertexRange.block != boundVertexBlock)
 		{
-			// Bind the mesh vertex buffer with offset 0
+			VkBuffer vertexBuffer = _geometry.buffer(GeometryArena::Pool::Vertex, mesh->_vertexRange.block);
 			VkDeviceSize offset = 0;
-			vkCmdBindVertexBuffers(cmd, 0, 1, &object.mesh->_vertexBuffer._buffer, &offset);
-			lastMesh = object.mesh;
+			vkCmdBindVertexBuffers(cmd, 0, 1, &vertexBuffer, &offset);
+			boundVertexBlock = mesh->_vertexRange.block;
 		}
-		// We can now draw
-		vkCmdDraw(cmd, object.mesh->_vertices.size(), 1, 0, i);
+
+		if (mesh->_indexCount > 0 && (mesh->_indexRange.block != boundIndexBlock || mesh->_indexType != boundIndexType))
+		{
+			vkCmdBindIndexBuffer(cmd, _geometry.buffer(GeometryArena::Pool::Index, mesh->_indexRange.block), 0, mesh->_indexType);
+			boundIndexBlock = mesh->_indexRange.block;
+			boundIndexType = mesh->_indexType;
+		}
+
+		VkPipeline pipeline = mesh->_vertexFormat == VertexFormat::Compact ? material->compactPipeline : material->pipeline;
+		if (pipeline != lastPipeline)
+		{
+			vkCmdBindPipeline(cmd, VK_PIPELINE_BIND_POINT_GRAPHICS, pipeline);
+			lastPipeline = pipeline;
+		}
+
+		const bool layoutChanged = material->pipelineLayout != lastLayout;
+		if (layoutChanged)
+		{
+			lastLayout = material->pipelineLayout;
+
+			vkCmdBindDescriptorSets(cmd, VK_PIPELINE_BIND_POINT_GRAPHICS, material->pipelineLayout, 0, 1, &get_current_frame().globalDescriptor, 2, globalOffsets);
+			vkCmdBindDescriptorSets(cmd, VK_PIPELINE_BIND_POINT_GRAPHICS, material->pipelineLayout, 1, 1, &objectSet, 1, &objectOffset);
+		}
+
+		if (material->textureSet != VK_NULL_HANDLE && (layoutChanged || material->textureSet != lastTextureSet))
+		{
+			vkCmdBindDescriptorSets(cmd, VK_PIPELINE_BIND_POINT_GRAPHICS, material->pipelineLayout, 2, 1, &material->textureSet, 0, nullptr);
+			lastTextureSet = material->textureSet;
+		}
+
+		// The matrices come from the object buffer, the push constants only hold what the material and mesh share
+		if (material != lastMaterial || mesh != lastMesh)
+		{
+			MeshPushConstants constants;
+			constants.data = glm::vec4(static_cast<float>(material->textureLayer), 0.0f, 0.0f, 0.0f);
+			constants.render_matrix = glm::mat4{ 1.0f };
+			constants.positionOffset = glm::vec4(mesh->_positionOffset, 0.0f);
+			constants.positionScale = glm::vec4(mesh->_positionScale, 0.0f);
+
+			vkCmdPushConstants(cmd, material->pipelineLayout, VK_SHADER_STAGE_VERTEX_BIT, 0, sizeof(MeshPushConstants), &constants);
+			lastMaterial = material;
+			lastMesh = mesh;
+		}
+
+		const VkDeviceSize commandOffset = batch.firstCommand * sizeof(VkDrawIndexedIndirectCommand);
+		const VkDeviceSize countOffset = b * sizeof(uint32_t);
+
+		if (mesh->_indexCount > 0)
+		{
+			vkCmdDrawIndexedIndirectCount(cmd, _culling.command_buffer(), commandOffset, _culling.count_buffer(), countOffset,
+				batch.capacity, sizeof(VkDrawIndexedIndirectCommand));
+		}
+		else
+		{
+			vkCmdDrawIndirectCount(cmd, _culling.command_buffer(), commandOffset, _culling.count_buffer(), countOffset,
+				batch.capacity, sizeof(VkDrawIndexedIndirectCommand));
+		}
+	}
+}
+
+void VulkanEngine::update_renderable_bounds()
+{
+	_renderableBounds.resize(_renderables.size());
+	for (size_t i = 0; i < _renderables.size(); i++)
+	{
+		const RenderObject& object = _renderables[i];
+		_renderableBounds.set(i, vkbounds::transform_sphere(object.mesh->_boundingSphere, object.transformMatrix));
 	}
 }
 
+void VulkanEngine::compute_world_bounds(const RenderObject* first, int count, std::vector<AABB>& outBounds)
+{
+	// Gather the mesh boxes, the matrices are read in place from the objects
+	outBounds.resize(count);
+	for (int i = 0; i < count; i++)
+	{
+		outBounds[i] = first[i].mesh->_bounds;
+	}
+
+	vkbounds::transform_aabbs(outBounds.data(), sizeof(AABB), &first->transformMatrix, sizeof(RenderObject), count, outBounds.data());
+}
+
+Material* VulkanEngine::draw_material(const RenderObject& object, const Submesh* submesh) const
+{
+	if (submesh && object.alphaTestedMaterial && (object.mesh->_materials[submesh->material].flags & MESH_MATERIAL_ALPHA_TESTED))
+	{
+		return object.alphaTestedMaterial;
+	}
+	return object.material;
+}
+
+float VulkanEngine::pixels_per_unit(const RenderObject& object, const glm::vec3& cameraPosition, float pixelsPerUnitAtOne)
+{
+	const Mesh& mesh = *object.mesh;
+
+	// Bounding sphere of the mesh in world space, scaled by the largest axis scale of the transform
+	const glm::vec3 center = object.transformMatrix * glm::vec4(glm::vec3(mesh._boundingSphere), 1.0f);
+	const float scale = glm::max(glm::length(glm::vec3(object.transformMatrix[0])),
+		glm::max(glm::length(glm::vec3(object.transformMatrix[1])), glm::length(glm::vec3(object.transformMatrix[2]))));
+	const float radius = mesh._boundingSphere.w * scale;
+
+	// Measure from the closest point of the sphere, a camera inside it always gets level 0
+	const float distance = glm::length(center - cameraPosition) - radius;
+	if (distance <= 0.0f)
+	{
+		return FLT_MAX;
+	}
+
+	return scale * pixelsPerUnitAtOne / distance;
+}
+
 FrameData& VulkanEngine::get_current_frame()
 {
 	return _frames[_frameNumber % FRAME_OVERLAP];
@@ -1062,6 +2032,7 @@ void VulkanEngine::init_descriptors()
 		{ VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER, 10 },
 		{ VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER_DYNAMIC, 10 },
 		{ VK_DESCRIPTOR_TYPE_STORAGE_BUFFER, 10 },
+		{ VK_DESCRIPTOR_TYPE_STORAGE_BUFFER_DYNAMIC, 10 },
 		{ VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER, 10 }
 	};
 
@@ -1074,7 +2045,8 @@ void VulkanEngine::init_descriptors()
 
 	vkCreateDescriptorPool(_device, &pool_info, nullptr, &_descriptorPool);
 
-	VkDescriptorSetLayoutBinding cameraBind = vkinit::descriptorset_layout_binding(VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER, VK_SHADER_STAGE_VERTEX_BIT, 0);
+	// Everything in the global and object sets lives in the frame arenas, at offsets that change every frame
+	VkDescriptorSetLayoutBinding cameraBind = vkinit::descriptorset_layout_binding(VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER_DYNAMIC, VK_SHADER_STAGE_VERTEX_BIT, 0);
 	VkDescriptorSetLayoutBinding sceneBind = vkinit::descriptorset_layout_binding(VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER_DYNAMIC, VK_SHADER_STAGE_VERTEX_BIT | VK_SHADER_STAGE_FRAGMENT_BIT, 1);
 
 	VkDescriptorSetLayoutBinding bindings[] = { cameraBind,sceneBind };
@@ -1088,7 +2060,7 @@ void VulkanEngine::init_descriptors()
 
 	vkCreateDescriptorSetLayout(_device, &setinfo, nullptr, &_globalSetLayout);
 
-	VkDescriptorSetLayoutBinding objectBind = vkinit::descriptorset_layout_binding(VK_DESCRIPTOR_TYPE_STORAGE_BUFFER, VK_SHADER_STAGE_VERTEX_BIT, 0);
+	VkDescriptorSetLayoutBinding objectBind = vkinit::descriptorset_layout_binding(VK_DESCRIPTOR_TYPE_STORAGE_BUFFER_DYNAMIC, VK_SHADER_STAGE_VERTEX_BIT, 0);
 
 	VkDescriptorSetLayoutCreateInfo set2info = {};
 	set2info.bindingCount = 1;
@@ -1111,17 +2083,12 @@ void VulkanEngine::init_descriptors()
 	vkCreateDescriptorSetLayout(_device, &set3info, nullptr, &_singleTextureSetLayout);
 
 
-	const size_t sceneParamBufferSize = FRAME_OVERLAP * pad_uniform_buffer_size(sizeof(GPUSceneData));
-
-	_sceneParameterBuffer = create_buffer(sceneParamBufferSize, VK_BUFFER_USAGE_UNIFORM_BUFFER_BIT, VMA_MEMORY_USAGE_CPU_TO_GPU);
-
+	// Slices of an arena are bound as uniform and storage buffers, so they have to meet both offset alignments
+	const VkDeviceSize arenaAlignment = std::max(_gpuProperties.limits.minUniformBufferOffsetAlignment, _gpuProperties.limits.minStorageBufferOffsetAlignment);
 
 	for (int i = 0; i < FRAME_OVERLAP; i++)
 	{
-		_frames[i].cameraBuffer = create_buffer(sizeof(GPUCameraData), VK_BUFFER_USAGE_UNIFORM_BUFFER_BIT, VMA_MEMORY_USAGE_CPU_TO_GPU);
-
-		const int MAX_OBJECTS = 10000;
-		_frames[i].objectBuffer = create_buffer(sizeof(GPUObjectData) * MAX_OBJECTS, VK_BUFFER_USAGE_STORAGE_BUFFER_BIT, VMA_MEMORY_USAGE_CPU_TO_GPU);
+		_frames[i].arena.init(_allocator, FRAME_ARENA_SIZE, VK_BUFFER_USAGE_UNIFORM_BUFFER_BIT | VK_BUFFER_USAGE_STORAGE_BUFFER_BIT, arenaAlignment);
 
 		VkDescriptorSetAllocateInfo allocInfo = {};
 		allocInfo.pNext = nullptr;
@@ -1142,26 +2109,26 @@ void VulkanEngine::init_descriptors()
 		vkAllocateDescriptorSets(_device, &objectSetAlloc, &_frames[i].objectDescriptor);
 
 		VkDescriptorBufferInfo cameraInfo;
-		cameraInfo.buffer = _frames[i].cameraBuffer._buffer;
+		cameraInfo.buffer = _frames[i].arena.buffer();
 		cameraInfo.offset = 0;
 		cameraInfo.range = sizeof(GPUCameraData);
 
 		VkDescriptorBufferInfo sceneInfo;
-		sceneInfo.buffer = _sceneParameterBuffer._buffer;
+		sceneInfo.buffer = _frames[i].arena.buffer();
 		sceneInfo.offset = 0;
 		sceneInfo.range = sizeof(GPUSceneData);
 
 		VkDescriptorBufferInfo objectBufferInfo;
-		objectBufferInfo.buffer = _frames[i].objectBuffer._buffer;
+		objectBufferInfo.buffer = _frames[i].arena.buffer();
 		objectBufferInfo.offset = 0;
 		objectBufferInfo.range = sizeof(GPUObjectData) * MAX_OBJECTS;
 
 
-		VkWriteDescriptorSet cameraWrite = vkinit::write_descriptor_buffer(VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER, _frames[i].globalDescriptor, &cameraInfo, 0);
+		VkWriteDescriptorSet cameraWrite = vkinit::write_descriptor_buffer(VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER_DYNAMIC, _frames[i].globalDescriptor, &cameraInfo, 0);
 
 		VkWriteDescriptorSet sceneWrite = vkinit::write_descriptor_buffer(VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER_DYNAMIC, _frames[i].globalDescriptor, &sceneInfo, 1);
 
-		VkWriteDescriptorSet objectWrite = vkinit::write_descriptor_buffer(VK_DESCRIPTOR_TYPE_STORAGE_BUFFER, _frames[i].objectDescriptor, &objectBufferInfo, 0);
+		VkWriteDescriptorSet objectWrite = vkinit::write_descriptor_buffer(VK_DESCRIPTOR_TYPE_STORAGE_BUFFER_DYNAMIC, _frames[i].objectDescriptor, &objectBufferInfo, 0);
 
 		VkWriteDescriptorSet setWrites[] = { cameraWrite,sceneWrite,objectWrite };
 
@@ -1171,8 +2138,6 @@ void VulkanEngine::init_descriptors()
 
 	_mainDeletionQueue.push_function([&]() {
 
-		vmaDestroyBuffer(_allocator, _sceneParameterBuffer._buffer, _sceneParameterBuffer._allocation);
-
 		vkDestroyDescriptorSetLayout(_device, _objectSetLayout, nullptr);
 		vkDestroyDescriptorSetLayout(_device, _globalSetLayout, nullptr);
 		vkDestroyDescriptorSetLayout(_device, _singleTextureSetLayout, nullptr);
@@ -1181,66 +2146,88 @@ void VulkanEngine::init_descriptors()
 
 		for (int i = 0; i < FRAME_OVERLAP; i++)
 		{
-			vmaDestroyBuffer(_allocator, _frames[i].cameraBuffer._buffer, _frames[i].cameraBuffer._allocation);
-
-			vmaDestroyBuffer(_allocator, _frames[i].objectBuffer._buffer, _frames[i].objectBuffer._allocation);
+			_frames[i].arena.cleanup();
 		}
 	});
 
 }
 
-size_t VulkanEngine::pad_uniform_buffer_size(size_t originalSize)
+void VulkanEngine::load_images(std::vector<ImageAsset>& assets)
 {
-	// Calculate required alignment based on minimum device offset alignment
-	size_t minUboAlignment = _gpuProperties.limits.minUniformBufferOffsetAlignment;
-	size_t alignedSize = originalSize;
-	if (minUboAlignment > 0) {
-		alignedSize = (alignedSize + minUboAlignment - 1) & ~(minUboAlignment - 1);
-	}
-	return alignedSize;
-}
-
-
-void VulkanEngine::immediate_submit(std::function<void(VkCommandBuffer cmd)>&& function)
-{
-	VkCommandBuffer cmd = _uploadContext._commandBuffer;
-
-	// Begin the command buffer recording. We will use this command buffer exactly once before resetting, so we tell vulkan that
-	VkCommandBufferBeginInfo cmdBeginInfo = vkinit::command_buffer_begin_info(VK_COMMAND_BUFFER_USAGE_ONE_TIME_SUBMIT_BIT);
+	// Every texture goes to the GPU in one submit
+	UploadBatch batch(_uploads);
 
-	VK_CHECK(vkBeginCommandBuffer(cmd, &cmdBeginInfo));
+	std::vector<uint32_t> decodedAssets;
+	std::vector<const DecodedImage*> decodedImages;
+	for (uint32_t i = 0; i < assets.size(); i++)
+	{
+		if (assets[i].decoded)
+		{
+			decodedAssets.push_back(i);
+			decodedImages.push_back(&assets[i].image);
+		}
+	}
 
-	// Execute the function
-	function(cmd);
+	// Textures that fit one array image share its view, and later the descriptor set of their materials
+	const std::vector<std::vector<uint32_t>> arrays = vkutil::pack_texture_arrays(decodedImages, _gpuProperties.limits.maxImageArrayLayers);
 
-	VK_CHECK(vkEndCommandBuffer(cmd));
+	std::vector<Texture> textures(arrays.size());
+	std::vector<VkImageViewCreateInfo> viewInfos(arrays.size());
+	for (size_t a = 0; a < arrays.size(); a++)
+	{
+		std::vector<DecodedImage*> layers;
+		for (uint32_t index : arrays[a])
+		{
+			layers.push_back(&assets[decodedAssets[index]].image);
+		}
 
-	VkSubmitInfo submit = vkinit::submit_info(&cmd);
+		const bool uploaded = vkutil::upload_image_array(*this, layers.data(), static_cast<uint32_t>(layers.size()), textures[a].image, batch);
+		if (uploaded)
+		{
+			// Uploads can change the format, when a block compressed image had to be transcoded
+			viewInfos[a] = vkinit::image_view_create_info(layers[0]->format, textures[a].image._image, VK_IMAGE_ASPECT_COLOR_BIT,
+				vkutil::uploaded_level_count(*layers[0]), static_cast<uint32_t>(layers.size()));
+			viewInfos[a].viewType = VK_IMAGE_VIEW_TYPE_2D_ARRAY;
+		}
 
+		for (uint32_t index : arrays[a])
+		{
+			assets[decodedAssets[index]].decoded = uploaded;
+		}
+	}
 
-	// Submit command buffer to the queue and execute it.
-	// _uploadFence will now block until the graphic commands finish execution
-	VK_CHECK(vkQueueSubmit(_graphicsQueue, 1, &submit, _uploadContext._uploadFence));
+	// The pixels are in staging memory now
+	for (ImageAsset& asset : assets)
+	{
+		asset.image.pixels.reset();
+		std::vector<unsigned char>().swap(asset.image.mips);
+	}
 
-	vkWaitForFences(_device, 1, &_uploadContext._uploadFence, true, 9999999999);
-	vkResetFences(_device, 1, &_uploadContext._uploadFence);
+	const UploadToken uploadToken = batch.submit();
 
-	// Reset the command buffers inside the command pool
-	vkResetCommandPool(_device, _uploadContext._commandPool, 0);
-}
+	for (size_t a = 0; a < arrays.size(); a++)
+	{
+		Texture& texture = textures[a];
+		if (!assets[decodedAssets[arrays[a][0]]].decoded)
+		{
+			continue;
+		}
 
-void VulkanEngine::load_images()
-{
-	Texture lostEmpire;
+		texture.uploadToken = uploadToken;
 
-	vkutil::load_image_from_file(*this, "../../assets/lost_empire-RGBA.png", lostEmpire.image);
+		vkCreateImageView(_device, &viewInfos[a], nullptr, &texture.imageView);
 
-	VkImageViewCreateInfo imageinfo = vkinit::image_view_create_info(VK_FORMAT_R8G8B8A8_SRGB, lostEmpire.image._image, VK_IMAGE_ASPECT_COLOR_BIT);
-	vkCreateImageView(_device, &imageinfo, nullptr, &lostEmpire.imageView);
+		const VkImageView imageView = texture.imageView;
+		_mainDeletionQueue.push_function([=]() {
+			vkDestroyImageView(_device, imageView, nullptr);
+		});
 
-	_mainDeletionQueue.push_function([=]() {
-		vkDestroyImageView(_device, lostEmpire.imageView, nullptr);
-	});
+		for (uint32_t layer = 0; layer < arrays[a].size(); layer++)
+		{
+			texture.layer = layer;
+			_loadedTextures[assets[decodedAssets[arrays[a][layer]]].name] = texture;
+		}
+	}
 
-	_loadedTextures["empire_diffuse"] = lostEmpire;
+	std::cout << "Packed " << decodedAssets.size() << " textures into " << arrays.size() << " texture arrays" << std::endl;
 }
\ No newline at end of file
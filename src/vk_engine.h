@@ -5,28 +5,59 @@
 
 #include <vk_types.h>
 #include "vk_mesh.h"
+#include "vk_upload.h"
+#include "vk_frame_arena.h"
+#include "vk_draw_sort.h"
+#include "vk_gpu_culling.h"
+#include "vk_host_image_copy.h"
+#include "vk_host_memory_import.h"
 
 #include <glm/glm.hpp>
 
 #include <functional>
+#include <mutex>
 #include <queue>
 #include <vector>
 
 constexpr unsigned int FRAME_OVERLAP = 2;
 
+// OBJ files at least this large are streamed to the GPU by stream_mesh_from_obj instead of loaded whole
+constexpr size_t STREAMING_IMPORT_MIN_SIZE = 256 * 1024 * 1024;
+
+// Vertices per batch of a streamed import, each batch takes this much of the staging ring
+constexpr size_t STREAMING_IMPORT_BATCH_VERTICES = 64 * 1024;
+
+// Size of each block of the geometry arena's vertex and index buffers. Meshes larger than a block get one of their own
+constexpr size_t GEOMETRY_VERTEX_BLOCK_SIZE = 128 * 1024 * 1024;
+constexpr size_t GEOMETRY_INDEX_BLOCK_SIZE = 64 * 1024 * 1024;
+
+// Size of the persistently mapped staging ring every upload copies from
+constexpr size_t UPLOAD_STAGING_SIZE = 64 * 1024 * 1024;
+
+// Draws of visible objects the object buffer of a frame holds, one entry per instance
+constexpr size_t MAX_OBJECTS = 10000;
+
+// Per-frame data each frame in flight can allocate: the camera, the scene parameters and MAX_OBJECTS objects with room to spare
+constexpr size_t FRAME_ARENA_SIZE = 1024 * 1024;
+
+// Frames between two prints of the CPU frame timings
+constexpr uint32_t FRAME_STATS_INTERVAL = 1000;
+
+// Meshes switch to a coarser level of detail once its error projects to less than this many pixels
+constexpr float LOD_MAX_PIXEL_ERROR = 1.0f;
+
+// Textures of the same format, size and levels are packed into one array image, image and imageView are shared by
+// every layer of it
 struct Texture {
 	AllocatedImage image;
 	VkImageView imageView;
-};
-
-struct UploadContext {
-	VkFence _uploadFence;
-	VkCommandPool _commandPool;
-	VkCommandBuffer _commandBuffer;
+	uint32_t layer{ 0 };
+	UploadToken uploadToken{ 0 };
 };
 
 struct GPUObjectData {
 	glm::mat4 modelMatrix;
+	glm::vec4 sphereBounds;		// Bounding sphere of the mesh in object space, for the GPU cull pass
 };
 
 struct GPUSceneData {
@@ -43,6 +74,26 @@ struct GPUCameraData {
 	glm::mat4 viewproj;
 };
 
+// Where a frame is seen from, shared by both draw paths and the cull pass
+struct FrameCamera {
+	glm::mat4 view;
+	glm::mat4 projection;
+	glm::vec3 position;
+	float pixelsPerUnitAtOne;	// Pixels one mesh unit covers at distance 1, for picking levels of detail
+};
+
+// Draws draw_objects recorded, the instances they drew and the binds they took since the last print. The used counts
+// are what binding everything for every draw would have taken
+struct DrawCounters {
+	size_t draws{ 0 };
+	size_t instances{ 0 };
+	size_t pipelineBinds{ 0 };
+	size_t descriptorSetBinds{ 0 };
+	size_t descriptorSetsUsed{ 0 };
+	size_t bufferBinds{ 0 };
+	size_t buffersUsed{ 0 };
+};
+
 struct FrameData {
 	VkSemaphore _presentSemaphore, _renderSemaphore;
 	VkFence _renderFence;
@@ -50,9 +101,8 @@ struct FrameData {
 	VkCommandPool _commandPool;
 	VkCommandBuffer _mainCommandBuffer;
 
-	// Buffer that holds a single GPUCameraData to use when rendering
-	AllocatedBuffer cameraBuffer;
-	AllocatedBuffer objectBuffer;
+	// Camera, scene parameters and object matrices of the frame, bound through dynamic offsets
+	FrameArena arena;
 
 	VkDescriptorSet objectDescriptor;
 
@@ -63,8 +113,13 @@ struct FrameData {
 //They are 64 bit handles to internal driver structures anyway so storing pointers to them isn't very useful
 struct Material {
 	VkDescriptorSet textureSet{ VK_NULL_HANDLE }; // Texture defaulted to null
+	uint32_t textureLayer{ 0 };						// Layer of the array in textureSet the material samples
 	VkPipeline pipeline;
+	VkPipeline compactPipeline{ VK_NULL_HANDLE };	// Same shading for meshes in VertexFormat::Compact
 	VkPipelineLayout pipelineLayout;
+
+	// Latest upload of the textures in textureSet
+	UploadToken uploadToken{ 0 };
 };
 
 struct RenderObject {
@@ -72,20 +127,48 @@ struct RenderObject {
 
 	Material* material;
 
+	// Used instead of material for the mesh's alpha tested submeshes. Null draws them with material too
+	Material* alphaTestedMaterial{ nullptr };
+
 	glm::mat4 transformMatrix;
 };
 
 struct MeshPushConstants
 {
-	glm::vec4 data;
+	glm::vec4 data;		// x is the texture layer of the material
 	glm::mat4 render_matrix;
+
+	// Dequantization of compact vertex positions, w unused
+	glm::vec4 positionOffset;
+	glm::vec4 positionScale;
+};
+
+// An OBJ file loaded at startup. It is parsed on a worker thread and uploaded afterwards by load_meshes
+struct MeshAsset {
+	std::string name;
+	std::string filename;
+	Mesh mesh;
+	bool parsed{ false };
+	bool loaded{ false };	// In the geometry arena, uploaded after parsing or streamed
+};
+
+// An image file loaded at startup, decoded on a worker thread and uploaded afterwards by load_images
+struct ImageAsset {
+	std::string name;
+	std::string filename;
+	DecodedImage image;
+	bool decoded{ false };
 };
 
 struct DeletionQueue
 {
 	std::deque<std::function<void()>> deletors;
 
+	// Startup tasks on different threads create objects at the same time
+	std::mutex mutex;
+
 	void push_function(std::function<void()>&& function) {
+		std::lock_guard<std::mutex> lock(mutex);
 		deletors.push_back(function);
 	}
 
@@ -126,6 +209,9 @@ public:
 	VkQueue _graphicsQueue;								// Queue that will be submitted to
 	uint32_t _graphicsQueueFamily;						// The family of the graphics queue
 
+	VkQueue _transferQueue;								// Queue uploads run on, the graphics queue if there is no separate one
+	uint32_t _transferQueueFamily;
+
 	VkRenderPass _renderPass;							// Vulkan renderpass
 	std::vector<VkFramebuffer> _framebuffers;			// Array of framebuffers
 
@@ -154,7 +240,18 @@ public:
 	VkFormat _depthFormat;
 
 	GPUSceneData _sceneParameters;
-	AllocatedBuffer _sceneParameterBuffer;
+
+	// CPU time of recording frames and, part of it, of writing their per-frame data since the last print
+	double _frameRecordMs{ 0.0 };
+	double _frameDataMs{ 0.0 };
+
+	// CPU time draw_objects spent culling and the objects it tested since the last print
+	double _frameCullMs{ 0.0 };
+	size_t _frameCulledObjects{ 0 };
+
+	// CPU time draw_objects spent sorting its draws, and what the sorted order saved, since the last print
+	double _frameSortMs{ 0.0 };
+	DrawCounters _drawCounters;
 
 	Mesh triangleMesh;
 	Mesh monkeyMesh;
@@ -162,11 +259,35 @@ public:
 	// Default array of renderable objects
 	std::vector<RenderObject> _renderables;
 
+	// Latest upload the meshes and material textures of _renderables read. Raised wherever meshes are uploaded or
+	// moved, materials get textures and objects are added, so draw_objects doesn't walk the objects to find it
+	UploadToken _sceneUploadToken{ 0 };
+
+	// World space bounding spheres of _renderables, in the same order, that draw_objects culls against
+	SphereBoundsTable _renderableBounds;
+
+	// Indices into _renderables of the objects draw_objects found in view this frame
+	std::vector<uint32_t> _visibleObjects;
+
+	// Draws of the visible objects, radix sorted by key before draw_objects records them
+	std::vector<DrawKey> _drawKeys;
+	std::vector<DrawKey> _drawKeyScratch;
+
+	// Ids of the state draw keys group by
+	DrawStateIds _pipelineIds;
+	DrawStateIds _textureSetIds;
+	DrawStateIds _meshIds;
+	DrawStateIds _materialIds;
+
 	std::unordered_map<std::string, Material> _materials;
 	std::unordered_map<std::string, Mesh> _meshes;
 
 	std::unordered_map<std::string, Texture> _loadedTextures;
 
+	// One descriptor set per texture array, shared by every material sampling one of its layers
+	std::unordered_map<VkImageView, VkDescriptorSet> _textureSets;
+	VkSampler _textureSampler{ VK_NULL_HANDLE };
+
 	// Getter for the frame currently being rendered
 	FrameData& get_current_frame();
 
@@ -179,27 +300,101 @@ public:
 	// Returns nullptr if it can't be found
 	Mesh* get_mesh(const std::string& name);
 
-	UploadContext _uploadContext;
+	// Point a material at a loaded texture, through the descriptor set of the array it was packed into
+	void set_material_texture(Material* material, const std::string& textureName);
+
+	// Uploads to GPU memory, submitted on the transfer queue without waiting for them
+	UploadService _uploads;
+
+	// Texture uploads without staging, on GPUs with VK_EXT_host_image_copy
+	HostImageCopy _hostImageCopy;
+
+	// Cooked mesh uploads straight out of their file mappings, on GPUs with VK_EXT_external_memory_host
+	HostMemoryImport _hostMemoryImport;
+
+	// Vertex and index buffers shared by every mesh
+	GeometryArena _geometry;
+
+	// Frustum culling and draw generation in a compute pass, on GPUs with indirect count draws
+	GpuCulling _culling;
+
+	// Draw through _culling when it is available. C switches between it and draw_objects
+	bool _useGpuCulling{ true };
 
-	void immediate_submit(std::function<void(VkCommandBuffer cmd)>&& function);
+	// _culling was built from mesh ranges that have been freed since. draw rebuilds it before the next cull
+	bool _cullingDirty{ false };
+
+	// Return a mesh's vertices and indices to the geometry arena once the frames drawing it have finished
+	void free_mesh(Mesh& mesh);
+
+	// Pack the geometry of every mesh in _meshes into one vertex and one index block. Waits for the GPU to go idle
+	void compact_geometry();
+
+	// Build _culling again from _renderables and the current mesh ranges. Waits for the GPU to go idle
+	void rebuild_culling();
 
 	AllocatedBuffer create_buffer(size_t allocSize, VkBufferUsageFlags usage, VmaMemoryUsage memoryUsage);
 
 	void init_descriptors();
 
-	// Draw function
+	// Draw function. Objects outside the camera frustum are skipped when first and count are the _renderables
+	// _renderableBounds was built from. Draws are recorded in draw key order, whatever order the objects come in,
+	// and consecutive draws of the same mesh, submesh, material and level of detail become one instanced draw
 	void draw_objects(VkCommandBuffer cmd, RenderObject* first, int count);
 
+	// Rebuild _renderableBounds, after _renderables or their transforms change
+	void update_renderable_bounds();
+
+	// Draw the scene _culling was built from, one indirect count draw per batch of its cull pass
+	void draw_objects_indirect(VkCommandBuffer cmd, const uint32_t globalOffsets[2]);
+
+	// Camera of the current frame
+	FrameCamera frame_camera() const;
+
+	// Write the camera and scene parameters into the frame's arena. outOffsets are the dynamic offsets of set 0.
+	// False when the arena is full
+	bool write_global_data(const FrameCamera& camera, uint32_t outOffsets[2]);
+
+	// World space boxes of a batch of objects, one per object, from their mesh bounds and transforms
+	void compute_world_bounds(const RenderObject* first, int count, std::vector<AABB>& outBounds);
+
+	// How many pixels one mesh unit of an object covers at its closest point, for picking levels of detail.
+	// FLT_MAX when the camera is inside the object's bounds
+	float pixels_per_unit(const RenderObject& object, const glm::vec3& cameraPosition, float pixelsPerUnitAtOne);
+
+	// Material a submesh of an object is drawn with. submesh is null for meshes without submeshes
+	Material* draw_material(const RenderObject& object, const Submesh* submesh) const;
+
 	// Load a shader module from a spir-v file. Returns fasle if any errors occur
 	bool load_shader_module(const char* filepath, VkShaderModule* outShaderModule);
 
-	void load_meshes();
+	// Upload parsed meshes and the triangle in one batch and add them to _meshes. Assets of STREAMING_IMPORT_MIN_SIZE
+	// and up weren't parsed and go through stream_mesh_from_obj, which submits on its own
+	void load_meshes(std::vector<MeshAsset>& assets);
+
+	// Upload decoded images in one batch and add them to _loadedTextures, packed into as few array images as
+	// vkutil::pack_texture_arrays manages
+	void load_images(std::vector<ImageAsset>& assets);
+
+	// Record the copies of a mesh's buffers into batch. The mesh's upload token is set when the batch submits.
+	// Cooked meshes are copied in place from their file mapping when the GPU can import it
+	void upload_meshes(Mesh& mesh, UploadBatch& batch);
+
+	// Parse an asset's OBJ without touching engine state, so assets can parse on several threads at once.
+	// Leaves streamed imports for load_meshes
+	void parse_mesh_asset(MeshAsset& asset, const MeshLoadOptions& options);
 
-	void load_images();
+	// True for OBJ files large enough to go through stream_mesh_from_obj
+	bool is_streamed_import(const char* filename);
 
-	void upload_meshes(Mesh& mesh);
+	// Parse an OBJ straight into a persistently mapped staging buffer, copying each full batch into the vertex buffer.
+	// Peak memory is the staging buffer and the OBJ attributes, never the whole vertex array. Vertices stay in file
+	// order with full precision, and an index buffer groups them into one submesh per material. Welding, levels of
+	// detail and the other cooking steps need the whole mesh at once
+	bool stream_mesh_from_obj(Mesh& mesh, const char* filename);
 
-	size_t pad_uniform_buffer_size(size_t originalSize);
+	// True if the GPU can fetch the CompactVertex attribute formats from vertex buffers
+	bool supports_compact_vertices();
 
 
 	//initializes everything in the engine
@@ -0,0 +1,63 @@
+#include "vk_frame_arena.h"
+
+void FrameArena::init(VmaAllocator allocator, VkDeviceSize size, VkBufferUsageFlags usage, VkDeviceSize alignment)
+{
+	_allocator = allocator;
+	_size = size;
+	_alignment = alignment > 0 ? alignment : 1;
+	_head = 0;
+
+	VkBufferCreateInfo bufferInfo = {};
+	bufferInfo.sType = VK_STRUCTURE_TYPE_BUFFER_CREATE_INFO;
+	bufferInfo.pNext = nullptr;
+	bufferInfo.size = size;
+	bufferInfo.usage = usage;
+
+	// Mapped for as long as it lives
+	VmaAllocationCreateInfo vmaallocInfo = {};
+	vmaallocInfo.usage = VMA_MEMORY_USAGE_CPU_TO_GPU;
+	vmaallocInfo.flags = VMA_ALLOCATION_CREATE_MAPPED_BIT;
+
+	VmaAllocationInfo allocationInfo;
+	VK_CHECK(vmaCreateBuffer(_allocator, &bufferInfo, &vmaallocInfo, &_buffer._buffer, &_buffer._allocation, &allocationInfo));
+	_data = static_cast<char*>(allocationInfo.pMappedData);
+
+	VkMemoryPropertyFlags memoryFlags;
+	vmaGetMemoryTypeProperties(_allocator, allocationInfo.memoryType, &memoryFlags);
+	_coherent = (memoryFlags & VK_MEMORY_PROPERTY_HOST_COHERENT_BIT) != 0;
+}
+
+void FrameArena::cleanup()
+{
+	if (_buffer._buffer != VK_NULL_HANDLE)
+	{
+		vmaDestroyBuffer(_allocator, _buffer._buffer, _buffer._allocation);
+	}
+	_buffer = {};
+	_data = nullptr;
+}
+
+void FrameArena::reset()
+{
+	_head = 0;
+}
+
+FrameSlice FrameArena::allocate(VkDeviceSize size)
+{
+	const VkDeviceSize offset = (_head + _alignment - 1) / _alignment * _alignment;
+	if (offset + size > _size)
+	{
+		return {};
+	}
+
+	_head = offset + size;
+	return { _data + offset, offset };
+}
+
+void FrameArena::flush()
+{
+	if (!_coherent && _head > 0)
+	{
+		vmaFlushAllocation(_allocator, _buffer._allocation, 0, _head);
+	}
+}
@@ -0,0 +1,46 @@
+#pragma once
+
+#include <vk_types.h>
+
+#include <cstdint>
+
+// A slice of a frame arena. Shaders read it through a dynamic descriptor with offset as its dynamic offset
+struct FrameSlice {
+	void* data{ nullptr };
+	VkDeviceSize offset{ 0 };
+
+	bool valid() const { return data != nullptr; }
+};
+
+// Persistently mapped buffer that one frame in flight bump allocates its per-frame data from. Writing that data is
+// plain stores: nothing is mapped, unmapped or freed while running, reset() rewinds the arena once the frame's fence
+// says the GPU is done with it
+class FrameArena {
+public:
+	// Slices start on a multiple of alignment, which has to cover the offset alignment of every descriptor type
+	// the buffer is bound as
+	void init(VmaAllocator allocator, VkDeviceSize size, VkBufferUsageFlags usage, VkDeviceSize alignment);
+	void cleanup();
+
+	// Start over from the front. Only once the GPU has finished the frame that used the arena last
+	void reset();
+
+	// size bytes at the next aligned offset. Invalid when the arena is full
+	FrameSlice allocate(VkDeviceSize size);
+
+	// Make the frame's writes visible to the GPU, before the submit that reads them. Free on host coherent memory
+	void flush();
+
+	VkBuffer buffer() const { return _buffer._buffer; }
+	VkDeviceSize used() const { return _head; }
+	VkDeviceSize capacity() const { return _size; }
+
+private:
+	VmaAllocator _allocator{ VK_NULL_HANDLE };
+	AllocatedBuffer _buffer{};
+	char* _data{ nullptr };
+	VkDeviceSize _size{ 0 };
+	VkDeviceSize _alignment{ 1 };
+	VkDeviceSize _head{ 0 };
+	bool _coherent{ true };
+};
@@ -0,0 +1,378 @@
+#include "vk_geometry_arena.h"
+
+#include <algorithm>
+#include <iostream>
+
+namespace {
+
+	VkDeviceSize align_up(VkDeviceSize value, VkDeviceSize alignment)
+	{
+		return (value + alignment - 1) / alignment * alignment;
+	}
+}
+
+void OffsetAllocator::init(VkDeviceSize capacity)
+{
+	_capacity = capacity;
+	_freeSpace = capacity;
+	_freeByOffset.clear();
+	_freeBySize.clear();
+	insert_free(0, capacity);
+}
+
+bool OffsetAllocator::allocate(VkDeviceSize size, VkDeviceSize alignment, VkDeviceSize& outOffset)
+{
+	if (size == 0)
+	{
+		outOffset = 0;
+		return true;
+	}
+
+	// Smallest blocks first. One that is big enough can still fail once its start is aligned, so keep looking
+	for (auto it = _freeBySize.lower_bound(size); it != _freeBySize.end(); ++it)
+	{
+		const VkDeviceSize blockOffset = it->second;
+		const VkDeviceSize blockSize = it->first;
+		const VkDeviceSize offset = align_up(blockOffset, alignment);
+		const VkDeviceSize padding = offset - blockOffset;
+		if (padding + size > blockSize)
+		{
+			continue;
+		}
+
+		erase_free(_freeByOffset.find(blockOffset));
+
+		// The padding in front and whatever is left behind stay free
+		if (padding > 0)
+		{
+			insert_free(blockOffset, padding);
+		}
+		if (padding + size < blockSize)
+		{
+			insert_free(offset + size, blockSize - padding - size);
+		}
+
+		_freeSpace -= size;
+		outOffset = offset;
+		return true;
+	}
+
+	return false;
+}
+
+void OffsetAllocator::free(VkDeviceSize offset, VkDeviceSize size)
+{
+	if (size == 0)
+	{
+		return;
+	}
+
+	_freeSpace += size;
+
+	// Merge with the free blocks right behind and right in front
+	auto next = _freeByOffset.lower_bound(offset);
+	if (next != _freeByOffset.end() && offset + size == next->first)
+	{
+		size += next->second;
+		erase_free(next);
+	}
+
+	auto previous = _freeByOffset.lower_bound(offset);
+	if (previous != _freeByOffset.begin())
+	{
+		--previous;
+		if (previous->first + previous->second == offset)
+		{
+			offset = previous->first;
+			size += previous->second;
+			erase_free(previous);
+		}
+	}
+
+	insert_free(offset, size);
+}
+
+VkDeviceSize OffsetAllocator::largest_free_block() const
+{
+	return _freeBySize.empty() ? 0 : _freeBySize.rbegin()->first;
+}
+
+void OffsetAllocator::insert_free(VkDeviceSize offset, VkDeviceSize size)
+{
+	_freeByOffset.emplace(offset, size);
+	_freeBySize.emplace(size, offset);
+}
+
+void OffsetAllocator::erase_free(std::map<VkDeviceSize, VkDeviceSize>::iterator block)
+{
+	auto sizes = _freeBySize.equal_range(block->second);
+	for (auto it = sizes.first; it != sizes.second; ++it)
+	{
+		if (it->second == block->first)
+		{
+			_freeBySize.erase(it);
+			break;
+		}
+	}
+	_freeByOffset.erase(block);
+}
+
+void GeometryArena::init(VkDevice device, VmaAllocator allocator, UploadService& uploads, uint32_t graphicsQueueFamily, uint32_t transferQueueFamily,
+	VkDeviceSize vertexBlockSize, VkDeviceSize indexBlockSize, uint32_t framesInFlight)
+{
+	_device = device;
+	_allocator = allocator;
+	_uploads = &uploads;
+	_framesInFlight = framesInFlight;
+
+	_queueFamilies[0] = graphicsQueueFamily;
+	_queueFamilies[1] = transferQueueFamily;
+	_queueFamilyCount = graphicsQueueFamily == transferQueueFamily ? 1 : 2;
+
+	// Compaction copies out of the old blocks, so every block is a transfer source too
+	PoolData& vertexPool = _pools[static_cast<uint32_t>(Pool::Vertex)];
+	vertexPool.name = "vertex";
+	vertexPool.usage = VK_BUFFER_USAGE_VERTEX_BUFFER_BIT | VK_BUFFER_USAGE_TRANSFER_DST_BIT | VK_BUFFER_USAGE_TRANSFER_SRC_BIT;
+	vertexPool.blockSize = vertexBlockSize;
+
+	PoolData& indexPool = _pools[static_cast<uint32_t>(Pool::Index)];
+	indexPool.name = "index";
+	indexPool.usage = VK_BUFFER_USAGE_INDEX_BUFFER_BIT | VK_BUFFER_USAGE_TRANSFER_DST_BIT | VK_BUFFER_USAGE_TRANSFER_SRC_BIT;
+	indexPool.blockSize = indexBlockSize;
+
+	for (PoolData& pool : _pools)
+	{
+		pool.blocks.push_back(create_block(pool, pool.blockSize));
+	}
+}
+
+void GeometryArena::cleanup()
+{
+	for (PoolData& pool : _pools)
+	{
+		for (Block& block : pool.blocks)
+		{
+			vmaDestroyBuffer(_allocator, block.buffer._buffer, block.buffer._allocation);
+		}
+		pool.blocks.clear();
+	}
+	_pendingFrees.clear();
+}
+
+GeometryArena::Block GeometryArena::create_block(const PoolData& pool, VkDeviceSize size)
+{
+	VkBufferCreateInfo bufferInfo = {};
+	bufferInfo.sType = VK_STRUCTURE_TYPE_BUFFER_CREATE_INFO;
+	bufferInfo.pNext = nullptr;
+	bufferInfo.size = size;
+	bufferInfo.usage = pool.usage;
+
+	// Shared instead of exclusive, ownership transfers of a whole block would stall the frames drawing from it
+	if (_queueFamilyCount > 1)
+	{
+		bufferInfo.sharingMode = VK_SHARING_MODE_CONCURRENT;
+		bufferInfo.queueFamilyIndexCount = _queueFamilyCount;
+		bufferInfo.pQueueFamilyIndices = _queueFamilies;
+	}
+
+	VmaAllocationCreateInfo vmaallocInfo = {};
+	vmaallocInfo.usage = VMA_MEMORY_USAGE_GPU_ONLY;
+
+	Block block;
+	VK_CHECK(vmaCreateBuffer(_allocator, &bufferInfo, &vmaallocInfo,
+		&block.buffer._buffer,
+		&block.buffer._allocation,
+		nullptr));
+
+	block.allocator.init(size);
+	return block;
+}
+
+GeometryRange GeometryArena::allocate(Pool pool, VkDeviceSize count, VkDeviceSize elementSize)
+{
+	PoolData& data = _pools[static_cast<uint32_t>(pool)];
+
+	GeometryRange range;
+	range.size = count * elementSize;
+	range.elementSize = elementSize;
+
+	for (uint32_t i = 0; i < data.blocks.size(); i++)
+	{
+		if (data.blocks[i].allocator.allocate(range.size, elementSize, range.offset))
+		{
+			range.block = i;
+			return range;
+		}
+	}
+
+	// A new block instead of a bigger one, copies already recorded against the old blocks stay valid
+	const VkDeviceSize blockSize = std::max(data.blockSize, range.size);
+	data.blocks.push_back(create_block(data, blockSize));
+	range.block = static_cast<uint32_t>(data.blocks.size() - 1);
+	data.blocks.back().allocator.allocate(range.size, elementSize, range.offset);
+
+	std::cout << "Geometry arena added " << data.name << " block " << range.block << " of " << blockSize / (1024 * 1024) << " MB" << std::endl;
+
+	return range;
+}
+
+void GeometryArena::free(Pool pool, GeometryRange& range)
+{
+	if (!range.valid())
+	{
+		return;
+	}
+
+	_pendingFrees.push_back(PendingFree{ pool, range, _frameNumber });
+	range = GeometryRange{};
+}
+
+void GeometryArena::shrink(Pool pool, GeometryRange& range, VkDeviceSize newSize)
+{
+	if (!range.valid() || newSize >= range.size)
+	{
+		return;
+	}
+
+	_pools[static_cast<uint32_t>(pool)].blocks[range.block].allocator.free(range.offset + newSize, range.size - newSize);
+	range.size = newSize;
+}
+
+void GeometryArena::begin_frame(uint64_t frameNumber)
+{
+	_frameNumber = frameNumber;
+
+	// A range freed during frame N is last drawn by frame N, which has finished once frame N + framesInFlight starts
+	auto released = std::remove_if(_pendingFrees.begin(), _pendingFrees.end(), [&](const PendingFree& pending) {
+		if (pending.frame + _framesInFlight > frameNumber)
+		{
+			return false;
+		}
+
+		_pools[static_cast<uint32_t>(pending.pool)].blocks[pending.range.block].allocator.free(pending.range.offset, pending.range.size);
+		return true;
+	});
+	_pendingFrees.erase(released, _pendingFrees.end());
+}
+
+UploadToken GeometryArena::compact(const std::vector<GeometryRange*>& vertexRanges, const std::vector<GeometryRange*>& indexRanges)
+{
+	// Nothing can be drawing from the old blocks or freed ranges once the GPU is idle
+	VK_CHECK(vkDeviceWaitIdle(_device));
+
+	for (const PendingFree& pending : _pendingFrees)
+	{
+		_pools[static_cast<uint32_t>(pending.pool)].blocks[pending.range.block].allocator.free(pending.range.offset, pending.range.size);
+	}
+	_pendingFrees.clear();
+
+	std::vector<BlockCopy> copies;
+	std::vector<Block> retired;
+	compact_pool(_pools[static_cast<uint32_t>(Pool::Vertex)], vertexRanges, copies, retired);
+	compact_pool(_pools[static_cast<uint32_t>(Pool::Index)], indexRanges, copies, retired);
+
+	VmaAllocator allocator = _allocator;
+	auto destroyRetired = [=]() {
+		for (const Block& block : retired)
+		{
+			vmaDestroyBuffer(allocator, block.buffer._buffer, block.buffer._allocation);
+		}
+	};
+
+	if (copies.empty())
+	{
+		destroyRetired();
+		return 0;
+	}
+
+	// Copies are in source block order, so each source and destination pair is one command
+	const UploadToken token = _uploads->submit([=](VkCommandBuffer cmd) {
+		std::vector<VkBufferCopy> regions;
+		for (size_t i = 0; i < copies.size();)
+		{
+			const BlockCopy& first = copies[i];
+			regions.clear();
+			for (; i < copies.size() && copies[i].source == first.source && copies[i].destination == first.destination; i++)
+			{
+				regions.push_back(copies[i].region);
+			}
+			vkCmdCopyBuffer(cmd, first.source, first.destination, static_cast<uint32_t>(regions.size()), regions.data());
+		}
+	});
+
+	_uploads->on_complete(token, std::move(destroyRetired));
+
+	print_stats();
+
+	return token;
+}
+
+void GeometryArena::compact_pool(PoolData& pool, const std::vector<GeometryRange*>& ranges, std::vector<BlockCopy>& outCopies, std::vector<Block>& outRetired)
+{
+	// One block with one hole has nothing to gain
+	if (pool.blocks.size() <= 1 && pool.blocks[0].allocator.free_space() == pool.blocks[0].allocator.largest_free_block())
+	{
+		return;
+	}
+
+	std::vector<GeometryRange*> live;
+	for (GeometryRange* range : ranges)
+	{
+		if (range->valid() && range->size > 0)
+		{
+			live.push_back(range);
+		}
+	}
+
+	// Block and offset order, so the copies out of each old block are contiguous
+	std::sort(live.begin(), live.end(), [](const GeometryRange* a, const GeometryRange* b) {
+		return a->block != b->block ? a->block < b->block : a->offset < b->offset;
+	});
+
+	VkDeviceSize packedSize = 0;
+	for (const GeometryRange* range : live)
+	{
+		packedSize = align_up(packedSize, range->elementSize) + range->size;
+	}
+
+	Block block = create_block(pool, std::max(pool.blockSize, packedSize));
+
+	for (GeometryRange* range : live)
+	{
+		VkDeviceSize offset;
+		block.allocator.allocate(range->size, range->elementSize, offset);
+
+		VkBufferCopy region;
+		region.srcOffset = range->offset;
+		region.dstOffset = offset;
+		region.size = range->size;
+		outCopies.push_back(BlockCopy{ pool.blocks[range->block].buffer._buffer, block.buffer._buffer, region });
+
+		range->block = 0;
+		range->offset = offset;
+	}
+
+	outRetired.insert(outRetired.end(), pool.blocks.begin(), pool.blocks.end());
+	pool.blocks.clear();
+	pool.blocks.push_back(block);
+}
+
+void GeometryArena::print_stats() const
+{
+	for (const PoolData& pool : _pools)
+	{
+		VkDeviceSize capacity = 0;
+		VkDeviceSize freeSpace = 0;
+		VkDeviceSize largestFree = 0;
+		for (const Block& block : pool.blocks)
+		{
+			capacity += block.allocator.capacity();
+			freeSpace += block.allocator.free_space();
+			largestFree = std::max(largestFree, block.allocator.largest_free_block());
+		}
+
+		std::cout << "Geometry arena " << pool.name << " pool: " << pool.blocks.size() << " blocks, "
+			<< (capacity - freeSpace) / 1024 << " of " << capacity / 1024 << " KB used, largest free range "
+			<< largestFree / 1024 << " KB" << std::endl;
+	}
+}
@@ -0,0 +1,128 @@
+#pragma once
+
+#include <vk_types.h>
+#include "vk_upload.h"
+
+#include <cstdint>
+#include <map>
+#include <vector>
+
+// Hands out ranges of a fixed size address space. Free space is kept sorted by offset, to merge neighbours on free,
+// and by size, for best fit allocation
+class OffsetAllocator {
+public:
+	void init(VkDeviceSize capacity);
+
+	// Best fit block that can hold size bytes at a multiple of alignment. Any alignment works, not just powers of two,
+	// so vertex ranges can start on a whole vertex. Returns false when no free block is large enough
+	bool allocate(VkDeviceSize size, VkDeviceSize alignment, VkDeviceSize& outOffset);
+
+	void free(VkDeviceSize offset, VkDeviceSize size);
+
+	VkDeviceSize capacity() const { return _capacity; }
+	VkDeviceSize free_space() const { return _freeSpace; }
+	VkDeviceSize largest_free_block() const;
+
+private:
+	void insert_free(VkDeviceSize offset, VkDeviceSize size);
+	void erase_free(std::map<VkDeviceSize, VkDeviceSize>::iterator block);
+
+	VkDeviceSize _capacity{ 0 };
+	VkDeviceSize _freeSpace{ 0 };
+
+	std::map<VkDeviceSize, VkDeviceSize> _freeByOffset;		// Offset to size
+	std::multimap<VkDeviceSize, VkDeviceSize> _freeBySize;	// Size to offset
+};
+
+// Part of one of the arena's buffers. Ranges start on a multiple of their element size, a vertex stride or an index
+// size, so the draw's base vertex or first index is offset / elementSize
+struct GeometryRange {
+	uint32_t block{ UINT32_MAX };
+	VkDeviceSize offset{ 0 };
+	VkDeviceSize size{ 0 };
+	VkDeviceSize elementSize{ 1 };
+
+	bool valid() const { return block != UINT32_MAX; }
+	uint32_t first_element() const { return static_cast<uint32_t>(offset / elementSize); }
+};
+
+// Large vertex and index buffers that every mesh is suballocated from, so draws bind them once and select their
+// geometry with base vertex and first index. A pool gets another block only when a range doesn't fit its blocks,
+// which keeps batched copies that already point into a block valid. compact() moves every live range into one block
+class GeometryArena {
+public:
+	enum class Pool : uint32_t {
+		Vertex,
+		Index,
+	};
+
+	// The buffers are shared by both queue families, so uploads write new ranges while frames read others
+	void init(VkDevice device, VmaAllocator allocator, UploadService& uploads, uint32_t graphicsQueueFamily, uint32_t transferQueueFamily,
+		VkDeviceSize vertexBlockSize, VkDeviceSize indexBlockSize, uint32_t framesInFlight);
+
+	void cleanup();
+
+	// Range for count elements of elementSize bytes. Adds a block to the pool if none has room
+	GeometryRange allocate(Pool pool, VkDeviceSize count, VkDeviceSize elementSize);
+
+	// Free a range once the frames that might still draw from it have finished
+	void free(Pool pool, GeometryRange& range);
+
+	// Give the end of a range back right away. Only for space that was never written or drawn from
+	void shrink(Pool pool, GeometryRange& range, VkDeviceSize newSize);
+
+	// Call at the start of every frame, after waiting for the frame that used the same resources. Releases old frees
+	void begin_frame(uint64_t frameNumber);
+
+	VkBuffer buffer(Pool pool, uint32_t block) const { return _pools[static_cast<uint32_t>(pool)].blocks[block].buffer._buffer; }
+
+	// Move every live range into a single block per pool and update the ranges. Nothing may have been recorded
+	// against the current blocks that isn't submitted yet. Waits for the GPU to go idle, so only call it between
+	// levels or after unloading. Returns the copy's upload token, 0 if nothing moved
+	UploadToken compact(const std::vector<GeometryRange*>& vertexRanges, const std::vector<GeometryRange*>& indexRanges);
+
+	void print_stats() const;
+
+private:
+	struct Block {
+		AllocatedBuffer buffer;
+		OffsetAllocator allocator;
+	};
+
+	struct PoolData {
+		const char* name;
+		VkBufferUsageFlags usage;
+		VkDeviceSize blockSize;
+		std::vector<Block> blocks;
+	};
+
+	struct BlockCopy {
+		VkBuffer source;
+		VkBuffer destination;
+		VkBufferCopy region;
+	};
+
+	struct PendingFree {
+		Pool pool;
+		GeometryRange range;
+		uint64_t frame;
+	};
+
+	Block create_block(const PoolData& pool, VkDeviceSize size);
+
+	// Pack one pool's ranges into a new block, adding the copies that move them. Leaves a pool that is already
+	// packed alone
+	void compact_pool(PoolData& pool, const std::vector<GeometryRange*>& ranges, std::vector<BlockCopy>& outCopies, std::vector<Block>& outRetired);
+
+	VkDevice _device{ VK_NULL_HANDLE };
+	VmaAllocator _allocator{ VK_NULL_HANDLE };
+	UploadService* _uploads{ nullptr };
+	uint32_t _queueFamilies[2];
+	uint32_t _queueFamilyCount{ 1 };
+
+	PoolData _pools[2];
+
+	uint32_t _framesInFlight{ 1 };
+	uint64_t _frameNumber{ 0 };
+	std::vector<PendingFree> _pendingFrees;
+};
@@ -0,0 +1,375 @@
+#include "vk_gpu_culling.h"
+
+#include "vk_engine.h"
+#include "vk_initializers.h"
+
+#include <algorithm>
+#include <cstring>
+#include <map>
+#include <tuple>
+
+namespace {
+
+	// local_size_x of cull.comp
+	constexpr uint32_t CULL_GROUP_SIZE = 64;
+
+	// Objects, records and batches in, commands and counts out
+	constexpr uint32_t CULL_BINDING_COUNT = 5;
+
+	// Level 0 of a submesh drawn with a material, and how many levels follow it
+	struct BatchChain {
+		uint32_t firstBatch;
+		uint32_t lodCount;
+	};
+}
+
+bool GpuCulling::query(VkPhysicalDevice gpu, VkPhysicalDeviceFeatures& features)
+{
+	VkPhysicalDeviceVulkan12Features vulkan12Features = {};
+	vulkan12Features.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_VULKAN_1_2_FEATURES;
+
+	VkPhysicalDeviceFeatures2 supported = {};
+	supported.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_FEATURES_2;
+	supported.pNext = &vulkan12Features;
+	vkGetPhysicalDeviceFeatures2(gpu, &supported);
+
+	// Each batch is one draw of many commands, and every command picks its object through firstInstance
+	_supported = vulkan12Features.drawIndirectCount && supported.features.multiDrawIndirect && supported.features.drawIndirectFirstInstance;
+	if (_supported)
+	{
+		features.multiDrawIndirect = VK_TRUE;
+		features.drawIndirectFirstInstance = VK_TRUE;
+	}
+	return _supported;
+}
+
+void GpuCulling::init(VkDevice device, VmaAllocator allocator, VkDescriptorSetLayout objectSetLayout, VkShaderModule cullShader)
+{
+	_device = device;
+	_allocator = allocator;
+
+	if (!_supported)
+	{
+		return;
+	}
+
+	VkDescriptorSetLayoutBinding bindings[CULL_BINDING_COUNT];
+	for (uint32_t i = 0; i < CULL_BINDING_COUNT; i++)
+	{
+		bindings[i] = vkinit::descriptorset_layout_binding(VK_DESCRIPTOR_TYPE_STORAGE_BUFFER, VK_SHADER_STAGE_COMPUTE_BIT, i);
+	}
+
+	VkDescriptorSetLayoutCreateInfo setInfo = {};
+	setInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_LAYOUT_CREATE_INFO;
+	setInfo.pNext = nullptr;
+	setInfo.flags = 0;
+	setInfo.bindingCount = CULL_BINDING_COUNT;
+	setInfo.pBindings = bindings;
+
+	VK_CHECK(vkCreateDescriptorSetLayout(_device, &setInfo, nullptr, &_cullSetLayout));
+
+	// The cull set and the graphics object set
+	std::vector<VkDescriptorPoolSize> sizes = {
+		{ VK_DESCRIPTOR_TYPE_STORAGE_BUFFER, CULL_BINDING_COUNT },
+		{ VK_DESCRIPTOR_TYPE_STORAGE_BUFFER_DYNAMIC, 1 }
+	};
+
+	VkDescriptorPoolCreateInfo poolInfo = {};
+	poolInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_POOL_CREATE_INFO;
+	poolInfo.flags = 0;
+	poolInfo.maxSets = 2;
+	poolInfo.poolSizeCount = static_cast<uint32_t>(sizes.size());
+	poolInfo.pPoolSizes = sizes.data();
+
+	VK_CHECK(vkCreateDescriptorPool(_device, &poolInfo, nullptr, &_descriptorPool));
+
+	VkDescriptorSetLayout setLayouts[] = { _cullSetLayout, objectSetLayout };
+	VkDescriptorSet sets[2];
+
+	VkDescriptorSetAllocateInfo allocInfo = {};
+	allocInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_ALLOCATE_INFO;
+	allocInfo.pNext = nullptr;
+	allocInfo.descriptorPool = _descriptorPool;
+	allocInfo.descriptorSetCount = 2;
+	allocInfo.pSetLayouts = setLayouts;
+
+	VK_CHECK(vkAllocateDescriptorSets(_device, &allocInfo, sets));
+	_cullSet = sets[0];
+	_objectSet = sets[1];
+
+	VkPushConstantRange pushConstant;
+	pushConstant.offset = 0;
+	pushConstant.size = sizeof(GPUCullData);
+	pushConstant.stageFlags = VK_SHADER_STAGE_COMPUTE_BIT;
+
+	VkPipelineLayoutCreateInfo layoutInfo = vkinit::pipeline_layout_create_info();
+	layoutInfo.setLayoutCount = 1;
+	layoutInfo.pSetLayouts = &_cullSetLayout;
+	layoutInfo.pushConstantRangeCount = 1;
+	layoutInfo.pPushConstantRanges = &pushConstant;
+
+	VK_CHECK(vkCreatePipelineLayout(_device, &layoutInfo, nullptr, &_pipelineLayout));
+
+	VkComputePipelineCreateInfo pipelineInfo = {};
+	pipelineInfo.sType = VK_STRUCTURE_TYPE_COMPUTE_PIPELINE_CREATE_INFO;
+	pipelineInfo.pNext = nullptr;
+	pipelineInfo.stage = vkinit::pipeline_shader_stage_create_info(VK_SHADER_STAGE_COMPUTE_BIT, cullShader);
+	pipelineInfo.layout = _pipelineLayout;
+
+	VK_CHECK(vkCreateComputePipelines(_device, VK_NULL_HANDLE, 1, &pipelineInfo, nullptr, &_pipeline));
+}
+
+void GpuCulling::cleanup()
+{
+	destroy_buffers();
+
+	if (_pipeline != VK_NULL_HANDLE)
+	{
+		vkDestroyPipeline(_device, _pipeline, nullptr);
+		vkDestroyPipelineLayout(_device, _pipelineLayout, nullptr);
+		vkDestroyDescriptorPool(_device, _descriptorPool, nullptr);
+		vkDestroyDescriptorSetLayout(_device, _cullSetLayout, nullptr);
+	}
+	_pipeline = VK_NULL_HANDLE;
+}
+
+bool GpuCulling::build(const RenderObject* objects, size_t count, UploadService& uploads)
+{
+	if (!available())
+	{
+		return false;
+	}
+
+	destroy_buffers();
+	_batches.clear();
+	_drawOrder.clear();
+	_recordCount = 0;
+	_uploadToken = 0;
+
+	std::vector<GPUObjectData> objectData(count);
+	std::vector<GPUDrawRecord> records;
+	std::vector<GPUDrawBatch> gpuBatches;
+
+	// Every object drawing the same submesh with the same material shares its chain of batches
+	std::map<std::tuple<const Mesh*, uint32_t, const Material*>, BatchChain> chains;
+
+	for (size_t i = 0; i < count; i++)
+	{
+		const RenderObject& object = objects[i];
+		Mesh* mesh = object.mesh;
+
+		objectData[i].modelMatrix = object.transformMatrix;
+		objectData[i].sphereBounds = mesh->_boundingSphere;
+
+		// Meshes that failed to load have nothing in the arena
+		if (!mesh->_vertexRange.valid())
+		{
+			continue;
+		}
+
+		const uint32_t firstIndex = mesh->_indexRange.first_element();
+		const int32_t vertexOffset = static_cast<int32_t>(mesh->_vertexRange.first_element());
+
+		const uint32_t submeshCount = static_cast<uint32_t>(std::max<size_t>(mesh->_submeshes.size(), 1));
+		for (uint32_t d = 0; d < submeshCount; d++)
+		{
+			const Submesh* submesh = mesh->_submeshes.empty() ? nullptr : &mesh->_submeshes[d];
+
+			Material* material = object.material;
+			if (submesh && object.alphaTestedMaterial && (mesh->_materials[submesh->material].flags & MESH_MATERIAL_ALPHA_TESTED))
+			{
+				material = object.alphaTestedMaterial;
+			}
+
+			auto chain = chains.find({ mesh, d, material });
+			if (chain == chains.end())
+			{
+				BatchChain newChain;
+				newChain.firstBatch = static_cast<uint32_t>(gpuBatches.size());
+				newChain.lodCount = submesh ? submesh->lodCount : 1;
+
+				for (uint32_t lod = 0; lod < newChain.lodCount; lod++)
+				{
+					GPUDrawBatch batch = {};
+					if (submesh)
+					{
+						batch.count = submesh->lods[lod].indexCount;
+						batch.first = firstIndex + submesh->lods[lod].firstIndex;
+						batch.error = submesh->lods[lod].error;
+					}
+					else if (mesh->_indexCount > 0)
+					{
+						batch.count = mesh->_indexCount;
+						batch.first = firstIndex;
+					}
+					else
+					{
+						batch.count = mesh->_vertexCount;
+						batch.first = static_cast<uint32_t>(vertexOffset);
+					}
+					batch.vertexOffset = vertexOffset;
+					batch.indexed = mesh->_indexCount > 0 ? 1 : 0;
+
+					gpuBatches.push_back(batch);
+					_batches.push_back({ mesh, material, 0, 0 });
+				}
+
+				_uploadToken = std::max(_uploadToken, std::max(mesh->_uploadToken, material->uploadToken));
+				chain = chains.emplace(std::make_tuple(mesh, d, material), newChain).first;
+			}
+
+			records.push_back({ static_cast<uint32_t>(i), chain->second.firstBatch, chain->second.lodCount, 0 });
+
+			// The record can land in any level of the chain
+			for (uint32_t lod = 0; lod < chain->second.lodCount; lod++)
+			{
+				_batches[chain->second.firstBatch + lod].capacity++;
+			}
+		}
+	}
+
+	if (records.empty())
+	{
+		return true;
+	}
+
+	// Each batch gets a run of commands as long as its capacity
+	uint32_t commandCount = 0;
+	for (size_t b = 0; b < _batches.size(); b++)
+	{
+		_batches[b].firstCommand = commandCount;
+		gpuBatches[b].firstCommand = commandCount;
+		commandCount += _batches[b].capacity;
+	}
+
+	// Draw batches of the same pipeline and mesh one after the other, so binds are made once per run
+	_drawOrder.resize(_batches.size());
+	for (uint32_t b = 0; b < _drawOrder.size(); b++)
+	{
+		_drawOrder[b] = b;
+	}
+
+	auto pipeline_of = [](const IndirectBatch& batch) {
+		return batch.mesh->_vertexFormat == VertexFormat::Compact ? batch.material->compactPipeline : batch.material->pipeline;
+	};
+
+	std::stable_sort(_drawOrder.begin(), _drawOrder.end(), [&](uint32_t a, uint32_t b) {
+		const IndirectBatch& batchA = _batches[a];
+		const IndirectBatch& batchB = _batches[b];
+		return std::make_tuple(pipeline_of(batchA), batchA.material, batchA.mesh) < std::make_tuple(pipeline_of(batchB), batchB.material, batchB.mesh);
+	});
+
+	const VkDeviceSize objectSize = sizeof(GPUObjectData) * objectData.size();
+	const VkDeviceSize recordSize = sizeof(GPUDrawRecord) * records.size();
+	const VkDeviceSize batchSize = sizeof(GPUDrawBatch) * gpuBatches.size();
+
+	_objectBuffer = create_buffer(objectSize, VK_BUFFER_USAGE_STORAGE_BUFFER_BIT | VK_BUFFER_USAGE_TRANSFER_DST_BIT);
+	_recordBuffer = create_buffer(recordSize, VK_BUFFER_USAGE_STORAGE_BUFFER_BIT | VK_BUFFER_USAGE_TRANSFER_DST_BIT);
+	_batchBuffer = create_buffer(batchSize, VK_BUFFER_USAGE_STORAGE_BUFFER_BIT | VK_BUFFER_USAGE_TRANSFER_DST_BIT);
+	_commandBuffer = create_buffer(sizeof(VkDrawIndexedIndirectCommand) * commandCount, VK_BUFFER_USAGE_STORAGE_BUFFER_BIT | VK_BUFFER_USAGE_INDIRECT_BUFFER_BIT);
+	_countBuffer = create_buffer(sizeof(uint32_t) * _batches.size(),
+		VK_BUFFER_USAGE_STORAGE_BUFFER_BIT | VK_BUFFER_USAGE_INDIRECT_BUFFER_BIT | VK_BUFFER_USAGE_TRANSFER_DST_BIT | VK_BUFFER_USAGE_TRANSFER_SRC_BIT);
+
+	UploadBatch batch(uploads);
+
+	auto upload = [&](const void* data, VkDeviceSize size, VkBuffer buffer, VkPipelineStageFlags stages) {
+		StagingRegion staging = batch.allocate_staging(size);
+		memcpy(staging.data, data, size);
+		batch.copy_buffer(staging, 0, buffer, 0, size);
+		batch.release_buffer({ buffer, VK_ACCESS_SHADER_READ_BIT, stages });
+	};
+
+	// The vertex shaders read the matrices too
+	upload(objectData.data(), objectSize, _objectBuffer._buffer, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT | VK_PIPELINE_STAGE_VERTEX_SHADER_BIT);
+	upload(records.data(), recordSize, _recordBuffer._buffer, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT);
+	upload(gpuBatches.data(), batchSize, _batchBuffer._buffer, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT);
+
+	_uploadToken = std::max(_uploadToken, batch.submit());
+	_recordCount = static_cast<uint32_t>(records.size());
+
+	VkDescriptorBufferInfo cullInfos[CULL_BINDING_COUNT] = {
+		{ _objectBuffer._buffer, 0, VK_WHOLE_SIZE },
+		{ _recordBuffer._buffer, 0, VK_WHOLE_SIZE },
+		{ _batchBuffer._buffer, 0, VK_WHOLE_SIZE },
+		{ _commandBuffer._buffer, 0, VK_WHOLE_SIZE },
+		{ _countBuffer._buffer, 0, VK_WHOLE_SIZE },
+	};
+
+	VkDescriptorBufferInfo objectInfo = { _objectBuffer._buffer, 0, objectSize };
+
+	VkWriteDescriptorSet writes[CULL_BINDING_COUNT + 1];
+	for (uint32_t i = 0; i < CULL_BINDING_COUNT; i++)
+	{
+		writes[i] = vkinit::write_descriptor_buffer(VK_DESCRIPTOR_TYPE_STORAGE_BUFFER, _cullSet, &cullInfos[i], i);
+	}
+	writes[CULL_BINDING_COUNT] = vkinit::write_descriptor_buffer(VK_DESCRIPTOR_TYPE_STORAGE_BUFFER_DYNAMIC, _objectSet, &objectInfo, 0);
+
+	vkUpdateDescriptorSets(_device, CULL_BINDING_COUNT + 1, writes, 0, nullptr);
+
+	return true;
+}
+
+void GpuCulling::record_cull(VkCommandBuffer cmd, const GPUCullData& data)
+{
+	if (_recordCount == 0)
+	{
+		return;
+	}
+
+	// The previous frame's draws read the commands and counts this pass rewrites, they only have to be done with them
+	vkCmdPipelineBarrier(cmd, VK_PIPELINE_STAGE_DRAW_INDIRECT_BIT, VK_PIPELINE_STAGE_TRANSFER_BIT | VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT,
+		0, 0, nullptr, 0, nullptr, 0, nullptr);
+
+	vkCmdFillBuffer(cmd, _countBuffer._buffer, 0, VK_WHOLE_SIZE, 0);
+
+	VkMemoryBarrier clearBarrier = {};
+	clearBarrier.sType = VK_STRUCTURE_TYPE_MEMORY_BARRIER;
+	clearBarrier.srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
+	clearBarrier.dstAccessMask = VK_ACCESS_SHADER_READ_BIT | VK_ACCESS_SHADER_WRITE_BIT;
+
+	vkCmdPipelineBarrier(cmd, VK_PIPELINE_STAGE_TRANSFER_BIT, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, 0, 1, &clearBarrier, 0, nullptr, 0, nullptr);
+
+	GPUCullData constants = data;
+	constants.recordCount = _recordCount;
+
+	vkCmdBindPipeline(cmd, VK_PIPELINE_BIND_POINT_COMPUTE, _pipeline);
+	vkCmdBindDescriptorSets(cmd, VK_PIPELINE_BIND_POINT_COMPUTE, _pipelineLayout, 0, 1, &_cullSet, 0, nullptr);
+	vkCmdPushConstants(cmd, _pipelineLayout, VK_SHADER_STAGE_COMPUTE_BIT, 0, sizeof(GPUCullData), &constants);
+	vkCmdDispatch(cmd, (_recordCount + CULL_GROUP_SIZE - 1) / CULL_GROUP_SIZE, 1, 1);
+
+	// The draws read what the pass wrote as their commands and counts
+	VkMemoryBarrier cullBarrier = {};
+	cullBarrier.sType = VK_STRUCTURE_TYPE_MEMORY_BARRIER;
+	cullBarrier.srcAccessMask = VK_ACCESS_SHADER_WRITE_BIT;
+	cullBarrier.dstAccessMask = VK_ACCESS_INDIRECT_COMMAND_READ_BIT;
+
+	vkCmdPipelineBarrier(cmd, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, VK_PIPELINE_STAGE_DRAW_INDIRECT_BIT, 0, 1, &cullBarrier, 0, nullptr, 0, nullptr);
+}
+
+void GpuCulling::destroy_buffers()
+{
+	for (AllocatedBuffer* buffer : { &_objectBuffer, &_recordBuffer, &_batchBuffer, &_commandBuffer, &_countBuffer })
+	{
+		if (buffer->_buffer != VK_NULL_HANDLE)
+		{
+			vmaDestroyBuffer(_allocator, buffer->_buffer, buffer->_allocation);
+		}
+		*buffer = {};
+	}
+}
+
+AllocatedBuffer GpuCulling::create_buffer(VkDeviceSize size, VkBufferUsageFlags usage)
+{
+	VkBufferCreateInfo bufferInfo = {};
+	bufferInfo.sType = VK_STRUCTURE_TYPE_BUFFER_CREATE_INFO;
+	bufferInfo.pNext = nullptr;
+	bufferInfo.size = size;
+	bufferInfo.usage = usage;
+
+	VmaAllocationCreateInfo vmaallocInfo = {};
+	vmaallocInfo.usage = VMA_MEMORY_USAGE_GPU_ONLY;
+
+	AllocatedBuffer buffer;
+	VK_CHECK(vmaCreateBuffer(_allocator, &bufferInfo, &vmaallocInfo, &buffer._buffer, &buffer._allocation, nullptr));
+	return buffer;
+}
@@ -0,0 +1,119 @@
+#pragma once
+
+#include <vk_types.h>
+#include "vk_upload.h"
+
+#include <glm/glm.hpp>
+
+#include <cstdint>
+#include <vector>
+
+struct Material;
+struct Mesh;
+struct RenderObject;
+
+// One submesh of one object, the unit the cull pass tests. Read by cull.comp
+struct GPUDrawRecord {
+	uint32_t objectIndex;
+	uint32_t firstBatch;	// Batch of level 0, the coarser levels follow it
+	uint32_t lodCount;
+	uint32_t pad;
+};
+
+// One level of detail of a submesh drawn with one material. Read by cull.comp to fill in the commands
+struct GPUDrawBatch {
+	uint32_t count;			// Indices, or vertices of meshes without an index buffer
+	uint32_t first;			// First index, or first vertex
+	int32_t vertexOffset;
+	uint32_t indexed;
+	uint32_t firstCommand;	// Where the batch's commands start in the command buffer
+	float error;			// MeshLod::error of the level
+	uint32_t pad[2];
+};
+
+// Push constants of the cull pass
+struct GPUCullData {
+	glm::vec4 frustum[6];
+	glm::vec4 cameraPosition;	// w is how many pixels one unit covers at distance 1
+	uint32_t recordCount;
+	float maxPixelError;
+};
+
+// The graphics side of a batch: what to bind before drawing its commands
+struct IndirectBatch {
+	Mesh* mesh;
+	Material* material;
+	uint32_t firstCommand;
+	uint32_t capacity;		// Most commands the batch can get, one per record that can pick its level
+};
+
+// Frustum culling and level of detail selection on the GPU. A compute pass tests every object and submesh against the
+// frustum and appends a draw command for each visible one to its batch, counting them as it goes. Graphics then draws
+// each batch with one indirect count draw, so recording a frame costs the same for ten objects or a million
+class GpuCulling {
+public:
+	// Check the GPU for indirect count draws, and for the core features they need, which are turned on in features
+	bool query(VkPhysicalDevice gpu, VkPhysicalDeviceFeatures& features);
+
+	// Build the cull pipeline. objectSetLayout is the graphics object set, the culled objects get a set of it too
+	void init(VkDevice device, VmaAllocator allocator, VkDescriptorSetLayout objectSetLayout, VkShaderModule cullShader);
+	void cleanup();
+
+	// The GPU can draw what the pass writes
+	bool supported() const { return _supported; }
+
+	// The pipeline is built too
+	bool available() const { return _supported && _pipeline != VK_NULL_HANDLE; }
+
+	// Upload the objects, their records and batches, replacing the previous scene. Only while no frame drawing the
+	// previous scene is in flight
+	bool build(const RenderObject* objects, size_t count, UploadService& uploads);
+
+	// Reset the counts, cull every record and make the commands visible to indirect draws. Outside a render pass
+	void record_cull(VkCommandBuffer cmd, const GPUCullData& data);
+
+	// Batches in the order to draw them, sorted so consecutive ones share pipelines and meshes
+	const std::vector<IndirectBatch>& batches() const { return _batches; }
+	const std::vector<uint32_t>& draw_order() const { return _drawOrder; }
+
+	// Commands are VkDrawIndexedIndirectCommand sized, meshes without indices use the first four members as a VkDrawIndirectCommand
+	VkBuffer command_buffer() const { return _commandBuffer._buffer; }
+	VkBuffer count_buffer() const { return _countBuffer._buffer; }
+
+	// The GPUDrawBatch of every batch, in the order of batches()
+	VkBuffer batch_buffer() const { return _batchBuffer._buffer; }
+
+	// Object data of the scene for set 1, bound with a dynamic offset of 0
+	VkDescriptorSet object_set() const { return _objectSet; }
+
+	// Latest upload the scene's draws read from: its own buffers, meshes and textures
+	UploadToken upload_token() const { return _uploadToken; }
+
+	uint32_t record_count() const { return _recordCount; }
+
+private:
+	void destroy_buffers();
+	AllocatedBuffer create_buffer(VkDeviceSize size, VkBufferUsageFlags usage);
+
+	VkDevice _device{ VK_NULL_HANDLE };
+	VmaAllocator _allocator{ VK_NULL_HANDLE };
+	bool _supported{ false };
+
+	VkDescriptorPool _descriptorPool{ VK_NULL_HANDLE };
+	VkDescriptorSetLayout _cullSetLayout{ VK_NULL_HANDLE };
+	VkDescriptorSet _cullSet{ VK_NULL_HANDLE };
+	VkDescriptorSet _objectSet{ VK_NULL_HANDLE };
+	VkPipelineLayout _pipelineLayout{ VK_NULL_HANDLE };
+	VkPipeline _pipeline{ VK_NULL_HANDLE };
+
+	AllocatedBuffer _objectBuffer{};
+	AllocatedBuffer _recordBuffer{};
+	AllocatedBuffer _batchBuffer{};
+	AllocatedBuffer _commandBuffer{};
+	AllocatedBuffer _countBuffer{};
+
+	std::vector<IndirectBatch> _batches;
+	std::vector<uint32_t> _drawOrder;
+	uint32_t _recordCount{ 0 };
+	UploadToken _uploadToken{ 0 };
+};
@@ -0,0 +1,178 @@
+#include "vk_host_image_copy.h"
+
+#include <algorithm>
+#include <cstring>
+
+std::vector<const char*> HostImageCopy::extensions()
+{
+#ifdef VK_EXT_host_image_copy
+	// The extension builds on these two, both are core in Vulkan 1.3 but the engine asks for 1.2
+	return { VK_EXT_HOST_IMAGE_COPY_EXTENSION_NAME, VK_KHR_COPY_COMMANDS_2_EXTENSION_NAME, VK_KHR_FORMAT_FEATURE_FLAGS_2_EXTENSION_NAME };
+#else
+	return {};
+#endif
+}
+
+VkBaseOutStructure* HostImageCopy::query(VkPhysicalDevice gpu)
+{
+	_gpu = gpu;
+	_supported = false;
+
+#ifdef VK_EXT_host_image_copy
+	uint32_t extensionCount = 0;
+	vkEnumerateDeviceExtensionProperties(gpu, nullptr, &extensionCount, nullptr);
+	std::vector<VkExtensionProperties> available(extensionCount);
+	vkEnumerateDeviceExtensionProperties(gpu, nullptr, &extensionCount, available.data());
+
+	for (const char* extension : extensions())
+	{
+		auto found = std::find_if(available.begin(), available.end(), [&](const VkExtensionProperties& p) {
+			return strcmp(p.extensionName, extension) == 0;
+		});
+		if (found == available.end())
+		{
+			return nullptr;
+		}
+	}
+
+	_features = {};
+	_features.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_HOST_IMAGE_COPY_FEATURES_EXT;
+
+	VkPhysicalDeviceFeatures2 features = {};
+	features.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_FEATURES_2;
+	features.pNext = &_features;
+	vkGetPhysicalDeviceFeatures2(gpu, &features);
+
+	if (!_features.hostImageCopy)
+	{
+		return nullptr;
+	}
+
+	// Textures are copied into the layout they are sampled in, which the GPU has to allow as a host copy destination
+	VkPhysicalDeviceHostImageCopyPropertiesEXT hostProperties = {};
+	hostProperties.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_HOST_IMAGE_COPY_PROPERTIES_EXT;
+
+	VkPhysicalDeviceProperties2 properties = {};
+	properties.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_PROPERTIES_2;
+	properties.pNext = &hostProperties;
+	vkGetPhysicalDeviceProperties2(gpu, &properties);
+
+	std::vector<VkImageLayout> dstLayouts(hostProperties.copyDstLayoutCount);
+	hostProperties.pCopyDstLayouts = dstLayouts.data();
+	vkGetPhysicalDeviceProperties2(gpu, &properties);
+
+	if (std::find(dstLayouts.begin(), dstLayouts.end(), VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL) == dstLayouts.end())
+	{
+		return nullptr;
+	}
+
+	_supported = true;
+	_features.pNext = nullptr;
+	return reinterpret_cast<VkBaseOutStructure*>(&_features);
+#else
+	return nullptr;
+#endif
+}
+
+void HostImageCopy::init(VkDevice device)
+{
+	_device = device;
+
+#ifdef VK_EXT_host_image_copy
+	if (_supported)
+	{
+		_transitionImageLayout = reinterpret_cast<PFN_vkTransitionImageLayoutEXT>(vkGetDeviceProcAddr(device, "vkTransitionImageLayoutEXT"));
+		_copyMemoryToImage = reinterpret_cast<PFN_vkCopyMemoryToImageEXT>(vkGetDeviceProcAddr(device, "vkCopyMemoryToImageEXT"));
+		_supported = _transitionImageLayout && _copyMemoryToImage;
+	}
+#endif
+}
+
+VkImageUsageFlags HostImageCopy::usage_flag()
+{
+#ifdef VK_EXT_host_image_copy
+	return VK_IMAGE_USAGE_HOST_TRANSFER_BIT_EXT;
+#else
+	return 0;
+#endif
+}
+
+bool HostImageCopy::supports(VkFormat format, VkImageUsageFlags usage) const
+{
+	if (!available())
+	{
+		return false;
+	}
+
+#ifdef VK_EXT_host_image_copy
+	VkPhysicalDeviceImageFormatInfo2 formatInfo = {};
+	formatInfo.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_IMAGE_FORMAT_INFO_2;
+	formatInfo.format = format;
+	formatInfo.type = VK_IMAGE_TYPE_2D;
+	formatInfo.tiling = VK_IMAGE_TILING_OPTIMAL;
+	formatInfo.usage = usage | VK_IMAGE_USAGE_HOST_TRANSFER_BIT_EXT;
+
+	// Some GPUs give up compression or a faster layout for images the host can write, those keep uploading through staging
+	VkHostImageCopyDevicePerformanceQueryEXT performance = {};
+	performance.sType = VK_STRUCTURE_TYPE_HOST_IMAGE_COPY_DEVICE_PERFORMANCE_QUERY_EXT;
+
+	VkImageFormatProperties2 properties = {};
+	properties.sType = VK_STRUCTURE_TYPE_IMAGE_FORMAT_PROPERTIES_2;
+	properties.pNext = &performance;
+
+	if (vkGetPhysicalDeviceImageFormatProperties2(_gpu, &formatInfo, &properties) != VK_SUCCESS)
+	{
+		return false;
+	}
+	return performance.optimalDeviceAccess == VK_TRUE;
+#else
+	return false;
+#endif
+}
+
+bool HostImageCopy::copy_to_image(VkImage image, const VkImageSubresourceRange& range, const std::vector<HostImageRegion>& regions)
+{
+	if (!available())
+	{
+		return false;
+	}
+
+#ifdef VK_EXT_host_image_copy
+	// Whatever the image held is discarded, the copies overwrite it anyway
+	VkHostImageLayoutTransitionInfoEXT transition = {};
+	transition.sType = VK_STRUCTURE_TYPE_HOST_IMAGE_LAYOUT_TRANSITION_INFO_EXT;
+	transition.image = image;
+	transition.oldLayout = VK_IMAGE_LAYOUT_UNDEFINED;
+	transition.newLayout = VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL;
+	transition.subresourceRange = range;
+	VK_CHECK(_transitionImageLayout(_device, 1, &transition));
+
+	std::vector<VkMemoryToImageCopyEXT> copies(regions.size());
+	for (size_t i = 0; i < regions.size(); i++)
+	{
+		VkMemoryToImageCopyEXT& copy = copies[i];
+		copy = {};
+		copy.sType = VK_STRUCTURE_TYPE_MEMORY_TO_IMAGE_COPY_EXT;
+		copy.pHostPointer = regions[i].data;
+		copy.memoryRowLength = 0;
+		copy.memoryImageHeight = 0;
+		copy.imageSubresource.aspectMask = range.aspectMask;
+		copy.imageSubresource.mipLevel = regions[i].mipLevel;
+		copy.imageSubresource.baseArrayLayer = regions[i].layer;
+		copy.imageSubresource.layerCount = 1;
+		copy.imageExtent = regions[i].extent;
+	}
+
+	VkCopyMemoryToImageInfoEXT copyInfo = {};
+	copyInfo.sType = VK_STRUCTURE_TYPE_COPY_MEMORY_TO_IMAGE_INFO_EXT;
+	copyInfo.dstImage = image;
+	copyInfo.dstImageLayout = VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL;
+	copyInfo.regionCount = static_cast<uint32_t>(copies.size());
+	copyInfo.pRegions = copies.data();
+	VK_CHECK(_copyMemoryToImage(_device, &copyInfo));
+
+	return true;
+#else
+	return false;
+#endif
+}
@@ -0,0 +1,55 @@
+#pragma once
+
+#include <vk_types.h>
+
+#include <vector>
+
+// One level of one layer to write, tightly packed in host memory
+struct HostImageRegion {
+	const void* data;
+	uint32_t mipLevel;
+	uint32_t layer;
+	VkExtent3D extent;
+};
+
+// Texture uploads through VK_EXT_host_image_copy: the CPU writes pixels straight into an optimally tiled image, with no
+// staging buffer and no queue submit. Never available when the Vulkan headers predate the extension
+class HostImageCopy {
+public:
+	// Device extensions the path needs, for the device selector to enable where the GPU has them
+	static std::vector<const char*> extensions();
+
+	// Check the GPU for the extension and feature. Returns the feature struct to chain into device creation,
+	// or nullptr if the GPU can't copy images from the host
+	VkBaseOutStructure* query(VkPhysicalDevice gpu);
+
+	// Load the copy functions once the device has been created with the features from query()
+	void init(VkDevice device);
+
+	bool available() const { return _supported && _enabled; }
+
+	// Lets benchmarks force the staging path on GPUs that have the extension
+	void set_enabled(bool enabled) { _enabled = enabled; }
+
+	// The usage an image needs on top of its own for host copies
+	static VkImageUsageFlags usage_flag();
+
+	// True if sampled images of format can be host copied without losing device access performance
+	bool supports(VkFormat format, VkImageUsageFlags usage) const;
+
+	// Move every subresource in range to SHADER_READ_ONLY_OPTIMAL and write the regions into it, on the calling thread.
+	// The image must have been created with usage_flag(). Any submit after this returns can sample it
+	bool copy_to_image(VkImage image, const VkImageSubresourceRange& range, const std::vector<HostImageRegion>& regions);
+
+private:
+	VkPhysicalDevice _gpu{ VK_NULL_HANDLE };
+	VkDevice _device{ VK_NULL_HANDLE };
+	bool _supported{ false };
+	bool _enabled{ true };
+
+#ifdef VK_EXT_host_image_copy
+	VkPhysicalDeviceHostImageCopyFeaturesEXT _features{};
+	PFN_vkTransitionImageLayoutEXT _transitionImageLayout{ nullptr };
+	PFN_vkCopyMemoryToImageEXT _copyMemoryToImage{ nullptr };
+#endif
+};
@@ -0,0 +1,152 @@
+#include "vk_host_memory_import.h"
+
+#include <algorithm>
+#include <cstring>
+
+std::vector<const char*> HostMemoryImport::extensions()
+{
+	return { VK_EXT_EXTERNAL_MEMORY_HOST_EXTENSION_NAME };
+}
+
+bool HostMemoryImport::query(VkPhysicalDevice gpu)
+{
+	_gpu = gpu;
+	_supported = false;
+
+	uint32_t extensionCount = 0;
+	vkEnumerateDeviceExtensionProperties(gpu, nullptr, &extensionCount, nullptr);
+	std::vector<VkExtensionProperties> available(extensionCount);
+	vkEnumerateDeviceExtensionProperties(gpu, nullptr, &extensionCount, available.data());
+
+	auto found = std::find_if(available.begin(), available.end(), [](const VkExtensionProperties& p) {
+		return strcmp(p.extensionName, VK_EXT_EXTERNAL_MEMORY_HOST_EXTENSION_NAME) == 0;
+	});
+	if (found == available.end())
+	{
+		return false;
+	}
+
+	VkPhysicalDeviceExternalMemoryHostPropertiesEXT hostProperties = {};
+	hostProperties.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_EXTERNAL_MEMORY_HOST_PROPERTIES_EXT;
+
+	VkPhysicalDeviceProperties2 properties = {};
+	properties.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_PROPERTIES_2;
+	properties.pNext = &hostProperties;
+	vkGetPhysicalDeviceProperties2(gpu, &properties);
+
+	_alignment = hostProperties.minImportedHostPointerAlignment;
+	_supported = _alignment > 0;
+	return _supported;
+}
+
+void HostMemoryImport::init(VkDevice device)
+{
+	_device = device;
+
+	if (_supported)
+	{
+		_getMemoryHostPointerProperties = reinterpret_cast<PFN_vkGetMemoryHostPointerPropertiesEXT>(
+			vkGetDeviceProcAddr(device, "vkGetMemoryHostPointerPropertiesEXT"));
+		_supported = _getMemoryHostPointerProperties != nullptr;
+	}
+}
+
+bool HostMemoryImport::import(const void* data, VkDeviceSize size, ImportedHostBuffer& outBuffer)
+{
+	if (!_supported || reinterpret_cast<uintptr_t>(data) % _alignment != 0 || size % _alignment != 0)
+	{
+		return false;
+	}
+
+	// File mappings are foreign memory to the driver, but some drivers only take them as plain host allocations
+	return import_as(VK_EXTERNAL_MEMORY_HANDLE_TYPE_HOST_MAPPED_FOREIGN_MEMORY_BIT_EXT, data, size, outBuffer)
+		|| import_as(VK_EXTERNAL_MEMORY_HANDLE_TYPE_HOST_ALLOCATION_BIT_EXT, data, size, outBuffer);
+}
+
+bool HostMemoryImport::import_as(VkExternalMemoryHandleTypeFlagBits handleType, const void* data, VkDeviceSize size, ImportedHostBuffer& outBuffer)
+{
+	VkPhysicalDeviceExternalBufferInfo externalInfo = {};
+	externalInfo.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_EXTERNAL_BUFFER_INFO;
+	externalInfo.usage = VK_BUFFER_USAGE_TRANSFER_SRC_BIT;
+	externalInfo.handleType = handleType;
+
+	VkExternalBufferProperties externalProperties = {};
+	externalProperties.sType = VK_STRUCTURE_TYPE_EXTERNAL_BUFFER_PROPERTIES;
+	vkGetPhysicalDeviceExternalBufferProperties(_gpu, &externalInfo, &externalProperties);
+
+	if (!(externalProperties.externalMemoryProperties.externalMemoryFeatures & VK_EXTERNAL_MEMORY_FEATURE_IMPORTABLE_BIT))
+	{
+		return false;
+	}
+
+	VkMemoryHostPointerPropertiesEXT pointerProperties = {};
+	pointerProperties.sType = VK_STRUCTURE_TYPE_MEMORY_HOST_POINTER_PROPERTIES_EXT;
+	if (_getMemoryHostPointerProperties(_device, handleType, data, &pointerProperties) != VK_SUCCESS)
+	{
+		return false;
+	}
+
+	VkExternalMemoryBufferCreateInfo externalBufferInfo = {};
+	externalBufferInfo.sType = VK_STRUCTURE_TYPE_EXTERNAL_MEMORY_BUFFER_CREATE_INFO;
+	externalBufferInfo.handleTypes = handleType;
+
+	VkBufferCreateInfo bufferInfo = {};
+	bufferInfo.sType = VK_STRUCTURE_TYPE_BUFFER_CREATE_INFO;
+	bufferInfo.pNext = &externalBufferInfo;
+	bufferInfo.size = size;
+	bufferInfo.usage = VK_BUFFER_USAGE_TRANSFER_SRC_BIT;
+	bufferInfo.sharingMode = VK_SHARING_MODE_EXCLUSIVE;
+
+	VkBuffer buffer;
+	if (vkCreateBuffer(_device, &bufferInfo, nullptr, &buffer) != VK_SUCCESS)
+	{
+		return false;
+	}
+
+	VkMemoryRequirements requirements;
+	vkGetBufferMemoryRequirements(_device, buffer, &requirements);
+
+	// Any type both the pointer and the buffer allow will do, the memory is only ever read by copies
+	const uint32_t typeBits = requirements.memoryTypeBits & pointerProperties.memoryTypeBits;
+	if (typeBits == 0 || requirements.size > size)
+	{
+		vkDestroyBuffer(_device, buffer, nullptr);
+		return false;
+	}
+
+	uint32_t memoryType = 0;
+	while (!(typeBits & (1u << memoryType)))
+	{
+		memoryType++;
+	}
+
+	VkImportMemoryHostPointerInfoEXT importInfo = {};
+	importInfo.sType = VK_STRUCTURE_TYPE_IMPORT_MEMORY_HOST_POINTER_INFO_EXT;
+	importInfo.handleType = handleType;
+	importInfo.pHostPointer = const_cast<void*>(data);
+
+	VkMemoryAllocateInfo allocInfo = {};
+	allocInfo.sType = VK_STRUCTURE_TYPE_MEMORY_ALLOCATE_INFO;
+	allocInfo.pNext = &importInfo;
+	allocInfo.allocationSize = size;
+	allocInfo.memoryTypeIndex = memoryType;
+
+	VkDeviceMemory memory;
+	if (vkAllocateMemory(_device, &allocInfo, nullptr, &memory) != VK_SUCCESS)
+	{
+		vkDestroyBuffer(_device, buffer, nullptr);
+		return false;
+	}
+
+	VK_CHECK(vkBindBufferMemory(_device, buffer, memory, 0));
+
+	outBuffer.buffer = buffer;
+	outBuffer.memory = memory;
+	return true;
+}
+
+void HostMemoryImport::destroy(const ImportedHostBuffer& buffer)
+{
+	vkDestroyBuffer(_device, buffer.buffer, nullptr);
+	vkFreeMemory(_device, buffer.memory, nullptr);
+}
@@ -0,0 +1,47 @@
+#pragma once
+
+#include <vk_types.h>
+
+#include <vector>
+
+// Host memory the GPU reads in place, as a transfer source buffer
+struct ImportedHostBuffer {
+	VkBuffer buffer{ VK_NULL_HANDLE };
+	VkDeviceMemory memory{ VK_NULL_HANDLE };
+};
+
+// Imports memory the process already has, like a file mapping, through VK_EXT_external_memory_host. Uploads copy
+// straight out of it instead of memcpying it into staging first
+class HostMemoryImport {
+public:
+	// Device extensions the import needs, for the device selector to enable where the GPU has them
+	static std::vector<const char*> extensions();
+
+	// Check the GPU for the extension and read the alignment imports need
+	bool query(VkPhysicalDevice gpu);
+
+	// Load the import functions once the device has been created
+	void init(VkDevice device);
+
+	bool available() const { return _supported; }
+
+	// Imported pointers and sizes must be multiples of this
+	VkDeviceSize alignment() const { return _alignment; }
+
+	// Import size bytes from data as a buffer to copy from. data must be aligned to alignment() and size a multiple of
+	// it. False when the driver can't import the range, the caller copies through staging then
+	bool import(const void* data, VkDeviceSize size, ImportedHostBuffer& outBuffer);
+
+	// Only once every copy out of the buffer has finished
+	void destroy(const ImportedHostBuffer& buffer);
+
+private:
+	bool import_as(VkExternalMemoryHandleTypeFlagBits handleType, const void* data, VkDeviceSize size, ImportedHostBuffer& outBuffer);
+
+	VkPhysicalDevice _gpu{ VK_NULL_HANDLE };
+	VkDevice _device{ VK_NULL_HANDLE };
+	bool _supported{ false };
+	VkDeviceSize _alignment{ 0 };
+
+	PFN_vkGetMemoryHostPointerPropertiesEXT _getMemoryHostPointerProperties{ nullptr };
+};
@@ -64,7 +64,7 @@ VkWriteDescriptorSet vkinit::write_descriptor_buffer(VkDescriptorType type, VkDe
 }
 
 
-VkImageCreateInfo vkinit::image_create_info(VkFormat format, VkImageUsageFlags usageFlags, VkExtent3D extent)
+VkImageCreateInfo vkinit::image_create_info(VkFormat format, VkImageUsageFlags usageFlags, VkExtent3D extent, uint32_t mipLevels /*= 1*/, uint32_t arrayLayers /*= 1*/)
 {
 	VkImageCreateInfo info = { };
 	info.sType = VK_STRUCTURE_TYPE_IMAGE_CREATE_INFO;
@@ -75,8 +75,8 @@ VkImageCreateInfo vkinit::image_create_info(VkFormat format, VkImageUsageFlags u
 	info.format = format;
 	info.extent = extent;
 
-	info.mipLevels = 1;
-	info.arrayLayers = 1;
+	info.mipLevels = mipLevels;
+	info.arrayLayers = arrayLayers;
 	info.samples = VK_SAMPLE_COUNT_1_BIT;
 	info.tiling = VK_IMAGE_TILING_OPTIMAL;
 	info.usage = usageFlags;
@@ -84,7 +84,7 @@ VkImageCreateInfo vkinit::image_create_info(VkFormat format, VkImageUsageFlags u
 	return info;
 }
 
-VkImageViewCreateInfo vkinit::image_view_create_info(VkFormat format, VkImage image, VkImageAspectFlags aspectFlags)
+VkImageViewCreateInfo vkinit::image_view_create_info(VkFormat format, VkImage image, VkImageAspectFlags aspectFlags, uint32_t mipLevels /*= 1*/, uint32_t arrayLayers /*= 1*/)
 {
 	// Build a image-view for the depth image to use for rendering
 	VkImageViewCreateInfo info = {};
@@ -95,9 +95,9 @@ VkImageViewCreateInfo vkinit::image_view_create_info(VkFormat format, VkImage im
 	info.image = image;
 	info.format = format;
 	info.subresourceRange.baseMipLevel = 0;
-	info.subresourceRange.levelCount = 1;
+	info.subresourceRange.levelCount = mipLevels;
 	info.subresourceRange.baseArrayLayer = 0;
-	info.subresourceRange.layerCount = 1;
+	info.subresourceRange.layerCount = arrayLayers;
 	info.subresourceRange.aspectMask = aspectFlags;
 
 	return info;
@@ -0,0 +1,393 @@
+#include "vk_ktx2.h"
+
+#include "vk_block_compression.h"
+
+#include <algorithm>
+#include <cstring>
+#include <fstream>
+#include <iostream>
+
+namespace {
+
+	const unsigned char KTX2_IDENTIFIER[12] = { 0xAB, 'K', 'T', 'X', ' ', '2', '0', 0xBB, '\r', '\n', 0x1A, '\n' };
+
+	// Identifier, header and index come before the level index
+	constexpr size_t KTX2_LEVEL_INDEX_OFFSET = 80;
+	constexpr size_t KTX2_LEVEL_INDEX_ENTRY_SIZE = 24;
+
+	// Data format descriptor values for the block formats, from the Khronos Data Format specification
+	constexpr uint8_t KHR_DF_MODEL_BC1A = 128;
+	constexpr uint8_t KHR_DF_MODEL_BC3 = 130;
+	constexpr uint8_t KHR_DF_MODEL_BC7 = 138;
+	constexpr uint8_t KHR_DF_CHANNEL_COLOR = 0;
+	constexpr uint8_t KHR_DF_CHANNEL_BC1A_ALPHAPRESENT = 1;
+	constexpr uint8_t KHR_DF_CHANNEL_BC3_ALPHA = 15;
+	constexpr uint8_t KHR_DF_PRIMARIES_BT709 = 1;
+	constexpr uint8_t KHR_DF_TRANSFER_SRGB = 2;
+	constexpr uint8_t KHR_DF_TRANSFER_LINEAR = 1;
+
+	// Key/value entry with the source fingerprint, a 64 bit size and hash as the value
+	const char KTX2_SOURCE_KEY[] = "vkguide.source";
+	constexpr size_t KTX2_SOURCE_VALUE_SIZE = 16;
+
+	// Little endian regardless of the host
+	void put_u8(std::vector<unsigned char>& out, uint8_t value)
+	{
+		out.push_back(value);
+	}
+
+	void put_u16(std::vector<unsigned char>& out, uint16_t value)
+	{
+		put_u8(out, static_cast<uint8_t>(value));
+		put_u8(out, static_cast<uint8_t>(value >> 8));
+	}
+
+	void put_u32(std::vector<unsigned char>& out, uint32_t value)
+	{
+		put_u16(out, static_cast<uint16_t>(value));
+		put_u16(out, static_cast<uint16_t>(value >> 16));
+	}
+
+	void put_u64(std::vector<unsigned char>& out, uint64_t value)
+	{
+		put_u32(out, static_cast<uint32_t>(value));
+		put_u32(out, static_cast<uint32_t>(value >> 32));
+	}
+
+	uint32_t get_u32(const unsigned char* in)
+	{
+		return in[0] | (in[1] << 8) | (in[2] << 16) | (static_cast<uint32_t>(in[3]) << 24);
+	}
+
+	uint64_t get_u64(const unsigned char* in)
+	{
+		return get_u32(in) | (static_cast<uint64_t>(get_u32(in + 4)) << 32);
+	}
+
+	struct DfdSample {
+		uint16_t bitOffset;
+		uint8_t bitLength;
+		uint8_t channel;
+	};
+
+	// Basic data format descriptor of a block format, with the total size in front
+	std::vector<unsigned char> block_format_dfd(VkFormat format, vkbc::BlockFormat blockFormat)
+	{
+		uint8_t model = KHR_DF_MODEL_BC7;
+		std::vector<DfdSample> samples;
+		switch (blockFormat)
+		{
+		case vkbc::BlockFormat::BC1:
+			model = KHR_DF_MODEL_BC1A;
+			samples.push_back({ 0, 64, KHR_DF_CHANNEL_BC1A_ALPHAPRESENT });
+			break;
+		case vkbc::BlockFormat::BC3:
+			model = KHR_DF_MODEL_BC3;
+			samples.push_back({ 0, 64, KHR_DF_CHANNEL_BC3_ALPHA });
+			samples.push_back({ 64, 64, KHR_DF_CHANNEL_COLOR });
+			break;
+		case vkbc::BlockFormat::BC7:
+			model = KHR_DF_MODEL_BC7;
+			samples.push_back({ 0, 128, KHR_DF_CHANNEL_COLOR });
+			break;
+		}
+
+		const bool srgb = format == vkbc::vk_format(blockFormat);
+		const uint16_t blockSize = static_cast<uint16_t>(24 + 16 * samples.size());
+
+		std::vector<unsigned char> dfd;
+		put_u32(dfd, 4 + blockSize);
+		put_u32(dfd, 0);				// Khronos vendor, basic descriptor type
+		put_u16(dfd, 2);				// Version
+		put_u16(dfd, blockSize);
+		put_u8(dfd, model);
+		put_u8(dfd, KHR_DF_PRIMARIES_BT709);
+		put_u8(dfd, srgb ? KHR_DF_TRANSFER_SRGB : KHR_DF_TRANSFER_LINEAR);
+		put_u8(dfd, 0);					// Straight alpha
+
+		// 4x4x1x1 texel blocks, stored as dimension - 1
+		put_u8(dfd, 3);
+		put_u8(dfd, 3);
+		put_u8(dfd, 0);
+		put_u8(dfd, 0);
+
+		put_u8(dfd, static_cast<uint8_t>(vkbc::block_size(blockFormat)));
+		for (int plane = 1; plane < 8; plane++)
+		{
+			put_u8(dfd, 0);
+		}
+
+		for (const DfdSample& sample : samples)
+		{
+			put_u16(dfd, sample.bitOffset);
+			put_u8(dfd, sample.bitLength - 1);
+			put_u8(dfd, sample.channel);
+			put_u32(dfd, 0);			// Sample position
+			put_u32(dfd, 0);			// Lower
+			put_u32(dfd, UINT32_MAX);	// Upper
+		}
+
+		return dfd;
+	}
+
+	size_t align_up(size_t value, size_t alignment)
+	{
+		return (value + alignment - 1) / alignment * alignment;
+	}
+
+	// Key/value data holding the source fingerprint, padded to 4 bytes as every entry is
+	std::vector<unsigned char> source_kvd(uint64_t sourceSize, uint64_t sourceHash)
+	{
+		std::vector<unsigned char> kvd;
+		put_u32(kvd, static_cast<uint32_t>(sizeof(KTX2_SOURCE_KEY) + KTX2_SOURCE_VALUE_SIZE));
+		kvd.insert(kvd.end(), KTX2_SOURCE_KEY, KTX2_SOURCE_KEY + sizeof(KTX2_SOURCE_KEY));
+		put_u64(kvd, sourceSize);
+		put_u64(kvd, sourceHash);
+		kvd.resize(align_up(kvd.size(), 4), 0);
+		return kvd;
+	}
+
+	// Find the source fingerprint among the key/value entries. Entries with other keys are skipped
+	bool find_source(const unsigned char* kvd, size_t size, uint64_t& outSourceSize, uint64_t& outSourceHash)
+	{
+		size_t offset = 0;
+		while (offset + 4 <= size)
+		{
+			const uint32_t length = get_u32(kvd + offset);
+			const unsigned char* entry = kvd + offset + 4;
+			if (length > size - offset - 4)
+			{
+				return false;
+			}
+
+			if (length == sizeof(KTX2_SOURCE_KEY) + KTX2_SOURCE_VALUE_SIZE && memcmp(entry, KTX2_SOURCE_KEY, sizeof(KTX2_SOURCE_KEY)) == 0)
+			{
+				outSourceSize = get_u64(entry + sizeof(KTX2_SOURCE_KEY));
+				outSourceHash = get_u64(entry + sizeof(KTX2_SOURCE_KEY) + 8);
+				return true;
+			}
+
+			offset = align_up(offset + 4 + length, 4);
+		}
+		return false;
+	}
+
+}
+
+bool vkktx::write(const char* filename, const Texture& texture)
+{
+	vkbc::BlockFormat blockFormat;
+	if (!vkbc::from_vk_format(texture.format, blockFormat) || texture.levelSizes.empty())
+	{
+		std::cout << "Can't write " << filename << ", only BC1, BC3 and BC7 textures are supported" << std::endl;
+		return false;
+	}
+
+	const uint32_t levelCount = static_cast<uint32_t>(texture.levelSizes.size());
+	const std::vector<unsigned char> dfd = block_format_dfd(texture.format, blockFormat);
+	const size_t dfdOffset = KTX2_LEVEL_INDEX_OFFSET + KTX2_LEVEL_INDEX_ENTRY_SIZE * levelCount;
+
+	// Key/value data follows the descriptor, which is a multiple of 4 bytes long
+	const std::vector<unsigned char> kvd = source_kvd(texture.sourceSize, texture.sourceHash);
+	const size_t kvdOffset = dfdOffset + dfd.size();
+
+	// Levels go in smallest first, each one aligned to the block size
+	const size_t alignment = vkbc::block_size(blockFormat);
+	std::vector<size_t> fileOffsets(levelCount);
+	size_t end = kvdOffset + kvd.size();
+	for (uint32_t level = levelCount; level-- > 0;)
+	{
+		fileOffsets[level] = align_up(end, alignment);
+		end = fileOffsets[level] + texture.levelSizes[level];
+	}
+
+	std::vector<unsigned char> out;
+	out.reserve(end);
+	out.insert(out.end(), KTX2_IDENTIFIER, KTX2_IDENTIFIER + sizeof(KTX2_IDENTIFIER));
+
+	put_u32(out, static_cast<uint32_t>(texture.format));
+	put_u32(out, 1);				// Type size of block compressed formats
+	put_u32(out, texture.width);
+	put_u32(out, texture.height);
+	put_u32(out, 0);				// Depth, layers: a single 2D image
+	put_u32(out, 0);
+	put_u32(out, 1);				// Faces
+	put_u32(out, levelCount);
+	put_u32(out, 0);				// No supercompression
+
+	put_u32(out, static_cast<uint32_t>(dfdOffset));
+	put_u32(out, static_cast<uint32_t>(dfd.size()));
+	put_u32(out, static_cast<uint32_t>(kvdOffset));
+	put_u32(out, static_cast<uint32_t>(kvd.size()));
+	put_u64(out, 0);				// No supercompression global data
+	put_u64(out, 0);
+
+	for (uint32_t level = 0; level < levelCount; level++)
+	{
+		put_u64(out, fileOffsets[level]);
+		put_u64(out, texture.levelSizes[level]);
+		put_u64(out, texture.levelSizes[level]);
+	}
+
+	out.insert(out.end(), dfd.begin(), dfd.end());
+	out.insert(out.end(), kvd.begin(), kvd.end());
+
+	for (uint32_t level = levelCount; level-- > 0;)
+	{
+		out.resize(fileOffsets[level], 0);
+		const unsigned char* levelData = texture.data.data() + texture.levelOffsets[level];
+		out.insert(out.end(), levelData, levelData + texture.levelSizes[level]);
+	}
+
+	std::ofstream file(filename, std::ios::binary | std::ios::trunc);
+	if (!file.is_open())
+	{
+		std::cout << "Failed to open " << filename << " for writing" << std::endl;
+		return false;
+	}
+
+	file.write(reinterpret_cast<const char*>(out.data()), static_cast<std::streamsize>(out.size()));
+	return file.good();
+}
+
+bool vkktx::read(const char* filename, Texture& outTexture)
+{
+	std::ifstream file(filename, std::ios::ate | std::ios::binary);
+	if (!file.is_open())
+	{
+		std::cout << "Failed to open " << filename << std::endl;
+		return false;
+	}
+
+	const size_t fileSize = static_cast<size_t>(file.tellg());
+	std::vector<unsigned char> bytes(fileSize);
+	file.seekg(0);
+	file.read(reinterpret_cast<char*>(bytes.data()), static_cast<std::streamsize>(fileSize));
+
+	if (fileSize < KTX2_LEVEL_INDEX_OFFSET || memcmp(bytes.data(), KTX2_IDENTIFIER, sizeof(KTX2_IDENTIFIER)) != 0)
+	{
+		std::cout << filename << " is not a KTX2 file" << std::endl;
+		return false;
+	}
+
+	const unsigned char* header = bytes.data() + sizeof(KTX2_IDENTIFIER);
+	const VkFormat format = static_cast<VkFormat>(get_u32(header + 0));
+	const uint32_t width = get_u32(header + 8);
+	const uint32_t height = get_u32(header + 12);
+	const uint32_t depth = get_u32(header + 16);
+	const uint32_t layers = get_u32(header + 20);
+	const uint32_t faces = get_u32(header + 24);
+	const uint32_t levelCount = std::max(1u, get_u32(header + 28));
+	const uint32_t supercompression = get_u32(header + 32);
+
+	if (depth > 1 || layers > 1 || faces != 1 || supercompression != 0 || width == 0 || height == 0)
+	{
+		std::cout << filename << ": only uncompressed 2D KTX2 images are supported" << std::endl;
+		return false;
+	}
+
+	vkbc::BlockFormat blockFormat;
+	if (!vkbc::from_vk_format(format, blockFormat))
+	{
+		std::cout << filename << ": only BC1, BC3 and BC7 KTX2 images are supported" << std::endl;
+		return false;
+	}
+
+	// No more levels than the chain down to 1x1 has
+	uint32_t maxLevelCount = 1;
+	for (uint32_t size = std::max(width, height); size > 1; size >>= 1)
+	{
+		maxLevelCount++;
+	}
+
+	if (levelCount > maxLevelCount)
+	{
+		std::cout << filename << " has " << levelCount << " levels, a " << width << "x" << height << " image has at most " << maxLevelCount << std::endl;
+		return false;
+	}
+
+	if (KTX2_LEVEL_INDEX_OFFSET + KTX2_LEVEL_INDEX_ENTRY_SIZE * levelCount > fileSize)
+	{
+		std::cout << filename << " is truncated" << std::endl;
+		return false;
+	}
+
+	outTexture.format = format;
+	outTexture.width = width;
+	outTexture.height = height;
+	outTexture.data.clear();
+	outTexture.levelOffsets.clear();
+	outTexture.levelSizes.clear();
+
+	for (uint32_t level = 0; level < levelCount; level++)
+	{
+		const unsigned char* entry = bytes.data() + KTX2_LEVEL_INDEX_OFFSET + KTX2_LEVEL_INDEX_ENTRY_SIZE * level;
+		const uint64_t offset = get_u64(entry);
+		const uint64_t size = get_u64(entry + 8);
+		if (offset > fileSize || size > fileSize - offset)
+		{
+			std::cout << filename << " is truncated" << std::endl;
+			return false;
+		}
+
+		// Uploads and the CPU decoder step through the levels by their expected sizes
+		const size_t expectedSize = vkbc::level_size(blockFormat, std::max(1u, width >> level), std::max(1u, height >> level));
+		if (size != expectedSize)
+		{
+			std::cout << filename << ": level " << level << " holds " << size << " bytes instead of " << expectedSize << std::endl;
+			return false;
+		}
+
+		outTexture.levelOffsets.push_back(outTexture.data.size());
+		outTexture.levelSizes.push_back(static_cast<size_t>(size));
+		outTexture.data.insert(outTexture.data.end(), bytes.begin() + offset, bytes.begin() + offset + size);
+	}
+
+	const uint32_t kvdOffset = get_u32(header + 44);
+	const uint32_t kvdSize = get_u32(header + 48);
+	outTexture.sourceSize = 0;
+	outTexture.sourceHash = 0;
+	if (kvdOffset <= fileSize && kvdSize <= fileSize - kvdOffset)
+	{
+		find_source(bytes.data() + kvdOffset, kvdSize, outTexture.sourceSize, outTexture.sourceHash);
+	}
+
+	return true;
+}
+
+bool vkktx::read_source(const char* filename, uint64_t& outSourceSize, uint64_t& outSourceHash)
+{
+	std::ifstream file(filename, std::ios::ate | std::ios::binary);
+	if (!file.is_open())
+	{
+		return false;
+	}
+
+	// Only the header and the key/value data, not the levels
+	const size_t fileSize = static_cast<size_t>(file.tellg());
+	unsigned char header[KTX2_LEVEL_INDEX_OFFSET];
+	if (fileSize < sizeof(header))
+	{
+		return false;
+	}
+
+	file.seekg(0);
+	file.read(reinterpret_cast<char*>(header), sizeof(header));
+	if (!file || memcmp(header, KTX2_IDENTIFIER, sizeof(KTX2_IDENTIFIER)) != 0)
+	{
+		return false;
+	}
+
+	const uint32_t kvdOffset = get_u32(header + sizeof(KTX2_IDENTIFIER) + 44);
+	const uint32_t kvdSize = get_u32(header + sizeof(KTX2_IDENTIFIER) + 48);
+	if (kvdOffset > fileSize || kvdSize > fileSize - kvdOffset)
+	{
+		return false;
+	}
+
+	std::vector<unsigned char> kvd(kvdSize);
+	file.seekg(kvdOffset);
+	file.read(reinterpret_cast<char*>(kvd.data()), static_cast<std::streamsize>(kvdSize));
+
+	return file && find_source(kvd.data(), kvd.size(), outSourceSize, outSourceHash);
+}
@@ -0,0 +1,39 @@
+#pragma once
+
+#include <vk_types.h>
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+// Reading and writing KTX2 texture containers. Only 2D images with one layer and no supercompression, the kind
+// vkbench --encode-textures writes
+namespace vkktx {
+
+	struct Texture {
+		VkFormat format{ VK_FORMAT_UNDEFINED };
+		uint32_t width{ 0 };
+		uint32_t height{ 0 };
+
+		// Every level from the largest down, one after another
+		std::vector<unsigned char> data;
+		std::vector<size_t> levelOffsets;
+		std::vector<size_t> levelSizes;
+
+		// Size and content hash of the image the texture was encoded from, kept in a key/value entry so a stale file
+		// can be told apart from a current one. 0 when unknown
+		uint64_t sourceSize{ 0 };
+		uint64_t sourceHash{ 0 };
+	};
+
+	// Writes the BC formats of vkbc only, those are the ones it has data format descriptors for
+	bool write(const char* filename, const Texture& texture);
+
+	// Only reads BC1, BC3 and BC7 files whose levels are a mip chain of the image, each holding exactly the blocks
+	// of its size, so every level can be read and decoded without checking its size again
+	bool read(const char* filename, Texture& outTexture);
+
+	// Read just the source fingerprint of a file write() wrote. False when the file can't be read or has none
+	bool read_source(const char* filename, uint64_t& outSourceSize, uint64_t& outSourceHash);
+
+}
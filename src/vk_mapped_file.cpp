@@ -0,0 +1,140 @@
+#include "vk_mapped_file.h"
+
+#ifdef _WIN32
+#define WIN32_LEAN_AND_MEAN
+#define NOMINMAX
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+MappedFile::~MappedFile()
+{
+	close();
+}
+
+bool MappedFile::open(const char* filename)
+{
+	close();
+
+#ifdef _WIN32
+	HANDLE file = CreateFileA(filename, GENERIC_READ, FILE_SHARE_READ, nullptr, OPEN_EXISTING, FILE_FLAG_SEQUENTIAL_SCAN, nullptr);
+	if (file == INVALID_HANDLE_VALUE)
+	{
+		return false;
+	}
+	_fileHandle = file;
+
+	LARGE_INTEGER fileSize;
+	if (!GetFileSizeEx(file, &fileSize))
+	{
+		close();
+		return false;
+	}
+	_size = static_cast<size_t>(fileSize.QuadPart);
+
+	// Empty files can't be mapped, but they are still valid files
+	if (_size == 0)
+	{
+		return true;
+	}
+
+	HANDLE mapping = CreateFileMappingA(file, nullptr, PAGE_READONLY, 0, 0, nullptr);
+	if (mapping == nullptr)
+	{
+		close();
+		return false;
+	}
+	_mappingHandle = mapping;
+
+	_data = static_cast<const char*>(MapViewOfFile(mapping, FILE_MAP_READ, 0, 0, 0));
+#else
+	_fileDescriptor = ::open(filename, O_RDONLY);
+	if (_fileDescriptor < 0)
+	{
+		return false;
+	}
+
+	struct stat fileStat;
+	if (fstat(_fileDescriptor, &fileStat) != 0)
+	{
+		close();
+		return false;
+	}
+	_size = static_cast<size_t>(fileStat.st_size);
+
+	// Empty files can't be mapped, but they are still valid files
+	if (_size == 0)
+	{
+		return true;
+	}
+
+	void* mapping = mmap(nullptr, _size, PROT_READ, MAP_PRIVATE, _fileDescriptor, 0);
+	if (mapping == MAP_FAILED)
+	{
+		close();
+		return false;
+	}
+
+	// The whole file is going to be read front to back
+	madvise(mapping, _size, MADV_SEQUENTIAL);
+
+	_data = static_cast<const char*>(mapping);
+#endif
+
+	if (_data == nullptr)
+	{
+		close();
+		return false;
+	}
+
+	return true;
+}
+
+void MappedFile::close()
+{
+#ifdef _WIN32
+	if (_data)
+	{
+		UnmapViewOfFile(_data);
+	}
+	if (_mappingHandle)
+	{
+		CloseHandle(_mappingHandle);
+	}
+	if (_fileHandle)
+	{
+		CloseHandle(_fileHandle);
+	}
+	_mappingHandle = nullptr;
+	_fileHandle = nullptr;
+#else
+	if (_data)
+	{
+		munmap(const_cast<char*>(_data), _size);
+	}
+	if (_fileDescriptor >= 0)
+	{
+		::close(_fileDescriptor);
+	}
+	_fileDescriptor = -1;
+#endif
+
+	_data = nullptr;
+	_size = 0;
+}
+
+size_t MappedFile::mapped_size() const
+{
+#ifdef _WIN32
+	SYSTEM_INFO systemInfo;
+	GetSystemInfo(&systemInfo);
+	const size_t pageSize = systemInfo.dwPageSize;
+#else
+	const size_t pageSize = static_cast<size_t>(sysconf(_SC_PAGESIZE));
+#endif
+	return (_size + pageSize - 1) / pageSize * pageSize;
+}
@@ -0,0 +1,35 @@
+#pragma once
+
+#include <cstddef>
+
+// Read-only memory mapping of a whole file. The mapping is released when the object is destroyed or closed
+class MappedFile {
+public:
+	MappedFile() = default;
+	~MappedFile();
+
+	MappedFile(const MappedFile&) = delete;
+	MappedFile& operator=(const MappedFile&) = delete;
+
+	// Map the file into memory. Returns false if the file can't be opened or mapped
+	bool open(const char* filename);
+
+	void close();
+
+	const char* data() const { return _data; }
+	size_t size() const { return _size; }
+
+	// Bytes the mapping spans, the file size rounded up to whole pages. The tail past the file reads as zeros
+	size_t mapped_size() const;
+
+private:
+	const char* _data{ nullptr };
+	size_t _size{ 0 };
+
+#ifdef _WIN32
+	void* _fileHandle{ nullptr };
+	void* _mappingHandle{ nullptr };
+#else
+	int _fileDescriptor{ -1 };
+#endif
+};
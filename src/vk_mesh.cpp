@@ -1,90 +1,635 @@
 #include "vk_mesh.h"
 
-#include <tiny_obj_loader.h>
+#include "vk_mesh_cache.h"
+#include "vk_mesh_optimizer.h"
+#include "vk_obj_loader.h"
+
+#include <algorithm>
+#include <cmath>
+#include <cstring>
 #include <iostream>
 
-bool Mesh::load_from_obj(const char* filename)
+#include <glm/geometric.hpp>
+#include <glm/trigonometric.hpp>
+
+namespace {
+
+	// Largest vertex count that can still be addressed with 16 bit indices
+	constexpr size_t MAX_16BIT_VERTICES = 65536;
+
+	uint32_t hash_vertex(const Vertex& vertex)
+	{
+		// FNV-1a over the raw words of the vertex. Welding is exact, so hashing the bits is enough
+		uint32_t words[sizeof(Vertex) / sizeof(uint32_t)];
+		memcpy(words, &vertex, sizeof(Vertex));
+
+		uint32_t hash = 2166136261u;
+		for (uint32_t word : words)
+		{
+			hash = (hash ^ word) * 16777619u;
+		}
+		return hash ^ (hash >> 15);
+	}
+
+	uint16_t quantize_unorm16(float value)
+	{
+		return static_cast<uint16_t>(std::lround(std::min(std::max(value, 0.0f), 1.0f) * 65535.0f));
+	}
+
+	int16_t quantize_snorm16(float value)
+	{
+		return static_cast<int16_t>(std::lround(std::min(std::max(value, -1.0f), 1.0f) * 32767.0f));
+	}
+
+	// Map a unit vector onto the octahedron |x| + |y| + |z| = 1 and unfold the lower half over the corners of the square
+	glm::vec2 encode_octahedral(glm::vec3 normal)
+	{
+		normal /= std::abs(normal.x) + std::abs(normal.y) + std::abs(normal.z);
+		if (normal.z >= 0.0f)
+		{
+			return glm::vec2(normal.x, normal.y);
+		}
+
+		return glm::vec2(
+			(1.0f - std::abs(normal.y)) * (normal.x >= 0.0f ? 1.0f : -1.0f),
+			(1.0f - std::abs(normal.x)) * (normal.y >= 0.0f ? 1.0f : -1.0f));
+	}
+
+	// Same decode as tri_mesh_compact.vert, used to measure the encoding error
+	glm::vec3 decode_octahedral(glm::vec2 encoded)
+	{
+		glm::vec3 normal(encoded.x, encoded.y, 1.0f - std::abs(encoded.x) - std::abs(encoded.y));
+		const float t = std::max(-normal.z, 0.0f);
+		normal.x += normal.x >= 0.0f ? -t : t;
+		normal.y += normal.y >= 0.0f ? -t : t;
+		return glm::normalize(normal);
+	}
+
+	MeshMaterial make_mesh_material(const ObjMaterial& objMaterial)
+	{
+		MeshMaterial material = {};
+		strncpy(material.name, objMaterial.name.c_str(), MESH_MATERIAL_NAME_SIZE - 1);
+		material.diffuse = glm::vec4(objMaterial.diffuse, objMaterial.dissolve);
+
+		// Foliage and the like cut out their shape with an alpha map, it can't go down the opaque path
+		if (!objMaterial.alphaTexture.empty() || objMaterial.dissolve < 1.0f)
+		{
+			material.flags |= MESH_MATERIAL_ALPHA_TESTED;
+		}
+
+		return material;
+	}
+
+	// Copy of the level 0 indices of a submesh
+	std::vector<uint32_t> submesh_indices(const std::vector<uint32_t>& indices, const Submesh& submesh)
+	{
+		const auto first = indices.begin() + submesh.lods[0].firstIndex;
+		return std::vector<uint32_t>(first, first + submesh.lods[0].indexCount);
+	}
+}
+
+bool Mesh::load_from_obj(const char* filename, const MeshLoadOptions& options)
 {
-	// Attrib will contain the vertex arrays of the file
-	tinyobj::attrib_t attrib;
-	// Shapes contains the info for each seperate object in the file
-	std::vector<tinyobj::shape_t> shapes;
-	// Materials contains the information about the material of each shape
-	std::vector<tinyobj::material_t> materials;
+	// Fingerprint the source and its material library so an edited OBJ or .mtl is never hidden by an old cook
+	uint64_t sourceSize = 0;
+	uint64_t sourceHash = 0;
+	uint64_t materialLibraryHash = 0;
+	{
+		MappedFile source;
+		if (!source.open(filename))
+		{
+			std::cerr << "Cannot open file [" << filename << "]" << std::endl;
+			return false;
+		}
+		sourceSize = source.size();
+		sourceHash = vkcache::hash_memory(source.data(), source.size());
+
+		MappedFile library;
+		const std::string libraryPath = vkobj::find_material_library(filename, source.data(), source.size());
+		if (!libraryPath.empty() && library.open(libraryPath.c_str()))
+		{
+			materialLibraryHash = vkcache::hash_memory(library.data(), library.size());
+		}
+	}
 
-	// Error and warning output from the load functions
-	std::string warn;
-	std::string err;
+	const std::string cachePath = vkcache::cache_path(filename);
+	const uint32_t cacheFlags = (options.optimize ? MESH_CACHE_OPTIMIZED : 0)
+		| (options.allowCompact ? MESH_CACHE_COMPACT_ALLOWED : 0)
+		| (options.buildMeshlets ? MESH_CACHE_MESHLETS : 0)
+		| (options.buildLods ? MESH_CACHE_LODS : 0);
 
-	// Load the OBJ file
-	tinyobj::LoadObj(&attrib, &shapes, &materials, &warn, &err, filename, nullptr);
-	
-	// Output any warnings to the console (such as issues with the file)
-	if (!warn.empty())
+	// Warm path: map the cooked file, the vertices get copied out of the mapping at upload time
+	auto cache = std::make_shared<MeshCache>();
+	if (cache->open(cachePath.c_str(), sourceSize, sourceHash, materialLibraryHash, cacheFlags))
 	{
-		std::cout << "WARNING: " << warn << std::endl;
+		const MeshCacheHeader& header = cache->header();
+
+		_cache = cache;
+		_vertices.clear();
+		_compactVertices.clear();
+		_meshlets.clear();
+		_materials.assign(cache->materials(), cache->materials() + header.materialCount);
+		_submeshes.assign(cache->submeshes(), cache->submeshes() + header.submeshCount);
+		_vertexFormat = static_cast<VertexFormat>(header.vertexFormat);
+		_bounds.min = glm::vec3(header.boundsMin[0], header.boundsMin[1], header.boundsMin[2]);
+		_bounds.max = glm::vec3(header.boundsMax[0], header.boundsMax[1], header.boundsMax[2]);
+		_boundingSphere = glm::vec4(header.boundingSphere[0], header.boundingSphere[1], header.boundingSphere[2], header.boundingSphere[3]);
+		_positionOffset = _bounds.min;
+		_positionScale = _bounds.max - _bounds.min;
+		return true;
 	}
 
-	// Output any errors to the console (such as file not found) and stop the mesh loading
-	if (!err.empty())
+	// Cold path: parse the OBJ file straight into our vertex array. The loader prints its own errors
+	std::vector<uint32_t> triangleMaterials;
+	std::vector<ObjMaterial> objMaterials;
+	if (!vkobj::load_obj(filename, _vertices, &triangleMaterials, &objMaterials))
 	{
-		std::cerr << err << std::endl;
 		return false;
 	}
 
-	// Loop over shapes
-	for (size_t s = 0; s < shapes.size(); s++) {
-		// Loop over faces(polygon)
-		size_t index_offset = 0;
-		for (size_t f = 0; f < shapes[s].mesh.num_face_vertices.size(); f++) {
+	_materials.clear();
+	for (const ObjMaterial& objMaterial : objMaterials)
+	{
+		_materials.push_back(make_mesh_material(objMaterial));
+	}
+
+	const size_t flatVertexCount = _vertices.size();
 
-			// Hardcode the number of vertices to 3 (a triangle)
-			int fv = 3;
+	group_by_material(triangleMaterials);
+	weld_vertices();
+	compute_bounds();
 
-			// Loop over vertices in the face.
-			for (size_t v = 0; v < fv; v++) {
-				// Access to vertex
-				tinyobj::index_t idx = shapes[s].mesh.indices[index_offset + v];
+	std::cout << "Welded " << filename << ": " << flatVertexCount << " -> " << _vertices.size() << " vertices, "
+		<< flatVertexCount * sizeof(Vertex) / 1024 << " KB -> "
+		<< (_vertices.size() * sizeof(Vertex) + _indices.size() * index_size()) / 1024 << " KB with indices, "
+		<< _submeshes.size() << " submeshes" << std::endl;
+
+	if (options.optimize)
+	{
+		optimize(filename);
+	}
 
-				// Vertex position
-				tinyobj::real_t vx = attrib.vertices[3 * idx.vertex_index + 0];
-				tinyobj::real_t vy = attrib.vertices[3 * idx.vertex_index + 1];
-				tinyobj::real_t vz = attrib.vertices[3 * idx.vertex_index + 2];
-				// Vertex normal
-				tinyobj::real_t nx = attrib.normals[3 * idx.normal_index + 0];
-				tinyobj::real_t ny = attrib.normals[3 * idx.normal_index + 1];
-				tinyobj::real_t nz = attrib.normals[3 * idx.normal_index + 2];
+	if (options.buildMeshlets)
+	{
+		build_meshlets(filename);
+	}
 
-				// Vertex uv
-				tinyobj::real_t ux = attrib.texcoords[2 * idx.texcoord_index + 0];
-				tinyobj::real_t uy = attrib.texcoords[2 * idx.texcoord_index + 1];
+	if (options.buildLods)
+	{
+		build_lods(filename);
+	}
 
-				// Copy it into our vertex
-				Vertex new_vert;
-				new_vert.position.x = vx;
-				new_vert.position.y = vy;
-				new_vert.position.z = vz;
+	if (options.allowCompact)
+	{
+		compact_vertices(filename);
+	}
 
-				new_vert.normal.x = nx;
-				new_vert.normal.y = ny;
-				new_vert.normal.z = nz;
+	if (!vkcache::write_mesh_cache(cachePath.c_str(), sourceSize, sourceHash, materialLibraryHash, cacheFlags, *this))
+	{
+		std::cout << "WARNING: could not write mesh cache " << cachePath << std::endl;
+	}
 
-				new_vert.uv.x = ux;
-				new_vert.uv.y = 1 - uy;
+	return true;
+}
 
-				// Set the vertex color as the vertex normal. This is just for display purposes
-				new_vert.color = new_vert.normal;
+const void* Mesh::vertex_data() const
+{
+	if (_cache)
+	{
+		return _cache->vertices();
+	}
+	return _vertexFormat == VertexFormat::Compact ? static_cast<const void*>(_compactVertices.data()) : _vertices.data();
+}
 
+size_t Mesh::vertex_data_count() const
+{
+	return _cache ? _cache->header().vertexCount : _vertices.size();
+}
 
-				_vertices.push_back(new_vert);
-			}
-			index_offset += fv;
+uint32_t Mesh::vertex_stride() const
+{
+	return _vertexFormat == VertexFormat::Compact ? sizeof(CompactVertex) : sizeof(Vertex);
+}
+
+void Mesh::group_by_material(const std::vector<uint32_t>& triangleMaterials)
+{
+	const size_t triangleCount = _vertices.size() / 3;
+
+	_submeshes.clear();
+
+	// Draw order of the materials: opaque ones first so they fill depth before anything discards, then in order of first use
+	std::vector<uint32_t> order(_materials.size());
+	for (uint32_t m = 0; m < order.size(); m++)
+	{
+		order[m] = m;
+	}
+	std::stable_sort(order.begin(), order.end(), [&](uint32_t a, uint32_t b) {
+		return (_materials[a].flags & MESH_MATERIAL_ALPHA_TESTED) < (_materials[b].flags & MESH_MATERIAL_ALPHA_TESTED);
+	});
+
+	std::vector<uint32_t> materialTriangleCounts(_materials.size(), 0);
+	for (size_t t = 0; t < triangleCount; t++)
+	{
+		materialTriangleCounts[triangleMaterials[t]]++;
+	}
+
+	// Counting sort: each material gets a slot range, one submesh per material that is actually used
+	std::vector<size_t> materialOffsets(_materials.size(), 0);
+	size_t offset = 0;
+	for (uint32_t material : order)
+	{
+		materialOffsets[material] = offset;
+		if (materialTriangleCounts[material] > 0)
+		{
+			Submesh submesh = {};
+			submesh.material = material;
+			submesh.lodCount = 1;
+			submesh.lods[0] = MeshLod{ static_cast<uint32_t>(offset * 3), materialTriangleCounts[material] * 3, 0.0f };
+			_submeshes.push_back(submesh);
+		}
+		offset += materialTriangleCounts[material];
+	}
+
+	// Nothing to move for single material meshes like the monkeys
+	if (_submeshes.size() <= 1)
+	{
+		return;
+	}
+
+	std::vector<Vertex> sorted(_vertices.size());
+	for (size_t t = 0; t < triangleCount; t++)
+	{
+		const size_t destination = materialOffsets[triangleMaterials[t]]++;
+		std::copy(_vertices.begin() + t * 3, _vertices.begin() + t * 3 + 3, sorted.begin() + destination * 3);
+	}
+	_vertices.swap(sorted);
+}
+
+void Mesh::group_by_material_runs(const std::vector<ObjMaterial>& materials, const std::vector<ObjTriangleRun>& runs,
+	std::vector<ObjTriangleRun>& outIndexOrder)
+{
+	_materials.clear();
+	for (const ObjMaterial& objMaterial : materials)
+	{
+		_materials.push_back(make_mesh_material(objMaterial));
+	}
+
+	_submeshes.clear();
+	outIndexOrder.clear();
+
+	// Same draw order as group_by_material: opaque materials first, then in order of first use
+	std::vector<uint32_t> order(_materials.size());
+	for (uint32_t m = 0; m < order.size(); m++)
+	{
+		order[m] = m;
+	}
+	std::stable_sort(order.begin(), order.end(), [&](uint32_t a, uint32_t b) {
+		return (_materials[a].flags & MESH_MATERIAL_ALPHA_TESTED) < (_materials[b].flags & MESH_MATERIAL_ALPHA_TESTED);
+	});
+
+	std::vector<std::vector<uint32_t>> materialRuns(_materials.size());
+	for (uint32_t r = 0; r < runs.size(); r++)
+	{
+		materialRuns[runs[r].material].push_back(r);
+	}
+
+	// Each material's runs go into the index buffer one after the other, in file order
+	size_t offset = 0;
+	for (uint32_t material : order)
+	{
+		size_t triangleCount = 0;
+		for (uint32_t r : materialRuns[material])
+		{
+			outIndexOrder.push_back(runs[r]);
+			triangleCount += runs[r].triangleCount;
+		}
+
+		if (triangleCount > 0)
+		{
+			Submesh submesh = {};
+			submesh.material = material;
+			submesh.lodCount = 1;
+			submesh.lods[0] = MeshLod{ static_cast<uint32_t>(offset * 3), static_cast<uint32_t>(triangleCount * 3), 0.0f };
+			_submeshes.push_back(submesh);
+		}
+		offset += triangleCount;
+	}
+}
+
+void Mesh::weld_vertices()
+{
+	const size_t flatCount = _vertices.size();
+
+	// Open addressing table of indices into the welded vertices, kept at most half full
+	size_t tableSize = 1;
+	while (tableSize < flatCount * 2)
+	{
+		tableSize <<= 1;
+	}
+	const uint32_t EMPTY = UINT32_MAX;
+	std::vector<uint32_t> table(tableSize, EMPTY);
+
+	_indices.resize(flatCount);
+
+	// Unique vertices are compacted to the front of _vertices in first-seen order
+	size_t uniqueCount = 0;
+	for (size_t i = 0; i < flatCount; i++)
+	{
+		const Vertex vertex = _vertices[i];
+
+		size_t slot = hash_vertex(vertex) & (tableSize - 1);
+		while (table[slot] != EMPTY && memcmp(&_vertices[table[slot]], &vertex, sizeof(Vertex)) != 0)
+		{
+			slot = (slot + 1) & (tableSize - 1);
+		}
+
+		if (table[slot] == EMPTY)
+		{
+			table[slot] = static_cast<uint32_t>(uniqueCount);
+			_vertices[uniqueCount] = vertex;
+			uniqueCount++;
+		}
+
+		_indices[i] = table[slot];
+	}
+
+	_vertices.resize(uniqueCount);
+	_vertices.shrink_to_fit();
+}
+
+void Mesh::optimize(const char* name)
+{
+	if (_indices.empty())
+	{
+		return;
+	}
+
+	const VertexCacheStats before = vkopt::analyze_vertex_cache(_indices, _vertices.size());
+
+	// Triangles can only move inside their submesh, the ranges have to stay valid
+	for (const Submesh& submesh : _submeshes)
+	{
+		std::vector<uint32_t> indices = submesh_indices(_indices, submesh);
+
+		vkopt::optimize_vertex_cache(indices, _vertices.size());
+		vkopt::optimize_overdraw(indices, _vertices);
+
+		std::copy(indices.begin(), indices.end(), _indices.begin() + submesh.lods[0].firstIndex);
+	}
+
+	vkopt::optimize_vertex_fetch(_indices, _vertices);
+
+	const VertexCacheStats after = vkopt::analyze_vertex_cache(_indices, _vertices.size());
+
+	std::cout << "Optimized " << name << ": ACMR " << before.acmr << " -> " << after.acmr
+		<< ", ATVR " << before.atvr << " -> " << after.atvr << std::endl;
+}
+
+void Mesh::build_meshlets(const char* name)
+{
+	if (_indices.empty())
+	{
+		return;
+	}
+
+	_meshlets.clear();
+
+	// Meshlets never span submeshes, so each one can be culled and drawn with its submesh's material
+	for (Submesh& submesh : _submeshes)
+	{
+		std::vector<uint32_t> indices = submesh_indices(_indices, submesh);
+		std::vector<Meshlet> meshlets;
+
+		vkopt::build_meshlets(indices, _vertices, meshlets);
+
+		std::copy(indices.begin(), indices.end(), _indices.begin() + submesh.lods[0].firstIndex);
+
+		submesh.firstMeshlet = static_cast<uint32_t>(_meshlets.size());
+		submesh.meshletCount = static_cast<uint32_t>(meshlets.size());
+		for (Meshlet& meshlet : meshlets)
+		{
+			meshlet.firstIndex += submesh.lods[0].firstIndex;
+			_meshlets.push_back(meshlet);
 		}
 	}
 
+	// Meshlets moved triangles around, put the vertices back in first use order
+	vkopt::optimize_vertex_fetch(_indices, _vertices);
+
+	const VertexCacheStats stats = vkopt::analyze_vertex_cache(_indices, _vertices.size());
+
+	float averageRadius = 0.0f;
+	size_t cullableCones = 0;
+	for (const Meshlet& meshlet : _meshlets)
+	{
+		averageRadius += meshlet.sphere.w;
+		cullableCones += meshlet.cone.w <= 1.0f;
+	}
+	averageRadius /= _meshlets.size();
+
+	std::cout << "Built " << _meshlets.size() << " meshlets for " << name << ": "
+		<< static_cast<float>(_indices.size() / 3) / _meshlets.size() << " triangles and "
+		<< static_cast<float>(_vertices.size()) / _meshlets.size() << " vertices on average, radius " << averageRadius << ", "
+		<< cullableCones << " with a usable backface cone, ACMR " << stats.acmr << std::endl;
+}
+
+bool Mesh::compact_vertices(const char* name)
+{
+	if (_vertices.empty())
+	{
+		return false;
+	}
+
+	// The compact layout has no color and clamps uvs, so it is only used when neither loses anything
+	for (const Vertex& vertex : _vertices)
+	{
+		if (vertex.color != vertex.normal || vertex.uv.x < 0.0f || vertex.uv.x > 1.0f || vertex.uv.y < 0.0f || vertex.uv.y > 1.0f)
+		{
+			return false;
+		}
+	}
+
+	// Positions are quantized inside the bounds, which the cooked file header stores as well
+	_positionOffset = _bounds.min;
+	_positionScale = _bounds.max - _bounds.min;
+
+	float maxPositionError = 0.0f;
+	float maxNormalError = 0.0f;
+	float maxUvError = 0.0f;
+
+	_compactVertices.resize(_vertices.size());
+	for (size_t v = 0; v < _vertices.size(); v++)
+	{
+		const Vertex& vertex = _vertices[v];
+		CompactVertex& compact = _compactVertices[v];
+
+		for (int axis = 0; axis < 3; axis++)
+		{
+			const float scale = _positionScale[axis];
+			compact.position[axis] = scale > 0.0f ? quantize_unorm16((vertex.position[axis] - _positionOffset[axis]) / scale) : 0;
+
+			const float decoded = _positionOffset[axis] + compact.position[axis] / 65535.0f * scale;
+			maxPositionError = std::max(maxPositionError, std::abs(decoded - vertex.position[axis]));
+		}
+		compact.position[3] = 0;
+
+		// Zero length normals encode as +Z, they don't have a direction to lose
+		const float normalLength = glm::length(vertex.normal);
+		if (normalLength > 0.0f)
+		{
+			const glm::vec3 normal = vertex.normal / normalLength;
+			const glm::vec2 encoded = encode_octahedral(normal);
+			compact.normal[0] = quantize_snorm16(encoded.x);
+			compact.normal[1] = quantize_snorm16(encoded.y);
+
+			const glm::vec3 decoded = decode_octahedral(glm::vec2(compact.normal[0], compact.normal[1]) / 32767.0f);
+			// Angle from the chord length, acos of the dot product is too coarse near 1 to see the error
+			maxNormalError = std::max(maxNormalError, 2.0f * std::asin(std::min(glm::length(decoded - normal) * 0.5f, 1.0f)));
+		}
+		else
+		{
+			compact.normal[0] = 0;
+			compact.normal[1] = 0;
+		}
+
+		for (int axis = 0; axis < 2; axis++)
+		{
+			compact.uv[axis] = quantize_unorm16(vertex.uv[axis]);
+			maxUvError = std::max(maxUvError, std::abs(compact.uv[axis] / 65535.0f - vertex.uv[axis]));
+		}
+	}
+
+	_vertexFormat = VertexFormat::Compact;
+
+	std::cout << "Compacted " << name << ": " << sizeof(Vertex) << " -> " << sizeof(CompactVertex) << " bytes per vertex, max error "
+		<< "position " << maxPositionError << " (extent " << glm::length(_positionScale) << "), "
+		<< "normal " << glm::degrees(maxNormalError) << " deg, uv " << maxUvError << std::endl;
+
 	return true;
+}
+
+void Mesh::build_lods(const char* name)
+{
+	// Each level aims for half the triangles of the one before
+	constexpr float LOD_RATIOS[] = { 0.5f, 0.25f, 0.125f };
+	// A level that doesn't get below this fraction of the previous one isn't worth its memory
+	constexpr float LOD_MIN_REDUCTION = 0.85f;
 
+	if (_indices.empty())
+	{
+		return;
+	}
+
+	// Triangles drawn when every submesh is at its coarsest level
+	size_t baseTriangles = 0;
+	size_t coarsestTriangles = 0;
+	size_t simplifiedSubmeshes = 0;
+
+	for (Submesh& submesh : _submeshes)
+	{
+		// Simplify from the full submesh every time, so each error is measured against the original surface.
+		// The triangles of other submeshes aren't seen, so the edges between materials stay where they are
+		const std::vector<uint32_t> baseIndices = submesh_indices(_indices, submesh);
+
+		for (float ratio : LOD_RATIOS)
+		{
+			if (submesh.lodCount == MESH_MAX_LODS)
+			{
+				break;
+			}
+
+			const size_t targetIndexCount = static_cast<size_t>(baseIndices.size() / 3 * ratio) * 3;
+
+			float error = 0.0f;
+			std::vector<uint32_t> lodIndices = vkopt::simplify(baseIndices, _vertices, targetIndexCount, error);
+
+			if (lodIndices.empty() || lodIndices.size() > submesh.lods[submesh.lodCount - 1].indexCount * LOD_MIN_REDUCTION)
+			{
+				break;
+			}
+
+			vkopt::optimize_vertex_cache(lodIndices, _vertices.size());
+
+			submesh.lods[submesh.lodCount++] = MeshLod{ static_cast<uint32_t>(_indices.size()), static_cast<uint32_t>(lodIndices.size()), error };
+			_indices.insert(_indices.end(), lodIndices.begin(), lodIndices.end());
+		}
+
+		baseTriangles += submesh.lods[0].indexCount / 3;
+		coarsestTriangles += submesh.lods[submesh.lodCount - 1].indexCount / 3;
+		simplifiedSubmeshes += submesh.lodCount > 1;
+	}
+
+	std::cout << "Built LODs for " << name << ": " << simplifiedSubmeshes << " of " << _submeshes.size() << " submeshes simplified, "
+		<< baseTriangles << " -> " << coarsestTriangles << " triangles at the coarsest levels, extent "
+		<< glm::length(_bounds.max - _bounds.min) << std::endl;
+}
+
+uint32_t Submesh::select_lod(float pixelsPerUnit, float maxPixelError) const
+{
+	// Errors only grow down the chain
+	uint32_t level = 0;
+	while (level + 1 < lodCount && lods[level + 1].error * pixelsPerUnit <= maxPixelError)
+	{
+		level++;
+	}
+	return level;
+}
+
+void Mesh::compute_bounds()
+{
+	const glm::vec3* positions = _vertices.empty() ? nullptr : &_vertices[0].position;
+
+	_bounds = vkbounds::compute_aabb(positions, _vertices.size(), sizeof(Vertex));
+	_boundingSphere = vkbounds::compute_sphere(positions, _vertices.size(), sizeof(Vertex), _bounds);
+}
+
+const Meshlet* Mesh::meshlet_data() const
+{
+	return _cache ? _cache->meshlets() : _meshlets.data();
+}
+
+size_t Mesh::meshlet_data_count() const
+{
+	return _cache ? _cache->header().meshletCount : _meshlets.size();
+}
+
+size_t Mesh::index_data_count() const
+{
+	return _cache ? _cache->header().indexCount : _indices.size();
+}
+
+uint32_t Mesh::index_size() const
+{
+	if (_cache)
+	{
+		return _cache->header().indexSize;
+	}
+	return vertex_data_count() <= MAX_16BIT_VERTICES ? sizeof(uint16_t) : sizeof(uint32_t);
+}
+
+void Mesh::write_index_data(void* destination) const
+{
+	// Cooked indices are already in their final size
+	if (_cache)
+	{
+		memcpy(destination, _cache->indices(), index_data_count() * index_size());
+		return;
+	}
+
+	if (index_size() == sizeof(uint16_t))
+	{
+		uint16_t* out = static_cast<uint16_t*>(destination);
+		for (size_t i = 0; i < _indices.size(); i++)
+		{
+			out[i] = static_cast<uint16_t>(_indices[i]);
+		}
+	}
+	else
+	{
+		memcpy(destination, _indices.data(), _indices.size() * sizeof(uint32_t));
+	}
 }
+
 VertexInputDescription Vertex::get_vertex_description()
 {
 	VertexInputDescription description;
@@ -134,5 +679,43 @@ VertexInputDescription Vertex::get_vertex_description()
 	description.attributes.push_back(colorAttribute);
 	description.attributes.push_back(uvAttribute);
 	
+	return description;
+}
+
+VertexInputDescription CompactVertex::get_vertex_description()
+{
+	VertexInputDescription description;
+
+	VkVertexInputBindingDescription mainBinding = {};
+	mainBinding.binding = 0;
+	mainBinding.stride = sizeof(CompactVertex);
+	mainBinding.inputRate = VK_VERTEX_INPUT_RATE_VERTEX;
+
+	description.bindings.push_back(mainBinding);
+
+	// Same locations as Vertex, location 2 (color) isn't used by the compact shader.
+	// The normalized formats make the input assembler do the integer to float conversion
+	VkVertexInputAttributeDescription positionAttribute = {};
+	positionAttribute.binding = 0;
+	positionAttribute.location = 0;
+	positionAttribute.format = VK_FORMAT_R16G16B16A16_UNORM;
+	positionAttribute.offset = offsetof(CompactVertex, position);
+
+	VkVertexInputAttributeDescription normalAttribute = {};
+	normalAttribute.binding = 0;
+	normalAttribute.location = 1;
+	normalAttribute.format = VK_FORMAT_R16G16_SNORM;
+	normalAttribute.offset = offsetof(CompactVertex, normal);
+
+	VkVertexInputAttributeDescription uvAttribute = {};
+	uvAttribute.binding = 0;
+	uvAttribute.location = 3;
+	uvAttribute.format = VK_FORMAT_R16G16_UNORM;
+	uvAttribute.offset = offsetof(CompactVertex, uv);
+
+	description.attributes.push_back(positionAttribute);
+	description.attributes.push_back(normalAttribute);
+	description.attributes.push_back(uvAttribute);
+
 	return description;
 }
\ No newline at end of file
@@ -1,9 +1,13 @@
 #pragma once
 #include "vk_types.h"
+#include "vk_bounds.h"
+#include "vk_geometry_arena.h"
 
+#include <memory>
 #include <vector>
 #include<glm/vec3.hpp>
 #include <glm/vec2.hpp>
+#include <glm/vec4.hpp>
 
 struct VertexInputDescription
 {
@@ -22,11 +26,193 @@ struct Vertex
 	static VertexInputDescription get_vertex_description();
 };
 
+// Vertex layouts a mesh can be uploaded in
+enum class VertexFormat : uint32_t {
+	Full,		// Vertex
+	Compact,	// CompactVertex
+};
+
+// 16 byte vertex. Positions are quantized inside the mesh bounds and decoded with Mesh::_positionOffset/_positionScale.
+// There is no color, the vertex shader uses the normal like the OBJ loader does
+struct CompactVertex
+{
+	uint16_t position[4];	// Unorm16 inside the mesh bounds, w unused
+	int16_t normal[2];		// Octahedral encoded unit normal, snorm16
+	uint16_t uv[2];			// Unorm16
+	static VertexInputDescription get_vertex_description();
+};
+
+// Limits of a meshlet, the sizes mesh shading hardware is tuned for
+constexpr uint32_t MESHLET_MAX_VERTICES = 64;
+constexpr uint32_t MESHLET_MAX_TRIANGLES = 124;
+
+// A small cluster of neighbouring triangles, stored as a range of the mesh's index buffer so it can be culled
+// and drawn on its own. Laid out for std430 so the array can be read by shaders as is
+struct Meshlet
+{
+	// Bounding sphere in mesh space, xyz center and w radius
+	glm::vec4 sphere;
+
+	// Backface cone. Every triangle faces away from a camera at cameraPos when
+	// dot(normalize(coneApex.xyz - cameraPos), cone.xyz) >= cone.w. The cutoff is above 1 when the normals spread too far to ever cull
+	glm::vec4 coneApex;
+	glm::vec4 cone;
+
+	uint32_t firstIndex;
+	uint32_t indexCount;
+	uint32_t vertexCount;	// Unique vertices used, at most MESHLET_MAX_VERTICES
+	uint32_t padding;
+};
+
+// Most levels of detail a mesh can have, including the full mesh
+constexpr uint32_t MESH_MAX_LODS = 8;
+
+// One level of detail, a range of the mesh's index buffer
+struct MeshLod
+{
+	uint32_t firstIndex;
+	uint32_t indexCount;
+	float error;			// How far the level strays from the full mesh, in mesh units
+};
+
+// MeshMaterial::flags
+constexpr uint32_t MESH_MATERIAL_ALPHA_TESTED = 1 << 0;	// Has an alpha map or isn't fully opaque, needs the discarding pipeline
+
+// Longest material name kept, including the terminator. Longer names are cut
+constexpr uint32_t MESH_MATERIAL_NAME_SIZE = 64;
+
+// A material the mesh's submeshes reference. Plain data so it can be stored in the cooked file as is
+struct MeshMaterial
+{
+	char name[MESH_MATERIAL_NAME_SIZE];
+	glm::vec4 diffuse;		// rgb diffuse color, a opacity
+	uint32_t flags;			// MESH_MATERIAL_* bits
+	uint32_t padding[3];
+};
+
+// The triangles of one material, drawn with one call per object. Opaque submeshes come before alpha tested ones
+struct Submesh
+{
+	uint32_t material;		// Index into Mesh::_materials
+
+	// Meshlets of level 0, a range of Mesh::_meshlets
+	uint32_t firstMeshlet;
+	uint32_t meshletCount;
+
+	// Levels of detail as ranges of the index buffer, finest first. Level 0 is the full submesh
+	uint32_t lodCount;
+	MeshLod lods[MESH_MAX_LODS];
+
+	// Coarsest level whose error projects to at most maxPixelError pixels, given how many pixels one mesh unit covers
+	uint32_t select_lod(float pixelsPerUnit, float maxPixelError) const;
+};
+
+// How Mesh::load_from_obj cooks a mesh
+struct MeshLoadOptions
+{
+	// Reorder triangles and vertices with Mesh::optimize
+	bool optimize{ true };
+	// Let the mesh pick VertexFormat::Compact when it can be encoded without losing data
+	bool allowCompact{ true };
+	// Split the triangles into meshlets with build_meshlets
+	bool buildMeshlets{ true };
+	// Append simplified levels of detail with build_lods
+	bool buildLods{ true };
+};
+
+class MeshCache;
+struct ObjMaterial;
+struct ObjTriangleRun;
+
 struct Mesh
 {
 	std::vector<Vertex> _vertices;
 
-	AllocatedBuffer _vertexBuffer;
+	// Layout of the vertex data that gets uploaded. Compact meshes keep their encoded vertices in _compactVertices
+	VertexFormat _vertexFormat{ VertexFormat::Full };
+	std::vector<CompactVertex> _compactVertices;
+
+	// Compact positions decode as _positionOffset + unorm * _positionScale
+	glm::vec3 _positionOffset{ 0.0f };
+	glm::vec3 _positionScale{ 1.0f };
+
+	// Triangle list indices into _vertices. Meshes without indices are drawn non-indexed
+	std::vector<uint32_t> _indices;
+
+	// Clusters of the index buffer, each a contiguous range of _indices
+	std::vector<Meshlet> _meshlets;
+
+	// Materials and the index ranges that use them. The level 0 ranges tile the start of _indices in order,
+	// simplified levels follow behind them. Every indexed mesh loaded from a file has at least one submesh
+	std::vector<MeshMaterial> _materials;
+	std::vector<Submesh> _submeshes;
+
+	// Bounds of the positions in mesh space. The sphere is centered on the box, xyz center and w radius
+	AABB _bounds;
+	glm::vec4 _boundingSphere{ 0.0f };
+
+	// Cooked mesh file the vertices are read from instead of _vertices. Released once the mesh is uploaded
+	std::shared_ptr<MeshCache> _cache;
+
+	// Number of vertices in _vertexRange and indices in _indexRange
+	uint32_t _vertexCount{ 0 };
+	uint32_t _indexCount{ 0 };
+	uint32_t _meshletCount{ 0 };
+	VkIndexType _indexType{ VK_INDEX_TYPE_UINT32 };
+
+	// Where the vertices and indices live in the engine's geometry arena. Draws add the ranges' first elements
+	// as base vertex and first index
+	GeometryRange _vertexRange;
+	GeometryRange _indexRange;
+
+	// Upload that fills the buffers. Frames drawing the mesh wait for it on the GPU
+	UploadToken _uploadToken{ 0 };
+
+	// Load the mesh from its cooked file if it is up to date, otherwise parse the OBJ and cook it for the next run
+	bool load_from_obj(const char* filename, const MeshLoadOptions& options = {});
+
+	// Sort the flat triangle list in _vertices so every material's triangles are contiguous, opaque materials first,
+	// and create a submesh for each material that has triangles. The order inside a material is kept
+	void group_by_material(const std::vector<uint32_t>& triangleMaterials);
+
+	// Set _materials and _submeshes for a flat triangle list that can't be moved, such as a streamed OBJ. Submeshes come
+	// out as group_by_material makes them, but are filled by an index buffer that lists the runs in outIndexOrder
+	void group_by_material_runs(const std::vector<ObjMaterial>& materials, const std::vector<ObjTriangleRun>& runs,
+		std::vector<ObjTriangleRun>& outIndexOrder);
+
+	// Merge identical vertices of the flat triangle list in _vertices and build _indices
+	void weld_vertices();
+
+	// Reorder triangles for the vertex cache and overdraw within each submesh, then vertices for fetch locality.
+	// Prints ACMR/ATVR before and after
+	void optimize(const char* name);
+
+	// Regroup each submesh's triangles into meshlets and fill _meshlets. Vertices are reordered for fetch afterwards
+	void build_meshlets(const char* name);
+
+	// Append simplified copies of each submesh's level 0 triangles to _indices at 50, 25 and 12.5% of its triangle count.
+	// A chain stops early once simplification can't make progress, e.g. when seams lock most of the submesh
+	void build_lods(const char* name);
+
+	// Set _bounds and _boundingSphere from _vertices
+	void compute_bounds();
+
+	// Encode _vertices into _compactVertices and switch to VertexFormat::Compact. Fails, leaving the mesh as it is,
+	// if the layout can't hold the vertices: uvs outside [0, 1] or colors that aren't a copy of the normal.
+	// Prints the measured quantization error
+	bool compact_vertices(const char* name);
+
+	// Vertex data to upload in _vertexFormat, either from the cooked file, _compactVertices or _vertices
+	const void* vertex_data() const;
+	size_t vertex_data_count() const;
+	uint32_t vertex_stride() const;
+
+	// Index data to upload. Indices are 16 bit whenever the vertex count allows it
+	size_t index_data_count() const;
+	uint32_t index_size() const;
+	void write_index_data(void* destination) const;
 
-	bool load_from_obj(const char* filename);
+	// Meshlets to cook, either from the cooked file or from _meshlets. They stay on the CPU until a shader culls them
+	const Meshlet* meshlet_data() const;
+	size_t meshlet_data_count() const;
 };
\ No newline at end of file
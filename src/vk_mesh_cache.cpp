@@ -0,0 +1,175 @@
+#include "vk_mesh_cache.h"
+
+#include <algorithm>
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+#include <vector>
+
+namespace {
+
+	// Vertex data starts on a cache line so the mapping can be read with aligned loads
+	constexpr uint64_t DATA_ALIGNMENT = 64;
+
+	uint64_t align_up(uint64_t value, uint64_t alignment)
+	{
+		return (value + alignment - 1) & ~(alignment - 1);
+	}
+}
+
+bool MeshCache::open(const char* path, uint64_t sourceSize, uint64_t sourceHash, uint64_t materialLibraryHash, uint32_t flags)
+{
+	if (!_file.open(path))
+	{
+		return false;
+	}
+
+	// Reject anything that isn't a complete cook of this exact source with the current vertex layout
+	bool valid = _file.size() >= sizeof(MeshCacheHeader);
+	if (valid)
+	{
+		const MeshCacheHeader& head = header();
+		const uint32_t expectedStride = head.vertexFormat == static_cast<uint32_t>(VertexFormat::Compact) ? sizeof(CompactVertex) : sizeof(Vertex);
+
+		valid = head.magic == MESH_CACHE_MAGIC
+			&& head.version == MESH_CACHE_VERSION
+			&& head.vertexFormat <= static_cast<uint32_t>(VertexFormat::Compact)
+			&& head.vertexStride == expectedStride
+			&& head.sourceSize == sourceSize
+			&& head.sourceHash == sourceHash
+			&& head.materialLibraryHash == materialLibraryHash
+			&& head.flags == flags
+			&& head.vertexOffset % DATA_ALIGNMENT == 0
+			&& head.vertexOffset + head.vertexCount * head.vertexStride <= _file.size()
+			&& head.indexOffset + head.indexCount * head.indexSize <= _file.size()
+			&& head.meshletOffset % DATA_ALIGNMENT == 0
+			&& head.meshletOffset + head.meshletCount * sizeof(Meshlet) <= _file.size()
+			&& head.submeshOffset % DATA_ALIGNMENT == 0
+			&& head.submeshOffset + head.submeshCount * sizeof(Submesh) <= _file.size()
+			&& head.materialOffset % DATA_ALIGNMENT == 0
+			&& head.materialOffset + head.materialCount * sizeof(MeshMaterial) <= _file.size();
+
+		// Every range the renderer reads has to stay inside the data it indexes
+		for (uint64_t s = 0; valid && s < head.submeshCount; s++)
+		{
+			const Submesh& submesh = submeshes()[s];
+			valid = submesh.material < head.materialCount
+				&& submesh.firstMeshlet + submesh.meshletCount <= head.meshletCount
+				&& submesh.lodCount >= 1 && submesh.lodCount <= MESH_MAX_LODS;
+
+			for (uint32_t level = 0; valid && level < submesh.lodCount; level++)
+			{
+				valid = submesh.lods[level].firstIndex + submesh.lods[level].indexCount <= head.indexCount;
+			}
+		}
+	}
+
+	if (!valid)
+	{
+		_file.close();
+	}
+
+	return valid;
+}
+
+std::string vkcache::cache_path(const char* sourcePath)
+{
+	return std::string(sourcePath) + ".meshcache";
+}
+
+uint64_t vkcache::hash_memory(const void* data, size_t size)
+{
+	// FNV-1a over 8 byte words, with the tail hashed byte by byte
+	constexpr uint64_t FNV_OFFSET = 0xcbf29ce484222325ull;
+	constexpr uint64_t FNV_PRIME = 0x100000001b3ull;
+
+	const unsigned char* bytes = static_cast<const unsigned char*>(data);
+	uint64_t hash = FNV_OFFSET ^ size;
+
+	size_t i = 0;
+	for (; i + sizeof(uint64_t) <= size; i += sizeof(uint64_t))
+	{
+		uint64_t word;
+		memcpy(&word, bytes + i, sizeof(word));
+		hash = (hash ^ word) * FNV_PRIME;
+	}
+	for (; i < size; i++)
+	{
+		hash = (hash ^ bytes[i]) * FNV_PRIME;
+	}
+
+	return hash;
+}
+
+bool vkcache::write_mesh_cache(const char* path, uint64_t sourceSize, uint64_t sourceHash, uint64_t materialLibraryHash, uint32_t flags, const Mesh& mesh)
+{
+	const size_t vertexCount = mesh.vertex_data_count();
+	const size_t vertexStride = mesh.vertex_stride();
+
+	MeshCacheHeader header = {};
+	header.magic = MESH_CACHE_MAGIC;
+	header.version = MESH_CACHE_VERSION;
+	header.sourceSize = sourceSize;
+	header.sourceHash = sourceHash;
+	header.materialLibraryHash = materialLibraryHash;
+	header.flags = flags;
+	header.vertexFormat = static_cast<uint32_t>(mesh._vertexFormat);
+	header.vertexStride = static_cast<uint32_t>(vertexStride);
+	header.indexSize = mesh.index_size();
+	header.vertexOffset = align_up(sizeof(MeshCacheHeader), DATA_ALIGNMENT);
+	header.vertexCount = vertexCount;
+	header.indexOffset = align_up(header.vertexOffset + vertexCount * vertexStride, DATA_ALIGNMENT);
+	header.indexCount = mesh.index_data_count();
+	header.meshletOffset = align_up(header.indexOffset + header.indexCount * header.indexSize, DATA_ALIGNMENT);
+	header.meshletCount = mesh.meshlet_data_count();
+	header.submeshOffset = align_up(header.meshletOffset + header.meshletCount * sizeof(Meshlet), DATA_ALIGNMENT);
+	header.submeshCount = mesh._submeshes.size();
+	header.materialOffset = align_up(header.submeshOffset + header.submeshCount * sizeof(Submesh), DATA_ALIGNMENT);
+	header.materialCount = mesh._materials.size();
+
+	// Bounds of the positions, so the mesh can be culled without touching the vertices
+	for (int axis = 0; axis < 3; axis++)
+	{
+		header.boundsMin[axis] = mesh._bounds.min[axis];
+		header.boundsMax[axis] = mesh._bounds.max[axis];
+	}
+	for (int axis = 0; axis < 4; axis++)
+	{
+		header.boundingSphere[axis] = mesh._boundingSphere[axis];
+	}
+
+	// Indices are stored in their final size so they can be copied straight into a staging buffer
+	std::vector<char> indexData(header.indexCount * header.indexSize);
+	mesh.write_index_data(indexData.data());
+
+	std::ofstream file(path, std::ios::binary | std::ios::trunc);
+	if (!file.is_open())
+	{
+		return false;
+	}
+
+	const char padding[DATA_ALIGNMENT] = {};
+	const uint64_t vertexEnd = header.vertexOffset + vertexCount * vertexStride;
+
+	file.write(reinterpret_cast<const char*>(&header), sizeof(header));
+	file.write(padding, header.vertexOffset - sizeof(header));
+	file.write(static_cast<const char*>(mesh.vertex_data()), vertexCount * vertexStride);
+	file.write(padding, header.indexOffset - vertexEnd);
+	file.write(indexData.data(), indexData.size());
+	file.write(padding, header.meshletOffset - header.indexOffset - indexData.size());
+	file.write(reinterpret_cast<const char*>(mesh.meshlet_data()), header.meshletCount * sizeof(Meshlet));
+	file.write(padding, header.submeshOffset - header.meshletOffset - header.meshletCount * sizeof(Meshlet));
+	file.write(reinterpret_cast<const char*>(mesh._submeshes.data()), header.submeshCount * sizeof(Submesh));
+	file.write(padding, header.materialOffset - header.submeshOffset - header.submeshCount * sizeof(Submesh));
+	file.write(reinterpret_cast<const char*>(mesh._materials.data()), header.materialCount * sizeof(MeshMaterial));
+	file.close();
+
+	// Don't leave a truncated cache behind. It would be rejected on load, but would be rewritten every run
+	if (!file)
+	{
+		std::remove(path);
+		return false;
+	}
+
+	return true;
+}
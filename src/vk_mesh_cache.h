@@ -0,0 +1,88 @@
+#pragma once
+
+#include "vk_mesh.h"
+#include "vk_mapped_file.h"
+
+#include <cstdint>
+#include <string>
+
+// "VKMC" in little endian
+constexpr uint32_t MESH_CACHE_MAGIC = 0x434D4B56;
+// Bump whenever the layout of the header, Vertex, CompactVertex, Meshlet, Submesh or MeshMaterial changes
+constexpr uint32_t MESH_CACHE_VERSION = 8;
+
+// MeshCacheHeader::flags
+constexpr uint32_t MESH_CACHE_OPTIMIZED = 1 << 0;		// Triangles and vertices were reordered by Mesh::optimize
+constexpr uint32_t MESH_CACHE_COMPACT_ALLOWED = 1 << 1;	// The mesh was free to pick VertexFormat::Compact
+constexpr uint32_t MESH_CACHE_MESHLETS = 1 << 2;			// Triangles were grouped by Mesh::build_meshlets
+constexpr uint32_t MESH_CACHE_LODS = 1 << 3;				// Simplified levels were appended by Mesh::build_lods
+
+// Header at the start of a cooked mesh file. Vertex and index data follow at the given byte offsets
+struct MeshCacheHeader {
+	uint32_t magic;
+	uint32_t version;
+
+	// Size and content hash of the OBJ the mesh was cooked from, used to detect stale caches
+	uint64_t sourceSize;
+	uint64_t sourceHash;
+	// Content hash of the OBJ's material library, 0 if it has none
+	uint64_t materialLibraryHash;
+
+	uint32_t flags;				// MESH_CACHE_* bits describing how the mesh was cooked
+	uint32_t vertexFormat;		// VertexFormat of the vertex data
+
+	uint32_t vertexStride;		// Size of one vertex of vertexFormat at cook time
+	uint32_t indexSize;			// Bytes per index, 0 when the mesh has no index buffer
+
+	uint64_t vertexOffset;
+	uint64_t vertexCount;
+	uint64_t indexOffset;
+	uint64_t indexCount;
+	uint64_t meshletOffset;
+	uint64_t meshletCount;
+	uint64_t submeshOffset;
+	uint64_t submeshCount;
+	uint64_t materialOffset;
+	uint64_t materialCount;
+
+	// Bounds of the positions, w unused. Compact positions are quantized inside them
+	float boundsMin[4];
+	float boundsMax[4];
+	// Sphere around the center of the bounds, xyz center and w radius
+	float boundingSphere[4];
+};
+
+// A cooked mesh file mapped read-only into memory. The vertex data can be copied straight out of the mapping
+class MeshCache {
+public:
+	// Map a cooked file and check that it is valid and was cooked with these flags from a source with this size and hashes
+	bool open(const char* path, uint64_t sourceSize, uint64_t sourceHash, uint64_t materialLibraryHash, uint32_t flags);
+
+	const MeshCacheHeader& header() const { return *reinterpret_cast<const MeshCacheHeader*>(_file.data()); }
+
+	// Vertices in the layout given by header().vertexFormat
+	const void* vertices() const { return _file.data() + header().vertexOffset; }
+	const void* indices() const { return _file.data() + header().indexOffset; }
+	const Meshlet* meshlets() const { return reinterpret_cast<const Meshlet*>(_file.data() + header().meshletOffset); }
+	const Submesh* submeshes() const { return reinterpret_cast<const Submesh*>(_file.data() + header().submeshOffset); }
+	const MeshMaterial* materials() const { return reinterpret_cast<const MeshMaterial*>(_file.data() + header().materialOffset); }
+
+	// The whole mapping, offsets in the header are relative to its start
+	const MappedFile& file() const { return _file; }
+
+private:
+	MappedFile _file;
+};
+
+namespace vkcache {
+
+	// Path of the cooked file that belongs to a source mesh
+	std::string cache_path(const char* sourcePath);
+
+	// 64 bit hash of a block of memory, used to fingerprint source files
+	uint64_t hash_memory(const void* data, size_t size);
+
+	// Write the vertices, indices, meshlets, submeshes and materials of a mesh to a cooked file. Returns false if the file can't be written
+	bool write_mesh_cache(const char* path, uint64_t sourceSize, uint64_t sourceHash, uint64_t materialLibraryHash, uint32_t flags, const Mesh& mesh);
+
+}
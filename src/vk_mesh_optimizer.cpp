@@ -0,0 +1,1257 @@
+#include "vk_mesh_optimizer.h"
+
+#include <algorithm>
+#include <cfloat>
+#include <cmath>
+#include <cstring>
+
+#include <glm/geometric.hpp>
+
+namespace {
+
+	// Tuning from Tom Forsyth's "Linear-Speed Vertex Cache Optimisation"
+	constexpr int FORSYTH_CACHE_SIZE = 32;
+	constexpr float CACHE_DECAY_POWER = 1.5f;
+	constexpr float LAST_TRIANGLE_SCORE = 0.75f;
+	constexpr float VALENCE_BOOST_SCALE = 2.0f;
+	constexpr float VALENCE_BOOST_POWER = 0.5f;
+
+	// Cache size used to find the cold spots where the overdraw pass may cut the triangle list
+	constexpr uint32_t OVERDRAW_CACHE_SIZE = 16;
+
+	float vertex_score(int cachePosition, uint32_t remainingValence)
+	{
+		// Vertices without triangles left to draw should never attract a triangle
+		if (remainingValence == 0)
+		{
+			return -1.0f;
+		}
+
+		float score = 0.0f;
+		if (cachePosition >= 0)
+		{
+			if (cachePosition < 3)
+			{
+				// Vertices of the last triangle get a fixed score so the next triangle doesn't simply reuse the same edge
+				score = LAST_TRIANGLE_SCORE;
+			}
+			else
+			{
+				const float scaler = 1.0f / (FORSYTH_CACHE_SIZE - 3);
+				score = std::pow(1.0f - (cachePosition - 3) * scaler, CACHE_DECAY_POWER);
+			}
+		}
+
+		// Boost vertices with few triangles left, so lone triangles get finished instead of left behind
+		score += VALENCE_BOOST_SCALE * std::pow(static_cast<float>(remainingValence), -VALENCE_BOOST_POWER);
+		return score;
+	}
+
+	// Triangles using each vertex, packed into one array. The triangles of vertex v are adjacency[offsets[v]] up to adjacency[offsets[v + 1]]
+	void build_triangle_adjacency(const std::vector<uint32_t>& indices, size_t vertexCount, std::vector<uint32_t>& offsets, std::vector<uint32_t>& adjacency)
+	{
+		offsets.assign(vertexCount + 1, 0);
+		for (uint32_t index : indices)
+		{
+			offsets[index + 1]++;
+		}
+		for (size_t v = 0; v < vertexCount; v++)
+		{
+			offsets[v + 1] += offsets[v];
+		}
+
+		adjacency.resize(indices.size());
+		std::vector<uint32_t> fill(offsets.begin(), offsets.end() - 1);
+		for (size_t i = 0; i < indices.size(); i++)
+		{
+			adjacency[fill[indices[i]]++] = static_cast<uint32_t>(i / 3);
+		}
+	}
+
+	// Leaves of the triangle kd-tree hold at most this many triangles
+	constexpr uint32_t KD_LEAF_SIZE = 8;
+
+	// Kd-tree over triangle centroids for finding the closest triangle that isn't in a meshlet yet.
+	// Every node counts its remaining triangles so emptied subtrees are skipped
+	class TriangleKdTree {
+	public:
+		TriangleKdTree(const std::vector<glm::vec3>& centroids)
+			: _centroids(centroids)
+			, _leafOf(centroids.size())
+		{
+			_items.resize(centroids.size());
+			for (size_t t = 0; t < centroids.size(); t++)
+			{
+				_items[t] = static_cast<uint32_t>(t);
+			}
+			build(0, static_cast<uint32_t>(_items.size()), UINT32_MAX);
+		}
+
+		void remove(uint32_t triangle)
+		{
+			for (uint32_t node = _leafOf[triangle]; node != UINT32_MAX; node = _nodes[node].parent)
+			{
+				_nodes[node].remaining--;
+			}
+		}
+
+		// Closest remaining triangle to a point, or UINT32_MAX if every triangle was removed
+		uint32_t nearest(const glm::vec3& point, const std::vector<uint8_t>& removed) const
+		{
+			uint32_t best = UINT32_MAX;
+			float bestDistance = FLT_MAX;
+			search(0, point, removed, best, bestDistance);
+			return best;
+		}
+
+	private:
+		struct Node {
+			uint32_t parent;
+			uint32_t remaining;
+			uint32_t axis;			// 3 for leaves
+			float split;
+			uint32_t first;			// Leaves: first item. Inner nodes: right child, the left child follows the node
+			uint32_t count;			// Leaves: number of items
+		};
+
+		uint32_t build(uint32_t first, uint32_t count, uint32_t parent)
+		{
+			const uint32_t nodeIndex = static_cast<uint32_t>(_nodes.size());
+			_nodes.push_back({ parent, count, 3, 0.0f, first, count });
+
+			if (count > KD_LEAF_SIZE)
+			{
+				// Split the longest axis of the centroid bounds at the mean
+				glm::vec3 boundsMin(FLT_MAX);
+				glm::vec3 boundsMax(-FLT_MAX);
+				glm::vec3 mean(0.0f);
+				for (uint32_t i = first; i < first + count; i++)
+				{
+					const glm::vec3& c = _centroids[_items[i]];
+					boundsMin = glm::min(boundsMin, c);
+					boundsMax = glm::max(boundsMax, c);
+					mean += c;
+				}
+				mean /= static_cast<float>(count);
+
+				const glm::vec3 extent = boundsMax - boundsMin;
+				const uint32_t axis = extent.x >= extent.y && extent.x >= extent.z ? 0 : (extent.y >= extent.z ? 1 : 2);
+				const float split = mean[axis];
+
+				auto middle = std::partition(_items.begin() + first, _items.begin() + first + count, [&](uint32_t t) {
+					return _centroids[t][axis] < split;
+				});
+				const uint32_t leftCount = static_cast<uint32_t>(middle - (_items.begin() + first));
+
+				// Coincident centroids can't be split, they stay in one leaf
+				if (leftCount > 0 && leftCount < count)
+				{
+					build(first, leftCount, nodeIndex);
+					const uint32_t right = build(first + leftCount, count - leftCount, nodeIndex);
+
+					_nodes[nodeIndex].axis = axis;
+					_nodes[nodeIndex].split = split;
+					_nodes[nodeIndex].first = right;
+					return nodeIndex;
+				}
+			}
+
+			for (uint32_t i = first; i < first + count; i++)
+			{
+				_leafOf[_items[i]] = nodeIndex;
+			}
+			return nodeIndex;
+		}
+
+		void search(uint32_t nodeIndex, const glm::vec3& point, const std::vector<uint8_t>& removed, uint32_t& best, float& bestDistance) const
+		{
+			const Node& node = _nodes[nodeIndex];
+			if (node.remaining == 0)
+			{
+				return;
+			}
+
+			if (node.axis == 3)
+			{
+				for (uint32_t i = node.first; i < node.first + node.count; i++)
+				{
+					const uint32_t t = _items[i];
+					if (removed[t])
+					{
+						continue;
+					}
+
+					const glm::vec3 delta = _centroids[t] - point;
+					const float distance = glm::dot(delta, delta);
+					if (distance < bestDistance)
+					{
+						bestDistance = distance;
+						best = t;
+					}
+				}
+				return;
+			}
+
+			// Near side first, then the far side only if the splitting plane is closer than the best hit
+			const float delta = point[node.axis] - node.split;
+			const uint32_t left = nodeIndex + 1;
+			const uint32_t right = node.first;
+
+			search(delta < 0.0f ? left : right, point, removed, best, bestDistance);
+			if (delta * delta < bestDistance)
+			{
+				search(delta < 0.0f ? right : left, point, removed, best, bestDistance);
+			}
+		}
+
+		const std::vector<glm::vec3>& _centroids;
+		std::vector<uint32_t> _items;
+		std::vector<uint32_t> _leafOf;
+		std::vector<Node> _nodes;
+	};
+
+	// How a vertex may move during simplification. Seams are the two wedges of a position split by a uv or normal discontinuity
+	enum VertexKind : uint8_t {
+		KIND_MANIFOLD,		// Interior vertex with a single wedge, can collapse onto anything
+		KIND_BORDER,		// On an open edge of the mesh, only slides along that edge
+		KIND_SEAM,			// On an attribute seam, only slides along the seam, taking its other wedge along
+		KIND_LOCKED,		// Anything more complex, never moves
+		KIND_COUNT
+	};
+
+	// CAN_COLLAPSE[a][b]: a vertex of kind a may collapse onto a vertex of kind b
+	const uint8_t CAN_COLLAPSE[KIND_COUNT][KIND_COUNT] = {
+		{ 1, 1, 1, 1 },
+		{ 0, 1, 0, 0 },
+		{ 0, 0, 1, 0 },
+		{ 0, 0, 0, 0 },
+	};
+
+	// HAS_OPPOSITE[a][b]: an edge between kinds a and b is shared by two triangles, so it shows up once in each direction
+	const uint8_t HAS_OPPOSITE[KIND_COUNT][KIND_COUNT] = {
+		{ 1, 1, 1, 1 },
+		{ 1, 0, 1, 0 },
+		{ 1, 1, 1, 1 },
+		{ 1, 0, 1, 0 },
+	};
+
+	// Open edges keep their shape much harder than seams, which only constrain which way collapses go
+	constexpr double BORDER_EDGE_WEIGHT = 10.0;
+	constexpr double SEAM_EDGE_WEIGHT = 1.0;
+
+	// Sum of weighted squared distances to a set of planes, as x^T A x + 2 b^T x + c. Dividing by the total weight
+	// makes the error an average squared distance
+	struct Quadric {
+		double a00, a11, a22;
+		double a10, a20, a21;
+		double b0, b1, b2;
+		double c;
+		double w;
+	};
+
+	void quadric_add(Quadric& q, const Quadric& r)
+	{
+		q.a00 += r.a00; q.a11 += r.a11; q.a22 += r.a22;
+		q.a10 += r.a10; q.a20 += r.a20; q.a21 += r.a21;
+		q.b0 += r.b0; q.b1 += r.b1; q.b2 += r.b2;
+		q.c += r.c;
+		q.w += r.w;
+	}
+
+	// Plane n.x + d = 0 with unit normal n
+	Quadric plane_quadric(const glm::dvec3& n, double d, double w)
+	{
+		Quadric q;
+		q.a00 = w * n.x * n.x; q.a11 = w * n.y * n.y; q.a22 = w * n.z * n.z;
+		q.a10 = w * n.y * n.x; q.a20 = w * n.z * n.x; q.a21 = w * n.z * n.y;
+		q.b0 = w * n.x * d; q.b1 = w * n.y * d; q.b2 = w * n.z * d;
+		q.c = w * d * d;
+		q.w = w;
+		return q;
+	}
+
+	double quadric_error(const Quadric& q, const glm::vec3& point)
+	{
+		const double x = point.x, y = point.y, z = point.z;
+
+		double r = q.a00 * x * x + q.a11 * y * y + q.a22 * z * z;
+		r += 2.0 * (q.a10 * x * y + q.a20 * x * z + q.a21 * y * z);
+		r += 2.0 * (q.b0 * x + q.b1 * y + q.b2 * z);
+		r += q.c;
+
+		return q.w > 0.0 ? std::abs(r) / q.w : 0.0;
+	}
+
+	// Plane of a triangle, weighted by the square root of its area so the error grows linearly with size
+	Quadric triangle_quadric(const glm::vec3& p0, const glm::vec3& p1, const glm::vec3& p2)
+	{
+		glm::dvec3 normal = glm::cross(glm::dvec3(p1 - p0), glm::dvec3(p2 - p0));
+		const double area = glm::length(normal);
+		if (area > 0.0)
+		{
+			normal /= area;
+		}
+		return plane_quadric(normal, -glm::dot(normal, glm::dvec3(p0)), std::sqrt(area * 0.5));
+	}
+
+	// Plane through the edge p0 p1, perpendicular to the triangle, weighted by edge length. Holds open edges in place
+	Quadric edge_quadric(const glm::vec3& p0, const glm::vec3& p1, const glm::vec3& p2, double weight)
+	{
+		glm::dvec3 edge = glm::dvec3(p1 - p0);
+		const double length = glm::length(edge);
+		if (length > 0.0)
+		{
+			edge /= length;
+		}
+
+		// Altitude from p2 onto the edge
+		const glm::dvec3 p20 = glm::dvec3(p2 - p0);
+		glm::dvec3 normal = p20 - edge * glm::dot(p20, edge);
+		const double normalLength = glm::length(normal);
+		if (normalLength > 0.0)
+		{
+			normal /= normalLength;
+		}
+
+		return plane_quadric(normal, -glm::dot(normal, glm::dvec3(p0)), length * weight);
+	}
+
+	// A simplification pass only takes collapses up to this multiple of the error needed to reach its goal
+	constexpr float PASS_ERROR_SLACK = 1.5f;
+
+	struct EdgeCollapse {
+		uint32_t from;
+		uint32_t to;
+		float error;
+	};
+
+	// Bounding sphere of a point set (Ritter): start from the most distant pair of axis extremes, then grow to cover every point
+	glm::vec4 bounding_sphere(const std::vector<glm::vec3>& points)
+	{
+		size_t minPoint[3] = { 0, 0, 0 };
+		size_t maxPoint[3] = { 0, 0, 0 };
+		for (size_t p = 1; p < points.size(); p++)
+		{
+			for (int axis = 0; axis < 3; axis++)
+			{
+				if (points[p][axis] < points[minPoint[axis]][axis]) minPoint[axis] = p;
+				if (points[p][axis] > points[maxPoint[axis]][axis]) maxPoint[axis] = p;
+			}
+		}
+
+		int widestAxis = 0;
+		float widestDistance = -1.0f;
+		for (int axis = 0; axis < 3; axis++)
+		{
+			const glm::vec3 delta = points[maxPoint[axis]] - points[minPoint[axis]];
+			const float distance = glm::dot(delta, delta);
+			if (distance > widestDistance)
+			{
+				widestDistance = distance;
+				widestAxis = axis;
+			}
+		}
+
+		glm::vec3 center = (points[minPoint[widestAxis]] + points[maxPoint[widestAxis]]) * 0.5f;
+		float radius = std::sqrt(widestDistance) * 0.5f;
+
+		for (const glm::vec3& point : points)
+		{
+			const float distance = glm::length(point - center);
+			if (distance > radius)
+			{
+				// Move the center towards the point just enough to cover it and the old sphere
+				const float newRadius = (radius + distance) * 0.5f;
+				center += (point - center) * ((newRadius - radius) / distance);
+				radius = newRadius;
+			}
+		}
+
+		return glm::vec4(center, radius);
+	}
+
+	// Bounding sphere and backface cone of the triangles indices[first] up to indices[first + count]
+	void compute_meshlet_bounds(Meshlet& meshlet, const std::vector<uint32_t>& indices, const std::vector<Vertex>& vertices, std::vector<glm::vec3>& scratch)
+	{
+		scratch.clear();
+		for (uint32_t i = meshlet.firstIndex; i < meshlet.firstIndex + meshlet.indexCount; i++)
+		{
+			scratch.push_back(vertices[indices[i]].position);
+		}
+		meshlet.sphere = bounding_sphere(scratch);
+
+		const glm::vec3 center(meshlet.sphere);
+
+		// The cone axis is the average triangle normal, its spread the widest angle between the axis and a triangle normal
+		glm::vec3 normalSum(0.0f);
+		for (size_t p = 0; p < scratch.size(); p += 3)
+		{
+			const glm::vec3 normal = glm::cross(scratch[p + 1] - scratch[p], scratch[p + 2] - scratch[p]);
+			const float area = glm::length(normal);
+			if (area > 0.0f)
+			{
+				normalSum += normal / area;
+			}
+		}
+
+		const float axisLength = glm::length(normalSum);
+		const glm::vec3 axis = axisLength > 0.0f ? normalSum / axisLength : glm::vec3(0.0f, 0.0f, 1.0f);
+
+		float minDot = 1.0f;
+		for (size_t p = 0; p < scratch.size(); p += 3)
+		{
+			const glm::vec3 normal = glm::cross(scratch[p + 1] - scratch[p], scratch[p + 2] - scratch[p]);
+			const float area = glm::length(normal);
+			if (area > 0.0f)
+			{
+				minDot = std::min(minDot, glm::dot(axis, normal / area));
+			}
+		}
+
+		// A spread of 90 degrees or more means some triangle faces every direction the cone could cull from
+		if (axisLength == 0.0f || minDot <= 0.0f)
+		{
+			meshlet.coneApex = glm::vec4(center, 0.0f);
+			meshlet.cone = glm::vec4(axis, 2.0f);
+			return;
+		}
+
+		// Slide the apex back along the axis until it is behind every triangle plane, so the test holds for all of them
+		float maxT = 0.0f;
+		for (size_t p = 0; p < scratch.size(); p += 3)
+		{
+			const glm::vec3 normal = glm::cross(scratch[p + 1] - scratch[p], scratch[p + 2] - scratch[p]);
+			const float area = glm::length(normal);
+			if (area > 0.0f)
+			{
+				const glm::vec3 unitNormal = normal / area;
+				maxT = std::max(maxT, glm::dot(center - scratch[p], unitNormal) / glm::dot(axis, unitNormal));
+			}
+		}
+
+		meshlet.coneApex = glm::vec4(center - axis * maxT, 0.0f);
+		meshlet.cone = glm::vec4(axis, std::sqrt(1.0f - minDot * minDot));
+	}
+}
+
+VertexCacheStats vkopt::analyze_vertex_cache(const std::vector<uint32_t>& indices, size_t vertexCount, uint32_t cacheSize)
+{
+	VertexCacheStats stats = {};
+	if (indices.empty())
+	{
+		return stats;
+	}
+
+	// A vertex is in the FIFO if fewer than cacheSize misses happened since it was last loaded
+	std::vector<uint32_t> timestamps(vertexCount, 0);
+	uint32_t time = cacheSize + 1;
+	size_t misses = 0;
+	size_t uniqueVertices = 0;
+
+	for (uint32_t index : indices)
+	{
+		if (timestamps[index] == 0)
+		{
+			uniqueVertices++;
+		}
+
+		if (time - timestamps[index] > cacheSize)
+		{
+			timestamps[index] = time++;
+			misses++;
+		}
+	}
+
+	stats.acmr = static_cast<float>(misses) / (indices.size() / 3);
+	stats.atvr = static_cast<float>(misses) / uniqueVertices;
+	return stats;
+}
+
+void vkopt::optimize_vertex_cache(std::vector<uint32_t>& indices, size_t vertexCount)
+{
+	const size_t triangleCount = indices.size() / 3;
+	if (triangleCount == 0)
+	{
+		return;
+	}
+
+	// Each vertex's live triangles sit at the front of its adjacency range, valence counts them
+	std::vector<uint32_t> adjacencyOffset;
+	std::vector<uint32_t> adjacency;
+	build_triangle_adjacency(indices, vertexCount, adjacencyOffset, adjacency);
+
+	std::vector<uint32_t> valence(vertexCount);
+	for (size_t v = 0; v < vertexCount; v++)
+	{
+		valence[v] = adjacencyOffset[v + 1] - adjacencyOffset[v];
+	}
+
+	std::vector<int> cachePosition(vertexCount, -1);
+	std::vector<float> vertexScores(vertexCount);
+	for (size_t v = 0; v < vertexCount; v++)
+	{
+		vertexScores[v] = vertex_score(-1, valence[v]);
+	}
+
+	std::vector<uint8_t> emitted(triangleCount, 0);
+	std::vector<uint32_t> output;
+	output.reserve(indices.size());
+
+	uint32_t cache[FORSYTH_CACHE_SIZE + 3];
+	int cacheCount = 0;
+
+	size_t inputCursor = 0;
+	int64_t bestTriangle = -1;
+
+	while (output.size() < indices.size())
+	{
+		// Nothing in the cache has triangles left, carry on with the next triangle in input order
+		if (bestTriangle < 0)
+		{
+			while (emitted[inputCursor])
+			{
+				inputCursor++;
+			}
+			bestTriangle = static_cast<int64_t>(inputCursor);
+		}
+
+		const uint32_t* triangle = &indices[bestTriangle * 3];
+		output.insert(output.end(), triangle, triangle + 3);
+		emitted[bestTriangle] = 1;
+
+		// Remove the triangle from its vertices' live lists
+		for (int k = 0; k < 3; k++)
+		{
+			const uint32_t v = triangle[k];
+			uint32_t* live = &adjacency[adjacencyOffset[v]];
+			for (uint32_t a = 0; a < valence[v]; a++)
+			{
+				if (live[a] == bestTriangle)
+				{
+					std::swap(live[a], live[valence[v] - 1]);
+					break;
+				}
+			}
+			valence[v]--;
+		}
+
+		// The triangle's vertices move to the front of the LRU cache, everything else shifts back
+		uint32_t newCache[FORSYTH_CACHE_SIZE + 3];
+		int newCacheCount = 0;
+		for (int k = 0; k < 3; k++)
+		{
+			newCache[newCacheCount++] = triangle[k];
+		}
+		for (int c = 0; c < cacheCount; c++)
+		{
+			const uint32_t v = cache[c];
+			if (v != triangle[0] && v != triangle[1] && v != triangle[2])
+			{
+				newCache[newCacheCount++] = v;
+			}
+		}
+
+		for (int c = 0; c < newCacheCount; c++)
+		{
+			cachePosition[newCache[c]] = c < FORSYTH_CACHE_SIZE ? c : -1;
+		}
+
+		cacheCount = std::min(newCacheCount, FORSYTH_CACHE_SIZE);
+		for (int c = 0; c < cacheCount; c++)
+		{
+			cache[c] = newCache[c];
+		}
+
+		// Rescore everything touched (including vertices that just fell out) and pick the best triangle among them
+		for (int c = 0; c < newCacheCount; c++)
+		{
+			const uint32_t v = newCache[c];
+			vertexScores[v] = vertex_score(cachePosition[v], valence[v]);
+		}
+
+		bestTriangle = -1;
+		float bestScore = -1.0f;
+		for (int c = 0; c < newCacheCount; c++)
+		{
+			const uint32_t v = newCache[c];
+			const uint32_t* live = &adjacency[adjacencyOffset[v]];
+			for (uint32_t a = 0; a < valence[v]; a++)
+			{
+				const uint32_t t = live[a];
+				const float score = vertexScores[indices[t * 3 + 0]] + vertexScores[indices[t * 3 + 1]] + vertexScores[indices[t * 3 + 2]];
+
+				if (score > bestScore)
+				{
+					bestScore = score;
+					bestTriangle = t;
+				}
+			}
+		}
+	}
+
+	indices.swap(output);
+}
+
+void vkopt::optimize_overdraw(std::vector<uint32_t>& indices, const std::vector<Vertex>& vertices)
+{
+	const size_t triangleCount = indices.size() / 3;
+	if (triangleCount == 0)
+	{
+		return;
+	}
+
+	// Cut the list into clusters wherever a triangle misses the cache on all three vertices.
+	// Those triangles start cold anyway, so moving the clusters around costs almost no cache hits
+	std::vector<uint32_t> clusterStarts;
+	{
+		std::vector<uint32_t> timestamps(vertices.size(), 0);
+		uint32_t time = OVERDRAW_CACHE_SIZE + 1;
+
+		for (size_t t = 0; t < triangleCount; t++)
+		{
+			int misses = 0;
+			for (int k = 0; k < 3; k++)
+			{
+				const uint32_t index = indices[t * 3 + k];
+				if (time - timestamps[index] > OVERDRAW_CACHE_SIZE)
+				{
+					timestamps[index] = time++;
+					misses++;
+				}
+			}
+
+			if (t == 0 || misses == 3)
+			{
+				clusterStarts.push_back(static_cast<uint32_t>(t));
+			}
+		}
+	}
+	clusterStarts.push_back(static_cast<uint32_t>(triangleCount));
+
+	const size_t clusterCount = clusterStarts.size() - 1;
+
+	// Area weighted centroid and normal of every cluster, and of the whole mesh
+	std::vector<glm::vec3> clusterCentroids(clusterCount, glm::vec3(0.0f));
+	std::vector<glm::vec3> clusterNormals(clusterCount, glm::vec3(0.0f));
+	glm::vec3 meshCentroid(0.0f);
+	float meshArea = 0.0f;
+
+	for (size_t c = 0; c < clusterCount; c++)
+	{
+		float clusterArea = 0.0f;
+		for (uint32_t t = clusterStarts[c]; t < clusterStarts[c + 1]; t++)
+		{
+			const glm::vec3& p0 = vertices[indices[t * 3 + 0]].position;
+			const glm::vec3& p1 = vertices[indices[t * 3 + 1]].position;
+			const glm::vec3& p2 = vertices[indices[t * 3 + 2]].position;
+
+			// Length of the cross product is twice the triangle area
+			const glm::vec3 normal = glm::cross(p1 - p0, p2 - p0);
+			const float area = glm::length(normal);
+			const glm::vec3 centroid = (p0 + p1 + p2) / 3.0f;
+
+			clusterCentroids[c] += centroid * area;
+			clusterNormals[c] += normal;
+			clusterArea += area;
+		}
+
+		meshCentroid += clusterCentroids[c];
+		meshArea += clusterArea;
+
+		if (clusterArea > 0.0f)
+		{
+			clusterCentroids[c] /= clusterArea;
+		}
+	}
+
+	if (meshArea > 0.0f)
+	{
+		meshCentroid /= meshArea;
+	}
+
+	// Clusters facing away from the centre are likely in front of the rest of the mesh, so they go first
+	std::vector<float> sortKeys(clusterCount);
+	for (size_t c = 0; c < clusterCount; c++)
+	{
+		const float normalLength = glm::length(clusterNormals[c]);
+		const glm::vec3 direction = normalLength > 0.0f ? clusterNormals[c] / normalLength : glm::vec3(0.0f);
+		sortKeys[c] = glm::dot(clusterCentroids[c] - meshCentroid, direction);
+	}
+
+	std::vector<uint32_t> clusterOrder(clusterCount);
+	for (size_t c = 0; c < clusterCount; c++)
+	{
+		clusterOrder[c] = static_cast<uint32_t>(c);
+	}
+	std::stable_sort(clusterOrder.begin(), clusterOrder.end(), [&](uint32_t a, uint32_t b) {
+		return sortKeys[a] > sortKeys[b];
+	});
+
+	std::vector<uint32_t> output;
+	output.reserve(indices.size());
+	for (uint32_t c : clusterOrder)
+	{
+		output.insert(output.end(), indices.begin() + clusterStarts[c] * 3, indices.begin() + clusterStarts[c + 1] * 3);
+	}
+
+	indices.swap(output);
+}
+
+void vkopt::optimize_vertex_fetch(std::vector<uint32_t>& indices, std::vector<Vertex>& vertices)
+{
+	const uint32_t UNUSED = UINT32_MAX;
+	std::vector<uint32_t> remap(vertices.size(), UNUSED);
+
+	uint32_t nextVertex = 0;
+	for (uint32_t& index : indices)
+	{
+		if (remap[index] == UNUSED)
+		{
+			remap[index] = nextVertex++;
+		}
+		index = remap[index];
+	}
+
+	// Vertices no index refers to are dropped
+	std::vector<Vertex> reordered(nextVertex);
+	for (size_t v = 0; v < vertices.size(); v++)
+	{
+		if (remap[v] != UNUSED)
+		{
+			reordered[remap[v]] = vertices[v];
+		}
+	}
+
+	vertices.swap(reordered);
+}
+
+void vkopt::build_meshlets(std::vector<uint32_t>& indices, const std::vector<Vertex>& vertices, std::vector<Meshlet>& outMeshlets)
+{
+	outMeshlets.clear();
+
+	const size_t triangleCount = indices.size() / 3;
+	if (triangleCount == 0)
+	{
+		return;
+	}
+
+	std::vector<uint32_t> adjacencyOffset;
+	std::vector<uint32_t> adjacency;
+	build_triangle_adjacency(indices, vertices.size(), adjacencyOffset, adjacency);
+
+	std::vector<glm::vec3> centroids(triangleCount);
+	for (size_t t = 0; t < triangleCount; t++)
+	{
+		centroids[t] = (vertices[indices[t * 3 + 0]].position + vertices[indices[t * 3 + 1]].position + vertices[indices[t * 3 + 2]].position) / 3.0f;
+	}
+
+	TriangleKdTree kdTree(centroids);
+
+	std::vector<uint8_t> emitted(triangleCount, 0);
+	std::vector<uint32_t> output;
+	output.reserve(indices.size());
+
+	// Meshlet that last used each vertex, so the vertices of the current meshlet can be counted without clearing a set
+	std::vector<uint32_t> vertexMeshlet(vertices.size(), UINT32_MAX);
+
+	// Triangles sharing a vertex with the current meshlet
+	std::vector<uint32_t> candidates;
+	std::vector<glm::vec3> scratch;
+
+	glm::vec3 lastCentroid = centroids[0];
+	size_t emittedCount = 0;
+
+	while (emittedCount < triangleCount)
+	{
+		const uint32_t meshletIndex = static_cast<uint32_t>(outMeshlets.size());
+
+		Meshlet meshlet = {};
+		meshlet.firstIndex = static_cast<uint32_t>(output.size());
+
+		glm::vec3 centroidSum(0.0f);
+		uint32_t meshletTriangles = 0;
+		candidates.clear();
+
+		while (meshletTriangles < MESHLET_MAX_TRIANGLES)
+		{
+			const glm::vec3 centroid = meshletTriangles > 0 ? centroidSum / static_cast<float>(meshletTriangles) : lastCentroid;
+
+			// Grow through shared vertices, preferring triangles that add the fewest new vertices, then the closest ones
+			int64_t bestTriangle = -1;
+			uint32_t bestNewVertices = 4;
+			float bestDistance = FLT_MAX;
+
+			size_t kept = 0;
+			for (uint32_t t : candidates)
+			{
+				if (emitted[t])
+				{
+					continue;
+				}
+				candidates[kept++] = t;
+
+				uint32_t newVertices = 0;
+				for (int k = 0; k < 3; k++)
+				{
+					newVertices += vertexMeshlet[indices[t * 3 + k]] != meshletIndex;
+				}
+
+				const glm::vec3 delta = centroids[t] - centroid;
+				const float distance = glm::dot(delta, delta);
+				if (newVertices < bestNewVertices || (newVertices == bestNewVertices && distance < bestDistance))
+				{
+					bestTriangle = t;
+					bestNewVertices = newVertices;
+					bestDistance = distance;
+				}
+			}
+			candidates.resize(kept);
+
+			// Nothing connected left, continue with the closest triangle anywhere. Blocky meshes like lost_empire
+			// are mostly disconnected quads, so this is what keeps their meshlets compact
+			if (bestTriangle < 0)
+			{
+				bestTriangle = kdTree.nearest(centroid, emitted);
+				bestNewVertices = 0;
+				for (int k = 0; k < 3; k++)
+				{
+					bestNewVertices += vertexMeshlet[indices[bestTriangle * 3 + k]] != meshletIndex;
+				}
+			}
+
+			if (meshlet.vertexCount + bestNewVertices > MESHLET_MAX_VERTICES)
+			{
+				break;
+			}
+
+			const uint32_t* triangle = &indices[bestTriangle * 3];
+			output.insert(output.end(), triangle, triangle + 3);
+			emitted[bestTriangle] = 1;
+			kdTree.remove(static_cast<uint32_t>(bestTriangle));
+			emittedCount++;
+
+			for (int k = 0; k < 3; k++)
+			{
+				const uint32_t v = triangle[k];
+				if (vertexMeshlet[v] != meshletIndex)
+				{
+					vertexMeshlet[v] = meshletIndex;
+					meshlet.vertexCount++;
+
+					candidates.insert(candidates.end(), adjacency.begin() + adjacencyOffset[v], adjacency.begin() + adjacencyOffset[v + 1]);
+				}
+			}
+
+			centroidSum += centroids[bestTriangle];
+			meshletTriangles++;
+
+			if (emittedCount == triangleCount)
+			{
+				break;
+			}
+		}
+
+		meshlet.indexCount = meshletTriangles * 3;
+		compute_meshlet_bounds(meshlet, output, vertices, scratch);
+		outMeshlets.push_back(meshlet);
+
+		lastCentroid = centroidSum / static_cast<float>(meshletTriangles);
+	}
+
+	indices.swap(output);
+}
+
+std::vector<uint32_t> vkopt::simplify(const std::vector<uint32_t>& indices, const std::vector<Vertex>& vertices, size_t targetIndexCount, float& outError)
+{
+	const size_t vertexCount = vertices.size();
+	const uint32_t NONE = UINT32_MAX;
+
+	std::vector<uint32_t> result(indices);
+	outError = 0.0f;
+
+	if (result.size() <= targetIndexCount)
+	{
+		return result;
+	}
+
+	// Vertices with the same position are wedges of one point. remap points every wedge at the first one,
+	// wedge links the wedges of a point into a ring
+	std::vector<uint32_t> remap(vertexCount);
+	std::vector<uint32_t> wedge(vertexCount);
+	{
+		size_t tableSize = 1;
+		while (tableSize < vertexCount * 2)
+		{
+			tableSize <<= 1;
+		}
+		std::vector<uint32_t> table(tableSize, NONE);
+
+		for (size_t v = 0; v < vertexCount; v++)
+		{
+			const glm::vec3& position = vertices[v].position;
+
+			uint32_t words[3];
+			memcpy(words, &position, sizeof(words));
+			uint32_t hash = (words[0] * 73856093u) ^ (words[1] * 19349663u) ^ (words[2] * 83492791u);
+
+			size_t slot = (hash ^ (hash >> 16)) & (tableSize - 1);
+			while (table[slot] != NONE && vertices[table[slot]].position != position)
+			{
+				slot = (slot + 1) & (tableSize - 1);
+			}
+
+			if (table[slot] == NONE)
+			{
+				table[slot] = static_cast<uint32_t>(v);
+				remap[v] = static_cast<uint32_t>(v);
+				wedge[v] = static_cast<uint32_t>(v);
+			}
+			else
+			{
+				const uint32_t r = table[slot];
+				remap[v] = r;
+				wedge[v] = wedge[r];
+				wedge[r] = static_cast<uint32_t>(v);
+			}
+		}
+	}
+
+	// Classify vertices from their open half edges, edges without a twin in the opposite direction.
+	// openOut/openIn hold the single open neighbour, or the vertex itself when there is more than one
+	std::vector<uint8_t> kind(vertexCount, KIND_LOCKED);
+	std::vector<uint32_t> loop(vertexCount, NONE);
+	std::vector<uint32_t> loopback(vertexCount, NONE);
+	{
+		std::vector<uint32_t> edgeOffset(vertexCount + 1, 0);
+		for (size_t i = 0; i < result.size(); i++)
+		{
+			edgeOffset[result[i] + 1]++;
+		}
+		for (size_t v = 0; v < vertexCount; v++)
+		{
+			edgeOffset[v + 1] += edgeOffset[v];
+		}
+
+		std::vector<uint32_t> edgeTargets(result.size());
+		{
+			std::vector<uint32_t> fill(edgeOffset.begin(), edgeOffset.end() - 1);
+			for (size_t t = 0; t < result.size(); t += 3)
+			{
+				for (int e = 0; e < 3; e++)
+				{
+					edgeTargets[fill[result[t + e]]++] = result[t + (e + 1) % 3];
+				}
+			}
+		}
+
+		auto has_edge = [&](uint32_t a, uint32_t b) {
+			for (uint32_t i = edgeOffset[a]; i < edgeOffset[a + 1]; i++)
+			{
+				if (edgeTargets[i] == b)
+				{
+					return true;
+				}
+			}
+			return false;
+		};
+
+		for (uint32_t v = 0; v < vertexCount; v++)
+		{
+			for (uint32_t i = edgeOffset[v]; i < edgeOffset[v + 1]; i++)
+			{
+				const uint32_t target = edgeTargets[i];
+				if (!has_edge(target, v))
+				{
+					loopback[target] = loopback[target] == NONE ? v : target;
+					loop[v] = loop[v] == NONE ? target : v;
+				}
+			}
+		}
+
+		for (uint32_t v = 0; v < vertexCount; v++)
+		{
+			if (remap[v] != v)
+			{
+				continue;
+			}
+
+			if (wedge[v] == v)
+			{
+				// One wedge: interior, or a border when exactly one open edge comes in and one goes out
+				if (loop[v] == NONE && loopback[v] == NONE)
+				{
+					kind[v] = KIND_MANIFOLD;
+				}
+				else if (loop[v] != NONE && loop[v] != v && loopback[v] != NONE && loopback[v] != v)
+				{
+					kind[v] = KIND_BORDER;
+				}
+			}
+			else if (wedge[wedge[v]] == v)
+			{
+				// Two wedges: a seam when each wedge has one open edge each way, and they run along the same neighbours in opposite directions
+				const uint32_t w = wedge[v];
+				const bool singleOpen = loop[v] != NONE && loop[v] != v && loopback[v] != NONE && loopback[v] != v
+					&& loop[w] != NONE && loop[w] != w && loopback[w] != NONE && loopback[w] != w;
+
+				if (singleOpen && remap[loopback[v]] == remap[loop[w]] && remap[loop[v]] == remap[loopback[w]] && remap[loopback[v]] != remap[loop[v]])
+				{
+					kind[v] = KIND_SEAM;
+				}
+			}
+		}
+
+		for (uint32_t v = 0; v < vertexCount; v++)
+		{
+			kind[v] = kind[remap[v]];
+		}
+	}
+
+	// Quadrics live on the points, shared by their wedges
+	std::vector<Quadric> quadrics(vertexCount, Quadric{});
+	for (size_t t = 0; t < result.size(); t += 3)
+	{
+		const uint32_t i0 = result[t + 0], i1 = result[t + 1], i2 = result[t + 2];
+		const Quadric q = triangle_quadric(vertices[i0].position, vertices[i1].position, vertices[i2].position);
+
+		quadric_add(quadrics[remap[i0]], q);
+		quadric_add(quadrics[remap[i1]], q);
+		quadric_add(quadrics[remap[i2]], q);
+
+		for (int e = 0; e < 3; e++)
+		{
+			const uint32_t a = result[t + e];
+			const uint32_t b = result[t + (e + 1) % 3];
+			const uint32_t c = result[t + (e + 2) % 3];
+			const uint8_t ka = kind[a];
+			const uint8_t kb = kind[b];
+
+			// Only edges that run along a border or seam loop. Edges from a loop into a locked corner count too,
+			// otherwise the last edge before the corner would have no error
+			const bool loopA = ka == KIND_BORDER || ka == KIND_SEAM;
+			const bool loopB = kb == KIND_BORDER || kb == KIND_SEAM;
+			if ((!loopA && !loopB) || (loopA && loop[a] != b) || (loopB && loopback[b] != a))
+			{
+				continue;
+			}
+
+			// Seam edges show up on both sides, count them once
+			if (HAS_OPPOSITE[ka][kb] && remap[b] > remap[a])
+			{
+				continue;
+			}
+
+			const double weight = ka == KIND_BORDER || kb == KIND_BORDER ? BORDER_EDGE_WEIGHT : SEAM_EDGE_WEIGHT;
+			const Quadric q = edge_quadric(vertices[a].position, vertices[b].position, vertices[c].position, weight);
+
+			quadric_add(quadrics[remap[a]], q);
+			quadric_add(quadrics[remap[b]], q);
+		}
+	}
+
+	std::vector<EdgeCollapse> collapses;
+	std::vector<uint32_t> collapseRemap(vertexCount);
+	std::vector<uint8_t> collapseLocked(vertexCount);
+	std::vector<uint32_t> pointOffset;
+	std::vector<uint32_t> pointTriangles;
+	double maxError = 0.0;
+
+	// Every pass collapses a set of edges that don't share a point, cheapest first
+	while (result.size() > targetIndexCount)
+	{
+		collapses.clear();
+		for (size_t t = 0; t < result.size(); t += 3)
+		{
+			for (int e = 0; e < 3; e++)
+			{
+				const uint32_t i0 = result[t + e];
+				const uint32_t i1 = result[t + (e + 1) % 3];
+				const uint8_t k0 = kind[i0];
+				const uint8_t k1 = kind[i1];
+
+				if (!CAN_COLLAPSE[k0][k1] && !CAN_COLLAPSE[k1][k0])
+				{
+					continue;
+				}
+
+				// Edges with a twin would be found twice
+				if (HAS_OPPOSITE[k0][k1] && remap[i1] > remap[i0])
+				{
+					continue;
+				}
+
+				// Two border or seam vertices that aren't neighbours on the same loop
+				if (k0 == k1 && (k0 == KIND_BORDER || k0 == KIND_SEAM) && loop[i0] != i1)
+				{
+					continue;
+				}
+
+				if (CAN_COLLAPSE[k0][k1] && CAN_COLLAPSE[k1][k0])
+				{
+					const float e0 = static_cast<float>(quadric_error(quadrics[remap[i0]], vertices[i1].position));
+					const float e1 = static_cast<float>(quadric_error(quadrics[remap[i1]], vertices[i0].position));
+					collapses.push_back(e0 <= e1 ? EdgeCollapse{ i0, i1, e0 } : EdgeCollapse{ i1, i0, e1 });
+				}
+				else if (CAN_COLLAPSE[k0][k1])
+				{
+					collapses.push_back({ i0, i1, static_cast<float>(quadric_error(quadrics[remap[i0]], vertices[i1].position)) });
+				}
+				else
+				{
+					collapses.push_back({ i1, i0, static_cast<float>(quadric_error(quadrics[remap[i1]], vertices[i0].position)) });
+				}
+			}
+		}
+
+		if (collapses.empty())
+		{
+			break;
+		}
+
+		std::sort(collapses.begin(), collapses.end(), [](const EdgeCollapse& a, const EdgeCollapse& b) {
+			return a.error < b.error;
+		});
+
+		// Triangles around each point, to reject collapses that would flip a triangle over
+		pointOffset.assign(vertexCount + 1, 0);
+		for (uint32_t index : result)
+		{
+			pointOffset[remap[index] + 1]++;
+		}
+		for (size_t v = 0; v < vertexCount; v++)
+		{
+			pointOffset[v + 1] += pointOffset[v];
+		}
+		pointTriangles.resize(result.size());
+		{
+			std::vector<uint32_t> fill(pointOffset.begin(), pointOffset.end() - 1);
+			for (size_t i = 0; i < result.size(); i++)
+			{
+				pointTriangles[fill[remap[result[i]]]++] = static_cast<uint32_t>(i / 3);
+			}
+		}
+
+		auto flips = [&](uint32_t from, uint32_t to) {
+			const uint32_t r0 = remap[from];
+			const uint32_t r1 = remap[to];
+			const glm::vec3& target = vertices[to].position;
+
+			for (uint32_t i = pointOffset[r0]; i < pointOffset[r0 + 1]; i++)
+			{
+				const uint32_t* triangle = &result[pointTriangles[i] * 3];
+				const uint32_t a = remap[triangle[0]], b = remap[triangle[1]], c = remap[triangle[2]];
+
+				// Triangles on the collapsed edge disappear
+				if (a == r1 || b == r1 || c == r1)
+				{
+					continue;
+				}
+
+				const glm::vec3& p0 = vertices[triangle[0]].position;
+				const glm::vec3& p1 = vertices[triangle[1]].position;
+				const glm::vec3& p2 = vertices[triangle[2]].position;
+				const glm::vec3 before = glm::cross(p1 - p0, p2 - p0);
+
+				const glm::vec3 q0 = a == r0 ? target : p0;
+				const glm::vec3 q1 = b == r0 ? target : p1;
+				const glm::vec3 q2 = c == r0 ? target : p2;
+				const glm::vec3 after = glm::cross(q1 - q0, q2 - q0);
+
+				if (glm::dot(before, after) <= 0.0f)
+				{
+					return true;
+				}
+			}
+			return false;
+		};
+
+		for (size_t v = 0; v < vertexCount; v++)
+		{
+			collapseRemap[v] = static_cast<uint32_t>(v);
+		}
+		std::fill(collapseLocked.begin(), collapseLocked.end(), 0);
+
+		const size_t triangleGoal = (result.size() - targetIndexCount) / 3;
+		size_t triangleCollapses = 0;
+		size_t edgeCollapses = 0;
+
+		// Most collapses remove two triangles. Collapses well above the error of the one that would reach the goal
+		// wait for a later pass, when the cheap ones around them are done and their quadrics are up to date
+		const size_t edgeGoal = triangleGoal / 2;
+		const float errorGoal = edgeGoal < collapses.size() ? PASS_ERROR_SLACK * collapses[edgeGoal].error : FLT_MAX;
+
+		for (const EdgeCollapse& collapse : collapses)
+		{
+			if (triangleCollapses >= triangleGoal || collapse.error > errorGoal)
+			{
+				break;
+			}
+
+			const uint32_t r0 = remap[collapse.from];
+			const uint32_t r1 = remap[collapse.to];
+			if (collapseLocked[r0] || collapseLocked[r1] || flips(collapse.from, collapse.to))
+			{
+				continue;
+			}
+
+			quadric_add(quadrics[r1], quadrics[r0]);
+
+			// A seam moves both of its wedges, the other wedge goes to the matching wedge on the far side of the seam
+			if (kind[collapse.from] == KIND_SEAM)
+			{
+				const uint32_t s0 = wedge[collapse.from];
+				const uint32_t s1 = loop[collapse.from] == collapse.to ? loopback[s0] : loop[s0];
+				collapseRemap[s0] = s1;
+			}
+			collapseRemap[collapse.from] = collapse.to;
+
+			collapseLocked[r0] = 1;
+			collapseLocked[r1] = 1;
+
+			// Border edges belong to one triangle, the rest to two
+			triangleCollapses += kind[collapse.from] == KIND_BORDER ? 1 : 2;
+			edgeCollapses++;
+			maxError = std::max(maxError, static_cast<double>(collapse.error));
+		}
+
+		if (edgeCollapses == 0)
+		{
+			break;
+		}
+
+		// Loops skip over vertices that collapsed. When a seam collapsed against the loop direction, the vertex itself is the target
+		for (std::vector<uint32_t>* edgeLoop : { &loop, &loopback })
+		{
+			for (size_t v = 0; v < vertexCount; v++)
+			{
+				const uint32_t next = (*edgeLoop)[v];
+				if (next != NONE)
+				{
+					const uint32_t r = collapseRemap[next];
+					(*edgeLoop)[v] = r == v ? (*edgeLoop)[next] : r;
+				}
+			}
+		}
+
+		// Apply the collapses and drop the triangles that became degenerate
+		size_t kept = 0;
+		for (size_t t = 0; t < result.size(); t += 3)
+		{
+			const uint32_t a = collapseRemap[result[t + 0]];
+			const uint32_t b = collapseRemap[result[t + 1]];
+			const uint32_t c = collapseRemap[result[t + 2]];
+
+			if (a != b && a != c && b != c)
+			{
+				result[kept + 0] = a;
+				result[kept + 1] = b;
+				result[kept + 2] = c;
+				kept += 3;
+			}
+		}
+		result.resize(kept);
+	}
+
+	outError = static_cast<float>(std::sqrt(maxError));
+	return result;
+}
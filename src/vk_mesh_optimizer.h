@@ -0,0 +1,39 @@
+#pragma once
+
+#include "vk_mesh.h"
+
+#include <cstdint>
+#include <vector>
+
+// Post-transform vertex cache statistics of an index buffer
+struct VertexCacheStats {
+	float acmr;		// Average cache miss ratio: transformed vertices per triangle (0.5 is ideal, 3 is worst)
+	float atvr;		// Average transform to vertex ratio: transformed vertices per unique vertex (1 is ideal)
+};
+
+namespace vkopt {
+
+	// Simulate a FIFO post-transform cache of the given size over a triangle list
+	VertexCacheStats analyze_vertex_cache(const std::vector<uint32_t>& indices, size_t vertexCount, uint32_t cacheSize = 16);
+
+	// Reorder triangles to maximise post-transform cache hits (Tom Forsyth's linear-speed algorithm)
+	void optimize_vertex_cache(std::vector<uint32_t>& indices, size_t vertexCount);
+
+	// Reorder clusters of a cache optimized triangle list so outward facing clusters draw first, cutting overdraw.
+	// Clusters are only cut where the cache was already cold, so the cache efficiency is kept
+	void optimize_overdraw(std::vector<uint32_t>& indices, const std::vector<Vertex>& vertices);
+
+	// Regroup the triangles into meshlets of at most MESHLET_MAX_VERTICES vertices and MESHLET_MAX_TRIANGLES triangles.
+	// Meshlets grow through shared vertices and jump to the closest free triangle when they run out of neighbours.
+	// Each meshlet's triangles end up contiguous in indices, in the order the meshlets are returned
+	void build_meshlets(std::vector<uint32_t>& indices, const std::vector<Vertex>& vertices, std::vector<Meshlet>& outMeshlets);
+
+	// Quadric error edge-collapse simplification towards targetIndexCount indices. UV and normal seams and open borders keep
+	// their topology: their vertices only slide along the seam or border. Stops early when nothing more can collapse.
+	// outError is the largest error of any collapse, roughly a distance in mesh units
+	std::vector<uint32_t> simplify(const std::vector<uint32_t>& indices, const std::vector<Vertex>& vertices, size_t targetIndexCount, float& outError);
+
+	// Renumber vertices in the order the index buffer first uses them, so vertex fetches walk memory linearly
+	void optimize_vertex_fetch(std::vector<uint32_t>& indices, std::vector<Vertex>& vertices);
+
+}
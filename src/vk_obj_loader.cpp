@@ -0,0 +1,1236 @@
+#include "vk_obj_loader.h"
+#include "vk_mapped_file.h"
+
+#include <algorithm>
+#include <atomic>
+#include <cmath>
+#include <cstdint>
+#include <cstring>
+#include <iostream>
+#include <limits>
+#include <thread>
+#include <unordered_map>
+
+namespace {
+
+	// Files smaller than this are parsed as a single chunk on the calling thread
+	constexpr size_t MIN_CHUNK_SIZE = 256 * 1024;
+
+	// Text parsed per round by stream_obj. Bounds the parsed faces held at once, independent of the file size
+	constexpr size_t STREAM_WINDOW_SIZE = 4 * 1024 * 1024;
+
+	// Each worker gets a few chunks so a slow chunk doesn't stall the others
+	constexpr size_t CHUNKS_PER_THREAD = 4;
+
+	// Material id of faces that come before any usemtl
+	constexpr uint32_t NO_MATERIAL = UINT32_MAX;
+
+	// Index that was left out of a face corner (such as the uv in "1//1")
+	constexpr int32_t MISSING_INDEX = std::numeric_limits<int32_t>::min();
+
+	// Bits of RawCorner::relativeMask, set when the index was negative (relative to the end of the chunk-local array)
+	constexpr uint32_t RELATIVE_POSITION = 1 << 0;
+	constexpr uint32_t RELATIVE_TEXCOORD = 1 << 1;
+	constexpr uint32_t RELATIVE_NORMAL = 1 << 2;
+
+	// A face corner as it was read from a chunk. Absolute indices are already zero based,
+	// relative ones still need the global offset of their chunk added
+	struct RawCorner {
+		int32_t position;
+		int32_t texcoord;
+		int32_t normal;
+		uint32_t relativeMask;
+	};
+
+	// A face corner with global, zero based indices. Missing indices are -1
+	struct ObjIndex {
+		int32_t position;
+		int32_t texcoord;
+		int32_t normal;
+	};
+
+	struct ObjChunk {
+		const char* begin;
+		const char* end;
+
+		std::vector<float> positions;
+		std::vector<float> normals;
+		std::vector<float> texcoords;
+
+		std::vector<RawCorner> corners;
+		std::vector<uint32_t> faceSizes;
+
+		// usemtl statements as the first face they apply to and the material name
+		std::vector<std::pair<uint32_t, std::string>> materialSwitches;
+
+		// Offsets of this chunk's attributes in the merged arrays
+		size_t positionBase{ 0 };
+		size_t normalBase{ 0 };
+		size_t texcoordBase{ 0 };
+
+		// Material ids of the switches and of the faces before the first switch, resolved in file order after parsing
+		std::vector<uint32_t> switchMaterials;
+		uint32_t startMaterial{ NO_MATERIAL };
+
+		// Triangulated corners, the material of every triangle and where they go in the output
+		std::vector<ObjIndex> triangles;
+		std::vector<uint32_t> triangleMaterials;
+		size_t vertexBase{ 0 };
+
+		// Start of the line that failed to parse, if any
+		const char* errorLine{ nullptr };
+	};
+
+	// Run function(i) for every i in [0, count) across all cores
+	template<typename F>
+	void parallel_for(size_t count, F&& function)
+	{
+		const size_t hardwareThreads = std::max(1u, std::thread::hardware_concurrency());
+		const size_t workerCount = std::min(count, hardwareThreads);
+
+		if (workerCount <= 1)
+		{
+			for (size_t i = 0; i < count; i++)
+			{
+				function(i);
+			}
+			return;
+		}
+
+		std::atomic<size_t> next{ 0 };
+		auto worker = [&]() {
+			for (size_t i = next++; i < count; i = next++)
+			{
+				function(i);
+			}
+		};
+
+		std::vector<std::thread> threads;
+		threads.reserve(workerCount - 1);
+		for (size_t t = 1; t < workerCount; t++)
+		{
+			threads.emplace_back(worker);
+		}
+
+		// The calling thread works too
+		worker();
+
+		for (std::thread& thread : threads)
+		{
+			thread.join();
+		}
+	}
+
+	inline bool is_space(char c)
+	{
+		return c == ' ' || c == '\t';
+	}
+
+	inline bool is_digit(char c)
+	{
+		return static_cast<unsigned int>(c - '0') < 10u;
+	}
+
+	// Character at p[offset], or '\0' past the end of the line. Mirrors the null terminated lines tinyobj works on
+	inline char char_at(const char* p, size_t offset, const char* lineEnd)
+	{
+		return p + offset < lineEnd ? p[offset] : '\0';
+	}
+
+	inline const char* skip_space(const char* p, const char* lineEnd)
+	{
+		while (p < lineEnd && is_space(*p))
+		{
+			p++;
+		}
+		return p;
+	}
+
+	inline const char* token_end(const char* p, const char* lineEnd)
+	{
+		while (p < lineEnd && *p != ' ' && *p != '\t' && *p != '\r')
+		{
+			p++;
+		}
+		return p;
+	}
+
+	// True if the line starts with the keyword followed by whitespace
+	inline bool is_keyword(const char* p, const char* lineEnd, const char* keyword)
+	{
+		const size_t length = strlen(keyword);
+		return static_cast<size_t>(lineEnd - p) > length && memcmp(p, keyword, length) == 0 && is_space(p[length]);
+	}
+
+	// Rest of the line after a keyword, without surrounding whitespace. Names and paths may contain spaces
+	std::string rest_of_line(const char* p, const char* lineEnd, size_t keywordLength)
+	{
+		p = skip_space(p + keywordLength, lineEnd);
+		while (lineEnd > p && (is_space(lineEnd[-1]) || lineEnd[-1] == '\r'))
+		{
+			lineEnd--;
+		}
+		return std::string(p, lineEnd);
+	}
+
+	// Port of tinyobj's tryParseDouble, so values are bit-identical to the old loader.
+	// Parses [sign] digits [. digits] [(e|E) [sign] digits] without allocating or touching the locale
+	bool parse_double(const char* s, const char* end, double* result)
+	{
+		if (s >= end)
+		{
+			return false;
+		}
+
+		static const double POW_LUT[] = { 1.0, 0.1, 0.01, 0.001, 0.0001, 0.00001, 0.000001, 0.0000001 };
+		constexpr int LUT_ENTRIES = sizeof(POW_LUT) / sizeof(POW_LUT[0]);
+
+		double mantissa = 0.0;
+		int exponent = 0;
+		char sign = '+';
+		char expSign = '+';
+		const char* curr = s;
+		int read = 0;
+		bool leadingDecimalDots = false;
+
+		// Sign
+		if (*curr == '+' || *curr == '-')
+		{
+			sign = *curr;
+			curr++;
+			if (curr != end && *curr == '.')
+			{
+				leadingDecimalDots = true;
+			}
+		}
+		else if (*curr == '.')
+		{
+			leadingDecimalDots = true;
+		}
+		else if (!is_digit(*curr))
+		{
+			return false;
+		}
+
+		// Integer part
+		if (!leadingDecimalDots)
+		{
+			while (curr != end && is_digit(*curr))
+			{
+				mantissa *= 10;
+				mantissa += static_cast<int>(*curr - '0');
+				curr++;
+				read++;
+			}
+
+			if (read == 0)
+			{
+				return false;
+			}
+		}
+
+		if (curr != end)
+		{
+			bool hasExponent = false;
+
+			// Decimal part
+			if (*curr == '.')
+			{
+				curr++;
+				read = 1;
+				while (curr != end && is_digit(*curr))
+				{
+					mantissa += static_cast<int>(*curr - '0') * (read < LUT_ENTRIES ? POW_LUT[read] : std::pow(10.0, -read));
+					read++;
+					curr++;
+				}
+				hasExponent = curr != end && (*curr == 'e' || *curr == 'E');
+			}
+			else if (*curr == 'e' || *curr == 'E')
+			{
+				hasExponent = true;
+			}
+
+			// Exponent part
+			if (hasExponent)
+			{
+				curr++;
+				if (curr != end && (*curr == '+' || *curr == '-'))
+				{
+					expSign = *curr;
+					curr++;
+				}
+				else if (curr == end || !is_digit(*curr))
+				{
+					// Empty exponent is not allowed
+					return false;
+				}
+
+				read = 0;
+				while (curr != end && is_digit(*curr))
+				{
+					exponent *= 10;
+					exponent += static_cast<int>(*curr - '0');
+					curr++;
+					read++;
+				}
+				exponent *= (expSign == '+' ? 1 : -1);
+
+				if (read == 0)
+				{
+					return false;
+				}
+			}
+		}
+
+		*result = (sign == '+' ? 1 : -1) * (exponent ? std::ldexp(mantissa * std::pow(5.0, exponent), exponent) : mantissa);
+		return true;
+	}
+
+	inline float parse_float(const char*& p, const char* lineEnd, double defaultValue = 0.0)
+	{
+		p = skip_space(p, lineEnd);
+		const char* end = token_end(p, lineEnd);
+
+		double value = defaultValue;
+		parse_double(p, end, &value);
+
+		p = end;
+		return static_cast<float>(value);
+	}
+
+	// Same behaviour as atoi on the index part of a face corner
+	inline int parse_int(const char* p, const char* lineEnd)
+	{
+		bool negative = false;
+		if (p < lineEnd && (*p == '+' || *p == '-'))
+		{
+			negative = *p == '-';
+			p++;
+		}
+
+		int value = 0;
+		while (p < lineEnd && is_digit(*p))
+		{
+			value = value * 10 + (*p - '0');
+			p++;
+		}
+		return negative ? -value : value;
+	}
+
+	inline const char* skip_index(const char* p, const char* lineEnd)
+	{
+		while (p < lineEnd && *p != '/' && *p != ' ' && *p != '\t' && *p != '\r')
+		{
+			p++;
+		}
+		return p;
+	}
+
+	// Convert an OBJ index to zero based. Negative indices count back from the current (chunk-local) attribute count
+	inline bool fix_index(int index, size_t localCount, uint32_t relativeBit, int32_t& outIndex, uint32_t& relativeMask)
+	{
+		if (index > 0)
+		{
+			outIndex = index - 1;
+			return true;
+		}
+
+		if (index < 0)
+		{
+			outIndex = static_cast<int32_t>(localCount) + index;
+			relativeMask |= relativeBit;
+			return true;
+		}
+
+		// Zero is not allowed according to the spec
+		return false;
+	}
+
+	// Parse one of: v, v/vt, v//vn, v/vt/vn
+	bool parse_corner(const char*& p, const char* lineEnd, const ObjChunk& chunk, RawCorner& outCorner)
+	{
+		outCorner = { MISSING_INDEX, MISSING_INDEX, MISSING_INDEX, 0 };
+
+		if (!fix_index(parse_int(p, lineEnd), chunk.positions.size() / 3, RELATIVE_POSITION, outCorner.position, outCorner.relativeMask))
+		{
+			return false;
+		}
+
+		p = skip_index(p, lineEnd);
+		if (char_at(p, 0, lineEnd) != '/')
+		{
+			return true;
+		}
+		p++;
+
+		// v//vn
+		if (char_at(p, 0, lineEnd) == '/')
+		{
+			p++;
+			if (!fix_index(parse_int(p, lineEnd), chunk.normals.size() / 3, RELATIVE_NORMAL, outCorner.normal, outCorner.relativeMask))
+			{
+				return false;
+			}
+			p = skip_index(p, lineEnd);
+			return true;
+		}
+
+		// v/vt/vn or v/vt
+		if (!fix_index(parse_int(p, lineEnd), chunk.texcoords.size() / 2, RELATIVE_TEXCOORD, outCorner.texcoord, outCorner.relativeMask))
+		{
+			return false;
+		}
+
+		p = skip_index(p, lineEnd);
+		if (char_at(p, 0, lineEnd) != '/')
+		{
+			return true;
+		}
+		p++;
+
+		if (!fix_index(parse_int(p, lineEnd), chunk.normals.size() / 3, RELATIVE_NORMAL, outCorner.normal, outCorner.relativeMask))
+		{
+			return false;
+		}
+		p = skip_index(p, lineEnd);
+		return true;
+	}
+
+	// Parse a single line. Returns false on a malformed face
+	bool parse_line(const char* p, const char* lineEnd, ObjChunk& chunk)
+	{
+		// Trim the '\r' of Windows line endings
+		if (lineEnd > p && lineEnd[-1] == '\r')
+		{
+			lineEnd--;
+		}
+
+		p = skip_space(p, lineEnd);
+		if (p == lineEnd || *p == '#')
+		{
+			return true;
+		}
+
+		const char c0 = p[0];
+		const char c1 = char_at(p, 1, lineEnd);
+		const char c2 = char_at(p, 2, lineEnd);
+
+		// Vertex position
+		if (c0 == 'v' && is_space(c1))
+		{
+			p += 2;
+			chunk.positions.push_back(parse_float(p, lineEnd));
+			chunk.positions.push_back(parse_float(p, lineEnd));
+			chunk.positions.push_back(parse_float(p, lineEnd));
+			return true;
+		}
+
+		// Vertex normal
+		if (c0 == 'v' && c1 == 'n' && is_space(c2))
+		{
+			p += 3;
+			chunk.normals.push_back(parse_float(p, lineEnd));
+			chunk.normals.push_back(parse_float(p, lineEnd));
+			chunk.normals.push_back(parse_float(p, lineEnd));
+			return true;
+		}
+
+		// Vertex uv
+		if (c0 == 'v' && c1 == 't' && is_space(c2))
+		{
+			p += 3;
+			chunk.texcoords.push_back(parse_float(p, lineEnd));
+			chunk.texcoords.push_back(parse_float(p, lineEnd));
+			return true;
+		}
+
+		// Face
+		if (c0 == 'f' && is_space(c1))
+		{
+			p += 2;
+			p = skip_space(p, lineEnd);
+
+			uint32_t faceSize = 0;
+			while (p < lineEnd && *p != '\r' && *p != '\0')
+			{
+				RawCorner corner;
+				if (!parse_corner(p, lineEnd, chunk, corner))
+				{
+					return false;
+				}
+
+				chunk.corners.push_back(corner);
+				faceSize++;
+
+				while (p < lineEnd && (is_space(*p) || *p == '\r'))
+				{
+					p++;
+				}
+			}
+
+			chunk.faceSizes.push_back(faceSize);
+			return true;
+		}
+
+		// Material for the faces that follow
+		if (is_keyword(p, lineEnd, "usemtl"))
+		{
+			chunk.materialSwitches.emplace_back(static_cast<uint32_t>(chunk.faceSizes.size()), rest_of_line(p, lineEnd, 6));
+			return true;
+		}
+
+		// Everything else (groups, objects, smoothing) doesn't change the output
+		return true;
+	}
+
+	void parse_chunk(ObjChunk& chunk)
+	{
+		const char* p = chunk.begin;
+		while (p < chunk.end)
+		{
+			const char* lineEnd = static_cast<const char*>(memchr(p, '\n', chunk.end - p));
+			if (lineEnd == nullptr)
+			{
+				lineEnd = chunk.end;
+			}
+
+			if (!parse_line(p, lineEnd, chunk))
+			{
+				chunk.errorLine = p;
+				return;
+			}
+
+			p = lineEnd + 1;
+		}
+	}
+
+	inline int32_t resolve_index(int32_t index, bool relative, size_t base)
+	{
+		if (index == MISSING_INDEX)
+		{
+			return -1;
+		}
+		return relative ? static_cast<int32_t>(base) + index : index;
+	}
+
+	// Point in polygon test, same as the one tinyobj triangulates with
+	int pnpoly(int nvert, const float* vertx, const float* verty, float testx, float testy)
+	{
+		int i, j, c = 0;
+		for (i = 0, j = nvert - 1; i < nvert; j = i++)
+		{
+			if (((verty[i] > testy) != (verty[j] > testy)) &&
+				(testx < (vertx[j] - vertx[i]) * (testy - verty[i]) / (verty[j] - verty[i]) + vertx[i]))
+			{
+				c = !c;
+			}
+		}
+		return c;
+	}
+
+	// Split a polygon into triangles by ear clipping. This is the exact algorithm tinyobj uses,
+	// so quads (most of lost_empire) are split along the same diagonal as before
+	void triangulate_polygon(const ObjIndex* face, size_t faceSize, const std::vector<float>& v, std::vector<ObjIndex>& remainingFace, std::vector<ObjIndex>& outTriangles)
+	{
+		if (faceSize < 3)
+		{
+			// Face must have 3+ vertices
+			return;
+		}
+
+		if (faceSize == 3)
+		{
+			outTriangles.insert(outTriangles.end(), face, face + 3);
+			return;
+		}
+
+		size_t npolys = faceSize;
+
+		// Find the two axes to work in
+		size_t axes[2] = { 1, 2 };
+		for (size_t k = 0; k < npolys; ++k)
+		{
+			size_t vi0 = size_t(face[(k + 0) % npolys].position);
+			size_t vi1 = size_t(face[(k + 1) % npolys].position);
+			size_t vi2 = size_t(face[(k + 2) % npolys].position);
+
+			if (((3 * vi0 + 2) >= v.size()) || ((3 * vi1 + 2) >= v.size()) || ((3 * vi2 + 2) >= v.size()))
+			{
+				// Invalid triangle
+				continue;
+			}
+
+			float e0x = v[vi1 * 3 + 0] - v[vi0 * 3 + 0];
+			float e0y = v[vi1 * 3 + 1] - v[vi0 * 3 + 1];
+			float e0z = v[vi1 * 3 + 2] - v[vi0 * 3 + 2];
+			float e1x = v[vi2 * 3 + 0] - v[vi1 * 3 + 0];
+			float e1y = v[vi2 * 3 + 1] - v[vi1 * 3 + 1];
+			float e1z = v[vi2 * 3 + 2] - v[vi1 * 3 + 2];
+			float cx = std::fabs(e0y * e1z - e0z * e1y);
+			float cy = std::fabs(e0z * e1x - e0x * e1z);
+			float cz = std::fabs(e0x * e1y - e0y * e1x);
+			const float epsilon = std::numeric_limits<float>::epsilon();
+			if (cx > epsilon || cy > epsilon || cz > epsilon)
+			{
+				// Found a corner
+				if (!(cx > cy && cx > cz))
+				{
+					axes[0] = 0;
+					if (cz > cx && cz > cy)
+					{
+						axes[1] = 1;
+					}
+				}
+				break;
+			}
+		}
+
+		float area = 0;
+		for (size_t k = 0; k < npolys; ++k)
+		{
+			size_t vi0 = size_t(face[(k + 0) % npolys].position);
+			size_t vi1 = size_t(face[(k + 1) % npolys].position);
+			if (((vi0 * 3 + axes[0]) >= v.size()) || ((vi0 * 3 + axes[1]) >= v.size()) ||
+				((vi1 * 3 + axes[0]) >= v.size()) || ((vi1 * 3 + axes[1]) >= v.size()))
+			{
+				// Invalid index
+				continue;
+			}
+			float v0x = v[vi0 * 3 + axes[0]];
+			float v0y = v[vi0 * 3 + axes[1]];
+			float v1x = v[vi1 * 3 + axes[0]];
+			float v1y = v[vi1 * 3 + axes[1]];
+			area += (v0x * v1y - v0y * v1x) * 0.5f;
+		}
+
+		remainingFace.assign(face, face + faceSize);
+		size_t guessVert = 0;
+		ObjIndex ind[3];
+		float vx[3];
+		float vy[3];
+
+		// How many iterations can we do without decreasing the remaining vertices
+		size_t remainingIterations = faceSize;
+		size_t previousRemainingVertices = remainingFace.size();
+
+		while (remainingFace.size() > 3 && remainingIterations > 0)
+		{
+			npolys = remainingFace.size();
+			if (guessVert >= npolys)
+			{
+				guessVert -= npolys;
+			}
+
+			if (previousRemainingVertices != npolys)
+			{
+				// The number of remaining vertices decreased. Reset counters
+				previousRemainingVertices = npolys;
+				remainingIterations = npolys;
+			}
+			else
+			{
+				// We didn't consume a vertex on the previous iteration, reduce the available iterations
+				remainingIterations--;
+			}
+
+			for (size_t k = 0; k < 3; k++)
+			{
+				ind[k] = remainingFace[(guessVert + k) % npolys];
+				size_t vi = size_t(ind[k].position);
+				if (((vi * 3 + axes[0]) >= v.size()) || ((vi * 3 + axes[1]) >= v.size()))
+				{
+					vx[k] = 0.0f;
+					vy[k] = 0.0f;
+				}
+				else
+				{
+					vx[k] = v[vi * 3 + axes[0]];
+					vy[k] = v[vi * 3 + axes[1]];
+				}
+			}
+			float e0x = vx[1] - vx[0];
+			float e0y = vy[1] - vy[0];
+			float e1x = vx[2] - vx[1];
+			float e1y = vy[2] - vy[1];
+			float cross = e0x * e1y - e0y * e1x;
+
+			// If an internal angle
+			if (cross * area < 0.0f)
+			{
+				guessVert += 1;
+				continue;
+			}
+
+			// Check all other verts in case they are inside this triangle
+			bool overlap = false;
+			for (size_t otherVert = 3; otherVert < npolys; ++otherVert)
+			{
+				size_t idx = (guessVert + otherVert) % npolys;
+				size_t ovi = size_t(remainingFace[idx].position);
+
+				if (((ovi * 3 + axes[0]) >= v.size()) || ((ovi * 3 + axes[1]) >= v.size()))
+				{
+					continue;
+				}
+				float tx = v[ovi * 3 + axes[0]];
+				float ty = v[ovi * 3 + axes[1]];
+				if (pnpoly(3, vx, vy, tx, ty))
+				{
+					overlap = true;
+					break;
+				}
+			}
+
+			if (overlap)
+			{
+				guessVert += 1;
+				continue;
+			}
+
+			// This triangle is an ear
+			outTriangles.insert(outTriangles.end(), ind, ind + 3);
+
+			// Remove v1 from the list
+			remainingFace.erase(remainingFace.begin() + (guessVert + 1) % npolys);
+		}
+
+		if (remainingFace.size() == 3)
+		{
+			outTriangles.insert(outTriangles.end(), remainingFace.begin(), remainingFace.end());
+		}
+	}
+
+	// Resolve the chunk's corner indices to global ones and split its faces into triangles
+	void triangulate_chunk(ObjChunk& chunk, const std::vector<float>& positions)
+	{
+		std::vector<ObjIndex> face;
+		std::vector<ObjIndex> remainingFace;
+
+		chunk.triangles.reserve(chunk.corners.size() * 3 / 2);
+		chunk.triangleMaterials.reserve(chunk.corners.size() / 2);
+
+		uint32_t material = chunk.startMaterial;
+		size_t nextSwitch = 0;
+
+		size_t cornerIndex = 0;
+		for (size_t f = 0; f < chunk.faceSizes.size(); f++)
+		{
+			const uint32_t faceSize = chunk.faceSizes[f];
+
+			while (nextSwitch < chunk.materialSwitches.size() && chunk.materialSwitches[nextSwitch].first == f)
+			{
+				material = chunk.switchMaterials[nextSwitch++];
+			}
+
+			face.resize(faceSize);
+			for (uint32_t c = 0; c < faceSize; c++)
+			{
+				const RawCorner& raw = chunk.corners[cornerIndex + c];
+
+				// Relative indices were made local to the end of the chunk's arrays at the time of the face,
+				// so they are offset by the chunk's base
+				face[c].position = resolve_index(raw.position, raw.relativeMask & RELATIVE_POSITION, chunk.positionBase);
+				face[c].texcoord = resolve_index(raw.texcoord, raw.relativeMask & RELATIVE_TEXCOORD, chunk.texcoordBase);
+				face[c].normal = resolve_index(raw.normal, raw.relativeMask & RELATIVE_NORMAL, chunk.normalBase);
+			}
+			cornerIndex += faceSize;
+
+			triangulate_polygon(face.data(), faceSize, positions, remainingFace, chunk.triangles);
+			chunk.triangleMaterials.resize(chunk.triangles.size() / 3, material);
+		}
+	}
+
+	// Copy the attributes a corner references into a vertex. Out of range indices produce zeros
+	inline void write_vertex(const ObjIndex& index, const std::vector<float>& positions, const std::vector<float>& normals, const std::vector<float>& texcoords, Vertex& outVertex)
+	{
+		outVertex.position = { 0.0f, 0.0f, 0.0f };
+		outVertex.normal = { 0.0f, 0.0f, 0.0f };
+		outVertex.uv = { 0.0f, 0.0f };
+
+		if (index.position >= 0 && size_t(index.position) * 3 + 2 < positions.size())
+		{
+			const float* p = &positions[size_t(index.position) * 3];
+			outVertex.position = { p[0], p[1], p[2] };
+		}
+
+		if (index.normal >= 0 && size_t(index.normal) * 3 + 2 < normals.size())
+		{
+			const float* n = &normals[size_t(index.normal) * 3];
+			outVertex.normal = { n[0], n[1], n[2] };
+		}
+
+		if (index.texcoord >= 0 && size_t(index.texcoord) * 2 + 1 < texcoords.size())
+		{
+			const float* t = &texcoords[size_t(index.texcoord) * 2];
+			outVertex.uv.x = t[0];
+			outVertex.uv.y = 1 - t[1];
+		}
+
+		// Set the vertex color as the vertex normal. This is just for display purposes
+		outVertex.color = outVertex.normal;
+	}
+
+	// Split a range of the file into chunkCount chunks on line boundaries
+	std::vector<ObjChunk> split_chunks(const char* begin, const char* end, size_t chunkCount)
+	{
+		std::vector<ObjChunk> chunks(chunkCount);
+		const size_t size = end - begin;
+
+		const char* chunkBegin = begin;
+		for (size_t i = 0; i < chunkCount; i++)
+		{
+			const char* chunkEnd = end;
+			if (i + 1 < chunkCount)
+			{
+				chunkEnd = std::max(chunkBegin, begin + size / chunkCount * (i + 1));
+				const char* newline = static_cast<const char*>(memchr(chunkEnd, '\n', end - chunkEnd));
+				chunkEnd = newline ? newline + 1 : end;
+			}
+
+			chunks[i].begin = chunkBegin;
+			chunks[i].end = chunkEnd;
+			chunkBegin = chunkEnd;
+		}
+
+		return chunks;
+	}
+
+	// Report the first failure in file order, with the same message the old loader gave. Returns true if there was one
+	bool report_parse_error(const char* fileBegin, const std::vector<ObjChunk>& chunks)
+	{
+		for (const ObjChunk& chunk : chunks)
+		{
+			if (chunk.errorLine)
+			{
+				size_t lineNumber = 1 + std::count(fileBegin, chunk.errorLine, '\n');
+				std::cerr << "Failed parse `f' line(e.g. zero value for face index. line " << lineNumber << ".)" << std::endl;
+				return true;
+			}
+		}
+		return false;
+	}
+
+	// Material ids in order of first use. Kept across calls, so a file can be numbered one window at a time
+	struct MaterialNumbering {
+		std::unordered_map<std::string, uint32_t> ids;
+		uint32_t current{ NO_MATERIAL };
+		std::vector<ObjMaterial> materials;
+	};
+
+	// Number the materials the chunks switch to. This has to walk the chunks in file order
+	void number_materials(std::vector<ObjChunk>& chunks, MaterialNumbering& numbering)
+	{
+		for (ObjChunk& chunk : chunks)
+		{
+			const bool facesBeforeSwitch = !chunk.faceSizes.empty() && (chunk.materialSwitches.empty() || chunk.materialSwitches[0].first > 0);
+			if (facesBeforeSwitch && numbering.current == NO_MATERIAL)
+			{
+				numbering.current = static_cast<uint32_t>(numbering.materials.size());
+				numbering.materials.emplace_back();
+			}
+			chunk.startMaterial = numbering.current;
+
+			for (const auto& materialSwitch : chunk.materialSwitches)
+			{
+				auto it = numbering.ids.find(materialSwitch.second);
+				if (it == numbering.ids.end())
+				{
+					it = numbering.ids.emplace(materialSwitch.second, static_cast<uint32_t>(numbering.materials.size())).first;
+					numbering.materials.emplace_back();
+					numbering.materials.back().name = materialSwitch.second;
+				}
+				numbering.current = it->second;
+				chunk.switchMaterials.push_back(numbering.current);
+			}
+		}
+	}
+
+	// Fill in the properties from the library. A missing library only costs the properties, not the mesh
+	void apply_material_library(const char* filename, const char* data, size_t size, std::vector<ObjMaterial>& materials)
+	{
+		const std::string libraryPath = vkobj::find_material_library(filename, data, size);
+
+		std::vector<ObjMaterial> library;
+		if (!libraryPath.empty() && !vkobj::load_mtl(libraryPath.c_str(), library))
+		{
+			std::cout << "WARNING: could not load material library " << libraryPath << std::endl;
+		}
+
+		for (ObjMaterial& material : materials)
+		{
+			for (const ObjMaterial& defined : library)
+			{
+				if (defined.name == material.name)
+				{
+					material = defined;
+					break;
+				}
+			}
+		}
+	}
+}
+
+bool vkobj::load_obj(const char* filename, std::vector<Vertex>& outVertices, std::vector<uint32_t>* outTriangleMaterials, std::vector<ObjMaterial>* outMaterials)
+{
+	MappedFile file;
+	if (!file.open(filename))
+	{
+		std::cerr << "Cannot open file [" << filename << "]" << std::endl;
+		return false;
+	}
+
+	const char* fileBegin = file.data();
+	const char* fileEnd = fileBegin + file.size();
+
+	// Split the file into chunks on line boundaries
+	const size_t hardwareThreads = std::max(1u, std::thread::hardware_concurrency());
+	const size_t maxChunks = hardwareThreads * CHUNKS_PER_THREAD;
+	const size_t chunkCount = std::max<size_t>(1, std::min(maxChunks, file.size() / MIN_CHUNK_SIZE));
+
+	std::vector<ObjChunk> chunks = split_chunks(fileBegin, fileEnd, chunkCount);
+
+	// Parse every chunk into its own attribute and face arrays
+	parallel_for(chunkCount, [&](size_t i) {
+		parse_chunk(chunks[i]);
+	});
+
+	if (report_parse_error(fileBegin, chunks))
+	{
+		return false;
+	}
+
+	// Work out where each chunk's attributes live in the merged arrays
+	size_t positionCount = 0;
+	size_t normalCount = 0;
+	size_t texcoordCount = 0;
+	for (ObjChunk& chunk : chunks)
+	{
+		chunk.positionBase = positionCount;
+		chunk.normalBase = normalCount;
+		chunk.texcoordBase = texcoordCount;
+
+		positionCount += chunk.positions.size() / 3;
+		normalCount += chunk.normals.size() / 3;
+		texcoordCount += chunk.texcoords.size() / 2;
+	}
+
+	std::vector<float> positions(positionCount * 3);
+	std::vector<float> normals(normalCount * 3);
+	std::vector<float> texcoords(texcoordCount * 2);
+
+	// Number the materials in order of first use
+	MaterialNumbering numbering;
+	number_materials(chunks, numbering);
+
+	// Merge the attributes and triangulate. Triangulation needs positions from any chunk, so it runs after the merge
+	parallel_for(chunkCount, [&](size_t i) {
+		ObjChunk& chunk = chunks[i];
+		std::copy(chunk.positions.begin(), chunk.positions.end(), positions.begin() + chunk.positionBase * 3);
+		std::copy(chunk.normals.begin(), chunk.normals.end(), normals.begin() + chunk.normalBase * 3);
+		std::copy(chunk.texcoords.begin(), chunk.texcoords.end(), texcoords.begin() + chunk.texcoordBase * 2);
+	});
+
+	parallel_for(chunkCount, [&](size_t i) {
+		triangulate_chunk(chunks[i], positions);
+	});
+
+	// Size the output once, then every chunk writes its own range of it
+	size_t vertexCount = 0;
+	for (ObjChunk& chunk : chunks)
+	{
+		chunk.vertexBase = vertexCount;
+		vertexCount += chunk.triangles.size();
+	}
+
+	const size_t firstVertex = outVertices.size();
+	outVertices.resize(firstVertex + vertexCount);
+
+	parallel_for(chunkCount, [&](size_t i) {
+		const ObjChunk& chunk = chunks[i];
+		Vertex* out = outVertices.data() + firstVertex + chunk.vertexBase;
+		for (size_t v = 0; v < chunk.triangles.size(); v++)
+		{
+			write_vertex(chunk.triangles[v], positions, normals, texcoords, out[v]);
+		}
+	});
+
+	if (outTriangleMaterials)
+	{
+		const size_t firstTriangle = outTriangleMaterials->size();
+		outTriangleMaterials->resize(firstTriangle + vertexCount / 3);
+		for (const ObjChunk& chunk : chunks)
+		{
+			std::copy(chunk.triangleMaterials.begin(), chunk.triangleMaterials.end(), outTriangleMaterials->begin() + firstTriangle + chunk.vertexBase / 3);
+		}
+	}
+
+	if (outMaterials)
+	{
+		apply_material_library(filename, fileBegin, file.size(), numbering.materials);
+		*outMaterials = std::move(numbering.materials);
+	}
+
+	return true;
+}
+
+bool vkobj::stream_obj(const char* filename, const ObjStreamTarget& target, AABB& outBounds)
+{
+	MappedFile file;
+	if (!file.open(filename))
+	{
+		std::cerr << "Cannot open file [" << filename << "]" << std::endl;
+		return false;
+	}
+
+	const char* fileBegin = file.data();
+	const char* fileEnd = fileBegin + file.size();
+
+	if (!target.begin(count_obj_vertices(fileBegin, file.size())))
+	{
+		return false;
+	}
+
+	// Attributes have to be kept whole, a face may reference any attribute above it
+	std::vector<float> positions;
+	std::vector<float> normals;
+	std::vector<float> texcoords;
+
+	Vertex* batch = nullptr;
+	size_t batchCount = 0;
+
+	MaterialNumbering numbering;
+	std::vector<ObjTriangleRun> runs;
+	size_t triangleCount = 0;
+
+	const size_t hardwareThreads = std::max(1u, std::thread::hardware_concurrency());
+
+	// Parse the file a window at a time. Each window is still split across all cores
+	const char* windowBegin = fileBegin;
+	while (windowBegin < fileEnd)
+	{
+		const char* windowEnd = fileEnd;
+		if (static_cast<size_t>(fileEnd - windowBegin) > STREAM_WINDOW_SIZE)
+		{
+			const char* newline = static_cast<const char*>(memchr(windowBegin + STREAM_WINDOW_SIZE, '\n', fileEnd - windowBegin - STREAM_WINDOW_SIZE));
+			windowEnd = newline ? newline + 1 : fileEnd;
+		}
+
+		const size_t chunkCount = std::max<size_t>(1, std::min(hardwareThreads, static_cast<size_t>(windowEnd - windowBegin) / MIN_CHUNK_SIZE));
+		std::vector<ObjChunk> chunks = split_chunks(windowBegin, windowEnd, chunkCount);
+
+		parallel_for(chunkCount, [&](size_t i) {
+			parse_chunk(chunks[i]);
+		});
+
+		if (report_parse_error(fileBegin, chunks))
+		{
+			return false;
+		}
+
+		// Append the window's attributes behind everything read so far
+		for (ObjChunk& chunk : chunks)
+		{
+			chunk.positionBase = positions.size() / 3;
+			chunk.normalBase = normals.size() / 3;
+			chunk.texcoordBase = texcoords.size() / 2;
+
+			positions.insert(positions.end(), chunk.positions.begin(), chunk.positions.end());
+			normals.insert(normals.end(), chunk.normals.begin(), chunk.normals.end());
+			texcoords.insert(texcoords.end(), chunk.texcoords.begin(), chunk.texcoords.end());
+		}
+
+		number_materials(chunks, numbering);
+
+		parallel_for(chunkCount, [&](size_t i) {
+			triangulate_chunk(chunks[i], positions);
+		});
+
+		// Convert straight into the target's memory, handing over every full batch
+		for (const ObjChunk& chunk : chunks)
+		{
+			for (uint32_t material : chunk.triangleMaterials)
+			{
+				if (runs.empty() || runs.back().material != material)
+				{
+					runs.push_back({ triangleCount, 0, material });
+				}
+				runs.back().triangleCount++;
+				triangleCount++;
+			}
+
+			for (const ObjIndex& index : chunk.triangles)
+			{
+				if (batch == nullptr)
+				{
+					batch = target.acquire_batch();
+					if (batch == nullptr)
+					{
+						return false;
+					}
+				}
+
+				write_vertex(index, positions, normals, texcoords, batch[batchCount++]);
+
+				if (batchCount == target.batchVertexCount)
+				{
+					if (!target.submit_batch(batchCount))
+					{
+						return false;
+					}
+					batch = nullptr;
+					batchCount = 0;
+				}
+			}
+		}
+
+		windowBegin = windowEnd;
+	}
+
+	// The positions are still around, which saves reading the vertices back out of the target's memory
+	outBounds = vkbounds::compute_aabb(reinterpret_cast<const glm::vec3*>(positions.data()), positions.size() / 3, sizeof(glm::vec3));
+
+	if (batchCount > 0 && !target.submit_batch(batchCount))
+	{
+		return false;
+	}
+
+	if (target.finish)
+	{
+		apply_material_library(filename, fileBegin, file.size(), numbering.materials);
+		return target.finish(numbering.materials, runs);
+	}
+	return true;
+}
+
+size_t vkobj::count_obj_vertices(const char* data, size_t size)
+{
+	const char* fileEnd = data + size;
+	const char* p = data;
+
+	size_t vertexCount = 0;
+	while (p < fileEnd)
+	{
+		const char* lineEnd = static_cast<const char*>(memchr(p, '\n', fileEnd - p));
+		if (lineEnd == nullptr)
+		{
+			lineEnd = fileEnd;
+		}
+
+		p = skip_space(p, lineEnd);
+		if (lineEnd - p > 1 && p[0] == 'f' && is_space(p[1]))
+		{
+			// Count the corners, ear clipping makes at most cornerCount - 2 triangles
+			size_t cornerCount = 0;
+			p = skip_space(p + 2, lineEnd);
+			while (p < lineEnd && *p != '\r')
+			{
+				cornerCount++;
+				p = skip_space(token_end(p, lineEnd), lineEnd);
+			}
+
+			if (cornerCount >= 3)
+			{
+				vertexCount += (cornerCount - 2) * 3;
+			}
+		}
+
+		p = lineEnd + 1;
+	}
+
+	return vertexCount;
+}
+
+bool vkobj::load_mtl(const char* filename, std::vector<ObjMaterial>& outMaterials)
+{
+	MappedFile file;
+	if (!file.open(filename))
+	{
+		return false;
+	}
+
+	const char* p = file.data();
+	const char* fileEnd = p + file.size();
+
+	while (p < fileEnd)
+	{
+		const char* lineEnd = static_cast<const char*>(memchr(p, '\n', fileEnd - p));
+		if (lineEnd == nullptr)
+		{
+			lineEnd = fileEnd;
+		}
+		const char* next = lineEnd + 1;
+
+		p = skip_space(p, lineEnd);
+
+		if (is_keyword(p, lineEnd, "newmtl"))
+		{
+			outMaterials.emplace_back();
+			outMaterials.back().name = rest_of_line(p, lineEnd, 6);
+		}
+		else if (!outMaterials.empty())
+		{
+			ObjMaterial& material = outMaterials.back();
+
+			if (is_keyword(p, lineEnd, "Kd"))
+			{
+				p += 2;
+				material.diffuse.r = parse_float(p, lineEnd);
+				material.diffuse.g = parse_float(p, lineEnd);
+				material.diffuse.b = parse_float(p, lineEnd);
+			}
+			else if (is_keyword(p, lineEnd, "d"))
+			{
+				p += 1;
+				material.dissolve = parse_float(p, lineEnd, 1.0);
+			}
+			else if (is_keyword(p, lineEnd, "Tr"))
+			{
+				p += 2;
+				material.dissolve = 1.0f - parse_float(p, lineEnd, 0.0);
+			}
+			else if (is_keyword(p, lineEnd, "map_Kd"))
+			{
+				material.diffuseTexture = rest_of_line(p, lineEnd, 6);
+			}
+			else if (is_keyword(p, lineEnd, "map_d"))
+			{
+				material.alphaTexture = rest_of_line(p, lineEnd, 5);
+			}
+		}
+
+		p = next;
+	}
+
+	return true;
+}
+
+std::string vkobj::find_material_library(const char* filename, const char* data, size_t size)
+{
+	const char* fileEnd = data + size;
+	const char* p = data;
+
+	while (p < fileEnd)
+	{
+		const char* lineEnd = static_cast<const char*>(memchr(p, '\n', fileEnd - p));
+		if (lineEnd == nullptr)
+		{
+			lineEnd = fileEnd;
+		}
+
+		const char* start = skip_space(p, lineEnd);
+		if (is_keyword(start, lineEnd, "mtllib"))
+		{
+			// Library paths are relative to the OBJ
+			const std::string path(filename);
+			const size_t slash = path.find_last_of("/\\");
+			const std::string directory = slash == std::string::npos ? std::string() : path.substr(0, slash + 1);
+
+			return directory + rest_of_line(start, lineEnd, 6);
+		}
+
+		p = lineEnd + 1;
+	}
+
+	return std::string();
+}
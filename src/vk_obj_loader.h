@@ -0,0 +1,70 @@
+#pragma once
+
+#include "vk_mesh.h"
+
+#include <functional>
+#include <string>
+#include <vector>
+
+// A material of an OBJ, with the properties from its material library (.mtl) the renderer cares about
+struct ObjMaterial {
+	std::string name;
+	glm::vec3 diffuse{ 1.0f };
+	float dissolve{ 1.0f };			// Opacity, "d" in the library
+	std::string diffuseTexture;		// map_Kd
+	std::string alphaTexture;		// map_d, makes the material alpha tested
+};
+
+// Consecutive triangles of an OBJ that use the same material, as a usemtl leaves them
+struct ObjTriangleRun {
+	size_t firstTriangle;
+	size_t triangleCount;
+	uint32_t material;		// Index into the materials of the file, numbered as load_obj numbers them
+};
+
+// Where vkobj::stream_obj writes its vertices. Batches are written in place into memory the target hands out,
+// so the converted vertices never exist anywhere else
+struct ObjStreamTarget {
+	// Vertices per batch. Every batch but the last is full
+	size_t batchVertexCount{ 0 };
+
+	// Called once before parsing with an upper bound on the number of vertices. Returning false aborts the load
+	std::function<bool(size_t maxVertexCount)> begin;
+
+	// Memory for the next batch, room for batchVertexCount vertices. Returning null aborts the load
+	std::function<Vertex*()> acquire_batch;
+
+	// The batch from the last acquire_batch now holds count vertices. Returning false aborts the load
+	std::function<bool(size_t count)> submit_batch;
+
+	// Called once after the last batch with the materials, filled in from the library as load_obj fills them, and the
+	// runs of triangles using each in file order. Optional. Returning false aborts the load
+	std::function<bool(std::vector<ObjMaterial>& materials, const std::vector<ObjTriangleRun>& runs)> finish;
+};
+
+namespace vkobj {
+
+	// Load a Wavefront OBJ file into a flat triangle list (3 vertices per triangle).
+	// The file is memory mapped and parsed in parallel chunks. The output matches what tinyobj produced for the same file.
+	// outTriangleMaterials gets one index into outMaterials per triangle. Materials are listed in order of first use,
+	// faces before any usemtl use an unnamed material, and names the library doesn't define keep default properties
+	bool load_obj(const char* filename, std::vector<Vertex>& outVertices,
+		std::vector<uint32_t>* outTriangleMaterials = nullptr, std::vector<ObjMaterial>* outMaterials = nullptr);
+
+	// Load an OBJ without ever holding its whole vertex output. The file is parsed a few MB of text at a time and the
+	// vertices are written straight into the target's batches, in the same order and with the same values as load_obj.
+	// Positions, normals and uvs are still kept whole, faces may only reference ones above them as the format requires.
+	// Materials go to the target's finish as runs, the triangles stay in file order. outBounds gets the bounds of every
+	// position in the file
+	bool stream_obj(const char* filename, const ObjStreamTarget& target, AABB& outBounds);
+
+	// Upper bound on the vertices load_obj produces for an OBJ in memory, from the corner count of every face
+	size_t count_obj_vertices(const char* data, size_t size);
+
+	// Parse the newmtl blocks of a material library. Properties the renderer doesn't use are skipped
+	bool load_mtl(const char* filename, std::vector<ObjMaterial>& outMaterials);
+
+	// Path of the first material library (mtllib) an OBJ references, relative to the OBJ's directory. Empty if there is none
+	std::string find_material_library(const char* filename, const char* data, size_t size);
+
+}
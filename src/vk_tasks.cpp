@@ -0,0 +1,159 @@
+#include "vk_tasks.h"
+
+#include <algorithm>
+#include <condition_variable>
+#include <deque>
+#include <iomanip>
+#include <iostream>
+#include <mutex>
+#include <thread>
+
+namespace {
+
+	// Width of the bars in the timeline, the whole run spans this many characters
+	constexpr int TIMELINE_COLUMNS = 48;
+
+}
+
+TaskGraph::TaskId TaskGraph::add(const std::string& name, std::function<void()>&& function, std::initializer_list<TaskId> dependencies)
+{
+	return add(name, std::move(function), std::vector<TaskId>(dependencies));
+}
+
+TaskGraph::TaskId TaskGraph::add(const std::string& name, std::function<void()>&& function, const std::vector<TaskId>& dependencies)
+{
+	const TaskId id = static_cast<TaskId>(_tasks.size());
+
+	Task task;
+	task.name = name;
+	task.function = std::move(function);
+	task.dependencyCount = static_cast<uint32_t>(dependencies.size());
+	_tasks.push_back(std::move(task));
+
+	for (TaskId dependency : dependencies)
+	{
+		_tasks[dependency].dependents.push_back(id);
+	}
+
+	return id;
+}
+
+void TaskGraph::run(uint32_t threadCount)
+{
+	if (_tasks.empty())
+	{
+		return;
+	}
+
+	if (threadCount == 0)
+	{
+		threadCount = std::max(1u, std::thread::hardware_concurrency());
+	}
+	_threadCount = std::min(threadCount, static_cast<uint32_t>(_tasks.size()));
+
+	std::mutex mutex;
+	std::condition_variable wake;
+
+	// Tasks start in the order they were added once their dependencies are done
+	std::deque<TaskId> ready;
+	std::vector<uint32_t> remaining(_tasks.size());
+	for (TaskId id = 0; id < _tasks.size(); id++)
+	{
+		remaining[id] = _tasks[id].dependencyCount;
+		if (remaining[id] == 0)
+		{
+			ready.push_back(id);
+		}
+	}
+	size_t finished = 0;
+
+	const Clock::time_point start = Clock::now();
+	auto elapsed_ms = [start]() {
+		return std::chrono::duration<double, std::milli>(Clock::now() - start).count();
+	};
+
+	auto worker = [&](uint32_t thread) {
+		std::unique_lock<std::mutex> lock(mutex);
+		while (true)
+		{
+			wake.wait(lock, [&]() { return !ready.empty() || finished == _tasks.size(); });
+			if (ready.empty())
+			{
+				return;
+			}
+
+			Task& task = _tasks[ready.front()];
+			ready.pop_front();
+
+			// The task runs without the lock, only the scheduling state is shared
+			lock.unlock();
+			task.thread = thread;
+			task.startMs = elapsed_ms();
+			task.function();
+			task.endMs = elapsed_ms();
+			lock.lock();
+
+			finished++;
+			for (TaskId dependent : task.dependents)
+			{
+				if (--remaining[dependent] == 0)
+				{
+					ready.push_back(dependent);
+				}
+			}
+			wake.notify_all();
+		}
+	};
+
+	std::vector<std::thread> threads;
+	threads.reserve(_threadCount - 1);
+	for (uint32_t thread = 1; thread < _threadCount; thread++)
+	{
+		threads.emplace_back(worker, thread);
+	}
+
+	// The calling thread works too
+	worker(0);
+
+	for (std::thread& thread : threads)
+	{
+		thread.join();
+	}
+
+	_wallMs = elapsed_ms();
+}
+
+void TaskGraph::print_timeline(const char* title) const
+{
+	size_t nameWidth = 4;
+	double sumMs = 0.0;
+	for (const Task& task : _tasks)
+	{
+		nameWidth = std::max(nameWidth, task.name.size());
+		sumMs += task.endMs - task.startMs;
+	}
+
+	std::cout << title << ", " << _tasks.size() << " tasks on " << _threadCount << " threads" << std::endl;
+	std::cout << std::fixed << std::setprecision(1);
+
+	for (const Task& task : _tasks)
+	{
+		// Bars share one time axis, so tasks that overlapped show up in the same columns
+		const double scale = _wallMs > 0.0 ? TIMELINE_COLUMNS / _wallMs : 0.0;
+		const int first = std::min(TIMELINE_COLUMNS - 1, static_cast<int>(task.startMs * scale));
+		const int last = std::max(first + 1, std::min(TIMELINE_COLUMNS, static_cast<int>(task.endMs * scale + 0.5)));
+
+		std::string bar(TIMELINE_COLUMNS, '.');
+		std::fill(bar.begin() + first, bar.begin() + last, '#');
+
+		std::cout << "  " << std::left << std::setw(static_cast<int>(nameWidth)) << task.name << std::right
+			<< "  thread " << std::setw(2) << task.thread
+			<< std::setw(9) << task.startMs << " ms -" << std::setw(9) << task.endMs << " ms  |" << bar << "|" << std::endl;
+	}
+
+	// The sum is how long the tasks would have taken one after another
+	std::cout << "  sum of tasks " << sumMs << " ms, wall " << _wallMs << " ms, "
+		<< std::setprecision(2) << (_wallMs > 0.0 ? sumMs / _wallMs : 1.0) << "x" << std::endl;
+
+	std::cout << std::defaultfloat << std::setprecision(6);
+}
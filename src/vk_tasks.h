@@ -0,0 +1,45 @@
+#pragma once
+
+#include <chrono>
+#include <cstdint>
+#include <functional>
+#include <initializer_list>
+#include <string>
+#include <vector>
+
+// A set of tasks with dependencies, run once on a pool of threads. A task starts as soon as every task it depends on
+// has finished. Tasks that touch the same state without a dependency between them need their own synchronization
+class TaskGraph {
+public:
+	using TaskId = uint32_t;
+
+	// Dependencies must have been added before the task that waits on them, so the graph can't have cycles
+	TaskId add(const std::string& name, std::function<void()>&& function, std::initializer_list<TaskId> dependencies = {});
+
+	// Same, for dependencies only known at runtime, such as one task per asset
+	TaskId add(const std::string& name, std::function<void()>&& function, const std::vector<TaskId>& dependencies);
+
+	// Run every task on up to threadCount threads, the calling thread included, and return when all have finished.
+	// 0 uses one thread per core
+	void run(uint32_t threadCount = 0);
+
+	// When each task ran relative to the start of run(), and how much of the sum of task times the threads overlapped
+	void print_timeline(const char* title) const;
+
+private:
+	using Clock = std::chrono::high_resolution_clock;
+
+	struct Task {
+		std::string name;
+		std::function<void()> function;
+		std::vector<TaskId> dependents;
+		uint32_t dependencyCount{ 0 };
+		uint32_t thread{ 0 };
+		double startMs{ 0.0 };
+		double endMs{ 0.0 };
+	};
+
+	std::vector<Task> _tasks;
+	uint32_t _threadCount{ 0 };
+	double _wallMs{ 0.0 };
+};
@@ -1,111 +1,548 @@
 #include <vk_textures.h>
+#include "vk_block_compression.h"
+#include "vk_ktx2.h"
+#include "vk_mapped_file.h"
+#include "vk_mesh_cache.h"
+
+#include <algorithm>
+#include <cmath>
+#include <cstdlib>
+#include <fstream>
 #include <iostream>
+#include <thread>
 
 #include <vk_initializers.h>
 
 #define STB_IMAGE_IMPLEMENTATION
 #include <stb_image.h>
 
-bool vkutil::load_image_from_file(VulkanEngine& engine, const char* file, AllocatedImage& outImage)
+namespace {
+
+	// Rows of a mip level each thread filters at least, smaller levels stay on one thread
+	constexpr uint32_t MIP_ROWS_PER_THREAD = 64;
+
+	// sRGB to 12 bit linear and back. Averaging has to happen in linear space or mips come out too dark
+	struct SrgbTables {
+		uint16_t toLinear[256];
+		uint8_t fromLinear[4096];
+
+		SrgbTables()
+		{
+			for (int i = 0; i < 256; i++)
+			{
+				const float c = i / 255.0f;
+				const float linear = c <= 0.04045f ? c / 12.92f : std::pow((c + 0.055f) / 1.055f, 2.4f);
+				toLinear[i] = static_cast<uint16_t>(linear * 4095.0f + 0.5f);
+			}
+			for (int i = 0; i < 4096; i++)
+			{
+				const float linear = i / 4095.0f;
+				const float c = linear <= 0.0031308f ? linear * 12.92f : 1.055f * std::pow(linear, 1.0f / 2.4f) - 0.055f;
+				fromLinear[i] = static_cast<uint8_t>(std::min(255.0f, c * 255.0f + 0.5f));
+			}
+		}
+	};
+
+	const SrgbTables& srgb_tables()
+	{
+		static const SrgbTables tables;
+		return tables;
+	}
+
+	// 2x2 box filter of rows [firstRow, endRow) of the next level. Odd edges repeat their last texel
+	void downsample_rows(const unsigned char* source, uint32_t sourceWidth, uint32_t sourceHeight,
+		unsigned char* destination, uint32_t destinationWidth, uint32_t firstRow, uint32_t endRow)
+	{
+		const SrgbTables& tables = srgb_tables();
+
+		for (uint32_t y = firstRow; y < endRow; y++)
+		{
+			const unsigned char* row0 = source + static_cast<size_t>(std::min(y * 2, sourceHeight - 1)) * sourceWidth * 4;
+			const unsigned char* row1 = source + static_cast<size_t>(std::min(y * 2 + 1, sourceHeight - 1)) * sourceWidth * 4;
+			unsigned char* out = destination + static_cast<size_t>(y) * destinationWidth * 4;
+
+			for (uint32_t x = 0; x < destinationWidth; x++)
+			{
+				const uint32_t x0 = std::min(x * 2, sourceWidth - 1) * 4;
+				const uint32_t x1 = std::min(x * 2 + 1, sourceWidth - 1) * 4;
+
+				for (uint32_t c = 0; c < 3; c++)
+				{
+					const uint32_t sum = tables.toLinear[row0[x0 + c]] + tables.toLinear[row0[x1 + c]] +
+						tables.toLinear[row1[x0 + c]] + tables.toLinear[row1[x1 + c]];
+					out[x * 4 + c] = tables.fromLinear[(sum + 2) >> 2];
+				}
+
+				// Alpha is linear already
+				out[x * 4 + 3] = static_cast<unsigned char>((row0[x0 + 3] + row0[x1 + 3] + row1[x0 + 3] + row1[x1 + 3] + 2) >> 2);
+			}
+		}
+	}
+
+}
+
+std::vector<std::vector<uint32_t>> vkutil::pack_texture_arrays(const std::vector<const DecodedImage*>& images, uint32_t maxLayers)
 {
-	int texWidth, texHeight, texChannels;
+	std::vector<std::vector<uint32_t>> groups;
+	for (uint32_t i = 0; i < images.size(); i++)
+	{
+		const DecodedImage& image = *images[i];
+
+		// A handful of textures at most, a linear search over the open groups is plenty
+		auto group = std::find_if(groups.begin(), groups.end(), [&](const std::vector<uint32_t>& g) {
+			const DecodedImage& first = *images[g[0]];
+			return g.size() < maxLayers && first.format == image.format && first.width == image.width &&
+				first.height == image.height && first.mipLevels == image.mipLevels;
+		});
 
-	stbi_uc* pixels = stbi_load(file, &texWidth, &texHeight, &texChannels, STBI_rgb_alpha);
+		if (group == groups.end())
+		{
+			groups.push_back({ i });
+		}
+		else
+		{
+			group->push_back(i);
+		}
+	}
+	return groups;
+}
 
-	if (!pixels) {
-		std::cout << "Failed to load texture file " << file << std::endl;
+uint32_t vkutil::mip_level_count(uint32_t width, uint32_t height)
+{
+	uint32_t levels = 1;
+	for (uint32_t size = std::max(width, height); size > 1; size /= 2)
+	{
+		levels++;
+	}
+	return levels;
+}
+
+bool vkutil::supports_linear_blit(VkPhysicalDevice gpu, VkFormat format)
+{
+	VkFormatProperties properties;
+	vkGetPhysicalDeviceFormatProperties(gpu, format, &properties);
+
+	const VkFormatFeatureFlags required = VK_FORMAT_FEATURE_BLIT_SRC_BIT | VK_FORMAT_FEATURE_BLIT_DST_BIT |
+		VK_FORMAT_FEATURE_SAMPLED_IMAGE_FILTER_LINEAR_BIT;
+	return (properties.optimalTilingFeatures & required) == required;
+}
+
+void vkutil::generate_mipmaps(DecodedImage& image)
+{
+	const uint32_t levelCount = mip_level_count(image.width, image.height);
+	if (image.format != VK_FORMAT_R8G8B8A8_SRGB || image.mipLevels == levelCount)
+	{
+		return;
+	}
+
+	// Every level after the first, one after another
+	size_t mipsSize = 0;
+	for (uint32_t level = 1, width = image.width, height = image.height; level < levelCount; level++)
+	{
+		width = std::max(1u, width / 2);
+		height = std::max(1u, height / 2);
+		mipsSize += static_cast<size_t>(width) * height * 4;
+	}
+	image.mips.resize(mipsSize);
+
+	const uint32_t hardwareThreads = std::max(1u, std::thread::hardware_concurrency());
+
+	const unsigned char* source = image.pixels.get();
+	unsigned char* destination = image.mips.data();
+	uint32_t width = image.width;
+	uint32_t height = image.height;
+
+	// Levels depend on the one above, the rows within a level are split between threads
+	for (uint32_t level = 1; level < levelCount; level++)
+	{
+		const uint32_t nextWidth = std::max(1u, width / 2);
+		const uint32_t nextHeight = std::max(1u, height / 2);
+
+		const uint32_t threadCount = std::min(hardwareThreads, std::max(1u, nextHeight / MIP_ROWS_PER_THREAD));
+		const uint32_t rowsPerThread = (nextHeight + threadCount - 1) / threadCount;
+
+		std::vector<std::thread> threads;
+		for (uint32_t thread = 1; thread < threadCount; thread++)
+		{
+			const uint32_t firstRow = std::min(nextHeight, thread * rowsPerThread);
+			const uint32_t endRow = std::min(nextHeight, firstRow + rowsPerThread);
+			threads.emplace_back(downsample_rows, source, width, height, destination, nextWidth, firstRow, endRow);
+		}
+
+		// The calling thread works too
+		downsample_rows(source, width, height, destination, nextWidth, 0, std::min(nextHeight, rowsPerThread));
+
+		for (std::thread& thread : threads)
+		{
+			thread.join();
+		}
+
+		source = destination;
+		destination += static_cast<size_t>(nextWidth) * nextHeight * 4;
+		width = nextWidth;
+		height = nextHeight;
+	}
+
+	image.mipLevels = levelCount;
+}
+
+size_t vkutil::level_size(VkFormat format, uint32_t width, uint32_t height)
+{
+	vkbc::BlockFormat blockFormat;
+	if (vkbc::from_vk_format(format, blockFormat))
+	{
+		return vkbc::level_size(blockFormat, width, height);
+	}
+	return static_cast<size_t>(width) * height * 4;
+}
+
+bool vkutil::supports_sampled_format(VkPhysicalDevice gpu, VkFormat format)
+{
+	VkFormatProperties properties;
+	vkGetPhysicalDeviceFormatProperties(gpu, format, &properties);
+
+	return (properties.optimalTilingFeatures & VK_FORMAT_FEATURE_SAMPLED_IMAGE_BIT) != 0;
+}
+
+uint32_t vkutil::uploaded_level_count(const DecodedImage& image)
+{
+	return image.format == VK_FORMAT_R8G8B8A8_SRGB ? mip_level_count(image.width, image.height) : image.mipLevels;
+}
+
+std::string vkutil::ktx2_path(const std::string& file)
+{
+	const size_t extension = file.find_last_of('.');
+	return (extension == std::string::npos ? file : file.substr(0, extension)) + ".ktx2";
+}
+
+bool vkutil::fingerprint_file(const char* file, uint64_t& outSize, uint64_t& outHash)
+{
+	MappedFile mapped;
+	if (!mapped.open(file))
+	{
 		return false;
 	}
 
-	void* pixel_ptr = pixels;
-	VkDeviceSize imageSize = texWidth * texHeight * 4;
+	outSize = mapped.size();
+	outHash = vkcache::hash_memory(mapped.data(), mapped.size());
+	return true;
+}
 
-	VkFormat image_format = VK_FORMAT_R8G8B8A8_SRGB;
+bool vkutil::ktx2_is_current(const std::string& compressed, const std::string& source)
+{
+	uint64_t storedSize;
+	uint64_t storedHash;
+	if (!vkktx::read_source(compressed.c_str(), storedSize, storedHash))
+	{
+		// No file at all is the usual case, only one without a fingerprint is worth mentioning
+		if (std::ifstream(compressed).good())
+		{
+			std::cout << compressed << " doesn't say what it was encoded from, loading " << source << " instead" << std::endl;
+		}
+		return false;
+	}
 
-	AllocatedBuffer stagingBuffer = engine.create_buffer(imageSize, VK_BUFFER_USAGE_TRANSFER_SRC_BIT, VMA_MEMORY_USAGE_CPU_ONLY);
+	// Without the source there is nothing it can be out of date with
+	uint64_t sourceSize;
+	uint64_t sourceHash;
+	if (!fingerprint_file(source.c_str(), sourceSize, sourceHash))
+	{
+		return true;
+	}
 
-	void* data;
-	vmaMapMemory(engine._allocator, stagingBuffer._allocation, &data);
+	if (sourceSize != storedSize || sourceHash != storedHash)
+	{
+		std::cout << compressed << " is out of date with " << source << ", loading that instead. Run vkbench --encode-textures to update it" << std::endl;
+		return false;
+	}
+	return true;
+}
 
-	memcpy(data, pixel_ptr, static_cast<size_t>(imageSize));
+bool vkutil::transcode_to_rgba8(DecodedImage& image)
+{
+	vkbc::BlockFormat blockFormat;
+	if (!vkbc::from_vk_format(image.format, blockFormat))
+	{
+		return image.format == VK_FORMAT_R8G8B8A8_SRGB;
+	}
 
-	vmaUnmapMemory(engine._allocator, stagingBuffer._allocation);
+	// Same level layout as a decoded PNG with its mips: level 0 on its own, the rest one after another
+	std::vector<unsigned char> mips;
+	std::unique_ptr<unsigned char, void(*)(void*)> pixels{ nullptr, nullptr };
+
+	const unsigned char* blocks = image.pixels.get();
+	uint32_t width = image.width;
+	uint32_t height = image.height;
+	for (uint32_t level = 0; level < image.mipLevels; level++)
+	{
+		const size_t rgbaSize = static_cast<size_t>(width) * height * 4;
+		unsigned char* rgba;
+		if (level == 0)
+		{
+			pixels = std::unique_ptr<unsigned char, void(*)(void*)>(static_cast<unsigned char*>(malloc(rgbaSize)), free);
+			rgba = pixels.get();
+		}
+		else
+		{
+			mips.resize(mips.size() + rgbaSize);
+			rgba = mips.data() + mips.size() - rgbaSize;
+		}
+
+		vkbc::decode(blockFormat, blocks, width, height, rgba);
+
+		blocks = (level == 0 ? image.mips.data() : blocks + vkbc::level_size(blockFormat, width, height));
+		width = std::max(1u, width / 2);
+		height = std::max(1u, height / 2);
+	}
 
-	stbi_image_free(pixels);
+	std::cout << "Transcoded " << image.file << " from " << vkbc::format_name(blockFormat) << " to RGBA8, the GPU can't sample it" << std::endl;
 
-	VkExtent3D imageExtent;
-	imageExtent.width = static_cast<uint32_t>(texWidth);
-	imageExtent.height = static_cast<uint32_t>(texHeight);
-	imageExtent.depth = 1;
+	image.pixels = std::move(pixels);
+	image.mips = std::move(mips);
+	image.format = VK_FORMAT_R8G8B8A8_SRGB;
+	return true;
+}
 
-	VkImageCreateInfo dimg_info = vkinit::image_create_info(image_format, VK_IMAGE_USAGE_SAMPLED_BIT | VK_IMAGE_USAGE_TRANSFER_DST_BIT, imageExtent);
+bool vkutil::decode_image_from_file(const char* file, DecodedImage& outImage)
+{
+	const std::string path = file;
+	if (path.size() >= 5 && path.compare(path.size() - 5, 5, ".ktx2") == 0)
+	{
+		vkktx::Texture texture;
+		if (!vkktx::read(file, texture))
+		{
+			return false;
+		}
+
+		// Level 0 apart from the others, the same as decoded pixels
+		unsigned char* pixels = static_cast<unsigned char*>(malloc(texture.levelSizes[0]));
+		memcpy(pixels, texture.data.data(), texture.levelSizes[0]);
+
+		outImage.width = texture.width;
+		outImage.height = texture.height;
+		outImage.format = texture.format;
+		outImage.pixels = std::unique_ptr<unsigned char, void(*)(void*)>(pixels, free);
+		outImage.file = file;
+		outImage.mipLevels = static_cast<uint32_t>(texture.levelSizes.size());
+		outImage.mips.assign(texture.data.begin() + texture.levelSizes[0], texture.data.end());
+		return true;
+	}
 
-	AllocatedImage newImage;
+	int texWidth, texHeight, texChannels;
 
-	VmaAllocationCreateInfo dimg_allocinfo = {};
-	dimg_allocinfo.usage = VMA_MEMORY_USAGE_GPU_ONLY;
+	stbi_uc* pixels = stbi_load(file, &texWidth, &texHeight, &texChannels, STBI_rgb_alpha);
 
-	// Allocate and create the image
-	vmaCreateImage(engine._allocator, &dimg_info, &dimg_allocinfo, &newImage._image, &newImage._allocation, nullptr);
+	if (!pixels) {
+		std::cout << "Failed to load texture file " << file << std::endl;
+		return false;
+	}
 
-	// Transition image to transfer-receiver	
-	engine.immediate_submit([&](VkCommandBuffer cmd) {
-		VkImageSubresourceRange range;
-		range.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
-		range.baseMipLevel = 0;
-		range.levelCount = 1;
-		range.baseArrayLayer = 0;
-		range.layerCount = 1;
+	outImage.width = static_cast<uint32_t>(texWidth);
+	outImage.height = static_cast<uint32_t>(texHeight);
+	outImage.format = VK_FORMAT_R8G8B8A8_SRGB;
+	outImage.pixels = std::unique_ptr<unsigned char, void(*)(void*)>(pixels, stbi_image_free);
+	outImage.file = file;
+	outImage.mipLevels = 1;
+	outImage.mips.clear();
+	return true;
+}
 
-		VkImageMemoryBarrier imageBarrier_toTransfer = {};
-		imageBarrier_toTransfer.sType = VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER;
+bool vkutil::load_image_from_file(VulkanEngine& engine, const char* file, AllocatedImage& outImage, UploadBatch& batch)
+{
+	DecodedImage image;
+	if (!decode_image_from_file(file, image))
+	{
+		return false;
+	}
 
-		imageBarrier_toTransfer.oldLayout = VK_IMAGE_LAYOUT_UNDEFINED;
-		imageBarrier_toTransfer.newLayout = VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL;
-		imageBarrier_toTransfer.image = newImage._image;
-		imageBarrier_toTransfer.subresourceRange = range;
+	return upload_image(engine, image, outImage, batch);
+}
 
-		imageBarrier_toTransfer.srcAccessMask = 0;
-		imageBarrier_toTransfer.dstAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
+bool vkutil::upload_image(VulkanEngine& engine, DecodedImage& image, AllocatedImage& outImage, UploadBatch& batch)
+{
+	DecodedImage* layers[] = { &image };
+	return upload_image_array(engine, layers, 1, outImage, batch);
+}
 
-		// Barrier the image into the transfer-receive layout
-		vkCmdPipelineBarrier(cmd, VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT, VK_PIPELINE_STAGE_TRANSFER_BIT, 0, 0, nullptr, 0, nullptr, 1, &imageBarrier_toTransfer);
+bool vkutil::upload_image_array(VulkanEngine& engine, DecodedImage* const* layers, uint32_t layerCount, AllocatedImage& outImage, UploadBatch& batch)
+{
+	// Block compressed images go up as they are if the GPU can sample them
+	for (uint32_t layer = 0; layer < layerCount; layer++)
+	{
+		DecodedImage& image = *layers[layer];
+		if (!supports_sampled_format(engine._chosenGPU, image.format) && !transcode_to_rgba8(image))
+		{
+			std::cout << "No way to upload " << image.file << ", format " << image.format << " is unsupported" << std::endl;
+			return false;
+		}
+	}
 
-		VkBufferImageCopy copyRegion = {};
-		copyRegion.bufferOffset = 0;
-		copyRegion.bufferRowLength = 0;
-		copyRegion.bufferImageHeight = 0;
+	const DecodedImage& first = *layers[0];
+	VkFormat image_format = first.format;
+
+	// Host copies write every level straight from the decoded pixels, no staging and no submit
+	const bool hostCopy = engine._hostImageCopy.supports(image_format, VK_IMAGE_USAGE_SAMPLED_BIT);
+
+	// Without linear blits on the upload queue the chain is filtered here instead. Layers share one decision, a blit
+	// covers all of them
+	const uint32_t levelCount = uploaded_level_count(first);
+	const bool blitMipmaps = !hostCopy && first.mipLevels < levelCount && batch.can_blit() && supports_linear_blit(engine._chosenGPU, image_format);
+	for (uint32_t layer = 0; layer < layerCount; layer++)
+	{
+		if (layers[layer]->mipLevels < levelCount && !blitMipmaps)
+		{
+			generate_mipmaps(*layers[layer]);
+		}
+	}
 
-		copyRegion.imageSubresource.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
-		copyRegion.imageSubresource.mipLevel = 0;
-		copyRegion.imageSubresource.baseArrayLayer = 0;
-		copyRegion.imageSubresource.layerCount = 1;
-		copyRegion.imageExtent = imageExtent;
+	// Layers of an array share their size and levels, so each one stages the same number of bytes
+	for (uint32_t layer = 1; layer < layerCount; layer++)
+	{
+		const DecodedImage& image = *layers[layer];
+		if (image.format != image_format || image.width != first.width || image.height != first.height || image.mipLevels != first.mipLevels)
+		{
+			std::cout << "Can't put " << image.file << " in the same array as " << first.file << ", size, format or levels differ" << std::endl;
+			return false;
+		}
+	}
 
-		// Copy the buffer into the image
-		vkCmdCopyBufferToImage(cmd, stagingBuffer._buffer, newImage._image, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, 1, &copyRegion);
+	VkExtent3D imageExtent;
+	imageExtent.width = first.width;
+	imageExtent.height = first.height;
+	imageExtent.depth = 1;
 
-		VkImageMemoryBarrier imageBarrier_toReadable = imageBarrier_toTransfer;
+	VkImageUsageFlags usage = VK_IMAGE_USAGE_SAMPLED_BIT;
+	if (hostCopy)
+	{
+		usage |= HostImageCopy::usage_flag();
+	}
+	else
+	{
+		usage |= VK_IMAGE_USAGE_TRANSFER_DST_BIT;
+	}
+	if (blitMipmaps)
+	{
+		usage |= VK_IMAGE_USAGE_TRANSFER_SRC_BIT;
+	}
 
-		imageBarrier_toReadable.oldLayout = VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL;
-		imageBarrier_toReadable.newLayout = VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL;
+	VkImageCreateInfo dimg_info = vkinit::image_create_info(image_format, usage, imageExtent, levelCount, layerCount);
 
-		imageBarrier_toReadable.srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
-		imageBarrier_toReadable.dstAccessMask = VK_ACCESS_SHADER_READ_BIT;
+	AllocatedImage newImage;
 
-		// Barrier the image into the shader readable layout
-		vkCmdPipelineBarrier(cmd, VK_PIPELINE_STAGE_TRANSFER_BIT, VK_PIPELINE_STAGE_FRAGMENT_SHADER_BIT, 0, 0, nullptr, 0, nullptr, 1, &imageBarrier_toReadable);
-		});
+	VmaAllocationCreateInfo dimg_allocinfo = {};
+	dimg_allocinfo.usage = VMA_MEMORY_USAGE_GPU_ONLY;
 
+	// Allocate and create the image
+	vmaCreateImage(engine._allocator, &dimg_info, &dimg_allocinfo, &newImage._image, &newImage._allocation, nullptr);
 
 	engine._mainDeletionQueue.push_function([=]() {
 
 		vmaDestroyImage(engine._allocator, newImage._image, newImage._allocation);
 		});
 
-	vmaDestroyBuffer(engine._allocator, stagingBuffer._buffer, stagingBuffer._allocation);
+	VkImageSubresourceRange range;
+	range.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
+	range.baseMipLevel = 0;
+	range.levelCount = levelCount;
+	range.baseArrayLayer = 0;
+	range.layerCount = layerCount;
+
+	VkDeviceSize imageSize = level_size(image_format, first.width, first.height);
+	VkDeviceSize layerSize = imageSize + first.mips.size();
+
+	if (hostCopy)
+	{
+		// One region per level held in memory and layer, read where the decoder left them
+		std::vector<HostImageRegion> regions;
+		regions.reserve(first.mipLevels * layerCount);
+		for (uint32_t layer = 0; layer < layerCount; layer++)
+		{
+			const DecodedImage& image = *layers[layer];
+			VkExtent3D levelExtent = imageExtent;
+			const unsigned char* levelData = image.pixels.get();
+			for (uint32_t level = 0; level < image.mipLevels; level++)
+			{
+				regions.push_back({ levelData, level, layer, levelExtent });
+
+				levelData = (level == 0 ? image.mips.data() : levelData + level_size(image_format, levelExtent.width, levelExtent.height));
+				levelExtent.width = std::max(1u, levelExtent.width / 2);
+				levelExtent.height = std::max(1u, levelExtent.height / 2);
+			}
+		}
+
+		engine._hostImageCopy.copy_to_image(newImage._image, range, regions);
+	}
+	else
+	{
+		// Copy offsets into a buffer must be a multiple of the texel or block size
+		const StagingRegion staging = batch.allocate_staging(layerSize * layerCount, 16);
+
+		for (uint32_t layer = 0; layer < layerCount; layer++)
+		{
+			const DecodedImage& image = *layers[layer];
+			char* layerData = static_cast<char*>(staging.data) + layerSize * layer;
+
+			memcpy(layerData, image.pixels.get(), static_cast<size_t>(imageSize));
+			if (!image.mips.empty())
+			{
+				memcpy(layerData + imageSize, image.mips.data(), image.mips.size());
+			}
+		}
+
+		// One copy per level held in memory and layer, the levels of a layer follow each other in staging
+		std::vector<VkBufferImageCopy> copyRegions;
+		copyRegions.reserve(first.mipLevels * layerCount);
+		for (uint32_t layer = 0; layer < layerCount; layer++)
+		{
+			VkDeviceSize bufferOffset = layerSize * layer;
+			VkExtent3D levelExtent = imageExtent;
+			for (uint32_t level = 0; level < first.mipLevels; level++)
+			{
+				VkBufferImageCopy copyRegion = {};
+				copyRegion.bufferOffset = bufferOffset;
+				copyRegion.bufferRowLength = 0;
+				copyRegion.bufferImageHeight = 0;
+
+				copyRegion.imageSubresource.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
+				copyRegion.imageSubresource.mipLevel = level;
+				copyRegion.imageSubresource.baseArrayLayer = layer;
+				copyRegion.imageSubresource.layerCount = 1;
+				copyRegion.imageExtent = levelExtent;
+				copyRegions.push_back(copyRegion);
+
+				bufferOffset += level_size(image_format, levelExtent.width, levelExtent.height);
+				levelExtent.width = std::max(1u, levelExtent.width / 2);
+				levelExtent.height = std::max(1u, levelExtent.height / 2);
+			}
+		}
+
+		// The batch moves the image to the transfer layout, copies, and leaves it shader readable
+		UploadImageRelease release;
+		release.image = newImage._image;
+		release.range = range;
+		release.oldLayout = VK_IMAGE_LAYOUT_UNDEFINED;
+		release.newLayout = VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL;
+		release.dstAccess = VK_ACCESS_SHADER_READ_BIT;
+		release.dstStage = VK_PIPELINE_STAGE_FRAGMENT_SHADER_BIT;
+
+		batch.copy_buffer_to_image(staging, copyRegions.data(), static_cast<uint32_t>(copyRegions.size()), release);
+
+		if (blitMipmaps)
+		{
+			batch.generate_mipmaps(newImage._image, { first.width, first.height }, levelCount, layerCount);
+		}
+	}
 
-	std::cout << "Texture loaded succesfully " << file << std::endl;
+	const char* mipSource = image_format != VK_FORMAT_R8G8B8A8_SRGB ? "from the file" : (blitMipmaps ? "blitted" : "filtered on the CPU");
+	for (uint32_t layer = 0; layer < layerCount; layer++)
+	{
+		std::cout << "Texture loaded succesfully " << layers[layer]->file << ", " << levelCount << " mip levels " << mipSource;
+		if (layerCount > 1)
+		{
+			std::cout << ", layer " << layer << " of " << layerCount;
+		}
+		std::cout << (hostCopy ? ", copied from the host" : "") << std::endl;
+	}
 
 	outImage = newImage;
 	return true;
@@ -5,6 +5,55 @@
 
 namespace vkutil {
 
-	bool load_image_from_file(VulkanEngine& engine, const char* file, AllocatedImage& outImage);
+	// Decode an image file into RGBA8, or read the blocks and levels of a .ktx2 file as they are. Touches no engine
+	// state, so it can run on any thread
+	bool decode_image_from_file(const char* file, DecodedImage& outImage);
+
+	// Where vkbench --encode-textures writes the block compressed copy of an image file
+	std::string ktx2_path(const std::string& file);
+
+	// Size and content hash of a file, the fingerprint a KTX2 file keeps of the image it was encoded from
+	bool fingerprint_file(const char* file, uint64_t& outSize, uint64_t& outHash);
+
+	// True when the KTX2 file at compressed was encoded from source as it is now, or source is gone
+	bool ktx2_is_current(const std::string& compressed, const std::string& source);
+
+	// Bytes of one level of an RGBA8 or block compressed image
+	size_t level_size(VkFormat format, uint32_t width, uint32_t height);
+
+	bool supports_sampled_format(VkPhysicalDevice gpu, VkFormat format);
+
+	// Decode block compressed levels to RGBA8 on the CPU, for GPUs that can't sample the format. False for formats
+	// there is no decoder for
+	bool transcode_to_rgba8(DecodedImage& image);
+
+	// Levels upload_image gives an image: a full chain for RGBA8, the levels the file has for block compressed ones
+	uint32_t uploaded_level_count(const DecodedImage& image);
+
+	// Record the upload of decoded pixels and a full mip chain into batch. Levels the image doesn't hold yet are
+	// blitted on the GPU when the upload queue and format allow it, otherwise filtered on the CPU first.
+	// GPUs with host image copy get the pixels written right away instead, leaving batch alone
+	bool upload_image(VulkanEngine& engine, DecodedImage& image, AllocatedImage& outImage, UploadBatch& batch);
+
+	// Same as upload_image for several images packed as the layers of one array image. They must end up with the same
+	// format, size and levels, pack_texture_arrays groups them that way
+	bool upload_image_array(VulkanEngine& engine, DecodedImage* const* layers, uint32_t layerCount, AllocatedImage& outImage, UploadBatch& batch);
+
+	// Group images that can be layers of one array image: same format, size and levels held in memory. Each group
+	// holds the indices of up to maxLayers images, in the order they came in
+	std::vector<std::vector<uint32_t>> pack_texture_arrays(const std::vector<const DecodedImage*>& images, uint32_t maxLayers);
+
+	// Levels in a full mip chain down to 1x1
+	uint32_t mip_level_count(uint32_t width, uint32_t height);
+
+	// True if images of format can be blitted into each other with linear filtering
+	bool supports_linear_blit(VkPhysicalDevice gpu, VkFormat format);
+
+	// Fill image.mips with a box filtered chain. sRGB colors are averaged in linear space. Touches no engine state.
+	// Leaves block compressed images and complete chains alone
+	void generate_mipmaps(DecodedImage& image);
+
+	// Records the upload into batch. The image can be sampled once the batch's token has been reached
+	bool load_image_from_file(VulkanEngine& engine, const char* file, AllocatedImage& outImage, UploadBatch& batch);
 
 }
\ No newline at end of file
@@ -5,6 +5,25 @@
 #include <vulkan/vulkan.h>
 #include <vk_mem_alloc.h>
 
+#include <cstdint>
+#include <cstdlib>
+#include <iostream>
+#include <memory>
+#include <string>
+#include <vector>
+
+// A macro function that will immediately abort when an error occurs
+#define VK_CHECK(x)														\
+	do																	\
+	{																	\
+		VkResult err = x;												\
+		if (err)														\
+		{																\
+			std::cout <<"Detected Vulkan error: " << err << std::endl;	\
+			abort();													\
+		}																\
+	} while (0)
+
 //we will add our main reusable types here
 
 struct AllocatedBuffer
@@ -17,4 +36,18 @@ struct AllocatedImage
 {
 	VkImage _image;
 	VmaAllocation _allocation;
-};
\ No newline at end of file
+};
+
+// Texels decoded on the CPU, not yet uploaded. RGBA8 unless they came from a block compressed KTX2 file
+struct DecodedImage
+{
+	uint32_t width{ 0 };
+	uint32_t height{ 0 };
+	VkFormat format{ VK_FORMAT_R8G8B8A8_SRGB };
+	std::unique_ptr<unsigned char, void(*)(void*)> pixels{ nullptr, nullptr };
+	std::string file;
+
+	// Levels held in memory, pixels is level 0 and mips holds the rest one after another
+	uint32_t mipLevels{ 1 };
+	std::vector<unsigned char> mips;
+};
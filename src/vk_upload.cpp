@@ -0,0 +1,542 @@
+#include "vk_upload.h"
+
+#include <vk_initializers.h>
+
+#include <algorithm>
+
+namespace {
+
+	// Host visible buffer to copy from, mapped until it is destroyed
+	void* create_mapped_staging(VmaAllocator allocator, VkDeviceSize size, AllocatedBuffer& outBuffer)
+	{
+		VkBufferCreateInfo bufferInfo = {};
+		bufferInfo.sType = VK_STRUCTURE_TYPE_BUFFER_CREATE_INFO;
+		bufferInfo.pNext = nullptr;
+		bufferInfo.size = size;
+		bufferInfo.usage = VK_BUFFER_USAGE_TRANSFER_SRC_BIT;
+
+		VmaAllocationCreateInfo vmaallocInfo = {};
+		vmaallocInfo.usage = VMA_MEMORY_USAGE_CPU_ONLY;
+		vmaallocInfo.flags = VMA_ALLOCATION_CREATE_MAPPED_BIT;
+
+		VmaAllocationInfo allocationInfo;
+		VK_CHECK(vmaCreateBuffer(allocator, &bufferInfo, &vmaallocInfo,
+			&outBuffer._buffer,
+			&outBuffer._allocation,
+			&allocationInfo));
+
+		return allocationInfo.pMappedData;
+	}
+
+	VkDeviceSize align_up(VkDeviceSize value, VkDeviceSize alignment)
+	{
+		return (value + alignment - 1) / alignment * alignment;
+	}
+}
+
+void UploadService::init(VkDevice device, VmaAllocator allocator, VkQueue queue, uint32_t queueFamily, uint32_t graphicsQueueFamily, VkDeviceSize stagingSize)
+{
+	_device = device;
+	_allocator = allocator;
+	_queue = queue;
+	_queueFamily = queueFamily;
+	_graphicsQueueFamily = graphicsQueueFamily;
+
+	// Command buffers are recycled one by one as their uploads finish
+	VkCommandPoolCreateInfo poolInfo = vkinit::command_pool_create_info(_queueFamily, VK_COMMAND_POOL_CREATE_RESET_COMMAND_BUFFER_BIT);
+	VK_CHECK(vkCreateCommandPool(_device, &poolInfo, nullptr, &_commandPool));
+
+	VkSemaphoreTypeCreateInfo timelineInfo = {};
+	timelineInfo.sType = VK_STRUCTURE_TYPE_SEMAPHORE_TYPE_CREATE_INFO;
+	timelineInfo.pNext = nullptr;
+	timelineInfo.semaphoreType = VK_SEMAPHORE_TYPE_TIMELINE;
+	timelineInfo.initialValue = 0;
+
+	VkSemaphoreCreateInfo semaphoreInfo = vkinit::semaphore_create_info();
+	semaphoreInfo.pNext = &timelineInfo;
+	VK_CHECK(vkCreateSemaphore(_device, &semaphoreInfo, nullptr, &_timeline));
+
+	// One staging buffer for every upload, mapped once. CPU_ONLY memory is host coherent, so writes need no flush
+	_stagingSize = stagingSize;
+	_stagingData = static_cast<char*>(create_mapped_staging(_allocator, _stagingSize, _stagingBuffer));
+}
+
+void UploadService::cleanup()
+{
+	wait(_lastToken);
+	collect();
+
+	vmaDestroyBuffer(_allocator, _stagingBuffer._buffer, _stagingBuffer._allocation);
+	vkDestroySemaphore(_device, _timeline, nullptr);
+	vkDestroyCommandPool(_device, _commandPool, nullptr);
+}
+
+StagingRegion UploadService::allocate_staging(VkDeviceSize size, VkDeviceSize alignment)
+{
+	while (size <= _stagingSize)
+	{
+		const bool empty = _stagingRetires.empty() && !_stagingOpen;
+		if (empty)
+		{
+			_stagingHead = 0;
+			_stagingTail = 0;
+		}
+
+		VkDeviceSize offset = align_up(_stagingHead, alignment);
+		bool fits = false;
+		if (empty)
+		{
+			fits = true;
+		}
+		else if (_stagingHead >= _stagingTail)
+		{
+			// Free space after the head, then at the start of the buffer. The head must stay short of the tail
+			if (offset + size <= _stagingSize)
+			{
+				fits = true;
+			}
+			else if (size < _stagingTail)
+			{
+				offset = 0;
+				fits = true;
+			}
+		}
+		else
+		{
+			fits = offset + size < _stagingTail;
+		}
+
+		if (fits)
+		{
+			_stagingHead = offset + size;
+			_stagingOpen = true;
+			return StagingRegion{ _stagingBuffer._buffer, offset, _stagingData + offset };
+		}
+
+		// Nothing submitted is left to wait for, the ring is full of this submit's own allocations
+		if (_stagingRetires.empty())
+		{
+			break;
+		}
+
+		wait(_stagingRetires.front().token);
+		retire_staging();
+	}
+
+	AllocatedBuffer buffer;
+	void* data = create_mapped_staging(_allocator, size, buffer);
+	_stagingOversized.push_back(buffer);
+	_stagingOversizedCount++;
+
+	return StagingRegion{ buffer._buffer, 0, data };
+}
+
+void UploadService::retire_staging()
+{
+	while (!_stagingRetires.empty() && _stagingRetires.front().token <= _completedToken)
+	{
+		_stagingTail = _stagingRetires.front().end;
+		_stagingRetires.pop_front();
+	}
+}
+
+UploadToken UploadService::submit(std::function<void(VkCommandBuffer cmd)>&& function,
+	const std::vector<UploadBufferRelease>& buffers, const std::vector<UploadImageRelease>& images)
+{
+	collect();
+
+	VkCommandBuffer cmd;
+	if (!_freeCommandBuffers.empty())
+	{
+		cmd = _freeCommandBuffers.back();
+		_freeCommandBuffers.pop_back();
+	}
+	else
+	{
+		VkCommandBufferAllocateInfo allocInfo = vkinit::command_buffer_allocate_info(_commandPool, 1);
+		VK_CHECK(vkAllocateCommandBuffers(_device, &allocInfo, &cmd));
+	}
+
+	VkCommandBufferBeginInfo beginInfo = vkinit::command_buffer_begin_info(VK_COMMAND_BUFFER_USAGE_ONE_TIME_SUBMIT_BIT);
+	VK_CHECK(vkBeginCommandBuffer(cmd, &beginInfo));
+
+	function(cmd);
+
+	// Release barriers. On a shared queue family they only finish the layout transitions, the timeline
+	// semaphore already makes the writes visible to whoever waits on it
+	const uint32_t srcFamily = has_transfer_queue() ? _queueFamily : VK_QUEUE_FAMILY_IGNORED;
+	const uint32_t dstFamily = has_transfer_queue() ? _graphicsQueueFamily : VK_QUEUE_FAMILY_IGNORED;
+
+	PendingAcquire acquire;
+	acquire.dstStages = 0;
+
+	std::vector<VkBufferMemoryBarrier> bufferBarriers;
+	for (const UploadBufferRelease& release : buffers)
+	{
+		VkBufferMemoryBarrier barrier = {};
+		barrier.sType = VK_STRUCTURE_TYPE_BUFFER_MEMORY_BARRIER;
+		barrier.srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
+		barrier.dstAccessMask = 0;
+		barrier.srcQueueFamilyIndex = srcFamily;
+		barrier.dstQueueFamilyIndex = dstFamily;
+		barrier.buffer = release.buffer;
+		barrier.offset = 0;
+		barrier.size = VK_WHOLE_SIZE;
+		bufferBarriers.push_back(barrier);
+
+		// The acquire repeats the transfer with the graphics side's access
+		barrier.srcAccessMask = 0;
+		barrier.dstAccessMask = release.dstAccess;
+		acquire.buffers.push_back(barrier);
+		acquire.dstStages |= release.dstStage;
+	}
+
+	std::vector<VkImageMemoryBarrier> imageBarriers;
+	for (const UploadImageRelease& release : images)
+	{
+		VkImageMemoryBarrier barrier = {};
+		barrier.sType = VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER;
+		barrier.srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
+		barrier.dstAccessMask = 0;
+		barrier.oldLayout = release.oldLayout;
+		barrier.newLayout = release.newLayout;
+		barrier.srcQueueFamilyIndex = srcFamily;
+		barrier.dstQueueFamilyIndex = dstFamily;
+		barrier.image = release.image;
+		barrier.subresourceRange = release.range;
+		imageBarriers.push_back(barrier);
+
+		barrier.srcAccessMask = 0;
+		barrier.dstAccessMask = release.dstAccess;
+		acquire.images.push_back(barrier);
+		acquire.dstStages |= release.dstStage;
+	}
+
+	if (!bufferBarriers.empty() || !imageBarriers.empty())
+	{
+		vkCmdPipelineBarrier(cmd, VK_PIPELINE_STAGE_TRANSFER_BIT, VK_PIPELINE_STAGE_BOTTOM_OF_PIPE_BIT, 0, 0, nullptr,
+			static_cast<uint32_t>(bufferBarriers.size()), bufferBarriers.data(),
+			static_cast<uint32_t>(imageBarriers.size()), imageBarriers.data());
+	}
+
+	VK_CHECK(vkEndCommandBuffer(cmd));
+
+	const UploadToken token = ++_lastToken;
+
+	VkTimelineSemaphoreSubmitInfo timelineInfo = {};
+	timelineInfo.sType = VK_STRUCTURE_TYPE_TIMELINE_SEMAPHORE_SUBMIT_INFO;
+	timelineInfo.pNext = nullptr;
+	timelineInfo.signalSemaphoreValueCount = 1;
+	timelineInfo.pSignalSemaphoreValues = &token;
+
+	VkSubmitInfo submit = vkinit::submit_info(&cmd);
+	submit.pNext = &timelineInfo;
+	submit.signalSemaphoreCount = 1;
+	submit.pSignalSemaphores = &_timeline;
+
+	VK_CHECK(vkQueueSubmit(_queue, 1, &submit, VK_NULL_HANDLE));
+
+	_inFlight.push_back(InFlightUpload{ token, cmd });
+
+	// Everything allocated since the last submit is read by this one. While a batch is open its allocations
+	// can't be told apart from others, so they all stay open until the batch submits
+	if (_stagingOpen && _stagingHolds == 0)
+	{
+		_stagingRetires.push_back(StagingRetire{ token, _stagingHead });
+		_stagingOpen = false;
+	}
+
+	for (const AllocatedBuffer& buffer : _stagingOversized)
+	{
+		VmaAllocator allocator = _allocator;
+		on_complete(token, [=]() {
+			vmaDestroyBuffer(allocator, buffer._buffer, buffer._allocation);
+		});
+	}
+	_stagingOversized.clear();
+
+	// Only a separate queue family needs the graphics side to take ownership
+	if (has_transfer_queue() && (!acquire.buffers.empty() || !acquire.images.empty()))
+	{
+		acquire.token = token;
+		_pendingAcquires.push_back(std::move(acquire));
+	}
+
+	return token;
+}
+
+void UploadService::on_complete(UploadToken token, std::function<void()>&& function)
+{
+	_completionCallbacks.emplace_back(token, std::move(function));
+}
+
+void UploadService::collect()
+{
+	VK_CHECK(vkGetSemaphoreCounterValue(_device, _timeline, &_completedToken));
+
+	while (!_inFlight.empty() && _inFlight.front().token <= _completedToken)
+	{
+		VK_CHECK(vkResetCommandBuffer(_inFlight.front().cmd, 0));
+		_freeCommandBuffers.push_back(_inFlight.front().cmd);
+		_inFlight.pop_front();
+	}
+
+	retire_staging();
+
+	// Callbacks can be registered out of token order, run every finished one and keep the rest in order
+	std::vector<std::pair<UploadToken, std::function<void()>>> remaining;
+	for (auto& callback : _completionCallbacks)
+	{
+		if (callback.first <= _completedToken)
+		{
+			callback.second();
+		}
+		else
+		{
+			remaining.push_back(std::move(callback));
+		}
+	}
+	_completionCallbacks.swap(remaining);
+}
+
+bool UploadService::is_complete(UploadToken token)
+{
+	if (token <= _completedToken)
+	{
+		return true;
+	}
+
+	VK_CHECK(vkGetSemaphoreCounterValue(_device, _timeline, &_completedToken));
+	return token <= _completedToken;
+}
+
+void UploadService::wait(UploadToken token)
+{
+	if (is_complete(token))
+	{
+		return;
+	}
+
+	VkSemaphoreWaitInfo waitInfo = {};
+	waitInfo.sType = VK_STRUCTURE_TYPE_SEMAPHORE_WAIT_INFO;
+	waitInfo.pNext = nullptr;
+	waitInfo.semaphoreCount = 1;
+	waitInfo.pSemaphores = &_timeline;
+	waitInfo.pValues = &token;
+
+	VK_CHECK(vkWaitSemaphores(_device, &waitInfo, UINT64_MAX));
+	_completedToken = std::max(_completedToken, token);
+}
+
+void UploadService::record_acquires(VkCommandBuffer cmd, UploadToken token)
+{
+	std::vector<VkBufferMemoryBarrier> buffers;
+	std::vector<VkImageMemoryBarrier> images;
+	VkPipelineStageFlags dstStages = 0;
+
+	while (!_pendingAcquires.empty() && _pendingAcquires.front().token <= token)
+	{
+		const PendingAcquire& acquire = _pendingAcquires.front();
+		buffers.insert(buffers.end(), acquire.buffers.begin(), acquire.buffers.end());
+		images.insert(images.end(), acquire.images.begin(), acquire.images.end());
+		dstStages |= acquire.dstStages;
+		_pendingAcquires.pop_front();
+	}
+
+	if (buffers.empty() && images.empty())
+	{
+		return;
+	}
+
+	// One barrier for all of them, the semaphore wait already orders them after the releases
+	vkCmdPipelineBarrier(cmd, VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT, dstStages, 0, 0, nullptr,
+		static_cast<uint32_t>(buffers.size()), buffers.data(),
+		static_cast<uint32_t>(images.size()), images.data());
+}
+
+void UploadBatch::copy_buffer(const StagingRegion& source, VkDeviceSize sourceOffset, VkBuffer destination, VkDeviceSize destinationOffset, VkDeviceSize size)
+{
+	VkBufferCopy region;
+	region.srcOffset = source.offset + sourceOffset;
+	region.dstOffset = destinationOffset;
+	region.size = size;
+	_bufferCopies.push_back(BufferCopy{ source.buffer, destination, region });
+}
+
+void UploadBatch::release_buffer(const UploadBufferRelease& release)
+{
+	_bufferReleases.push_back(release);
+}
+
+void UploadBatch::copy_buffer_to_image(const StagingRegion& source, const VkBufferImageCopy* copies, uint32_t copyCount, const UploadImageRelease& release)
+{
+	ImageCopy copy{ source.buffer, release.image, std::vector<VkBufferImageCopy>(copies, copies + copyCount) };
+	for (VkBufferImageCopy& region : copy.regions)
+	{
+		region.bufferOffset += source.offset;
+	}
+	_imageCopies.push_back(std::move(copy));
+	_imageReleases.push_back(release);
+}
+
+void UploadBatch::generate_mipmaps(VkImage image, VkExtent2D extent, uint32_t levelCount, uint32_t layerCount)
+{
+	_mipChains.push_back({ image, extent, levelCount, layerCount });
+}
+
+void UploadBatch::on_complete(std::function<void()>&& function)
+{
+	_completionCallbacks.push_back(std::move(function));
+}
+
+UploadToken UploadBatch::submit()
+{
+	if (empty())
+	{
+		// Nothing was copied, so nothing is reading the memory anymore
+		for (std::function<void()>& callback : _completionCallbacks)
+		{
+			callback();
+		}
+		_completionCallbacks.clear();
+		return 0;
+	}
+
+	// Group copies by buffer pair so each pair is one command. The sort is stable to keep the copy order within a pair
+	std::stable_sort(_bufferCopies.begin(), _bufferCopies.end(), [](const BufferCopy& a, const BufferCopy& b) {
+		return a.source != b.source ? a.source < b.source : a.destination < b.destination;
+	});
+
+	std::vector<BufferCopy> bufferCopies;
+	bufferCopies.swap(_bufferCopies);
+	std::vector<ImageCopy> imageCopies;
+	imageCopies.swap(_imageCopies);
+
+	// Every image goes to the transfer layout in one barrier, whatever it held before is thrown away
+	std::vector<VkImageMemoryBarrier> toTransfer;
+	for (const UploadImageRelease& release : _imageReleases)
+	{
+		VkImageMemoryBarrier barrier = {};
+		barrier.sType = VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER;
+		barrier.srcAccessMask = 0;
+		barrier.dstAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
+		barrier.oldLayout = VK_IMAGE_LAYOUT_UNDEFINED;
+		barrier.newLayout = VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL;
+		barrier.srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+		barrier.dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+		barrier.image = release.image;
+		barrier.subresourceRange = release.range;
+		toTransfer.push_back(barrier);
+	}
+
+	std::vector<MipChain> mipChains;
+	mipChains.swap(_mipChains);
+
+	// The releases pick up from the transfer layout. Mip chains leave every level but the last as a blit source
+	std::vector<UploadImageRelease> imageReleases;
+	for (const UploadImageRelease& release : _imageReleases)
+	{
+		UploadImageRelease written = release;
+		written.oldLayout = VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL;
+
+		auto chain = std::find_if(mipChains.begin(), mipChains.end(), [&](const MipChain& c) { return c.image == release.image; });
+		if (chain != mipChains.end() && chain->levelCount > 1)
+		{
+			UploadImageRelease sources = release;
+			sources.oldLayout = VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL;
+			sources.range.baseMipLevel = 0;
+			sources.range.levelCount = chain->levelCount - 1;
+			imageReleases.push_back(sources);
+
+			written.range.baseMipLevel = chain->levelCount - 1;
+			written.range.levelCount = 1;
+		}
+
+		imageReleases.push_back(written);
+	}
+	_imageReleases.swap(imageReleases);
+
+	// Let the submit close the batch's staging allocations
+	_service._stagingHolds--;
+
+	const UploadToken token = _service.submit([&](VkCommandBuffer cmd) {
+		if (!toTransfer.empty())
+		{
+			vkCmdPipelineBarrier(cmd, VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT, VK_PIPELINE_STAGE_TRANSFER_BIT, 0, 0, nullptr, 0, nullptr,
+				static_cast<uint32_t>(toTransfer.size()), toTransfer.data());
+		}
+
+		std::vector<VkBufferCopy> regions;
+		for (size_t i = 0; i < bufferCopies.size();)
+		{
+			const BufferCopy& first = bufferCopies[i];
+			regions.clear();
+			for (; i < bufferCopies.size() && bufferCopies[i].source == first.source && bufferCopies[i].destination == first.destination; i++)
+			{
+				regions.push_back(bufferCopies[i].region);
+			}
+			vkCmdCopyBuffer(cmd, first.source, first.destination, static_cast<uint32_t>(regions.size()), regions.data());
+		}
+
+		for (const ImageCopy& copy : imageCopies)
+		{
+			vkCmdCopyBufferToImage(cmd, copy.source, copy.destination, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL,
+				static_cast<uint32_t>(copy.regions.size()), copy.regions.data());
+		}
+
+		// Each level is blitted from the one above once that one has been written, every layer in the same blit
+		for (const MipChain& chain : mipChains)
+		{
+			VkImageMemoryBarrier barrier = {};
+			barrier.sType = VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER;
+			barrier.srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
+			barrier.dstAccessMask = VK_ACCESS_TRANSFER_READ_BIT;
+			barrier.oldLayout = VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL;
+			barrier.newLayout = VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL;
+			barrier.srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+			barrier.dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+			barrier.image = chain.image;
+			barrier.subresourceRange.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
+			barrier.subresourceRange.levelCount = 1;
+			barrier.subresourceRange.baseArrayLayer = 0;
+			barrier.subresourceRange.layerCount = chain.layerCount;
+
+			int32_t width = static_cast<int32_t>(chain.extent.width);
+			int32_t height = static_cast<int32_t>(chain.extent.height);
+
+			for (uint32_t level = 1; level < chain.levelCount; level++)
+			{
+				barrier.subresourceRange.baseMipLevel = level - 1;
+				vkCmdPipelineBarrier(cmd, VK_PIPELINE_STAGE_TRANSFER_BIT, VK_PIPELINE_STAGE_TRANSFER_BIT, 0, 0, nullptr, 0, nullptr, 1, &barrier);
+
+				const int32_t nextWidth = std::max(1, width / 2);
+				const int32_t nextHeight = std::max(1, height / 2);
+
+				VkImageBlit blit = {};
+				blit.srcSubresource = { VK_IMAGE_ASPECT_COLOR_BIT, level - 1, 0, chain.layerCount };
+				blit.srcOffsets[1] = { width, height, 1 };
+				blit.dstSubresource = { VK_IMAGE_ASPECT_COLOR_BIT, level, 0, chain.layerCount };
+				blit.dstOffsets[1] = { nextWidth, nextHeight, 1 };
+
+				vkCmdBlitImage(cmd, chain.image, VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL, chain.image, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL,
+					1, &blit, VK_FILTER_LINEAR);
+
+				width = nextWidth;
+				height = nextHeight;
+			}
+		}
+	}, _bufferReleases, _imageReleases);
+
+	_service._stagingHolds++;
+
+	_bufferReleases.clear();
+	_imageReleases.clear();
+
+	for (std::function<void()>& callback : _completionCallbacks)
+	{
+		_service.on_complete(token, std::move(callback));
+	}
+	_completionCallbacks.clear();
+
+	return token;
+}
@@ -0,0 +1,212 @@
+#pragma once
+
+#include <vk_types.h>
+
+#include <cstdint>
+#include <deque>
+#include <functional>
+#include <utility>
+#include <vector>
+
+// Timeline semaphore value an upload signals once its commands have finished. Later tokens always finish after
+// earlier ones, and 0 counts as finished from the start
+using UploadToken = uint64_t;
+
+// A buffer an upload wrote, handed over to the graphics queue when uploads run on a different queue family
+struct UploadBufferRelease {
+	VkBuffer buffer;
+	VkAccessFlags dstAccess;			// How the graphics queue reads the buffer
+	VkPipelineStageFlags dstStage;		// Where the graphics queue first reads it
+};
+
+// An image an upload wrote. The layout transition happens as part of the handover
+struct UploadImageRelease {
+	VkImage image;
+	VkImageSubresourceRange range;
+	VkImageLayout oldLayout;
+	VkImageLayout newLayout;
+	VkAccessFlags dstAccess;
+	VkPipelineStageFlags dstStage;
+};
+
+// Part of the staging ring an upload copies from. data is mapped for as long as the service lives
+struct StagingRegion {
+	VkBuffer buffer;
+	VkDeviceSize offset;
+	void* data;
+};
+
+// Submits uploads on a dedicated transfer queue when the GPU has one, otherwise on the graphics queue.
+// Nothing waits on submit: every upload signals the next value of a timeline semaphore and callers keep it as a token.
+// Frames wait on the GPU for the tokens of what they draw instead of the CPU waiting for every copy
+class UploadService {
+public:
+	void init(VkDevice device, VmaAllocator allocator, VkQueue queue, uint32_t queueFamily, uint32_t graphicsQueueFamily, VkDeviceSize stagingSize);
+
+	// Wait for every upload, run the remaining completion callbacks and destroy the Vulkan objects
+	void cleanup();
+
+	// Staging memory for the next submit to copy from. It is reused once that upload finishes. Blocks only when
+	// the ring is full of unfinished uploads. Requests the ring can't hold get a buffer of their own
+	StagingRegion allocate_staging(VkDeviceSize size, VkDeviceSize alignment = 16);
+
+	// Record an upload into a fresh command buffer and submit it. The released resources get their barriers
+	// appended, with a queue family ownership transfer when uploads run on their own queue family
+	UploadToken submit(std::function<void(VkCommandBuffer cmd)>&& function,
+		const std::vector<UploadBufferRelease>& buffers = {}, const std::vector<UploadImageRelease>& images = {});
+
+	// Run function from a later collect() once the upload has finished. Used to free the memory an upload reads from
+	void on_complete(UploadToken token, std::function<void()>&& function);
+
+	// Recycle command buffers and run the callbacks of finished uploads. Never blocks
+	void collect();
+
+	bool is_complete(UploadToken token);
+
+	// Block until an upload has finished. Only for memory that has to be reused right away
+	void wait(UploadToken token);
+
+	// Record the graphics queue half of the ownership transfer for every upload up to token.
+	// The submission of cmd must wait on timeline() reaching token at acquire_stages()
+	void record_acquires(VkCommandBuffer cmd, UploadToken token);
+
+	// Stages the acquire barriers block, the wait stages for timeline()
+	VkPipelineStageFlags acquire_stages() const { return _acquireStages; }
+
+	VkSemaphore timeline() const { return _timeline; }
+
+	// True while an UploadBatch is open. Submits made meanwhile can't free their staging until the batch submits
+	bool staging_held() const { return _stagingHolds > 0; }
+
+	// Requests that didn't fit the ring and got a staging buffer of their own, since init
+	size_t oversized_staging_count() const { return _stagingOversizedCount; }
+
+	// Token of the latest submit, also the number of submits so far
+	UploadToken last_token() const { return _lastToken; }
+
+	// True when uploads run on their own queue family
+	bool has_transfer_queue() const { return _queueFamily != _graphicsQueueFamily; }
+
+	// True when uploads run on the graphics queue, transfer queues can't blit
+	bool can_blit() const { return !has_transfer_queue(); }
+
+private:
+	friend class UploadBatch;
+
+	struct InFlightUpload {
+		UploadToken token;
+		VkCommandBuffer cmd;
+	};
+
+	// Ring space up to end, free again once token has finished
+	struct StagingRetire {
+		UploadToken token;
+		VkDeviceSize end;
+	};
+
+	// Move the ring tail past every finished upload
+	void retire_staging();
+
+	struct PendingAcquire {
+		UploadToken token;
+		std::vector<VkBufferMemoryBarrier> buffers;
+		std::vector<VkImageMemoryBarrier> images;
+		VkPipelineStageFlags dstStages;
+	};
+
+	VkDevice _device{ VK_NULL_HANDLE };
+	VmaAllocator _allocator{ VK_NULL_HANDLE };
+	VkQueue _queue{ VK_NULL_HANDLE };
+	uint32_t _queueFamily{ 0 };
+	uint32_t _graphicsQueueFamily{ 0 };
+
+	VkCommandPool _commandPool{ VK_NULL_HANDLE };
+	VkSemaphore _timeline{ VK_NULL_HANDLE };
+	UploadToken _lastToken{ 0 };
+	UploadToken _completedToken{ 0 };
+
+	std::deque<InFlightUpload> _inFlight;
+	std::vector<VkCommandBuffer> _freeCommandBuffers;
+	std::vector<std::pair<UploadToken, std::function<void()>>> _completionCallbacks;
+
+	// Staging ring. Allocations go at _stagingHead, finished uploads free them from _stagingTail.
+	// The two are equal only while the ring is empty
+	AllocatedBuffer _stagingBuffer;
+	char* _stagingData{ nullptr };
+	VkDeviceSize _stagingSize{ 0 };
+	VkDeviceSize _stagingHead{ 0 };
+	VkDeviceSize _stagingTail{ 0 };
+	bool _stagingOpen{ false };				// Allocated since the last submit
+	int _stagingHolds{ 0 };					// Open batches. Their staging stays open through other submits
+	std::deque<StagingRetire> _stagingRetires;
+	std::vector<AllocatedBuffer> _stagingOversized;	// Own buffers for the next submit, freed when it finishes
+	size_t _stagingOversizedCount{ 0 };
+
+	std::deque<PendingAcquire> _pendingAcquires;
+	VkPipelineStageFlags _acquireStages{ VK_PIPELINE_STAGE_VERTEX_INPUT_BIT | VK_PIPELINE_STAGE_VERTEX_SHADER_BIT | VK_PIPELINE_STAGE_FRAGMENT_SHADER_BIT | VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT };
+};
+
+// Collects the copies of many assets and submits them together: one command buffer, one barrier for the layout
+// transitions into transfer, one for the releases and one timeline signal. Copies between the same staging and
+// destination buffers are merged into one vkCmdCopyBuffer
+class UploadBatch {
+public:
+	explicit UploadBatch(UploadService& service) : _service(service) { _service._stagingHolds++; }
+	~UploadBatch() { _service._stagingHolds--; }
+
+	UploadBatch(const UploadBatch&) = delete;
+	UploadBatch& operator=(const UploadBatch&) = delete;
+
+	StagingRegion allocate_staging(VkDeviceSize size, VkDeviceSize alignment = 16) { return _service.allocate_staging(size, alignment); }
+
+	// Copy size bytes from offset in a staging region, and hand the buffer to the graphics queue afterwards
+	void copy_buffer(const StagingRegion& source, VkDeviceSize sourceOffset, VkBuffer destination, VkDeviceSize destinationOffset, VkDeviceSize size);
+	void release_buffer(const UploadBufferRelease& release);
+
+	// Copy into one subresource range of an image in any layout, leaving it in release.newLayout.
+	// The range's previous contents are discarded. Buffer offsets of the copies are relative to the staging region
+	void copy_buffer_to_image(const StagingRegion& source, const VkBufferImageCopy* copies, uint32_t copyCount, const UploadImageRelease& release);
+
+	// Fill levels 1 to levelCount - 1 of the first layerCount layers of an image by blitting down from level 0, after its
+	// copies. The image's release must cover every level. Only for services that can_blit() and formats with linear blit support
+	void generate_mipmaps(VkImage image, VkExtent2D extent, uint32_t levelCount, uint32_t layerCount = 1);
+
+	bool can_blit() const { return _service.can_blit(); }
+
+	// Run function once the batch's submit has finished, to free memory the copies read that isn't staging
+	void on_complete(std::function<void()>&& function);
+
+	bool empty() const { return _bufferCopies.empty() && _imageCopies.empty(); }
+
+	// Submit everything recorded so far and start over. Returns 0 for an empty batch
+	UploadToken submit();
+
+private:
+	struct BufferCopy {
+		VkBuffer source;
+		VkBuffer destination;
+		VkBufferCopy region;
+	};
+
+	struct ImageCopy {
+		VkBuffer source;
+		VkImage destination;
+		std::vector<VkBufferImageCopy> regions;
+	};
+
+	struct MipChain {
+		VkImage image;
+		VkExtent2D extent;
+		uint32_t levelCount;
+		uint32_t layerCount;
+	};
+
+	UploadService& _service;
+
+	std::vector<BufferCopy> _bufferCopies;
+	std::vector<ImageCopy> _imageCopies;
+	std::vector<MipChain> _mipChains;
+	std::vector<UploadBufferRelease> _bufferReleases;
+	std::vector<UploadImageRelease> _imageReleases;
+	std::vector<std::function<void()>> _completionCallbacks;
+};